@@ -6,7 +6,30 @@
 #include <BLE2902.h>
 #include <M5Core2.h>
 #include <Adafruit_seesaw.h>
-#include "../include/game_image_bitmaps.h"
+#include "../include/game_indexed_bitmaps.h"
+#include "../include/game_sprite_atlas.h"
+#include "../include/sprite_draw.h"
+#include "../include/game_tick.h"
+#include "../include/hud_draw.h"
+#include "../include/render_task.h"
+#include "../include/fog_draw.h"
+#include "../include/character_collision.h"
+#include "../include/kinematics.h"
+#include "../include/joystick_setup.h"
+#include "../include/game_flow.h"
+#include "../include/reliable_channel.h"
+#include "../include/powerups.h"
+#include "../include/state_snapshot.h"
+#include "../include/link_tuning.h"
+#include "../include/link_telemetry.h"
+#include "../include/match_record.h"
+#include "../include/rollback.h"
+#include "../include/lockstep.h"
+#include "../include/spectator_feed.h"
+#include "../include/match_beacon.h"
+#include "../include/alloc_guard.h"
+#include "../include/log_task.h"
+#include "../include/memory_monitor.h"
 
 ///////////////////////////////////////////////////////////////
 // Variables
@@ -18,41 +41,85 @@ BLEService *bleService;
 bool deviceConnected = false;
 bool previouslyConnected = false;
 
-// Location Characteristics/Variables
-BLECharacteristic *bleReadXCharacteristic;
-BLECharacteristic *bleReadYCharacteristic;
-BLECharacteristic *bleReadWriteXCharacteristic;
-BLECharacteristic *bleReadWriteYCharacteristic;
-bool locationWasUpdated = true;
+// Location, timer and the rest of our state, both ways (state_snapshot.h)
+BLECharacteristic *bleSnapshotCharacteristic;
+static SnapshotLink snapshotLink;
+static GameSnapshot opponentSnapshot;   // the client's latest
+uint32_t linkStatsLoggedMs = 0;
+uint32_t linkStatsBytes = 0;
+uint32_t linkStatsRttSamples = 0;
+uint32_t linkStatsRttTotalMs = 0;
+
+// Connection parameters (link_tuning.h); we ask, the client agrees
+static LinkTuner linkTuner;
+static esp_bd_addr_t peerAddress;
+volatile bool peerAddressKnown = false;
+static RenderQueue<LinkUpdate, 4> linkUpdates;
+
+// Pings and link quality (link_telemetry.h); the record can be read off
+// its own characteristic
+BLECharacteristic *blePingCharacteristic;
+BLECharacteristic *bleTelemetryCharacteristic;
+static LinkTelemetry linkTelemetry;
+uint32_t linkStatsReceived = 0;
+uint32_t linkStatsLost = 0;
+uint8_t linkDropPercent = 0;   // snapshots lost in the last stats window
+bool linkOverlay = false;      // BtnB shows the round trip and drops on the HUD
+
+// Each game's inputs and what came in, for tools/replay_match.cpp (match_record.h)
+static MatchRecorder matchRecorder;
+uint32_t matchDumped = 0;      // bytes of the recording printed so far
+
+// Input modes (duel_sim.h, NET_MODE): both sides' inputs on their own
+// characteristic, both characters simulated here
+BLECharacteristic *bleInputCharacteristic;
+static RollbackSession rollback;
+static LockstepSession lockstep;
+uint32_t duelWorstUs = 0;      // longest simulation advance since the last stats line
+
+// Spectators (spectator_feed.h): any central after the client. The frame is
+// built once in loop() and notified to each of them by a task of its own.
+BLECharacteristic *bleSpectatorCharacteristic;
+static SpectatorFeed spectatorFeed;
+static RenderQueue<SpectatorPacket, 4> spectatorPackets;   // loop -> spectator task
+static TaskHandle_t spectatorTaskHandle = NULL;
+const uint32_t SPECTATOR_STACK_SIZE = 4096;
+const UBaseType_t SPECTATOR_PRIORITY = 1;
+volatile uint16_t playerConnId = 0;
+volatile uint8_t spectatorCount = 0;
+volatile uint16_t spectatorConns[SPECTATOR_MAX];   // conn_id + 1 of each spectator, 0 for a free slot
+volatile bool spectatorJoined = false;   // the next frame is a keyframe for it
+
+// Our match status in the advertising data (match_beacon.h)
+static MatchBeacon advertisedBeacon;
+bool beaconAdvertised = false;
 
 // Gameplay Characteristics/Variables
-bool screenUpdated = false;
-bool gameEnded = false;
-bool playingAgain = false;
+bool redrawGame = false; // next game frame redraws everything (a powerup ended)
 
-// Characteristics for each player's player type (2) and when an opponents powerup is used (2), and gamestate (1)
-
-BLECharacteristic *bleLocalPlayerSelectionCharacteristic; // 1 (Princess), 2 (Dragon), 3 (Unchosen)
-BLECharacteristic *bleOpponentPlayerSelectionCharacteristic; // 1 (Princess), 2 (Dragon), 3 (Unchosen)
-BLECharacteristic *bleGameStateCharacteristic; // 1 (intro), 2 (tutorial), 3 (playing), 4 (end)
+// Game state, player selection and powerups, both ways (reliable_channel.h)
+BLECharacteristic *bleEventChannelCharacteristic;
+static ReliableChannel eventChannel;
 
 // If game ends before time is up, princess wins
 
 // Location Unique IDs
 #define SERVICE_UUID "7d7a7768-a9d0-4fb8-bf2b-fc994c662eb6"
-#define READ_X_CHARACTERISTIC_UUID "563c64b2-9634-4f7a-9f4f-d9e3231faa56"
-#define READ_Y_CHARACTERISTIC_UUID "aa88ac15-3e2b-4735-92ff-4c712173e9f3"
-#define READ_WRITE_X_CHARACTERISTIC_UUID "1da468d6-993d-4387-9e71-1c826b10fff9"
-#define READ_WRITE_Y_CHARACTERISTIC_UUID "cf7b4787-d412-4e69-8b61-e2cfba89ff19"
+#define SNAPSHOT_UUID "3f1c9a52-6d0e-4b87-9a3e-2c5d7e81b4f6"
 
 // Gameplay Unique IDs
-#define LOCAL_PLAYER_SELECTION_UUID "ecaaac5c-5057-49dc-83ab-e0e2322f2703"
-#define OPPONENT_PLAYER_SELECTION_UUID "cad4571b-2ca1-47c9-ae9d-75bbce0d814f"
-#define GAME_STATE_UUID "07471f02-b963-449e-a39c-9a44ae312b78"
+#define EVENT_CHANNEL_UUID "ebbd4b49-ce56-4aea-aeca-08d53d41cb10"
+#define INPUT_UUID "5b2e8f14-7c93-4a6d-b1e0-3d9a6c47f825"
+
+// Telemetry Unique IDs
+#define PING_UUID "c4a1e7d2-5f38-4b6e-9d21-7a0b3e8f1c54"
+#define TELEMETRY_UUID "9e6d2b7a-1c84-4f3e-b5a0-68d4c2e91f07"
+
+// Spectator Unique IDs
+#define SPECTATOR_UUID "2a8f6c31-e4b7-4d92-8c05-b1d7e3a96f48"
 
-// State
-enum Gameplay { S_PLAYER_SELECT, S_TUTORIAL, S_GAME, S_GAME_OVER };
-static Gameplay gameState = S_PLAYER_SELECT;
+// State (game_flow.h)
+static GameFlow gameFlow;
 
 enum PlayerType { PRINCESS, DRAGON, UNCHOSEN };
 static PlayerType chosenPlayer = UNCHOSEN;
@@ -77,8 +144,8 @@ Button START(210, 190, 100, 50, false, "Start", offColStart, onCol);
 Button ENDTUTORIAL(210, 10, 100, 50, false, "X", offColTut, onCol);
 Button PLAYAGAIN(100, 190, 100, 50, false, "Play Again", offColStart, onCol);
 
-// joystick and button coordinates
-int xServer = 10, yServer = 120, xClient = 0, yClient = 0;
+// joystick and button coordinates (world pixels, start on the map's spawn points)
+int xServer = 0, yServer = 0, xClient = 0, yClient = 0;
 
 // joystick and button acceleration
 int acceleration = 5;
@@ -87,16 +154,19 @@ int acceleration = 5;
 int countdownTime = 120000; // Two minutes
 int prevTime = 0;
 int currTime = 0;
-bool timerHasBeenStarted = false; 
+unsigned long remainingTime = 0;
 bool timeRanOut = false;
 
-// Powerup
-int powerupsLeft = 3; // players start with 3 powerups
-bool powerupsStillAvailable = true; 
-int powerupTime = 3000; // powerups last 3 seconds
-int powerupStartTime = 0;
-bool dragonPowerupActive = false;
-bool princessPowerupActive = false;
+// Powerups (powerups.h), timed on simClock ticks from the start of the game
+Powerups powerups;
+
+// Movement and animation
+TickClock simClock;
+KinematicBody localBody;   // sub-pixel position and velocity of the local character
+SpriteAnimator localAnimator;
+int moveX = 0, moveY = 0; // joystick axes (-127..127), drive the movement and the facing
+bool startWasDown = false;
+bool selectWasDown = false;
 
 ///////////////////////////////////////////////////////////////
 // Forward Declarations
@@ -106,7 +176,7 @@ void broadcastBleServer();
 // Gameplay (Order of appearance)
 void drawTitleScreen();
 void drawWaitingScreen();
-void drawCenteredBackgroundImage(String iconName, int resizeMult);
+void drawCenteredBackgroundImage(const char *iconName, int resizeMult);
 void chooseCharacter();
 void drawSelectedCharacterName();
 void princessTapped(Event& e);
@@ -117,159 +187,191 @@ void startTutorial();
 void endTutorialTapped(Event& e);
 void playAgainTapped(Event& e);
 void hideButtons();
-
-void drawCharacters(uint32_t serverX, uint32_t serverY, uint32_t clientX, uint32_t clientY);
-void drawCharacterImage(String iconName, int resizeMult, int xLoc, int yLoc);
-void printDistance();
+void sendGameState(int value);
+void sendPlayerSelection(int value);
+void sendEventPacket(const uint8_t *bytes, size_t length);
+void receiveGameMessage(const ReliableMessage &message);
+void takeSnapshot(GameSnapshot &snapshot);
+void receiveSnapshot(const GameSnapshot &snapshot);
+void sendSnapshotPacket(const uint8_t *bytes, size_t length);
+void sendPingPacket(const uint8_t *bytes, size_t length);
+void sendInputPacket(const uint8_t *bytes, size_t length);
+void logLinkStats();
+void tuneLink();
+bool queueMatchDump();
+void dumpMatchRecord();
+void finishMatchDump();
+void serviceSpectators();
+void takeSpectatorFrame(SpectatorFrame &frame);
+void startSpectatorTask();
+void advertiseMatchBeacon();
+
+void stepSimulation();
+void stepInputMode(uint32_t ticks);
+bool localBlocked(int x, int y);
 void checkTimeAndPrint();
-void addressPowerup();
+void updateHud(const FrameSnapshot &frame);
+void addressPowerup(FrameSnapshot &frame);
+void postGameFrame();
+void drawGameOverScreen();
 
 void serverAccelIncrement();
-String milis_to_seconds(long milis);
 
 
 void playGame();
-void endGame();
+void endGame(uint8_t event);
 bool checkDistance();
 void usePowerup();
 
+// Game flow (entry/exit actions and guards)
+void enterWaiting(uint8_t from, uint8_t event);
+void enterPlayerSelect(uint8_t from, uint8_t event);
+void enterTutorial(uint8_t from, uint8_t event);
+void enterGame(uint8_t from, uint8_t event);
+void enterGameOver(uint8_t from, uint8_t event);
+void leaveMenu(uint8_t to, uint8_t event);
+bool checkGameGuard(uint8_t guard);
+
+// What each state does on entry and exit, in GameState order
+const GameStateActions gameStateActions[S_STATE_COUNT] = {
+    { enterWaiting,      NULL },       // S_WAITING
+    { enterPlayerSelect, leaveMenu },  // S_PLAYER_SELECT
+    { enterTutorial,     leaveMenu },  // S_TUTORIAL
+    { enterGame,         NULL },       // S_GAME
+    { enterGameOver,     leaveMenu },  // S_GAME_OVER
+};
+
 ///////////////////////////////////////////////////////////////
 // BLE Server Callback Methods
 ///////////////////////////////////////////////////////////////
 class MyServerCallbacks: public BLEServerCallbacks {
-    void onConnect(BLEServer *pServer) {
-        deviceConnected = true;
-        screenUpdated = true;
-        bleReadXCharacteristic->setValue(xServer);
-        bleReadYCharacteristic->setValue(yServer);
-        
-        bleReadXCharacteristic->notify();
-        delay(10);
-        bleReadYCharacteristic->notify();
-        delay(10);
-        previouslyConnected = true;
-        Serial.println("Device connected...");
+    // The first central is the other player, any after it a spectator
+    // (spectator_feed.h). The link tuning needs the player's address.
+    void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) {
+        if (!deviceConnected) {
+            playerConnId = param->connect.conn_id;
+            memcpy(peerAddress, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+            peerAddressKnown = true;
+            deviceConnected = true;
+            postGameEvent(gameFlow, EV_CONNECTED);
+            previouslyConnected = true;
+            logEvent(LOG_DEVICE_CONNECTED);
+        } else {
+            for (uint8_t i = 0; i < SPECTATOR_MAX; i++) {
+                if (!spectatorConns[i]) {
+                    spectatorConns[i] = param->connect.conn_id + 1;
+                    break;
+                }
+            }
+            spectatorCount++;
+            spectatorJoined = true;
+            logEvent(LOG_SPECTATOR_CONNECTED, spectatorCount);
+        }
+        // Connecting stops advertising; it goes on while spectators fit
+        if (spectatorCount < SPECTATOR_MAX) {
+            BLEDevice::startAdvertising();
+        }
+    }
+    void onMtuChanged(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) {
+        logEvent(LOG_MTU_CHANGED, param->mtu.mtu);
     }
-    void onDisconnect(BLEServer *pServer) {
-        deviceConnected = false;
-        Serial.println("Device disconnected...");
+    void onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) {
+        if (deviceConnected && param->disconnect.conn_id == playerConnId) {
+            deviceConnected = false;
+            peerAddressKnown = false;
+            postGameEvent(gameFlow, EV_DISCONNECTED);
+            logEvent(LOG_DEVICE_DISCONNECTED);
+        } else if (spectatorCount) {
+            for (uint8_t i = 0; i < SPECTATOR_MAX; i++) {
+                if (spectatorConns[i] == param->disconnect.conn_id + 1) {
+                    spectatorConns[i] = 0;
+                }
+            }
+            spectatorCount--;
+            logEvent(LOG_SPECTATOR_DISCONNECTED, spectatorCount);
+        }
+        BLEDevice::startAdvertising();
     }
 };
+static MyServerCallbacks serverCallbacks;
 
 //////////////////////////////////////////////////////////////
 // BLE Client Characteristic Callback Methods
 //////////////////////////////////////////////////////////////
+
+// Which of ours a characteristic is, for the log (no UUID strings built);
+// the names are in the log formats (binary_log.h)
+uint8_t characteristicIndex(BLECharacteristic *pCharacteristic) {
+    BLECharacteristic *const ours[] = { bleSnapshotCharacteristic, bleEventChannelCharacteristic, blePingCharacteristic,
+                                        bleInputCharacteristic, bleTelemetryCharacteristic, bleSpectatorCharacteristic };
+    uint8_t i = 0;
+    while (i < sizeof(ours) / sizeof(ours[0]) && ours[i] != pCharacteristic) {
+        i++;
+    }
+    return i;
+}
+
 class MyCharacteristicCallbacks: public BLECharacteristicCallbacks {
     // callback function to support a read request
     void onRead(BLECharacteristic* pCharacteristic) {
-        String characteristicUUID = pCharacteristic->getUUID().toString().c_str();
-        String characteristicValue = pCharacteristic->getValue().c_str();
-        Serial.printf("Client JUST read from %s: %s", characteristicUUID, characteristicValue.c_str());
+        logEvent(LOG_CHARACTERISTIC_READ, characteristicIndex(pCharacteristic));
     }
     
-    // callback function to support a write request
-    void onWrite(BLECharacteristic* pCharacteristic) {
-        String characteristicUUID = pCharacteristic->getUUID().toString().c_str();
-        String characteristcValue = pCharacteristic->getValue().c_str();
-        Serial.printf("Client JUST wrote to %s: %s", characteristicUUID, characteristcValue.c_str());
-
-        // check if characteristicUUID matches a known UUID
-        if (characteristicUUID.equals(READ_WRITE_X_CHARACTERISTIC_UUID)) {
-            // extract the x value 
-            std::string readXValue = pCharacteristic->getValue();
-            String valXStr = readXValue.c_str();
-            xClient = valXStr.toInt();
-        }
-        if (characteristicUUID.equals(READ_WRITE_Y_CHARACTERISTIC_UUID)) {
-            // extrac the y value
-            std::string readYValue = pCharacteristic->getValue();
-            String valYStr = readYValue.c_str();
-            yClient = valYStr.toInt();
-        }
-
-        if (characteristicUUID.equals(OPPONENT_PLAYER_SELECTION_UUID)) {
-            // extrac the y value
-            std::string readOpponentPlayer = pCharacteristic->getValue();
-            String valOpponentPlayer = readOpponentPlayer.c_str();
-            opponentPlayer = PlayerType(valOpponentPlayer.toInt() - 1);
+    // Spectators only watch: anything they write is dropped here
+    void onWrite(BLECharacteristic* pCharacteristic, esp_ble_gatts_cb_param_t *param) {
+        if (param->write.conn_id == playerConnId) {
+            onWrite(pCharacteristic);
         }
+    }
 
-        if (characteristicUUID.equals(GAME_STATE_UUID)) {
-            // extrac the y value
-            std::string readGameState = pCharacteristic->getValue();
-            String valGameState = readGameState.c_str();
-            Serial.print("VAL GAME STATE: ");
-            Serial.println(valGameState);
-            if (valGameState.toInt() == 1 || valGameState.toInt() == 2) {
-              gameState = gameState;
-            } else if (valGameState.toInt() == 3) {
-              if (gameState == S_GAME_OVER) {
-                  xServer = 10, yServer = 120;
-                  bleReadYCharacteristic->setValue(yServer);
-                  bleReadXCharacteristic->setValue(xServer);
-                  bleReadXCharacteristic->notify();
-                  delay(10);
-                  bleReadYCharacteristic->notify();
-                  delay(10);
-                  int chosenPlayerInt = 3;
-                  bleLocalPlayerSelectionCharacteristic->setValue(chosenPlayerInt);
-                  bleLocalPlayerSelectionCharacteristic->notify();
-                  delay(10);
-                  M5.Lcd.fillRect(10, 20, 10, 10, TFT_BLACK);
-                  playingAgain = true;
-              } else {
-                prevTime = millis();
-                gameEnded = true;
-              }
-              gameState = S_GAME;
+    // callback function to support a write request. Each packet only gets
+    // queued, straight from the characteristic's buffer; nothing is copied
+    // into a String or std::string on the way.
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const uint8_t *packet = pCharacteristic->getData();
+        size_t length = pCharacteristic->getLength();
+        linkTelemetry.bytesReceived += length;
+
+        if (pCharacteristic == bleSnapshotCharacteristic) {
+            // Decoded in loop(), against the snapshots it keeps
+            receiveSnapshotPacket(snapshotLink, packet, length);
+        } else if (pCharacteristic == bleEventChannelCharacteristic) {
+            // Packets only get queued here, loop() runs the channel
+            receiveReliablePacket(eventChannel, packet, length);
+        } else if (pCharacteristic == blePingCharacteristic) {
+            // Answered and timed in loop()
+            receivePingPacket(linkTelemetry, packet, length);
+        } else if (pCharacteristic == bleInputCharacteristic) {
+            // The client's inputs, taken in by stepInputMode()
+            if (netMode == NET_LOCKSTEP) {
+                receiveLockstepPacket(lockstep, packet, length);
             } else {
-              gameState = S_GAME_OVER;
+                receiveRollbackPacket(rollback, packet, length);
             }
-            screenUpdated = true;
         }
     }
 
-    // callback function to support a Notify request
-    void onNotify(BLECharacteristic* pCharacteristic) {
-        String characteristicUUID = pCharacteristic->getUUID().toString().c_str();
-        Serial.printf("Client JUST notified about change to %s: %s", characteristicUUID, pCharacteristic->getValue().c_str());
-    }
-
     // callback function to support when a client subscribes to notifications/indications
     void onSubscribe(BLECharacteristic* pCharacteristic, uint16_t subValu) {}
 
-    // calllback function to support a Notify/Indicate Status report
-    void onStatus(BLECharacteristic* pCharacteristic, Status s, uint32_t code) {
-        // print appropriate response
-        String characteristicUUID = pCharacteristic->getUUID().toString().c_str();
-        switch(s) {
-            case SUCCESS_INDICATE:
-                break;
-            case SUCCESS_NOTIFY:
-                Serial.printf("Status for %s: Successful Notification", characteristicUUID.c_str());
-                break;
-            case ERROR_INDICATE_DISABLED:
-                Serial.printf("Status for %s: Failure; Indication Disabled on Client", characteristicUUID.c_str());
-                break;
-            case ERROR_NOTIFY_DISABLED:
-                Serial.printf("Status for %s: Failure; Notification Disabled on Client", characteristicUUID.c_str());
-                break;
-            case ERROR_GATT:
-                Serial.printf("Status for %s: Failure; GATT Issue", characteristicUUID.c_str());
-                break;
-            case ERROR_NO_CLIENT:
-                Serial.printf("Status for %s: Failure; No BLE Client", characteristicUUID.c_str());
-                break;
-            case ERROR_INDICATE_TIMEOUT:
-                Serial.printf("Status for %s: Failure; Indication Timeout", characteristicUUID.c_str());
-                break;
-            case ERROR_INDICATE_FAILURE:
-                Serial.printf("Status for %s: Failure; Indication Failure", characteristicUUID.c_str());
-                break;
-        }
-    }    
-
 };
+// One for every characteristic: it keeps no state and goes by the pointer
+static MyCharacteristicCallbacks characteristicCallbacks;
+
+///////////////////////////////////////////////////////////////
+// GAP events (BLE task). Only the connection parameter updates
+// matter; loop() logs them.
+///////////////////////////////////////////////////////////////
+static void linkGapHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) {
+        LinkUpdate update;
+        update.status = param->update_conn_params.status;
+        update.interval = param->update_conn_params.conn_int;
+        update.latency = param->update_conn_params.latency;
+        update.timeout = param->update_conn_params.timeout;
+        linkUpdates.push(update);
+    }
+}
 
 ///////////////////////////////////////////////////////////////
 // Put your setup code here, to run once
@@ -280,10 +382,27 @@ void setup()
     M5.begin();
     M5.Lcd.setTextSize(3);
 
+    // setup() draws the waiting screen itself; the BLE callbacks can
+    // post events as soon as BLE is up
+    initGameFlow(gameFlow, S_WAITING, gameStateActions, checkGameGuard);
+
     // Initialize M5Core2 as a BLE server
     Serial.print("Starting BLE...");
-    String bleDeviceName = "Princess of Fire";
-    BLEDevice::init(bleDeviceName.c_str());
+    BLEDevice::init("Princess of Fire");
+    // Room for more than 20 bytes a packet once the client asks
+    BLEDevice::setMTU(LINK_MTU);
+    BLEDevice::setCustomGapHandler(linkGapHandler);
+    resetLinkTuner(linkTuner, millis());
+
+    // Gamepad, and the joystick calibration before any other screen is
+    // drawn. Holding Start while booting measures the stick again.
+    if(!gamePad.begin(0x50)){
+        Serial.println("ERROR! seesaw not found");
+        while(1) delay(1);
+    }
+    gamePad.pinModeBulk(button_mask, INPUT_PULLUP);
+    gamePad.setGPIOInterrupts(button_mask, 1);
+    setupJoystick(gamePad, !(gamePad.digitalReadBulk(button_mask) & (1UL << BUTTON_START)));
 
     // Draw the game intro screen
     drawTitleScreen();
@@ -295,21 +414,13 @@ void setup()
     broadcastBleServer();
 
     // Gameplay setup
-    if(!gamePad.begin(0x50)){
-        Serial.println("ERROR! seesaw not found");
+    setupHud();
+    if (!setupTileMap()) {
+        Serial.println("ERROR! arena map is invalid");
         while(1) delay(1);
     }
-    gamePad.pinModeBulk(button_mask, INPUT_PULLUP);
-    gamePad.setGPIOInterrupts(button_mask, 1);
-    for (int i = 0; i < 10; i++) {
-      bleReadXCharacteristic->setValue(xServer);
-      bleReadYCharacteristic->setValue(yServer);
-      
-      bleReadXCharacteristic->notify();
-      delay(10);
-      bleReadYCharacteristic->notify();
-      delay(500);
-    }
+    xServer = arenaMap.spawnX[SPAWN_SERVER], yServer = arenaMap.spawnY[SPAWN_SERVER];
+    xClient = arenaMap.spawnX[SPAWN_CLIENT], yClient = arenaMap.spawnY[SPAWN_CLIENT];
 
     PRINCESS_BTN.addHandler(princessTapped, E_TAP);
     DRAGON_BTN.addHandler(dragonTapped, E_TAP);
@@ -317,6 +428,13 @@ void setup()
     START.addHandler(startTapped, E_TAP);
     ENDTUTORIAL.addHandler(endTutorialTapped, E_TAP);
     PLAYAGAIN.addHandler(playAgainTapped, E_TAP);
+
+    // From here on only the render task draws
+    startRenderTask();
+    startLogTask();
+    startSpectatorTask();
+    startMemoryMonitor();
+    watchTaskStack(MEM_TASK_SPECTATORS, spectatorTaskHandle);
 }
 
 ///////////////////////////////////////////////////////////////
@@ -324,63 +442,83 @@ void setup()
 ///////////////////////////////////////////////////////////////
 void loop()
 {
+    beginLoopTiming();
+
+    // Button feedback draws, so it shares the panel with the render task.
+    // A game shows no buttons (leaveMenu() hid them): no waiting on a blit.
+    bool buttonsShown = gameFlow.state != S_GAME;
+    if (buttonsShown) {
+      lockLcd();
+    }
     M5.update();
-    if (deviceConnected) {
-      if (gameState != S_GAME && gameState != S_GAME_OVER) {
-        if (gameState == S_PLAYER_SELECT && screenUpdated) {
-          chooseCharacter();
-        } else if (gameState == S_TUTORIAL && screenUpdated) {
-          startTutorial();
-        }
-      } else {
-        timerHasBeenStarted = true;
-        M5.Lcd.fillRect(200, 10, 50, 50, TFT_BLACK);
-        M5.Lcd.fillRect(0, 0, 50, 50, TFT_BLACK);
-        if (gameState == S_GAME) {
-          checkTimeAndPrint();
-          if (checkDistance()) {
-            playGame();
-            if (locationWasUpdated || playingAgain) {
-            M5.Lcd.fillScreen(TFT_BLACK);
-            drawCharacters(xServer, yServer, xClient, yClient); 
-
-            bleReadXCharacteristic->setValue(xServer);
-            bleReadYCharacteristic->setValue(yServer);
-            
-            bleReadXCharacteristic->notify();
-            delay(10);
-            bleReadYCharacteristic->notify();
-            delay(10);
-            playingAgain = false;
-          }
+    if (buttonsShown) {
+      unlockLcd();
+    }
 
-          currTime = millis();
-            if ((currTime - powerupStartTime < powerupTime) && (dragonPowerupActive || princessPowerupActive)) {
-              addressPowerup();
-              Serial.println("Powerup is active");
-            } 
-            
-            if (!((currTime - powerupStartTime < powerupTime)) && (dragonPowerupActive || princessPowerupActive)) {
-              Serial.println("Powerup has ended");
-              playingAgain = true;
-              if (dragonPowerupActive) {
-                dragonPowerupActive = false;
-              } else {
-                princessPowerupActive = false;
-              }
-          }
-        }
-        locationWasUpdated = false;
-        } else {
-          if (gameEnded) {
-            endGame();
-            gameEnded = false;
+    // BtnB toggles the link overlay; the next frame repaints under it
+    if (M5.BtnB.wasPressed()) {
+      linkOverlay = !linkOverlay;
+      redrawGame = true;
+    }
+
+    // Screen changes asked for by the taps above and the BLE callbacks
+    runGameEvents(gameFlow);
+
+    if (deviceConnected) {
+      // The menus only change on events; a game runs every loop, off the
+      // heap (alloc_guard.h checks in debug builds)
+      if (gameFlow.state == S_GAME) {
+        beginAllocCheck();
+        checkTimeAndPrint();
+        if (gameFlow.state == S_GAME && checkDistance()) {
+          playGame();
+          stepSimulation();
+          if (expirePowerups(powerups, simClock.tick)) {
+            logEvent(LOG_POWERUP_ENDED);
+            redrawGame = true;
           }
+          postGameFrame();
         }
+        endAllocCheck("game tick");
+      }
+
+      // Sends what this loop queued, resends what wasn't acked
+      serviceReliableChannel(eventChannel, millis(), sendEventPacket, receiveGameMessage);
+
+      // Our snapshot if anything in it changed, the client's as it arrives
+      GameSnapshot snapshot;
+      takeSnapshot(snapshot);
+      if (serviceSnapshotLink(snapshotLink, snapshot, millis(), sendSnapshotPacket, opponentSnapshot)) {
+        receiveSnapshot(opponentSnapshot);
+      }
+      // Answers the client's pings and times ours
+      servicePings(linkTelemetry, millis(), sendPingPacket);
+      if (netMode == NET_ROLLBACK && gameFlow.state == S_GAME) {
+        // Our inputs the client hasn't acknowledged, and our ack of its
+        sendRollbackInputs(rollback, millis(), sendInputPacket);
+      } else if (netMode == NET_LOCKSTEP && gameFlow.state == S_GAME) {
+        // The same, with our state hash now and then
+        sendLockstepInputs(lockstep, millis(), sendInputPacket);
+      }
+      if (gameFlow.state == S_GAME) {
+        // Every MATCH_CHECK_TICKS, the state the replay has to arrive at
+        recordMatchCheck(matchRecorder, simClock.tick,
+                         matchStateHash(simClock.tick, localBody, xClient, yClient, powerups), remainingTime);
       }
-      screenUpdated = false;
+      tuneLink();
+      logLinkStats();
     } else if (previouslyConnected) {
     }
+
+    // The match for anyone watching, with or without a player
+    serviceSpectators();
+    // Who can still join, for the clients scanning
+    advertiseMatchBeacon();
+
+    endLoopTiming();
+    logRenderStats();
+    monitorMemory();
+    dumpMatchRecord();
 }
 
 ///////////////////////////////////////////////////////////////
@@ -445,6 +583,7 @@ void chooseCharacter() {
 // Draws the name of the currently selected character
 ///////////////////////////////////////////////////////////////
 void drawSelectedCharacterName() {
+  M5.Lcd.fillRect(120, 60, 48, 8, TFT_BLACK);
   M5.Lcd.setTextColor(TFT_WHITE);
   M5.Lcd.setCursor(120, 40);
   M5.Lcd.setTextSize(1);
@@ -473,11 +612,8 @@ void drawSelectedCharacterName() {
 void princessTapped(Event& e) {
   if (opponentPlayer != PRINCESS) {
     chosenPlayer = PRINCESS;
-    int chosenPlayerInt = 1;
-    bleLocalPlayerSelectionCharacteristic->setValue(chosenPlayerInt);
-    bleLocalPlayerSelectionCharacteristic->notify();
-    delay(10);
-    screenUpdated = true;
+    sendPlayerSelection(1);
+    postScreen(drawSelectedCharacterName);
   }
 }
 
@@ -487,14 +623,8 @@ void princessTapped(Event& e) {
 void dragonTapped(Event& e) {
   if (opponentPlayer != DRAGON) {
     chosenPlayer = DRAGON;
-    int chosenPlayerInt = 2;
-    bleLocalPlayerSelectionCharacteristic->setValue(chosenPlayerInt);
-    bleLocalPlayerSelectionCharacteristic->notify();
-    String val = bleLocalPlayerSelectionCharacteristic->getValue().c_str();
-    Serial.print("NOTIFIED CLIENT OF VALUE: ");
-    Serial.println(val);
-    delay(10);
-    screenUpdated = true;
+    sendPlayerSelection(2);
+    postScreen(drawSelectedCharacterName);
   }
 }
 
@@ -502,46 +632,18 @@ void dragonTapped(Event& e) {
 // Starts tutorial
 ///////////////////////////////////////////////////////////////
 void tutorialTapped(Event& e) {
- gameState = S_TUTORIAL;
- int gameStateLocal = 2;
- bleGameStateCharacteristic->setValue(gameStateLocal);
- bleGameStateCharacteristic->notify();
- screenUpdated = true;
+  raiseGameEvent(gameFlow, EV_TUTORIAL_OPENED);
 }
 
 ///////////////////////////////////////////////////////////////
-// Starts game
+// Starts game (once both players have picked a character)
 ///////////////////////////////////////////////////////////////
 void startTapped(Event& e) {
-  hideButtons();
-  if (opponentPlayer != UNCHOSEN && chosenPlayer != UNCHOSEN) {
-    gameState = S_GAME;
-    int gameStateLocal = 3;
-    screenUpdated = true;
-    bleGameStateCharacteristic->setValue(gameStateLocal);
-    bleGameStateCharacteristic->notify();
-    delay(10);
-    prevTime = millis();
-  }
+  raiseGameEvent(gameFlow, EV_START);
 }
 
 void playAgainTapped(Event& e) {
-  hideButtons();
-  playingAgain = true;
-  gameState = S_PLAYER_SELECT;
-  chosenPlayer = UNCHOSEN;
-  int player = 3;
-  bleLocalPlayerSelectionCharacteristic->setValue(player);
-  bleLocalPlayerSelectionCharacteristic->notify();
-  delay(10);
-  screenUpdated = true;
-  int gameStateLocal = 1;
-  bleGameStateCharacteristic->setValue(gameStateLocal);
-  bleGameStateCharacteristic->notify();
-  delay(10);
-  powerupsLeft = 3;
-  powerupsStillAvailable = true;
-  prevTime = millis();
+  raiseGameEvent(gameFlow, EV_PLAY_AGAIN);
 }
 
 void hideButtons() {
@@ -577,12 +679,373 @@ void startTutorial() {
 // Ends the tutorial
 ///////////////////////////////////////////////////////////////
 void endTutorialTapped(Event& e) {
-  gameState = S_PLAYER_SELECT;
-  screenUpdated = true;
-  int val = 1;
-  bleGameStateCharacteristic->setValue(val);
-  bleGameStateCharacteristic->notify();
-  delay(10);
+  raiseGameEvent(gameFlow, EV_TUTORIAL_CLOSED);
+}
+
+// Tells the client which screen we are on (1 select, 2 tutorial, 3 game; the
+// game over goes with its reason, from endGame())
+void sendGameState(int value) {
+  sendReliableByte(eventChannel, MSG_GAME_STATE, value);
+}
+
+// Tells the client our character (1 princess, 2 dragon, 3 unchosen)
+void sendPlayerSelection(int value) {
+  sendReliableByte(eventChannel, MSG_PLAYER_SELECTION, value);
+}
+
+///////////////////////////////////////////////////////////////
+// Notifies one central. The library's notify() goes to every
+// central connected, with one subscription shared by all of
+// them, so the player's packets would reach the spectators too
+// and theirs the player.
+///////////////////////////////////////////////////////////////
+bool notifyCentral(BLECharacteristic *characteristic, uint16_t connId, const uint8_t *bytes, size_t length) {
+  return esp_ble_gatts_send_indicate(bleServer->getGattsIf(), connId, characteristic->getHandle(), length,
+                                     (uint8_t *)bytes, false) == ESP_OK;
+}
+
+// Player traffic, counted for the telemetry (link_telemetry.h); only
+// failures are logged, at most one a second
+void notifyPlayer(BLECharacteristic *characteristic, const uint8_t *bytes, size_t length) {
+  characteristic->setValue((uint8_t *)bytes, length);
+  if (notifyCentral(characteristic, playerConnId, bytes, length)) {
+    linkTelemetry.notifyOk++;
+  } else {
+    linkTelemetry.notifyFailed++;
+    logEvent(LOG_NOTIFY_FAILED, characteristicIndex(characteristic), BLECharacteristicCallbacks::ERROR_GATT -
+             BLECharacteristicCallbacks::ERROR_INDICATE_DISABLED);
+  }
+  linkTelemetry.bytesSent += length;
+}
+
+// Puts a channel packet on the air; the channel resends it if it is lost
+void sendEventPacket(const uint8_t *bytes, size_t length) {
+  notifyPlayer(bleEventChannelCharacteristic, bytes, length);
+}
+
+///////////////////////////////////////////////////////////////
+// Handles a message from the client, in the order it was sent.
+// Only the start and the end of a game are shared, the menus are
+// local; the game flow decides if an event means anything now.
+///////////////////////////////////////////////////////////////
+void receiveGameMessage(const ReliableMessage &message) {
+  recordMatchMessage(matchRecorder, simClock.tick, message);
+  if (message.type == MSG_GAME_STATE) {
+    if (message.payload[0] == 3) {
+      raiseGameEvent(gameFlow, EV_REMOTE_START);
+    } else if (message.payload[0] == 4) {
+      raiseGameEvent(gameFlow, remoteGameOverEvent(message.length > 1 ? message.payload[1] : 0));
+    }
+  } else if (message.type == MSG_PLAYER_SELECTION) {
+    opponentPlayer = (message.payload[0] == 1) ? PRINCESS : (message.payload[0] == 2) ? DRAGON : UNCHOSEN;
+    logEvent(LOG_OPPONENT_CHOSE, message.payload[0]);
+  } else if (message.type == MSG_POWERUP && message.length == POWERUP_MESSAGE_SIZE) {
+    // Ends on the tick it ends on the client, however late this arrived
+    startOpponentPowerup(powerups, decodePowerupTick(message.payload, simClock.tick));
+    logEvent(LOG_OPPONENT_POWERUP);
+  }
+}
+
+// Our share of the game state, as the client gets it (state_snapshot.h)
+void takeSnapshot(GameSnapshot &snapshot) {
+  setSnapshotField(snapshot, SF_STATE, gameFlow.state);
+  setSnapshotField(snapshot, SF_CHARACTER, (chosenPlayer == PRINCESS) ? 1 : (chosenPlayer == DRAGON) ? 2 : 3);
+  setSnapshotField(snapshot, SF_X, xServer);
+  setSnapshotField(snapshot, SF_Y, yServer);
+  setSnapshotField(snapshot, SF_TIMER, (gameFlow.state == S_GAME) ? remainingTime / 100 : 0);
+  setSnapshotField(snapshot, SF_POWERUPS_LEFT, powerups.left);
+  setSnapshotField(snapshot, SF_POWERUP_ACTIVE, powerups.own.active);
+  setSnapshotField(snapshot, SF_TICK, simClock.tick);
+}
+
+///////////////////////////////////////////////////////////////
+// Takes in the client's latest snapshot. Its position is ours
+// to draw (in rollback mode we simulate it instead); state
+// changes and powerups arrive on the event channel and are only
+// logged here.
+///////////////////////////////////////////////////////////////
+void receiveSnapshot(const GameSnapshot &snapshot) {
+  if (netMode == NET_SNAPSHOTS) {
+    xClient = snapshot.field[SF_X];
+    yClient = snapshot.field[SF_Y];
+    recordMatchOpponent(matchRecorder, simClock.tick, xClient, yClient);
+  }
+  static int32_t lastState = -1;
+  if (snapshot.field[SF_STATE] != lastState) {
+    lastState = snapshot.field[SF_STATE];
+    logEvent(LOG_OPPONENT_STATE, lastState);
+  }
+}
+
+void sendSnapshotPacket(const uint8_t *bytes, size_t length) {
+  notifyPlayer(bleSnapshotCharacteristic, bytes, length);
+}
+
+void sendPingPacket(const uint8_t *bytes, size_t length) {
+  notifyPlayer(blePingCharacteristic, bytes, length);
+}
+
+// Unacknowledged inputs go out again with the next packet
+void sendInputPacket(const uint8_t *bytes, size_t length) {
+  notifyPlayer(bleInputCharacteristic, bytes, length);
+}
+
+///////////////////////////////////////////////////////////////
+// The match as spectators get it (spectator_feed.h): both
+// positions, the timer and both players' powerups
+///////////////////////////////////////////////////////////////
+void takeSpectatorFrame(SpectatorFrame &frame) {
+  uint8_t serverCharacter = (chosenPlayer == PRINCESS) ? 1 : (chosenPlayer == DRAGON) ? 2 : 3;
+  uint8_t clientCharacter = (opponentPlayer == PRINCESS) ? 1 : (opponentPlayer == DRAGON) ? 2 : 3;
+  setSpectatorField(frame, SPF_STATE, spectatorStateField(gameFlow.state, serverCharacter, clientCharacter));
+  setSpectatorField(frame, SPF_SERVER_X, xServer);
+  setSpectatorField(frame, SPF_SERVER_Y, yServer);
+  setSpectatorField(frame, SPF_CLIENT_X, xClient);
+  setSpectatorField(frame, SPF_CLIENT_Y, yClient);
+  setSpectatorField(frame, SPF_TIMER, (gameFlow.state == S_GAME) ? remainingTime / 100 : 0);
+  setSpectatorField(frame, SPF_POWERUPS_LEFT, (powerups.left & 0x0F) << 4 | (opponentSnapshot.field[SF_POWERUPS_LEFT] & 0x0F));
+  setSpectatorField(frame, SPF_POWERUPS_ACTIVE, (powerups.own.active ? 1 : 0) | (powerups.opponent.active ? 2 : 0));
+}
+
+///////////////////////////////////////////////////////////////
+// Builds the spectators' frame when one is due and hands it to
+// the spectator task. Nothing to do while nobody watches, and
+// the same work however many do.
+///////////////////////////////////////////////////////////////
+void serviceSpectators() {
+  if (!spectatorCount) {
+    return;
+  }
+  if (spectatorJoined) {
+    spectatorJoined = false;
+    requestSpectatorKeyframe(spectatorFeed);
+  }
+  SpectatorFrame frame;
+  takeSpectatorFrame(frame);
+  if (buildSpectatorFrame(spectatorFeed, frame, millis()) && spectatorPackets.push(spectatorFeed.packet)) {
+    xTaskNotifyGive(spectatorTaskHandle);
+  }
+}
+
+// Notifies each frame to every spectator, and nobody else, off the game loop
+void spectatorTask(void *) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    SpectatorPacket packet;
+    while (spectatorPackets.pop(packet)) {
+      bleSpectatorCharacteristic->setValue(packet.bytes, packet.length);
+      for (uint8_t i = 0; i < SPECTATOR_MAX; i++) {
+        uint16_t conn = spectatorConns[i];
+        if (conn) {
+          notifyCentral(bleSpectatorCharacteristic, conn - 1, packet.bytes, packet.length);
+        }
+      }
+    }
+  }
+}
+
+void startSpectatorTask() {
+  resetSpectatorFeed(spectatorFeed);
+  xTaskCreatePinnedToCore(spectatorTask, "spectators", SPECTATOR_STACK_SIZE, NULL,
+                          SPECTATOR_PRIORITY, &spectatorTaskHandle, RENDER_CORE);
+}
+
+///////////////////////////////////////////////////////////////
+// Prints what the snapshots cost on the link every
+// RENDER_STATS_LOG_MS, then logs the telemetry record as bytes
+// (tools/decode_log.py prints the hex tools/link_telemetry.py
+// decodes) and puts the same record
+// on the telemetry characteristic
+///////////////////////////////////////////////////////////////
+void logLinkStats() {
+  uint32_t now = millis();
+  if (now - linkStatsLoggedMs < RENDER_STATS_LOG_MS) {
+    return;
+  }
+  const SnapshotStats &stats = snapshotLink.stats;
+  uint32_t samples = stats.rttSamples - linkStatsRttSamples;
+  logEvent(LOG_LINK_STATS, stats.sent, stats.keyframes, (stats.bytes - linkStatsBytes) * 1000 / (now - linkStatsLoggedMs),
+           stats.received, stats.lost, stats.undecodable,
+           samples ? (stats.rttTotalMs - linkStatsRttTotalMs) / samples : 0);
+  linkStatsLoggedMs = now;
+  linkStatsBytes = stats.bytes;
+  linkStatsRttSamples = stats.rttSamples;
+  linkStatsRttTotalMs = stats.rttTotalMs;
+
+  uint32_t received = stats.received - linkStatsReceived;
+  uint32_t lost = stats.lost - linkStatsLost;
+  linkDropPercent = (received + lost) ? lost * 100 / (received + lost) : 0;
+  linkStatsReceived = stats.received;
+  linkStatsLost = stats.lost;
+
+  if (netMode == NET_ROLLBACK) {
+    const RollbackStats &rollbackStats = rollback.stats;
+    logEvent(LOG_ROLLBACK_STATS, rollbackStats.rollbacks, rollbackStats.resimulated, rollbackStats.deepest,
+             rollbackStats.stalls, duelWorstUs);
+    duelWorstUs = 0;
+  } else if (netMode == NET_LOCKSTEP) {
+    const LockstepStats &lockstepStats = lockstep.stats;
+    logEvent(LOG_LOCKSTEP_STATS, lockstepStats.waits, lockstepStats.checks, lockstepStats.desyncs,
+             lockstepStats.firstDesyncTick, duelWorstUs);
+    duelWorstUs = 0;
+  }
+
+  LinkReport report;
+  fillLinkReport(report, linkTelemetry, stats.received, stats.lost);
+  uint8_t record[TELEMETRY_RECORD_SIZE];
+  encodeLinkReport(report, record);
+  bleTelemetryCharacteristic->setValue(record, TELEMETRY_RECORD_SIZE);
+  logEventBytes(LOG_TELEMETRY, record, TELEMETRY_RECORD_SIZE);
+}
+
+///////////////////////////////////////////////////////////////
+// Keeps the connection parameters in step with the game and the
+// link (link_tuning.h), and logs what the controllers agreed on
+// next to the round trip measured before the change
+///////////////////////////////////////////////////////////////
+void tuneLink() {
+  const SnapshotStats &stats = snapshotLink.stats;
+  setLinkInGame(linkTuner, gameFlow.state == S_GAME);
+  if (updateLinkTuner(linkTuner, millis(), stats.received, stats.lost, stats.rttSamples, stats.rttTotalMs)) {
+    logEvent(LOG_LINK_WINDOW, linkIntervalMs(linkParams(linkTuner).maxInterval), linkTuner.rttMs,
+             linkTuner.lossPercent);
+  }
+  if (peerAddressKnown && takeLinkRequest(linkTuner)) {
+    const LinkParams &params = linkParams(linkTuner);
+    bleServer->updateConnParams(peerAddress, params.minInterval, params.maxInterval, params.latency, params.timeout);
+    logEvent(LOG_LINK_REQUEST, linkIntervalMs(params.minInterval), linkIntervalMs(params.maxInterval), params.latency,
+             linkTuner.inGame, linkTuner.rttMs);
+  }
+  LinkUpdate update;
+  while (linkUpdates.pop(update)) {
+    logEvent(LOG_LINK_UPDATED, linkIntervalMs(update.interval), update.latency, update.timeout * 10, update.status);
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Queues the next lines of the last game's recording for
+// tools/replay_match.cpp while the log has half its room to
+// spare; the log task writes them out, tools/decode_log.py
+// prints them. True once all of it is queued. Nothing more goes
+// into the recording once this started.
+///////////////////////////////////////////////////////////////
+bool queueMatchDump() {
+  if (matchDumped >= matchRecorder.length || !logSiteEnabled(LOG_MATCH_BYTES)) {
+    return true;
+  }
+  while (logSpace() > LOG_QUEUE_SIZE / 2) {
+    if (matchDumped == 0) {
+      matchRecorder.recording = 0;
+      logEvent(LOG_MATCH_BEGIN, matchRecorder.length, matchRecorder.truncated);
+    }
+    uint32_t end = matchDumped + MATCH_DUMP_BYTES;
+    if (end > matchRecorder.length) {
+      end = matchRecorder.length;
+    }
+    // Sent again if the log had no room after all (the replayer
+    // takes a repeated "match begin" as the same start)
+    if (!logEventBytes(LOG_MATCH_BYTES, matchRecorder.bytes + matchDumped, end - matchDumped)) {
+      return false;
+    }
+    matchDumped = end;
+    if (matchDumped == matchRecorder.length) {
+      logEvent(LOG_MATCH_END);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Dumps the recording from loop() once the game is over
+void dumpMatchRecord() {
+  if (gameFlow.state != S_GAME) {
+    queueMatchDump();
+  }
+}
+
+// A new game records over the last one: whatever of it the log
+// has not taken yet goes first, however long the UART needs
+void finishMatchDump() {
+  while (!queueMatchDump()) {
+    vTaskDelay(1);
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Game flow actions (game_flow.h). Each runs once, on the loop
+// task, when the state is really entered or left.
+///////////////////////////////////////////////////////////////
+void enterWaiting(uint8_t from, uint8_t event) {
+  // Whatever was in flight belonged to the old connection
+  resetReliableChannel(eventChannel);
+  resetSnapshotLink(snapshotLink);
+  resetLinkTuner(linkTuner, millis());
+  resetLinkTelemetry(linkTelemetry, millis());
+  postScreen(drawWaitingScreen);
+}
+
+void enterPlayerSelect(uint8_t from, uint8_t event) {
+  if (event == EV_PLAY_AGAIN) {
+    chosenPlayer = UNCHOSEN;
+    sendPlayerSelection(3);
+  }
+  if (event == EV_PLAY_AGAIN || event == EV_TUTORIAL_CLOSED) {
+    sendGameState(1);
+  }
+  postScreen(chooseCharacter);
+}
+
+void enterTutorial(uint8_t from, uint8_t event) {
+  sendGameState(2);
+  postScreen(startTutorial);
+}
+
+void enterGame(uint8_t from, uint8_t event) {
+  finishMatchDump();
+  // A remote start was sent by the client, ours goes out here
+  if (event == EV_START) {
+    sendGameState(3);
+  }
+  prevTime = millis();
+  // Tick 0 of the game on both sides, the powerup timers count from it
+  resetTickClock(simClock, millis());
+  resetPowerups(powerups);
+  // Standing on the spawn point
+  placeBody(localBody, xServer, yServer);
+  if (netMode == NET_ROLLBACK) {
+    // Both characters, from the spawn points on both sides (rollback.h)
+    resetRollback(rollback, 0, arenaMap, (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON,
+                  (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS, acceleration);
+  } else if (netMode == NET_LOCKSTEP) {
+    // The same, a few ticks of standing still ahead (lockstep.h)
+    resetLockstep(lockstep, 0, arenaMap, (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON,
+                  (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS, acceleration);
+  } else {
+    // Recorded from here on (match_record.h)
+    startMatchRecord(matchRecorder, MATCH_ROLE_SERVER, (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON,
+                     (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS, acceleration, xServer, yServer, xClient, yClient);
+    matchDumped = 0;
+  }
+}
+
+void enterGameOver(uint8_t from, uint8_t event) {
+  timeRanOut = (gameOverReason(event) == GAME_OVER_TIME_UP);
+  recordMatchEnd(matchRecorder, simClock.tick, event);
+  endGame(event);
+}
+
+// The menu buttons must not take taps once their screen is gone
+void leaveMenu(uint8_t to, uint8_t event) {
+  lockLcd();
+  hideButtons();
+  unlockLcd();
+}
+
+bool checkGameGuard(uint8_t guard) {
+  if (guard == GUARD_PLAYERS_CHOSEN) {
+    return opponentPlayer != UNCHOSEN && chosenPlayer != UNCHOSEN;
+  }
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////
@@ -593,104 +1056,143 @@ void broadcastBleServer() {
     Serial.println("Broadcasting!!!");
     bleServer = BLEDevice::createServer();
     Serial.println("Created Server");
-    bleServer->setCallbacks(new MyServerCallbacks());
+    bleServer->setCallbacks(&serverCallbacks);
     Serial.println("Set Callbacks");
     bleService = bleServer->createService(BLEUUID(SERVICE_UUID), 32);
     Serial.println("Created Service");
     
-    bleReadXCharacteristic = bleService->createCharacteristic(READ_X_CHARACTERISTIC_UUID,
-        BLECharacteristic::PROPERTY_READ |
+    // Snapshots: we notify ours, the client writes its own without response
+    bleSnapshotCharacteristic = bleService->createCharacteristic(SNAPSHOT_UUID,
         BLECharacteristic::PROPERTY_NOTIFY |
-        BLECharacteristic::PROPERTY_INDICATE
+        BLECharacteristic::PROPERTY_WRITE |
+        BLECharacteristic::PROPERTY_WRITE_NR
     );
-    bleReadXCharacteristic->setCallbacks(new MyCharacteristicCallbacks());
-    Serial.println("Created Read X Characteristic");
+    bleSnapshotCharacteristic->setCallbacks(&characteristicCallbacks);
 
-    bleReadXCharacteristic->setValue(xServer);
+    Serial.println("Created snapshot Characteristic");
 
-    bleReadYCharacteristic = bleService->createCharacteristic(READ_Y_CHARACTERISTIC_UUID,
-        BLECharacteristic::PROPERTY_READ |
+    // Client writes without response, we notify; the channel acks both ways
+    bleEventChannelCharacteristic = bleService->createCharacteristic(EVENT_CHANNEL_UUID,
         BLECharacteristic::PROPERTY_NOTIFY |
-        BLECharacteristic::PROPERTY_INDICATE
-    );
-    bleReadYCharacteristic->setValue(yServer);
-    bleReadYCharacteristic->setCallbacks(new MyCharacteristicCallbacks());
-    
-    Serial.println("Created Read y Characteristic");
-    
-    bleReadWriteXCharacteristic = bleService->createCharacteristic(READ_WRITE_X_CHARACTERISTIC_UUID,
-        BLECharacteristic::PROPERTY_WRITE
+        BLECharacteristic::PROPERTY_WRITE |
+        BLECharacteristic::PROPERTY_WRITE_NR
     );
-    bleReadWriteXCharacteristic->setCallbacks(new MyCharacteristicCallbacks());
+    bleEventChannelCharacteristic->setCallbacks(&characteristicCallbacks);
 
-    Serial.println("Created Write X Characteristic");
+    Serial.println("Created event channel Characteristic");
 
-    bleReadWriteYCharacteristic = bleService->createCharacteristic(READ_WRITE_Y_CHARACTERISTIC_UUID,
-        BLECharacteristic::PROPERTY_WRITE
+    // Pings both ways; the client writes its own without response
+    blePingCharacteristic = bleService->createCharacteristic(PING_UUID,
+        BLECharacteristic::PROPERTY_NOTIFY |
+        BLECharacteristic::PROPERTY_WRITE_NR
     );
-    bleReadWriteYCharacteristic->setCallbacks(new MyCharacteristicCallbacks());
-
-    Serial.println("Created Write Y Characteristic");
+    blePingCharacteristic->setCallbacks(&characteristicCallbacks);
 
-    //IMPORTANT: ADDED THESE
-    bleLocalPlayerSelectionCharacteristic = bleService->createCharacteristic(LOCAL_PLAYER_SELECTION_UUID,
-        BLECharacteristic::PROPERTY_READ |
+    // Inputs in the rollback and lockstep modes, both ways like the pings
+    bleInputCharacteristic = bleService->createCharacteristic(INPUT_UUID,
         BLECharacteristic::PROPERTY_NOTIFY |
-        BLECharacteristic::PROPERTY_INDICATE
+        BLECharacteristic::PROPERTY_WRITE_NR
     );
-    bleLocalPlayerSelectionCharacteristic->setCallbacks(new MyCharacteristicCallbacks());
-
-    Serial.println("Created Local Player Characteristic");
+    bleInputCharacteristic->setCallbacks(&characteristicCallbacks);
 
-    bleOpponentPlayerSelectionCharacteristic = bleService->createCharacteristic(OPPONENT_PLAYER_SELECTION_UUID,
-    BLECharacteristic::PROPERTY_WRITE
+    // The latest telemetry record, for anything that connects to read it
+    bleTelemetryCharacteristic = bleService->createCharacteristic(TELEMETRY_UUID,
+        BLECharacteristic::PROPERTY_READ
     );
-    bleOpponentPlayerSelectionCharacteristic->setCallbacks(new MyCharacteristicCallbacks());
 
-    Serial.println("Created Opponent Selection Characteristic");
+    Serial.println("Created telemetry Characteristics");
 
-    bleGameStateCharacteristic = bleService->createCharacteristic(GAME_STATE_UUID,
+    // The match for spectators, notify only (spectator_feed.h)
+    bleSpectatorCharacteristic = bleService->createCharacteristic(SPECTATOR_UUID,
         BLECharacteristic::PROPERTY_READ |
-        BLECharacteristic::PROPERTY_NOTIFY |
-        BLECharacteristic::PROPERTY_INDICATE |
-        BLECharacteristic::PROPERTY_WRITE
+        BLECharacteristic::PROPERTY_NOTIFY
     );
-    bleGameStateCharacteristic->setCallbacks(new MyCharacteristicCallbacks());
 
-    Serial.println("Created game state Characteristic");
+    Serial.println("Created spectator Characteristic");
 
     bleService->start();
 
-    // Start broadcasting (advertising) BLE service
-    BLEAdvertising *bleAdvertising = BLEDevice::getAdvertising();
-    bleAdvertising->addServiceUUID(SERVICE_UUID);
-    bleAdvertising->setScanResponse(true);
-    bleAdvertising->setMinPreferred(0x12);
+    // Start broadcasting (advertising) BLE service: the service and our
+    // match status, the name only in the scan response
+    BLEAdvertisementData scanResponse;
+    scanResponse.setName("Princess of Fire");
+    BLEDevice::getAdvertising()->setScanResponseData(scanResponse);
+    advertiseMatchBeacon();
     BLEDevice::startAdvertising();
     Serial.println("Characteristic defined...you can connect with your phone!"); 
 }
 
+///////////////////////////////////////////////////////////////
+// Puts our match status in the advertising data (match_beacon.h)
+// when it changed, so a client sees a free slot before it
+// connects. Advertising goes on with the new data.
+///////////////////////////////////////////////////////////////
+void advertiseMatchBeacon() {
+  MatchBeacon beacon;
+  beacon.netMode = netMode;
+  beacon.state = gameFlow.state;
+  beacon.character = (chosenPlayer == PRINCESS) ? 1 : (chosenPlayer == DRAGON) ? 2 : 3;
+  beacon.freePlayers = deviceConnected ? 0 : 1;
+  // No room for another connection on a tight heap (memory_watch.h)
+  beacon.freeSpectators = (spectatorCount < SPECTATOR_MAX && !memoryTight(memoryWatch)) ? SPECTATOR_MAX - spectatorCount : 0;
+  if (beaconAdvertised && sameMatchBeacon(beacon, advertisedBeacon)) {
+    return;
+  }
+  uint8_t data[MATCH_BEACON_SIZE];
+  encodeMatchBeacon(beacon, data);
+  BLEAdvertisementData advertisement;
+  advertisement.setFlags(0x06);   // general discoverable, no BR/EDR
+  advertisement.setCompleteServices(BLEUUID(SERVICE_UUID));
+  advertisement.setManufacturerData(std::string((const char *)data, sizeof(data)));
+  BLEDevice::getAdvertising()->setAdvertisementData(advertisement);
+  advertisedBeacon = beacon;
+  beaconAdvertised = true;
+}
+
 bool checkDistance() {
-  long distance = abs(sqrt(pow((xServer - xClient), 2) + pow((yServer - yClient), 2)));
-  if (distance <= 10) {
-    screenUpdated = true;
-    gameEnded = true;
-    gameState = S_GAME_OVER;
+  // Caught as soon as the two sprites overlap (character_collision.h); in
+  // rollback mode once every input up to that tick is in, so both sides agree.
+  // Lockstep only ever runs ticks whose inputs are all in.
+  PlayerType character = (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON;
+  PlayerType opponent = (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS;
+  bool caught = (netMode == NET_ROLLBACK) ? rollbackCaught(rollback)
+               : (netMode == NET_LOCKSTEP) ? lockstep.state.caught
+                                           : charactersOverlap(character, xServer, yServer, opponent, xClient, yClient);
+  if (caught) {
+    dispatchGameEvent(gameFlow, EV_CAUGHT);
     return false;
   }
   return true;
 }
-void printDistance() {
-  long distance = abs(sqrt(pow((xServer - xClient), 2) + pow((yServer - yClient), 2)));
-  M5.Lcd.fillRect(10, 20, 10, 10, TFT_BLACK);
-  M5.Lcd.setCursor(10, 20);
-  if (chosenPlayer == DRAGON) {
-    M5.Lcd.setTextColor(TFT_PINK);
-  } else {
-    M5.Lcd.setTextColor(TFT_GREEN);
+///////////////////////////////////////////////////////////////
+// Redraws the HUD characters whose value changed since the last
+// frame (nothing at all on most frames). Runs on the render task.
+///////////////////////////////////////////////////////////////
+void updateHud(const FrameSnapshot &frame) {
+  char text[HUD_FIELD_CHARS + 1];
+  setHudFieldStyle(hudTimer, frame.timerStyle);
+  formatHudTime(text, frame.remainingMs);
+  updateHudField(hudTimer, text, hudStyles, drawHudGlyph);
+
+  // Distance is shown in the opponent's colour
+  setHudFieldStyle(hudDistance, frame.distanceStyle);
+  formatHudNumber(text, frame.distance);
+  updateHudField(hudDistance, text, hudStyles, drawHudGlyph);
+
+  formatHudNumber(text, frame.powerupsLeft);
+  updateHudField(hudPowerups, text, hudStyles, drawHudGlyph);
+
+  formatHudNumber(text, frame.acceleration);
+  updateHudField(hudAcceleration, text, hudStyles, drawHudGlyph);
+
+  if (frame.linkOverlay) {
+    formatHudNumber(text, frame.rttMedian);
+    updateHudField(hudRttMedian, text, hudStyles, drawHudGlyph);
+    formatHudNumber(text, frame.rttTail);
+    updateHudField(hudRttTail, text, hudStyles, drawHudGlyph);
+    formatHudNumber(text, frame.dropPercent);
+    updateHudField(hudLoss, text, hudStyles, drawHudGlyph);
   }
-  M5.Lcd.setTextSize(1);
-  M5.Lcd.print(distance);
 }
 
 void serverAccelIncrement() {
@@ -701,27 +1203,21 @@ void serverAccelIncrement() {
   }
 }
 
-String milis_to_seconds(long milis) {
-    unsigned long seconds = milis / 1000;
-    String secondStr = seconds < 10 ? "0" + String(seconds) : String(seconds);
-    unsigned long miliseconds = milis % 60;
-    String milisecondsStr = miliseconds < 10 ? "0" + String(miliseconds) : String(miliseconds);
-    return secondStr + "." + milisecondsStr + "s";
-}
+void endGame(uint8_t event) {
+  // Why, so the client shows the same result if this reached it first
+  uint8_t gameOver[2] = { 4, gameOverReason(event) };
+  sendReliableMessage(eventChannel, MSG_GAME_STATE, gameOver, sizeof(gameOver));
+  // The next snapshot takes us back to the spawn point on the client too
+  xServer = arenaMap.spawnX[SPAWN_SERVER], yServer = arenaMap.spawnY[SPAWN_SERVER];
 
-void endGame() {
-  int val = 4;
-  bleGameStateCharacteristic->setValue(val);
-  bleGameStateCharacteristic->notify();
-  delay(10);
-  xServer = 10, yServer = 120;
-  bleReadYCharacteristic->setValue(yServer);
-  bleReadXCharacteristic->setValue(xServer);
-  bleReadXCharacteristic->notify();
-  delay(10);
-  bleReadYCharacteristic->notify();
-  delay(10);
+  postScreen(drawGameOverScreen);
+  sendPlayerSelection(3);
+}
 
+///////////////////////////////////////////////////////////////
+// Draws the result screen (posted to the render task by endGame)
+///////////////////////////////////////////////////////////////
+void drawGameOverScreen() {
   M5.Lcd.fillScreen(TFT_BLACK);
   M5.Lcd.setTextColor(TFT_RED);
   M5.Lcd.setTextSize(3);
@@ -735,247 +1231,220 @@ void endGame() {
     M5.Lcd.drawString("YOU WON", M5.Lcd.width() / 4, M5.Lcd.height() / 2 - 30);
   }
   PLAYAGAIN.draw();
-  int chosenPlayerInt = 3;
-  bleLocalPlayerSelectionCharacteristic->setValue(chosenPlayerInt);
-  bleLocalPlayerSelectionCharacteristic->notify();
-  delay(10);
 }
 
 void playGame() {
-  printDistance();
-  // Reverse x/y values to match joystick orientation
-  int x = 1023 - gamePad.analogRead(14);
-  int y = 1023 - gamePad.analogRead(15);
-
-  // Left & Right For Joystick
-  if (x > 600) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((xServer + 1) < 320) {
-        xServer++;
-        locationWasUpdated = true;
-      } else {
-        xServer = 0;
-        locationWasUpdated = true;
-      }
-    }
-  } else if (x < 500) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((xServer - 1) > 0) {
-        xServer--;
-        locationWasUpdated = true;
-      } else {
-        xServer = 320;
-        locationWasUpdated = true;
-      }
-    }
-  }
-
-  if (y < 480) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((yServer + 1) < 240) {
-        yServer++;
-        locationWasUpdated = true;
-      } else {
-        yServer = 0;
-        locationWasUpdated = true;
-      }
-    }
-  } else if (y > 560) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((yServer - 1) > 0) {
-        yServer--;
-        locationWasUpdated = true;
-      } else {
-        yServer = 240;
-        locationWasUpdated = true;
-      }
-    }
-  }
+  // Calibrated stick vector (joystick_setup.h). Only reads the stick
+  // here; stepSimulation() moves the character once per tick.
+  JoystickVector stick = readJoystick(gamePad);
+  moveX = stick.x;
+  moveY = stick.y;
 
   // For the gamepad buttons
   uint32_t buttons = gamePad.digitalReadBulk(button_mask);
-  if (! (buttons & (1UL << BUTTON_SELECT))) {
+  // Start cycles the speed level shown on the HUD
+  bool startDown = !(buttons & (1UL << BUTTON_START));
+  if (startDown && !startWasDown) {
+    serverAccelIncrement();
+  }
+  startWasDown = startDown;
+  // Select starts a powerup; usePowerup() ignores presses during the cooldown
+  bool selectDown = !(buttons & (1UL << BUTTON_SELECT));
+  bool selectPressed = selectDown && !selectWasDown;
+  if (selectPressed) {
     usePowerup();
   }
+  selectWasDown = selectDown;
+  // The inputs this loop's ticks run on, for the replay
+  recordMatchInput(matchRecorder, simClock.tick, moveX, moveY, acceleration, selectPressed);
 }
 
 void usePowerup() {
-  Serial.print("Made it to powerup");
-  if (powerupsStillAvailable) {
-    // If we're the dragon, set the bit to the princess
-    if (chosenPlayer == DRAGON && !dragonPowerupActive) {
-      powerupStartTime = millis();
-      dragonPowerupActive = true;
-      // Update the amount of powerups left 
-      if (powerupsStillAvailable && powerupsLeft > 0) {
-        powerupsLeft--; 
-      } else {
-        powerupsStillAvailable = false;
-      }
-      delay(10);
-    } else if (chosenPlayer == PRINCESS && !princessPowerupActive) {
-      powerupStartTime = millis();
-      princessPowerupActive = true;
-      // Update the amount of powerups left 
-      if (powerupsStillAvailable && powerupsLeft > 0) {
-        powerupsLeft--; 
-      } else {
-        powerupsStillAvailable = false;
-      }
-    }
+  if (pressPowerup(powerups, simClock.tick)) {
+    logEvent(LOG_POWERUP_STARTED);
+    uint8_t payload[POWERUP_MESSAGE_SIZE];
+    encodePowerupMessage(payload, (chosenPlayer == PRINCESS) ? 1 : 2, powerups.own.startTick);
+    sendReliableMessage(eventChannel, MSG_POWERUP, payload, POWERUP_MESSAGE_SIZE);
   }
-  screenUpdated = true;
-  locationWasUpdated = true;
 }
 
-void addressPowerup() {
-  if (dragonPowerupActive && chosenPlayer == DRAGON) {
-    M5.Lcd.fillScreen(TFT_BLACK);
-    drawCharacters(xServer, yServer, xClient, yClient); 
-    M5.Lcd.drawPixel(xClient, yClient, TFT_PINK);
-  }
+///////////////////////////////////////////////////////////////
+// Fills in the reveal part of the frame: while our own powerup
+// is active the fog opens around the opponent
+///////////////////////////////////////////////////////////////
+void addressPowerup(FrameSnapshot &frame) {
+  frame.reveal = powerups.own.active;
+  frame.revealColor = (chosenPlayer == DRAGON) ? TFT_PINK : TFT_GREEN;
+  frame.revealX = frame.reveal ? xClient : 0;
+  frame.revealY = frame.reveal ? yClient : 0;
+
+  // The opponent is shown standing, facing right
+  PlayerType opponent = (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS;
+  const AnimationClip &idle = characterFacings[opponent][FACE_RIGHT].clips[ANIM_IDLE];
+  frame.revealFrame = idle.firstFrame;
+  frame.revealPalette = idle.palette;
+}
+
+///////////////////////////////////////////////////////////////
+// Runs the simulation ticks that are due: moves the local
+// character (kinematics.h) and advances its animation. The
+// renderer works out from the frame snapshot whether anything
+// has to be redrawn.
+///////////////////////////////////////////////////////////////
+void stepSimulation() {
+  PlayerType character = (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON;
+  const FacingVariant *facings = characterFacings[character];
 
-  if (princessPowerupActive && chosenPlayer == PRINCESS) {
-    M5.Lcd.fillScreen(TFT_BLACK);
-    drawCharacters(xServer, yServer, xClient, yClient); 
-    M5.Lcd.drawPixel(xClient, yClient, TFT_GREEN);
+  uint32_t ticks = advanceTickClock(simClock, millis());
+  if (netMode != NET_SNAPSHOTS) {
+    stepInputMode(ticks);
+  } else {
+    // Spawns and new rounds set the pixel position directly
+    syncBody(localBody, xServer, yServer);
+    for (uint32_t i = 0; i < ticks; i++) {
+      stepBody(localBody, moveX, moveY, acceleration, localBlocked);
+    }
+  }
+  int x = kinToPixels(localBody.x);
+  int y = kinToPixels(localBody.y);
+  // The next snapshot tells the client if the pixel position changed
+  xServer = x;
+  yServer = y;
+
+  faceVelocity(localAnimator, facings, moveX, moveY);
+  const AnimationClip *clips = facingClips(localAnimator, facings);
+
+  // Pick the clip from what the character is doing right now
+  if (isPowerupActive(powerups.own, simClock.tick)) {
+    playAnimation(localAnimator, clips, ANIM_POWERUP);
+  } else if (localBody.vx != 0 || localBody.vy != 0) {
+    playAnimation(localAnimator, clips, ANIM_WALK);
+  } else {
+    playAnimation(localAnimator, clips, ANIM_IDLE);
+  }
+  for (uint32_t i = 0; i < ticks; i++) {
+    advanceAnimation(localAnimator, clips);
   }
 }
 
-void drawCharacters(uint32_t serverX, uint32_t serverY, uint32_t clientX, uint32_t clientY) {
-  if (chosenPlayer == PRINCESS) {
-    drawCharacterImage("princess", 1, serverX, serverY);
+///////////////////////////////////////////////////////////////
+// Input modes: both characters move on both sides' inputs. In
+// rollback mode (rollback.h) ours goes in as it is now and the
+// client's is predicted until it arrives; in lockstep mode
+// (lockstep.h) ours is played a few ticks on and nothing runs
+// ahead of the client's.
+///////////////////////////////////////////////////////////////
+void stepInputMode(uint32_t ticks) {
+  DuelInput input = {(int8_t)moveX, (int8_t)moveY, (uint8_t)acceleration};
+  const DuelState *state = &rollback.state;
+  uint32_t start = micros();
+  if (netMode == NET_ROLLBACK) {
+    receiveRollbackInputs(rollback);
+    advanceRollback(rollback, input, ticks);
   } else {
-    drawCharacterImage("dragon", 1, serverX, serverY);
+    receiveLockstepInputs(lockstep);
+    advanceLockstep(lockstep, input, ticks);
+    state = &lockstep.state;
+  }
+  uint32_t took = micros() - start;
+  if (took > duelWorstUs) {
+    duelWorstUs = took;
+  }
+  localBody = state->body[0];
+  xClient = kinToPixels(state->body[1].x);
+  yClient = kinToPixels(state->body[1].y);
+}
+
+// Walls block the local character's feet
+bool localBlocked(int x, int y) {
+  return characterBlocked(arenaMap, (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON, x, y);
+}
+
+///////////////////////////////////////////////////////////////
+// Hands everything this loop's frame needs to the render task.
+// Nothing in here touches the display.
+///////////////////////////////////////////////////////////////
+void postGameFrame() {
+  PlayerType character = (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON;
+  const FacingVariant *facings = characterFacings[character];
+  const AnimationClip *clips = facingClips(localAnimator, facings);
+
+  FrameSnapshot frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.x = xServer;
+  frame.y = yServer;
+  frame.atlasFrame = currentAtlasFrame(localAnimator, clips);
+  frame.palette = clips[localAnimator.clip].palette;
+  frame.mirrored = facings[localAnimator.facing].mirrored;
+  addressPowerup(frame);
+
+  frame.remainingMs = remainingTime;
+  frame.distance = characterDistance(xServer, yServer, xClient, yClient);
+  frame.distanceStyle = (chosenPlayer == DRAGON) ? HUD_STYLE_PINK : HUD_STYLE_GREEN;
+  frame.powerupsLeft = powerups.left;
+  // The timer turns the opponent's colour while their powerup shows them where we are
+  frame.timerStyle = !powerups.opponent.active ? HUD_STYLE_TIMER :
+                     (chosenPlayer == DRAGON) ? HUD_STYLE_PINK : HUD_STYLE_GREEN;
+  frame.acceleration = acceleration;
+  // Median and tail round trip of the pings, snapshots lost lately
+  frame.linkOverlay = linkOverlay;
+  if (linkOverlay) {
+    LinkReport report;
+    fillLinkReport(report, linkTelemetry, snapshotLink.stats.received, snapshotLink.stats.lost);
+    frame.rttMedian = report.rttMedian;
+    frame.rttTail = report.rttTail;
+    frame.dropPercent = linkDropPercent;
   }
+  frame.forceRedraw = redrawGame;
+  // A full queue drops the frame; the repaint goes with the next one then
+  if (postFrame(frame)) {
+    redrawGame = false;
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Draws one game frame. Runs on the render task. The fog of war
+// composites only the tiles that changed; the HUD only redraws
+// the characters that did.
+///////////////////////////////////////////////////////////////
+void renderFrame(const FrameSnapshot &frame, bool fullRedraw) {
+  showHudOverlay(frame.linkOverlay);
+  renderFoggedFrame(frame, fullRedraw);
+  updateHud(frame);
 }
 
 void checkTimeAndPrint() {
   currTime = millis();
-  unsigned long remainingTime = 0;
+  remainingTime = 0;
   if (countdownTime - (currTime - prevTime) >= 0) {
     remainingTime = countdownTime - (currTime - prevTime);
   }
   if (remainingTime <= 0) {
-    Serial.print("Made it to game over");
-    gameState = S_GAME_OVER;
-    int val = 4; 
-    bleGameStateCharacteristic->setValue(val);
-    bleGameStateCharacteristic->notify();
-    delay(10);
-    timeRanOut = true;
-    gameEnded = true;
-    screenUpdated = true;
-    endGame();
-  }
-  unsigned long minutes = (remainingTime / 1000) / 60;
-  unsigned long seconds = (remainingTime  / 1000) % 60;
-  
-  if (gameState == S_GAME && remainingTime >= 0) {
-    M5.Lcd.setTextSize(1);
-    M5.Lcd.setCursor(210, 20);
-    M5.Lcd.print(minutes);
-    M5.Lcd.print(":");
-    if (seconds < 10) {
-      String secs = String(seconds);
-      M5.Lcd.print("0"+secs);
-    } else {
-      M5.Lcd.print(seconds);
-    }
+    logEvent(LOG_GAME_OVER);
+    dispatchGameEvent(gameFlow, EV_TIME_UP);
   }
+  // The HUD draws remainingTime in updateHud()
 }
 
 /////////////////////////////////////////////////////////////////
-// This method takes in an image icon string (from API) and a 
-// resize multiple and draws the corresponding image (bitmap byte
-// arrays found in EGR425_Phase1_weather_bitmap_images.h) to scale (for 
-// example, if resizeMult==2, will draw the image as 200x200 instead
-// of the native 100x100 pixels) on the right-hand side of the
-// screen (centered vertically). 
+// This method takes in an image icon string and a resize multiple
+// and draws the corresponding indexed sprite (generated into
+// game_indexed_bitmaps.h) to scale (for example, if resizeMult==2,
+// will draw the image as 200x200 instead of the native 100x100
+// pixels) centered on the screen.
 /////////////////////////////////////////////////////////////////
-void drawCenteredBackgroundImage(String iconName, int resizeMult) {
-    // Get the corresponding byte array
-    const uint16_t * iconBitmap = getIconBitmap(iconName);
-
-    // Compute offsets so that the image is centered vertically and is
-    // right-aligned
-    int yOffset = -(resizeMult * imgSqDim - M5.Lcd.height()) / 2;
-    // int xOffset = sWidth - (imgSqDim*resizeMult*.8); // Right align (image doesn't take up entire array)
-    int xOffset = (M5.Lcd.width() / 2) - (imgSqDim * resizeMult / 2); // center horizontally
-    
-    // Iterate through each pixel of the imgSqDim x imgSqDim (100 x 100) array
-    for (int y = 0; y < imgSqDim; y++) {
-        for (int x = 0; x < imgSqDim; x++) {
-            // Compute the linear index in the array and get pixel value
-            int pixNum = (y * imgSqDim) + x;
-            uint16_t pixel = iconBitmap[pixNum];
-
-            // If the pixel is black, do NOT draw (treat it as transparent);
-            // otherwise, draw the value
-            if (pixel != 0) {
-                // 16-bit RBG565 values give the high 5 pixels to red, the middle
-                // 6 pixels to green and the low 5 pixels to blue as described
-                // here: http://www.barth-dev.de/online/rgb565-color-picker/
-                byte red = (pixel >> 11) & 0b0000000000011111;
-                red = red << 3;
-                byte green = (pixel >> 5) & 0b0000000000111111;
-                green = green << 2;
-                byte blue = pixel & 0b0000000000011111;
-                blue = blue << 3;
-
-                // Scale image; for example, if resizeMult == 2, draw a 2x2
-                // filled square for each original pixel
-                for (int i = 0; i < resizeMult; i++) {
-                    for (int j = 0; j < resizeMult; j++) {
-                        int xDraw = x * resizeMult + i + xOffset;
-                        int yDraw = y * resizeMult + j + yOffset;
-                        M5.Lcd.drawPixel(xDraw, yDraw, M5.Lcd.color565(red, green, blue));
-                    }
-                }
-            }
-        }
+void drawCenteredBackgroundImage(const char *iconName, int resizeMult) {
+    // Get the corresponding indexed sprite
+    const IndexedSprite *sprite = getIndexedSprite(iconName);
+    if (sprite == NULL) {
+        return;
     }
-}
 
-void drawCharacterImage(String iconName, int resizeMult, int xLoc, int yLoc) {
-    // Get the corresponding byte array
-    const uint16_t * iconBitmap = getIconBitmap(iconName);
+    // Compute offsets so that the image is centered
+    int yOffset = -(resizeMult * sprite->height - M5.Lcd.height()) / 2;
+    int xOffset = (M5.Lcd.width() / 2) - (sprite->width * resizeMult / 2); // center horizontally
+
+    // Transparent (index 0) pixels are skipped by the blit
+    drawIndexedSprite(*sprite, xOffset, yOffset, resizeMult);
+}
 
-    // Compute offsets so that the image is centered vertically and is
-    // right-aligned
-    int yOffset = yLoc - (imgSqDim * resizeMult / 2); // center vertically    // int xOffset = sWidth - (imgSqDim*resizeMult*.8); // Right align (image doesn't take up entire array)
-    int xOffset = xLoc - (imgSqDim * resizeMult / 2); // center horizontally
-    
-    // Iterate through each pixel of the imgSqDim x imgSqDim (100 x 100) array
-    for (int y = 0; y < imgSqDim; y++) {
-        for (int x = 0; x < imgSqDim; x++) {
-            // Compute the linear index in the array and get pixel value
-            int pixNum = (y * imgSqDim) + x;
-            uint16_t pixel = iconBitmap[pixNum];
-
-            // If the pixel is black, do NOT draw (treat it as transparent);
-            // otherwise, draw the value
-            if (pixel != 0) {
-                // 16-bit RBG565 values give the high 5 pixels to red, the middle
-                // 6 pixels to green and the low 5 pixels to blue as described
-                // here: http://www.barth-dev.de/online/rgb565-color-picker/
-                byte red = (pixel >> 11) & 0b0000000000011111;
-                red = red << 3;
-                byte green = (pixel >> 5) & 0b0000000000111111;
-                green = green << 2;
-                byte blue = pixel & 0b0000000000011111;
-                blue = blue << 3;
-
-                // Scale image; for example, if resizeMult == 2, draw a 2x2
-                // filled square for each original pixel
-                for (int i = 0; i < resizeMult; i++) {
-                    for (int j = 0; j < resizeMult; j++) {
-                        int xDraw = x * resizeMult + i + xOffset;
-                        int yDraw = y * resizeMult + j + yOffset;
-                        M5.Lcd.drawPixel(xDraw, yDraw, M5.Lcd.color565(red, green, blue));
-                    }
-                }
-            }
-        }
-    }
-}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#ifndef ALLOC_GUARD_H
+#define ALLOC_GUARD_H
+/////////////////////////////////////////////////////////////////////////////
+// Counts heap allocations made by the loop task, in debug builds.
+//
+// A game tick must not touch the heap: hours of small String allocations
+// fragment it until a large one fails. Built with ALLOC_GUARD (the
+// m5stack-core2-debug environment in platformio.ini), malloc(), calloc()
+// and realloc() are wrapped at link time (-Wl,--wrap=...) and count every
+// call made from the task between beginAllocCheck() and endAllocCheck().
+// operator new and String go through malloc() too. endAllocCheck() prints
+// how many there were and asserts there were none.
+//
+// Only the task that called beginAllocCheck() counts: the BLE stack and the
+// render task allocate on their own. The radio calls (notify(), writeValue())
+// allocate inside the BLE library, so loop() checks the game tick and leaves
+// the sends outside it. Without ALLOC_GUARD both calls are empty.
+//
+// Include from one translation unit only (the role file): the wrappers are
+// the definitions the linker looks for.
+/////////////////////////////////////////////////////////////////////////////
+#include <Arduino.h>
+
+#ifdef ALLOC_GUARD
+#include <assert.h>
+
+static TaskHandle_t allocGuardTask = NULL;
+static volatile uint32_t allocGuardCount = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+static inline void countAllocation() {
+    if (allocGuardTask != NULL && xTaskGetCurrentTaskHandle() == allocGuardTask) {
+        allocGuardCount++;
+    }
+}
+
+void *__wrap_malloc(size_t size) {
+    countAllocation();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    countAllocation();
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    countAllocation();
+    return __real_realloc(pointer, size);
+}
+}
+
+inline void beginAllocCheck() {
+    allocGuardCount = 0;
+    allocGuardTask = xTaskGetCurrentTaskHandle();
+}
+
+// `what` names the code checked in the message
+inline void endAllocCheck(const char *what) {
+    allocGuardTask = NULL;
+    uint32_t count = allocGuardCount;
+    if (count != 0) {
+        Serial.printf("alloc: %u heap allocations in %s\n", count, what);
+    }
+    assert(count == 0);
+}
+
+#else
+
+inline void beginAllocCheck() {}
+inline void endAllocCheck(const char *what) {}
+
+#endif
+
+#endif
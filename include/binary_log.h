@@ -0,0 +1,387 @@
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+/////////////////////////////////////////////////////////////////////////////
+// Binary log records: which line and its numbers, never the text.
+//
+// Serial.printf() from loop() and the BLE callbacks blocked on the UART at
+// 115200 baud, one character every 87 us. A log site now pushes a small
+// record (the site, a timestamp and up to LOG_MAX_ARGS integers) into a
+// lock-free queue, and a low-priority task (log_task.h) writes the records
+// out as frames:
+//
+//     [0xA5][site][suppressed][argc][ms, 4 bytes][args...][xor]
+//
+// Each argument is a zigzag LEB128 varint; the last byte is the xor of all
+// the ones before it. The format strings live only in LOG_SITES below: the
+// firmware keeps the site's level and rate limit, and tools/decode_log.py
+// reads the strings out of this file to print the records. Besides printf's
+// %d, %u and %x, a format can hold %{a|b|c}, which prints the choice the
+// argument indexes.
+//
+// A site whose format is a prefix and %h logs bytes instead (logBytes():
+// the telemetry record, the match recording). Its frames carry up to
+// LOG_BYTES_MAX of them as they are, argc says how many with LOG_BYTES set,
+// and what is longer goes out in parts: the suppressed byte numbers them,
+// and LOG_BYTES_MORE says another follows. The decoder prints the parts of
+// one call as one line of hex, the line the tools reading it expect, and
+// drops a line that lost a part. Text lines written straight to Serial
+// (setup) pass through the decoder untouched; 0xA5 never shows up in them.
+//
+// A site below LOG_LEVEL (default LOG_INFO) compiles to nothing. A site with
+// a rate limit logs at most once per its interval; the next record that
+// goes out says how many were held back. The queue takes records from any
+// task (loop, BLE callbacks, render) without a lock; when it is full the
+// record is dropped and counted, and the drain reports the count.
+//
+// Nothing here touches the hardware, see tools/test_binary_log.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+enum LogLevel { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG };
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+/////////////////////////////////////////////////////////////////
+// Every log site: name, level, least ms between two records
+// (0 for none), format. tools/decode_log.py parses these lines,
+// keep one entry per line.
+/////////////////////////////////////////////////////////////////
+#define LOG_SITES(X) \
+    X(LOG_DROPPED,                LOG_WARN,  0,    "%u log records dropped, the buffer was full") \
+    X(LOG_DEVICE_CONNECTED,       LOG_INFO,  0,    "Device connected...") \
+    X(LOG_DEVICE_DISCONNECTED,    LOG_INFO,  0,    "Device disconnected...") \
+    X(LOG_SPECTATOR_CONNECTED,    LOG_INFO,  0,    "Spectator connected (%u watching)") \
+    X(LOG_SPECTATOR_DISCONNECTED, LOG_INFO,  0,    "Spectator disconnected (%u watching)") \
+    X(LOG_SERVER_FOUND,           LOG_INFO,  0,    "Server with a free slot found (state %u, %u spectator slots)") \
+    X(LOG_MTU_CHANGED,            LOG_INFO,  0,    "MTU is now %u") \
+    X(LOG_CHARACTERISTIC_READ,    LOG_DEBUG, 1000, "Client read from %{snapshot|event channel|ping|input|telemetry|spectator|unknown}") \
+    X(LOG_NOTIFY_FAILED,          LOG_WARN,  1000, "Status for %{snapshot|event channel|ping|input|telemetry|spectator|unknown}: Failure; %{Indication Disabled on Client|Notification Disabled on Client|GATT Issue|No BLE Client|Indication Timeout|Indication Failure}") \
+    X(LOG_OPPONENT_CHOSE,         LOG_INFO,  0,    "Opponent is: %{none|princess|dragon|unchosen}") \
+    X(LOG_OPPONENT_STATE,         LOG_INFO,  0,    "Opponent state: %{waiting|player select|tutorial|game|game over}") \
+    X(LOG_POWERUP_STARTED,        LOG_INFO,  0,    "Powerup started") \
+    X(LOG_POWERUP_ENDED,          LOG_INFO,  0,    "Powerup has ended") \
+    X(LOG_OPPONENT_POWERUP,       LOG_INFO,  0,    "Opponent used a powerup") \
+    X(LOG_GAME_OVER,              LOG_INFO,  0,    "Made it to game over") \
+    X(LOG_LINK_STATS,             LOG_INFO,  0,    "link: snapshots %u sent (%u keyframes), %u B/s, %u received (%u lost, %u undecodable), rtt %u ms") \
+    X(LOG_ROLLBACK_STATS,         LOG_INFO,  0,    "rollback: %u rollbacks (%u ticks resimulated, deepest %u), %u ticks stalled, worst %u us") \
+    X(LOG_LOCKSTEP_STATS,         LOG_INFO,  0,    "lockstep: %u ticks waited, %u hashes checked, %u desyncs (first at tick %u), worst %u us") \
+    X(LOG_LINK_WINDOW,            LOG_INFO,  0,    "link: %u ms interval, rtt %u ms, loss %u%%") \
+    X(LOG_LINK_REQUEST,           LOG_INFO,  0,    "link: asking for a %u-%u ms interval, latency %u (%{idle|game}, rtt %u ms so far)") \
+    X(LOG_LINK_UPDATED,           LOG_INFO,  0,    "link: interval now %u ms, latency %u, timeout %u ms (status %u)") \
+    X(LOG_RENDER_STATS,           LOG_INFO,  0,    "render: queue %u (max %u, drops %u), frames %u (%u coalesced), load render %u%% loop %u%%") \
+    X(LOG_MEMORY_HEAP,            LOG_INFO,  0,    "memory: heap %u free (lowest %u), largest block %u (%u%% fragmented), %d B/min, psram %u free") \
+    X(LOG_MEMORY_STACKS,          LOG_INFO,  0,    "memory: stack unused loop %d, render %d, log %d, ble %d, spectators %d (-1 not running)") \
+    X(LOG_MEMORY_LOW,             LOG_WARN,  0,    "memory: heap down to %u free (floor %u)") \
+    X(LOG_MEMORY_FRAGMENTED,      LOG_WARN,  0,    "memory: largest free block down to %u (floor %u), %u free in all") \
+    X(LOG_MEMORY_SHRINKING,       LOG_WARN,  0,    "memory: heap shrinking %d B/min, at its floor in %u min") \
+    X(LOG_STACK_LOW,              LOG_WARN,  0,    "memory: %{loop|render|log|ble|spectators} stack down to %u unused") \
+    X(LOG_PSRAM_LOW,              LOG_WARN,  0,    "memory: psram down to %u free (floor %u)") \
+    X(LOG_MEMORY_CLEARED,         LOG_INFO,  0,    "memory: %{heap low|largest block small|heap shrinking|stack low|psram low} cleared") \
+    X(LOG_TELEMETRY,              LOG_INFO,  0,    "telemetry: %h") \
+    X(LOG_MATCH_BEGIN,            LOG_INFO,  0,    "match begin: %u bytes%{|, truncated}") \
+    X(LOG_MATCH_BYTES,            LOG_INFO,  0,    "match: %h") \
+    X(LOG_MATCH_END,              LOG_INFO,  0,    "match end")
+
+#define LOG_SITE_ID(name, level, intervalMs, format) name,
+#define LOG_SITE_LEVEL(name, level, intervalMs, format) level,
+#define LOG_SITE_INTERVAL(name, level, intervalMs, format) intervalMs,
+
+enum LogSite { LOG_SITES(LOG_SITE_ID) LOG_SITE_COUNT };
+
+const uint8_t logSiteLevels[LOG_SITE_COUNT] = { LOG_SITES(LOG_SITE_LEVEL) };
+const uint16_t logSiteIntervalMs[LOG_SITE_COUNT] = { LOG_SITES(LOG_SITE_INTERVAL) };
+
+const uint8_t LOG_MAX_ARGS = 7;
+const uint8_t LOG_BYTES = 0x80;             // argc: the record carries bytes, the count below
+const uint8_t LOG_BYTES_MORE = 0x40;        // argc: and the next part continues them
+const uint8_t LOG_BYTES_COUNT = 0x3F;
+const uint8_t LOG_BYTES_MAX = LOG_MAX_ARGS * sizeof(int32_t);
+const uint8_t LOG_FRAME_SYNC = 0xA5;
+const uint8_t LOG_FRAME_HEADER = 8;
+const uint8_t LOG_FRAME_MAX = LOG_FRAME_HEADER + LOG_MAX_ARGS * 5 + 1;
+const uint32_t LOG_QUEUE_SIZE = 64;          // records, power of two
+
+struct LogRecord {
+    uint32_t ms;
+    uint8_t site;
+    uint8_t suppressed;     // records of this site held back by its rate limit just before; part number of bytes
+    uint8_t argc;           // argument count, or LOG_BYTES and the byte count
+    union {
+        int32_t args[LOG_MAX_ARGS];
+        uint8_t bytes[LOG_BYTES_MAX];
+    };
+};
+
+/////////////////////////////////////////////////////////////////
+// Lock-free multi producer / single consumer ring of records
+// (a bounded queue with a sequence number per slot). Producers
+// claim a slot with a compare-and-swap and publish it through
+// its sequence number, so a producer that stops half way never
+// lets the consumer see a torn record.
+/////////////////////////////////////////////////////////////////
+template <uint32_t Capacity>
+class LogQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    LogQueue() : enqueuePos(0), dequeuePos(0), dropped(0) {
+        for (uint32_t i = 0; i < Capacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Any task. Returns false (and counts a drop) if the queue is full.
+    bool push(const LogRecord &record) {
+        uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;) {
+            slot = &slots[pos & (Capacity - 1)];
+            int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->record = record;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // The drain task only. Returns false if nothing is published yet.
+    bool pop(LogRecord &record) {
+        uint32_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Slot &slot = slots[pos & (Capacity - 1)];
+        if ((int32_t)(slot.sequence.load(std::memory_order_acquire) - (pos + 1)) < 0) {
+            return false;
+        }
+        record = slot.record;
+        slot.sequence.store(pos + Capacity, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint32_t drops() const { return dropped.load(std::memory_order_relaxed); }
+
+    // Free slots as of now; any task may take some before the caller pushes
+    uint32_t space() const {
+        uint32_t dequeued = dequeuePos.load(std::memory_order_relaxed);
+        uint32_t used = enqueuePos.load(std::memory_order_relaxed) - dequeued;
+        return used < Capacity ? Capacity - used : 0;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        LogRecord record;
+    };
+    Slot slots[Capacity];
+    std::atomic<uint32_t> enqueuePos;
+    std::atomic<uint32_t> dequeuePos;       // written by the drain only, read by space()
+    std::atomic<uint32_t> dropped;
+};
+
+// The queue and each rate limited site's state. That state is
+// not locked: two tasks logging the same rate limited site at
+// once can only get the suppressed count off by one. Sites
+// without a rate limit never touch it.
+struct BinaryLog {
+    LogQueue<LOG_QUEUE_SIZE> queue;
+    uint32_t lastMs[LOG_SITE_COUNT];
+    uint8_t logged[LOG_SITE_COUNT];
+    uint8_t suppressed[LOG_SITE_COUNT];
+    uint32_t dropsReported;             // drain side
+};
+
+// Constant for a constant site, so the compiler drops what's below LOG_LEVEL
+inline bool logSiteEnabled(uint8_t site) {
+    return logSiteLevels[site] <= LOG_LEVEL;
+}
+
+inline void fillLogArgs(int32_t *) {
+}
+
+template <typename T, typename... Rest>
+inline void fillLogArgs(int32_t *out, T first, Rest... rest) {
+    *out = (int32_t)first;
+    fillLogArgs(out + 1, rest...);
+}
+
+/////////////////////////////////////////////////////////////////
+// Queues a record for `site` unless its level is compiled out
+// or its rate limit holds it back. True if it was queued.
+/////////////////////////////////////////////////////////////////
+template <typename... Args>
+inline bool logRecord(BinaryLog &log, uint8_t site, uint32_t now, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    if (!logSiteEnabled(site)) {
+        return false;
+    }
+    LogRecord record;
+    record.ms = now;
+    record.site = site;
+    record.suppressed = 0;
+    record.argc = sizeof...(Args);
+    if (logSiteIntervalMs[site]) {
+        if (log.logged[site] && now - log.lastMs[site] < logSiteIntervalMs[site]) {
+            if (log.suppressed[site] < 255) {
+                log.suppressed[site]++;
+            }
+            return false;
+        }
+        record.suppressed = log.suppressed[site];
+        log.lastMs[site] = now;
+        log.logged[site] = 1;
+        log.suppressed[site] = 0;
+    }
+    fillLogArgs(record.args, args...);
+    return log.queue.push(record);
+}
+
+/////////////////////////////////////////////////////////////////
+// Queues `length` bytes for a %h site, in parts of up to
+// LOG_BYTES_MAX. True if every part was queued; the decoder
+// drops a line that misses one. No rate limit applies.
+/////////////////////////////////////////////////////////////////
+inline bool logBytes(BinaryLog &log, uint8_t site, uint32_t now, const uint8_t *bytes, size_t length) {
+    if (!logSiteEnabled(site)) {
+        return false;
+    }
+    LogRecord record;
+    record.ms = now;
+    record.site = site;
+    record.suppressed = 0;
+    do {
+        uint8_t count = length > LOG_BYTES_MAX ? LOG_BYTES_MAX : (uint8_t)length;
+        length -= count;
+        record.argc = LOG_BYTES | (length ? LOG_BYTES_MORE : 0) | count;
+        memcpy(record.bytes, bytes, count);
+        bytes += count;
+        if (!log.queue.push(record)) {
+            return false;
+        }
+        record.suppressed++;
+    } while (length);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// One record as a frame; returns its length (LOG_FRAME_MAX at
+// most)
+/////////////////////////////////////////////////////////////////
+inline uint8_t encodeLogRecord(const LogRecord &record, uint8_t *out) {
+    uint8_t length = 0;
+    out[length++] = LOG_FRAME_SYNC;
+    out[length++] = record.site;
+    out[length++] = record.suppressed;
+    out[length++] = record.argc;
+    for (uint8_t i = 0; i < 4; i++) {
+        out[length++] = (uint8_t)(record.ms >> (8 * i));
+    }
+    if (record.argc & LOG_BYTES) {
+        uint8_t count = record.argc & LOG_BYTES_COUNT;
+        memcpy(out + length, record.bytes, count);
+        length += count;
+    } else {
+        for (uint8_t a = 0; a < record.argc; a++) {
+            uint32_t value = ((uint32_t)record.args[a] << 1) ^ (uint32_t)(record.args[a] >> 31);   // zigzag
+            do {
+                uint8_t byte = value & 0x7F;
+                value >>= 7;
+                out[length++] = byte | (value ? 0x80 : 0);
+            } while (value);
+        }
+    }
+    uint8_t check = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        check ^= out[i];
+    }
+    out[length++] = check;
+    return length;
+}
+
+/////////////////////////////////////////////////////////////////
+// Reverses encodeLogRecord(); the host decoder does the same in
+// Python. Returns the frame's length, 0 if it isn't one.
+/////////////////////////////////////////////////////////////////
+inline size_t decodeLogRecord(const uint8_t *bytes, size_t length, LogRecord &record) {
+    if (length < LOG_FRAME_HEADER + 1 || bytes[0] != LOG_FRAME_SYNC) {
+        return 0;
+    }
+    bool raw = (bytes[3] & LOG_BYTES) != 0;
+    if (raw ? (bytes[3] & LOG_BYTES_COUNT) > LOG_BYTES_MAX : bytes[3] > LOG_MAX_ARGS) {
+        return 0;
+    }
+    record.site = bytes[1];
+    record.suppressed = bytes[2];
+    record.argc = bytes[3];
+    record.ms = bytes[4] | bytes[5] << 8 | bytes[6] << 16 | (uint32_t)bytes[7] << 24;
+    size_t at = LOG_FRAME_HEADER;
+    if (raw) {
+        uint8_t count = record.argc & LOG_BYTES_COUNT;
+        if (at + count > length) {
+            return 0;
+        }
+        memcpy(record.bytes, bytes + at, count);
+        at += count;
+    }
+    for (uint8_t a = 0; !raw && a < record.argc; a++) {
+        uint32_t value = 0;
+        for (uint8_t shift = 0;; shift += 7) {
+            if (at >= length || shift > 28) {
+                return 0;
+            }
+            uint8_t byte = bytes[at++];
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        record.args[a] = (int32_t)((value >> 1) ^ (0 - (value & 1)));
+    }
+    if (at >= length) {
+        return 0;
+    }
+    uint8_t check = 0;
+    for (size_t i = 0; i < at; i++) {
+        check ^= bytes[i];
+    }
+    return check == bytes[at] ? at + 1 : 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Drain side: encodes queued records into `out` while a whole
+// frame still fits, a LOG_DROPPED record first if the queue
+// dropped any since the last time. Returns the bytes written.
+/////////////////////////////////////////////////////////////////
+inline size_t drainBinaryLog(BinaryLog &log, uint32_t now, uint8_t *out, size_t capacity) {
+    size_t length = 0;
+    uint32_t drops = log.queue.drops();
+    if (drops != log.dropsReported && capacity >= LOG_FRAME_MAX) {
+        LogRecord record;
+        record.ms = now;
+        record.site = LOG_DROPPED;
+        record.suppressed = 0;
+        record.argc = 1;
+        record.args[0] = (int32_t)(drops - log.dropsReported);
+        log.dropsReported = drops;
+        length += encodeLogRecord(record, out);
+    }
+    LogRecord record;
+    while (capacity - length >= LOG_FRAME_MAX && log.queue.pop(record)) {
+        length += encodeLogRecord(record, out + length);
+    }
+    return length;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef CHARACTER_COLLISION_H
+#define CHARACTER_COLLISION_H
+/////////////////////////////////////////////////////////////////////////////
+// Collision tests for the game characters, on top of collision.h and the
+// masks generated into game_sprite_atlas.h.
+//
+// Positions are the character centres in world pixels, as used by the
+// game; the character cell is centred on them like when drawing.
+//
+// Catches compare the whole idle frame of both characters. Each device
+// only knows where the opponent is, not which animation frame it shows,
+// so both sides use the same frames and therefore always agree on whether
+// the princess was caught.
+//
+// Walls only block a character's footprint (its feet), see
+// tools/build_sprite_atlas.py.
+/////////////////////////////////////////////////////////////////////////////
+#include "collision.h"
+#include "game_sprite_atlas.h"
+
+static CollisionGrid characterGrid;
+
+// Mask of a character's first idle frame (character in PlayerType order)
+inline const CollisionMask &characterCatchMask(int character) {
+    return atlasMasks[characterFacings[character][FACE_RIGHT].clips[ANIM_IDLE].firstFrame][0];
+}
+
+// True if the character's feet would touch a wall at (x, y)
+inline bool characterBlocked(const TileMap &map, int character, int x, int y) {
+    return maskHitsSolidTiles(map, characterFootprints[character],
+                              x - ATLAS_CELL_SIZE / 2, y - ATLAS_CELL_SIZE / 2);
+}
+
+/////////////////////////////////////////////////////////////////
+// True if the sprites of two characters overlap. Goes through
+// the broad phase grid like any number of entities would.
+/////////////////////////////////////////////////////////////////
+inline bool charactersOverlap(int a, int ax, int ay, int b, int bx, int by) {
+    clearCollisionGrid(characterGrid);
+    addCollisionEntity(characterGrid, characterCatchMask(a), ax - ATLAS_CELL_SIZE / 2, ay - ATLAS_CELL_SIZE / 2);
+    addCollisionEntity(characterGrid, characterCatchMask(b), bx - ATLAS_CELL_SIZE / 2, by - ATLAS_CELL_SIZE / 2);
+    return findCollisionPairs(characterGrid, NULL) > 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Distance between two character centres in whole pixels,
+// rounded down. Integer only (a bitwise square root), so it is
+// the same on every device and cheap on the loop.
+/////////////////////////////////////////////////////////////////
+inline uint32_t characterDistance(int ax, int ay, int bx, int by) {
+    uint32_t dx = ax > bx ? ax - bx : bx - ax;
+    uint32_t dy = ay > by ? ay - by : by - ay;
+    uint32_t square = dx * dx + dy * dy;
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > square) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (square >= root + bit) {
+            square -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+#endif
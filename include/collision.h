@@ -0,0 +1,231 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+/////////////////////////////////////////////////////////////////////////////
+// Pixel accurate collision between sprites, and between sprites and the
+// solid tiles of the arena.
+//
+// Every sprite frame has a 1-bit mask generated at build time next to the
+// atlas (tools/build_sprite_atlas.py), one bit per opaque pixel, packed
+// into 32-bit words per row. The narrow phase lines two masks up and ANDs
+// them 32 pixels at a time, so a test costs (overlap height) x (overlap
+// width / 32) word operations at most and stops at the first hit.
+//
+// The broad phase is a uniform grid: each tick every entity is put into
+// the cells its bounding box touches, and only entities sharing a cell
+// (and whose boxes actually intersect) reach the narrow phase. Walls need
+// no grid of their own, since the tile map already is one: a mask is only
+// tested against the solid tiles under its bounding box.
+//
+// Masks are positioned like atlas frames: by the top left corner of the
+// character cell, plus the mask's own offset inside the cell. Nothing in
+// here touches the display, so it compiles on the host as well.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+#include "tile_map.h"
+
+struct CollisionMask {
+    int8_t offsetX;         // top left of the mask inside the character cell
+    int8_t offsetY;
+    uint8_t w;              // in pixels
+    uint8_t h;
+    uint8_t wordsPerRow;
+    const uint32_t *words;  // row by row; bit 31 of a row's first word is its leftmost pixel
+};
+
+const int COLLISION_CELL_SIZE = 128;   // broad phase cell, larger than any sprite
+const int COLLISION_GRID_COLS = 8;     // covers 1024x1024 world pixels
+const int COLLISION_GRID_ROWS = 8;
+const int COLLISION_MAX_ENTITIES = 16;
+
+struct CollisionEntity {
+    int16_t x;                   // top left of the mask in world pixels
+    int16_t y;
+    const CollisionMask *mask;
+};
+
+struct CollisionGrid {
+    uint8_t entityCount;
+    CollisionEntity entities[COLLISION_MAX_ENTITIES];
+    uint8_t cellCount[COLLISION_GRID_ROWS][COLLISION_GRID_COLS];
+    uint8_t cellEntities[COLLISION_GRID_ROWS][COLLISION_GRID_COLS][COLLISION_MAX_ENTITIES];
+};
+
+// Called for every pair of entities whose masks overlap
+typedef void (*CollisionPairFn)(uint8_t a, uint8_t b);
+
+/////////////////////////////////////////////////////////////////
+// 32 bits of one mask row starting at column `col`. Columns
+// outside the mask read as clear, so `col` may be negative or
+// past the right edge.
+/////////////////////////////////////////////////////////////////
+inline uint32_t maskRowBits(const CollisionMask &mask, int row, int col) {
+    if (col <= -32 || col >= mask.w) {
+        return 0;
+    }
+    const uint32_t *words = mask.words + row * mask.wordsPerRow;
+    if (col < 0) {
+        return words[0] >> -col;
+    }
+    int word = col >> 5;
+    int shift = col & 31;
+    uint32_t bits = words[word] << shift;
+    if (shift != 0 && word + 1 < mask.wordsPerRow) {
+        bits |= words[word + 1] >> (32 - shift);
+    }
+    return bits;
+}
+
+/////////////////////////////////////////////////////////////////
+// Narrow phase: true if any opaque pixel of mask a, with its
+// cell at (ax, ay), lies on an opaque pixel of mask b with its
+// cell at (bx, by)
+/////////////////////////////////////////////////////////////////
+inline bool masksOverlap(const CollisionMask &a, int ax, int ay, const CollisionMask &b, int bx, int by) {
+    ax += a.offsetX;
+    ay += a.offsetY;
+    bx += b.offsetX;
+    by += b.offsetY;
+    int x0 = ax > bx ? ax : bx;
+    int y0 = ay > by ? ay : by;
+    int x1 = (ax + a.w < bx + b.w) ? ax + a.w : bx + b.w;
+    int y1 = (ay + a.h < by + b.h) ? ay + a.h : by + b.h;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x += 32) {
+            // Bits past either mask's width read as clear, so no end mask is needed
+            if (maskRowBits(a, y - ay, x - ax) & maskRowBits(b, y - by, x - bx)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Floor division, so pixels left of / above the map land in negative tiles
+inline int collisionFloorDiv(int value, int size) {
+    return (value >= 0) ? value / size : -((-value + size - 1) / size);
+}
+
+/////////////////////////////////////////////////////////////////
+// True if the mask, with its cell at (x, y), covers any pixel of
+// a solid tile or of the outside of the map. Only the tiles under
+// the mask's bounding box are looked at.
+/////////////////////////////////////////////////////////////////
+inline bool maskHitsSolidTiles(const TileMap &map, const CollisionMask &mask, int x, int y) {
+    x += mask.offsetX;
+    y += mask.offsetY;
+    int ts = map.tileSize;
+    int firstCol = collisionFloorDiv(x, ts), lastCol = collisionFloorDiv(x + mask.w - 1, ts);
+    int firstRow = collisionFloorDiv(y, ts), lastRow = collisionFloorDiv(y + mask.h - 1, ts);
+    // Leftmost `ts` bits of a word (tiles are at most 32 pixels wide)
+    uint32_t tileBits = (ts >= 32) ? 0xFFFFFFFFUL : ~(0xFFFFFFFFUL >> ts);
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        int y0 = row * ts > y ? row * ts : y;
+        int y1 = (row + 1) * ts < y + mask.h ? (row + 1) * ts : y + mask.h;
+        for (int col = firstCol; col <= lastCol; col++) {
+            if (!((map.solidMask >> tileAt(map, col, row)) & 1)) {
+                continue;
+            }
+            for (int py = y0; py < y1; py++) {
+                if (maskRowBits(mask, py - y, col * ts - x) & tileBits) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////
+// Broad phase
+/////////////////////////////////////////////////////////////////
+inline void clearCollisionGrid(CollisionGrid &grid) {
+    grid.entityCount = 0;
+    memset(grid.cellCount, 0, sizeof(grid.cellCount));
+}
+
+// Grid cell range covered by a pixel box, clamped to the grid
+inline void collisionCellRange(int x, int y, int w, int h, int &firstCol, int &firstRow, int &lastCol, int &lastRow) {
+    firstCol = collisionFloorDiv(x, COLLISION_CELL_SIZE);
+    firstRow = collisionFloorDiv(y, COLLISION_CELL_SIZE);
+    lastCol = collisionFloorDiv(x + w - 1, COLLISION_CELL_SIZE);
+    lastRow = collisionFloorDiv(y + h - 1, COLLISION_CELL_SIZE);
+    firstCol = firstCol < 0 ? 0 : (firstCol >= COLLISION_GRID_COLS ? COLLISION_GRID_COLS - 1 : firstCol);
+    firstRow = firstRow < 0 ? 0 : (firstRow >= COLLISION_GRID_ROWS ? COLLISION_GRID_ROWS - 1 : firstRow);
+    lastCol = lastCol < 0 ? 0 : (lastCol >= COLLISION_GRID_COLS ? COLLISION_GRID_COLS - 1 : lastCol);
+    lastRow = lastRow < 0 ? 0 : (lastRow >= COLLISION_GRID_ROWS ? COLLISION_GRID_ROWS - 1 : lastRow);
+}
+
+/////////////////////////////////////////////////////////////////
+// Adds an entity with its cell at (x, y). Returns its index, or
+// -1 if the grid is full.
+/////////////////////////////////////////////////////////////////
+inline int addCollisionEntity(CollisionGrid &grid, const CollisionMask &mask, int x, int y) {
+    if (grid.entityCount >= COLLISION_MAX_ENTITIES) {
+        return -1;
+    }
+    uint8_t index = grid.entityCount++;
+    CollisionEntity &entity = grid.entities[index];
+    entity.x = x + mask.offsetX;
+    entity.y = y + mask.offsetY;
+    entity.mask = &mask;
+
+    int firstCol, firstRow, lastCol, lastRow;
+    collisionCellRange(entity.x, entity.y, mask.w, mask.h, firstCol, firstRow, lastCol, lastRow);
+    for (int r = firstRow; r <= lastRow; r++) {
+        for (int c = firstCol; c <= lastCol; c++) {
+            grid.cellEntities[r][c][grid.cellCount[r][c]++] = index;
+        }
+    }
+    return index;
+}
+
+/////////////////////////////////////////////////////////////////
+// Runs the narrow phase on every pair of entities that share a
+// grid cell and whose bounding boxes intersect, and hands the
+// overlapping pairs to `hit` (may be NULL). Every pair is tested
+// at most once. Returns the number of overlapping pairs.
+/////////////////////////////////////////////////////////////////
+inline int findCollisionPairs(const CollisionGrid &grid, CollisionPairFn hit) {
+    uint16_t tested[COLLISION_MAX_ENTITIES] = { 0 };  // bit b of tested[a]: pair (a, b) seen, a < b
+    int pairs = 0;
+    for (int r = 0; r < COLLISION_GRID_ROWS; r++) {
+        for (int c = 0; c < COLLISION_GRID_COLS; c++) {
+            uint8_t count = grid.cellCount[r][c];
+            for (int i = 0; i + 1 < count; i++) {
+                for (int j = i + 1; j < count; j++) {
+                    uint8_t a = grid.cellEntities[r][c][i];
+                    uint8_t b = grid.cellEntities[r][c][j];
+                    if (a > b) {
+                        uint8_t t = a;
+                        a = b;
+                        b = t;
+                    }
+                    if (tested[a] & (1U << b)) {
+                        continue;
+                    }
+                    tested[a] |= 1U << b;
+
+                    const CollisionEntity &ea = grid.entities[a];
+                    const CollisionEntity &eb = grid.entities[b];
+                    if (ea.x >= eb.x + eb.mask->w || eb.x >= ea.x + ea.mask->w ||
+                        ea.y >= eb.y + eb.mask->h || eb.y >= ea.y + ea.mask->h) {
+                        continue;
+                    }
+                    // Entities store the mask's own corner, so pass it back as a cell position
+                    if (masksOverlap(*ea.mask, ea.x - ea.mask->offsetX, ea.y - ea.mask->offsetY,
+                                     *eb.mask, eb.x - eb.mask->offsetX, eb.y - eb.mask->offsetY)) {
+                        pairs++;
+                        if (hit) {
+                            hit(a, b);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return pairs;
+}
+
+#endif
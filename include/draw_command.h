@@ -0,0 +1,93 @@
+#ifndef DRAW_COMMAND_H
+#define DRAW_COMMAND_H
+/////////////////////////////////////////////////////////////////////////////
+// What loop() hands the render task (render_task.h), and how the render
+// task takes it off the queue.
+//
+// A frame with a newer frame already queued behind it is skipped. A
+// repaint it asked for (forceRedraw: the link overlay switched off, a
+// powerup ended) is not skipped with it: loop() has cleared redrawGame by
+// then, so the flag carries over to the next frame that is drawn.
+//
+// Nothing here touches the hardware, see tools/test_render_queue.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include "render_queue.h"
+
+// Everything the renderer needs to draw one game frame
+struct FrameSnapshot {
+    int16_t x;              // local character position (cell centre)
+    int16_t y;
+    uint8_t atlasFrame;     // animation state of the local character
+    uint8_t palette;
+    uint8_t mirrored;
+    uint8_t reveal;         // powerup: show where the opponent is
+    int16_t revealX;
+    int16_t revealY;
+    uint16_t revealColor;
+    uint8_t revealFrame;    // opponent sprite drawn inside the reveal
+    uint8_t revealPalette;
+    uint32_t remainingMs;   // HUD values
+    uint8_t timerStyle;     // HudStyle of the timer
+    int32_t distance;
+    uint8_t distanceStyle;
+    uint8_t powerupsLeft;
+    uint8_t acceleration;
+    uint8_t linkOverlay;    // debug overlay (link_telemetry.h) shown
+    uint16_t rttMedian;
+    uint16_t rttTail;
+    uint8_t dropPercent;
+    uint8_t forceRedraw;    // repaint even if nothing above changed
+};
+
+enum DrawCommandType { DRAW_FRAME, DRAW_SCREEN };
+
+struct DrawCommand {
+    uint8_t type;
+    void (*screen)();       // DRAW_SCREEN: function that draws a whole screen
+    FrameSnapshot frame;    // DRAW_FRAME
+};
+
+// The render task's state between commands
+struct FrameCoalescer {
+    bool screenReplaced;    // a screen function drew last, the next frame repaints all
+    bool pendingForce;      // a skipped frame asked for a repaint
+    uint32_t coalesced;     // frames skipped for a newer one
+};
+
+// setup() draws the last screen before the render task starts
+inline void resetFrameCoalescer(FrameCoalescer &coalescer) {
+    coalescer.screenReplaced = true;
+    coalescer.pendingForce = false;
+    coalescer.coalesced = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Pops the next command to carry out, skipping frames a newer
+// frame replaces. For a frame, fullRedraw says whether it has
+// to repaint everything. False once the queue is empty.
+/////////////////////////////////////////////////////////////////
+template <uint32_t Capacity>
+inline bool nextDrawCommand(RenderQueue<DrawCommand, Capacity> &queue, FrameCoalescer &coalescer,
+                            DrawCommand &command, bool &fullRedraw) {
+    while (queue.pop(command)) {
+        const DrawCommand *next = queue.peek();
+        if (command.type == DRAW_FRAME && next != NULL && next->type == DRAW_FRAME) {
+            coalescer.pendingForce = coalescer.pendingForce || command.frame.forceRedraw;
+            coalescer.coalesced++;
+            continue;
+        }
+        if (command.type == DRAW_SCREEN) {
+            coalescer.screenReplaced = true;
+            fullRedraw = false;
+        } else {
+            fullRedraw = coalescer.screenReplaced || coalescer.pendingForce || command.frame.forceRedraw;
+            coalescer.screenReplaced = false;
+            coalescer.pendingForce = false;
+        }
+        return true;
+    }
+    return false;
+}
+
+#endif
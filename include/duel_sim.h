@@ -0,0 +1,227 @@
+#ifndef DUEL_SIM_H
+#define DUEL_SIM_H
+/////////////////////////////////////////////////////////////////////////////
+// Both characters on one fixed-point simulation.
+//
+// In the default mode each device moves its own character and streams the
+// position (state_snapshot.h). The input modes (rollback.h, lockstep.h)
+// instead exchange the stick and speed level of every tick and run both
+// characters here, on both devices, from the same spawn points. The
+// movement (kinematics.h) and the catch test (character_collision.h) are
+// integer only, so the same inputs give the same bits on both ESP32s and
+// on the host.
+//
+// Body 0 is always the server's character and body 1 the client's. A
+// state is what the world looks like after `tick` ticks; the inputs of
+// tick t take it from t to t + 1.
+//
+// The mode is picked at build time and has to be the same on both
+// devices, e.g. build_flags = -D NET_MODE=2 in platformio.ini for lockstep.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+#include "kinematics.h"
+#include "character_collision.h"
+#include "render_queue.h"
+
+enum NetMode { NET_SNAPSHOTS, NET_ROLLBACK, NET_LOCKSTEP };
+
+#ifndef NET_MODE
+#define NET_MODE NET_SNAPSHOTS
+#endif
+const uint8_t netMode = NET_MODE;
+
+const uint8_t DUEL_INPUT_SIZE = 3;   // stick x, stick y, speed level
+
+// What one player did on one tick
+struct DuelInput {
+    int8_t x;
+    int8_t y;
+    uint8_t level;
+};
+
+struct DuelState {
+    uint32_t tick;
+    KinematicBody body[2];
+    uint8_t caught;          // the sprites overlapped on caughtTick
+    uint32_t caughtTick;
+};
+
+static const TileMap *duelMap = NULL;
+static uint8_t duelCharacters[2];
+
+inline bool duelBlocked0(int x, int y) {
+    return characterBlocked(*duelMap, duelCharacters[0], x, y);
+}
+
+inline bool duelBlocked1(int x, int y) {
+    return characterBlocked(*duelMap, duelCharacters[1], x, y);
+}
+
+/////////////////////////////////////////////////////////////////
+// A new game: both characters standing on their spawn points.
+// Characters in PlayerType order (0 princess, 1 dragon).
+/////////////////////////////////////////////////////////////////
+inline void resetDuel(DuelState &state, const TileMap &map, uint8_t serverCharacter, uint8_t clientCharacter) {
+    duelMap = &map;
+    duelCharacters[0] = serverCharacter;
+    duelCharacters[1] = clientCharacter;
+    memset(&state, 0, sizeof(state));
+    placeBody(state.body[0], map.spawnX[0], map.spawnY[0]);
+    placeBody(state.body[1], map.spawnX[1], map.spawnY[1]);
+}
+
+inline bool sameDuelInput(const DuelInput &a, const DuelInput &b) {
+    return a.x == b.x && a.y == b.y && a.level == b.level;
+}
+
+// One tick of both characters, then the catch test
+inline void stepDuel(DuelState &state, const DuelInput &server, const DuelInput &client) {
+    stepBody(state.body[0], server.x, server.y, server.level, duelBlocked0);
+    stepBody(state.body[1], client.x, client.y, client.level, duelBlocked1);
+    state.tick++;
+    if (!state.caught &&
+        charactersOverlap(duelCharacters[0], kinToPixels(state.body[0].x), kinToPixels(state.body[0].y),
+                          duelCharacters[1], kinToPixels(state.body[1].x), kinToPixels(state.body[1].y))) {
+        state.caught = 1;
+        state.caughtTick = state.tick;
+    }
+}
+
+inline void encodeDuelInput(uint8_t *out, const DuelInput &input) {
+    out[0] = (uint8_t)input.x;
+    out[1] = (uint8_t)input.y;
+    out[2] = input.level;
+}
+
+inline DuelInput decodeDuelInput(const uint8_t *in) {
+    DuelInput input;
+    input.x = (int8_t)in[0];
+    input.y = (int8_t)in[1];
+    input.level = in[2];
+    return input;
+}
+
+// Full tick of a 16 bit one on the wire: the one closest to `near`
+inline uint32_t widenDuelTick(uint16_t low, uint32_t near) {
+    return near + (int16_t)(uint16_t)(low - (uint16_t)near);
+}
+
+// FNV-1a over everything the simulation carries from tick to tick
+inline uint32_t duelStateHash(const DuelState &state) {
+    int32_t words[11] = {(int32_t)state.tick, state.body[0].x, state.body[0].y, state.body[0].vx, state.body[0].vy,
+                         state.body[1].x, state.body[1].y, state.body[1].vx, state.body[1].vy,
+                         state.caught, (int32_t)state.caughtTick};
+    uint32_t hash = 2166136261UL;
+    for (uint8_t i = 0; i < 11; i++) {
+        for (uint8_t b = 0; b < 32; b += 8) {
+            hash = (hash ^ (((uint32_t)words[i] >> b) & 0xFF)) * 16777619UL;
+        }
+    }
+    return hash;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Input packets, the same in both input modes. Each carries a run of the
+// sender's inputs the receiver hasn't acknowledged, the sender's own ack
+// (it has the receiver's inputs for every tick before it) and, now and
+// then, the hash of the sender's state after some tick. Ticks go as their
+// low 16 bits:
+//
+//     [version << 4 | hash << 3 | count][first tick][ack]
+//     ([hash tick][hash])  then count x (x, y, level)
+//
+// At most DUEL_PACKET_SIZE bytes, so it fits a notification at the
+// default MTU.
+/////////////////////////////////////////////////////////////////////////////
+const uint8_t DUEL_PACKET_VERSION = 1;
+const uint8_t DUEL_PACKET_HEADER = 5;
+const uint8_t DUEL_PACKET_HASH = 6;
+const uint8_t DUEL_PACKET_INPUTS = 4;             // 3 with a hash
+const uint8_t DUEL_PACKET_SIZE = 20;
+const uint32_t DUEL_INPUT_RING = 64;              // inputs kept per player, by tick % DUEL_INPUT_RING
+
+struct DuelPacket {
+    uint8_t length;
+    uint8_t bytes[DUEL_PACKET_SIZE];
+};
+
+struct DuelHash {
+    uint32_t tick;
+    uint32_t value;
+};
+
+struct DuelPacketView {
+    uint32_t first;
+    uint32_t ack;
+    uint8_t count;
+    bool hasHash;
+    DuelHash hash;
+    const uint8_t *inputs;      // count x DUEL_INPUT_SIZE bytes
+};
+
+typedef void (*DuelSendFn)(const uint8_t *bytes, size_t length);
+
+/////////////////////////////////////////////////////////////////
+// Writes `count` inputs of `ring` from tick `first` on, and the
+// hash if there is one. Returns the length.
+/////////////////////////////////////////////////////////////////
+inline uint8_t encodeDuelPacket(uint8_t *out, const DuelInput *ring, uint32_t first, uint8_t count,
+                                uint32_t ack, const DuelHash *hash) {
+    out[0] = DUEL_PACKET_VERSION << 4 | (hash ? 0x08 : 0) | count;
+    out[1] = first & 0xFF;
+    out[2] = (first >> 8) & 0xFF;
+    out[3] = ack & 0xFF;
+    out[4] = (ack >> 8) & 0xFF;
+    uint8_t pos = DUEL_PACKET_HEADER;
+    if (hash) {
+        out[pos++] = hash->tick & 0xFF;
+        out[pos++] = (hash->tick >> 8) & 0xFF;
+        for (uint8_t b = 0; b < 32; b += 8) {
+            out[pos++] = (hash->value >> b) & 0xFF;
+        }
+    }
+    for (uint8_t i = 0; i < count; i++, pos += DUEL_INPUT_SIZE) {
+        encodeDuelInput(out + pos, ring[(first + i) % DUEL_INPUT_RING]);
+    }
+    return pos;
+}
+
+/////////////////////////////////////////////////////////////////
+// Reads a packet; the ticks in it are widened around `nearTick`
+// and the ack around `nearAck`. False if it doesn't add up.
+/////////////////////////////////////////////////////////////////
+inline bool decodeDuelPacket(const DuelPacket &packet, uint32_t nearTick, uint32_t nearAck, DuelPacketView &view) {
+    const uint8_t *in = packet.bytes;
+    if (packet.length < DUEL_PACKET_HEADER || (in[0] >> 4) != DUEL_PACKET_VERSION) {
+        return false;
+    }
+    view.count = in[0] & 0x07;
+    view.hasHash = (in[0] & 0x08) != 0;
+    uint8_t pos = DUEL_PACKET_HEADER + (view.hasHash ? DUEL_PACKET_HASH : 0);
+    if (packet.length != pos + view.count * DUEL_INPUT_SIZE) {
+        return false;
+    }
+    view.first = widenDuelTick(in[1] | (in[2] << 8), nearTick);
+    view.ack = widenDuelTick(in[3] | (in[4] << 8), nearAck);
+    if (view.hasHash) {
+        view.hash.tick = widenDuelTick(in[5] | (in[6] << 8), nearTick);
+        view.hash.value = (uint32_t)in[7] | (uint32_t)in[8] << 8 | (uint32_t)in[9] << 16 | (uint32_t)in[10] << 24;
+    }
+    view.inputs = in + pos;
+    return true;
+}
+
+// Called from the BLE callback with a packet as it arrived
+template <uint32_t Capacity>
+inline bool queueDuelPacket(RenderQueue<DuelPacket, Capacity> &inbox, const uint8_t *bytes, size_t length) {
+    if (length > DUEL_PACKET_SIZE) {
+        return false;
+    }
+    DuelPacket packet;
+    packet.length = (uint8_t)length;
+    memcpy(packet.bytes, bytes, length);
+    return inbox.push(packet);   // lost inputs come again until acked
+}
+
+#endif
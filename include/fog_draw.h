@@ -0,0 +1,175 @@
+#ifndef FOG_DRAW_H
+#define FOG_DRAW_H
+/////////////////////////////////////////////////////////////////////////////
+// M5Core2 side of the fog of war (fog_of_war.h): turns a FrameSnapshot
+// into vision sources and dirty sprite rectangles, then composites the
+// dirty tile runs over the arena map. Runs on the render task.
+//
+// The local player always sees a circle around themselves. While a powerup
+// is active a second circle opens around the opponent and their sprite is
+// drawn inside it; outside a powerup the opponent stays hidden, as before.
+// Map tiles under the fog are drawn with the darkened tile palette.
+//
+// Positions in the snapshot are world pixels. The camera (tile_map.h)
+// scrolls in whole tiles, and each screen tile slot remembers which tile
+// type it shows, so a scroll only redraws the slots whose tile changed.
+/////////////////////////////////////////////////////////////////////////////
+#include <M5Core2.h>
+#include "fog_of_war.h"
+#include "game_sprite_atlas.h"
+#include "sprite_draw.h"
+#include "tile_map_draw.h"
+#include "hud_draw.h"
+#include "render_task.h"
+
+static_assert(FOG_TILE_SIZE == TILESET_TILE_SIZE, "fog tiles must line up with map tiles");
+
+const int FOG_VISION_RADIUS = 64;       // around the local player
+const int FOG_REVEAL_RADIUS = 48;       // around the revealed opponent
+const int FOG_MARKER_SIZE = 3;          // centre marker of the revealed opponent
+const uint8_t FOG_SLOT_UNKNOWN = 0xFF;  // slot content is not known
+
+static FogMask fogMask;
+static FrameSnapshot fogShown;                  // frame the panel shows
+static TileCamera fogShownCamera;               // camera it was drawn with
+static TileCamera fogCamera;                    // camera of the frame being composited
+static const FrameSnapshot *fogDrawing = NULL;  // frame being composited
+static uint8_t fogSlotTiles[FOG_ROWS][FOG_COLS];
+
+// Screen rectangle of the local character's current atlas frame
+inline void fogCharacterRect(const FrameSnapshot &frame, const TileCamera &camera, int &x, int &y, int &w, int &h) {
+    const AtlasFrame &atlasFrame = atlasFrames[frame.atlasFrame];
+    atlasFramePosition(atlasFrame, frame.x - camera.x - ATLAS_CELL_SIZE / 2, frame.y - camera.y - ATLAS_CELL_SIZE / 2,
+                       ATLAS_CELL_SIZE, frame.mirrored, x, y);
+    w = atlasFrame.w;
+    h = atlasFrame.h;
+}
+
+// Screen rectangle of the revealed opponent (sprite and marker)
+inline void fogRevealRect(const FrameSnapshot &frame, const TileCamera &camera, int &x, int &y, int &w, int &h) {
+    if (!frame.reveal) {
+        x = y = w = h = 0;
+        return;
+    }
+    int revealX = frame.revealX - camera.x;
+    int revealY = frame.revealY - camera.y;
+    const AtlasFrame &atlasFrame = atlasFrames[frame.revealFrame];
+    atlasFramePosition(atlasFrame, revealX - ATLAS_CELL_SIZE / 2, revealY - ATLAS_CELL_SIZE / 2,
+                       ATLAS_CELL_SIZE, false, x, y);
+    w = atlasFrame.w;
+    h = atlasFrame.h;
+    int mx = revealX - FOG_MARKER_SIZE / 2;
+    int my = revealY - FOG_MARKER_SIZE / 2;
+    int x1 = max(x + w, mx + FOG_MARKER_SIZE);
+    int y1 = max(y + h, my + FOG_MARKER_SIZE);
+    x = min(x, mx);
+    y = min(y, my);
+    w = x1 - x;
+    h = y1 - y;
+}
+
+/////////////////////////////////////////////////////////////////
+// Composites one run of dirty tiles: the map tiles (darkened
+// under the fog), then whatever part of the sprites falls inside
+// the run
+/////////////////////////////////////////////////////////////////
+inline void compositeFogRun(int x, int y, int w, int h, bool visible) {
+    int col = (fogCamera.x + x) / FOG_TILE_SIZE;
+    int row = (fogCamera.y + y) / FOG_TILE_SIZE;
+    int count = w / FOG_TILE_SIZE;
+    drawTileRun(arenaMap, col, row, count, x, y, !visible);
+    for (int i = 0; i < count; i++) {
+        fogSlotTiles[y / FOG_TILE_SIZE][x / FOG_TILE_SIZE + i] = tileAt(arenaMap, col + i, row);
+    }
+    invalidateHudRect(x, y, w, h);
+
+    const FrameSnapshot &frame = *fogDrawing;
+    if (visible && frame.reveal) {
+        int revealX = frame.revealX - fogCamera.x;
+        int revealY = frame.revealY - fogCamera.y;
+        drawAtlasFrameClipped(atlasSprite, atlasFrames[frame.revealFrame], atlasPalettes[frame.revealPalette],
+                              revealX - ATLAS_CELL_SIZE / 2, revealY - ATLAS_CELL_SIZE / 2,
+                              ATLAS_CELL_SIZE, false, x, y, w, h);
+        int mx0 = max(x, revealX - FOG_MARKER_SIZE / 2);
+        int my0 = max(y, revealY - FOG_MARKER_SIZE / 2);
+        int mx1 = min(x + w, revealX - FOG_MARKER_SIZE / 2 + FOG_MARKER_SIZE);
+        int my1 = min(y + h, revealY - FOG_MARKER_SIZE / 2 + FOG_MARKER_SIZE);
+        if (mx0 < mx1 && my0 < my1) {
+            M5.Lcd.fillRect(mx0, my0, mx1 - mx0, my1 - my0, frame.revealColor);
+        }
+    }
+
+    // The local character is never fogged and is drawn last so it stays on top
+    drawAtlasFrameClipped(atlasSprite, atlasFrames[frame.atlasFrame], atlasPalettes[frame.palette],
+                          frame.x - fogCamera.x - ATLAS_CELL_SIZE / 2, frame.y - fogCamera.y - ATLAS_CELL_SIZE / 2,
+                          ATLAS_CELL_SIZE, frame.mirrored, x, y, w, h);
+}
+
+// Marks the old and the new rectangle dirty if they differ
+inline void markFogMovedRect(int ox, int oy, int ow, int oh, int x, int y, int w, int h, bool contentChanged) {
+    if (!contentChanged && ox == x && oy == y && ow == w && oh == h) {
+        return;
+    }
+    markFogRectDirty(fogMask, ox, oy, ow, oh);
+    markFogRectDirty(fogMask, x, y, w, h);
+}
+
+/////////////////////////////////////////////////////////////////
+// After a scroll, marks the screen slots whose tile type differs
+// from the one already on the panel. Slots showing the same tile
+// type are kept as they are.
+/////////////////////////////////////////////////////////////////
+inline void markScrolledTiles() {
+    int firstCol = fogCamera.x / FOG_TILE_SIZE;
+    int firstRow = fogCamera.y / FOG_TILE_SIZE;
+    for (int r = 0; r < FOG_ROWS; r++) {
+        for (int c = 0; c < FOG_COLS; c++) {
+            if (fogSlotTiles[r][c] != tileAt(arenaMap, firstCol + c, firstRow + r)) {
+                markFogTileDirty(fogMask, c, r);
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Draws the playfield for a frame, touching only the tiles whose
+// visibility or map tile changed, or that a sprite moved over.
+// fullRedraw repaints every tile (first frame after another
+// screen).
+/////////////////////////////////////////////////////////////////
+inline void renderFoggedFrame(const FrameSnapshot &frame, bool fullRedraw) {
+    followTileCamera(fogCamera, arenaMap, frame.x, frame.y, FOG_COLS * FOG_TILE_SIZE, FOG_ROWS * FOG_TILE_SIZE);
+
+    if (fullRedraw) {
+        invalidateFogMask(fogMask);
+        memset(fogSlotTiles, FOG_SLOT_UNKNOWN, sizeof(fogSlotTiles));
+    } else {
+        if (fogCamera.x != fogShownCamera.x || fogCamera.y != fogShownCamera.y) {
+            markScrolledTiles();
+        }
+
+        // Old and new sprite rectangles have to be composited again
+        int ox, oy, ow, oh, x, y, w, h;
+        fogCharacterRect(fogShown, fogShownCamera, ox, oy, ow, oh);
+        fogCharacterRect(frame, fogCamera, x, y, w, h);
+        markFogMovedRect(ox, oy, ow, oh, x, y, w, h,
+                         frame.atlasFrame != fogShown.atlasFrame || frame.palette != fogShown.palette ||
+                         frame.mirrored != fogShown.mirrored);
+        fogRevealRect(fogShown, fogShownCamera, ox, oy, ow, oh);
+        fogRevealRect(frame, fogCamera, x, y, w, h);
+        markFogMovedRect(ox, oy, ow, oh, x, y, w, h,
+                         frame.reveal != fogShown.reveal || frame.revealFrame != fogShown.revealFrame);
+    }
+
+    setFogSource(fogMask, FOG_SOURCE_PLAYER, frame.x - fogCamera.x, frame.y - fogCamera.y, FOG_VISION_RADIUS, true);
+    setFogSource(fogMask, FOG_SOURCE_REVEAL, frame.revealX - fogCamera.x, frame.revealY - fogCamera.y,
+                 FOG_REVEAL_RADIUS, frame.reveal != 0);
+
+    fogDrawing = &frame;
+    compositeFog(fogMask, compositeFogRun);
+    fogDrawing = NULL;
+    fogShown = frame;
+    fogShownCamera = fogCamera;
+}
+
+#endif
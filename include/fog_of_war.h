@@ -0,0 +1,231 @@
+#ifndef FOG_OF_WAR_H
+#define FOG_OF_WAR_H
+/////////////////////////////////////////////////////////////////////////////
+// Fog-of-war visibility mask
+//
+// The screen is split into FOG_TILE_SIZE square tiles. Each vision source
+// (the local player, and the opponent while a powerup reveals them) makes
+// the tiles that touch its circle visible, and the mask is the union of
+// all sources, kept as one bit per tile per row.
+//
+// Moving a source only recomputes the rows its old and new circle cover,
+// and every tile whose visibility flips is marked dirty. Sprites that move
+// mark the tiles under them dirty as well. The renderer then composites
+// only the dirty tiles, merged into horizontal runs of equal visibility,
+// instead of repainting the whole screen.
+//
+// Drawing goes through a callback so this file stays display independent
+// (the M5 side lives in fog_draw.h).
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+
+const int FOG_TILE_SIZE = 16;
+const int FOG_COLS = 320 / FOG_TILE_SIZE;
+const int FOG_ROWS = 240 / FOG_TILE_SIZE;
+
+// Vision sources, in source table order
+enum FogSource { FOG_SOURCE_PLAYER, FOG_SOURCE_REVEAL, FOG_SOURCE_COUNT };
+
+struct FogCircle {
+    int16_t x;         // centre in screen pixels
+    int16_t y;
+    int16_t radius;
+    uint8_t active;
+};
+
+struct FogMask {
+    FogCircle sources[FOG_SOURCE_COUNT];
+    uint32_t sourceRows[FOG_SOURCE_COUNT][FOG_ROWS];  // tiles each source sees, bit = column
+    uint32_t visible[FOG_ROWS];                       // union of all sources
+    uint32_t dirty[FOG_ROWS];                         // tiles that have to be composited
+};
+
+// Called for every run of dirty tiles: a pixel rectangle and whether it is visible
+typedef void (*FogRunDrawFn)(int x, int y, int w, int h, bool visible);
+
+const uint32_t FOG_ROW_BITS = (1UL << FOG_COLS) - 1;
+
+/////////////////////////////////////////////////////////////////
+// Clears every source and marks the whole screen dirty
+/////////////////////////////////////////////////////////////////
+inline void initFogMask(FogMask &mask) {
+    memset(&mask, 0, sizeof(mask));
+    for (int r = 0; r < FOG_ROWS; r++) {
+        mask.dirty[r] = FOG_ROW_BITS;
+    }
+}
+
+// Forgets what is on the panel (e.g. after a screen function drew over it)
+inline void invalidateFogMask(FogMask &mask) {
+    for (int r = 0; r < FOG_ROWS; r++) {
+        mask.dirty[r] = FOG_ROW_BITS;
+    }
+}
+
+inline bool isFogTileVisible(const FogMask &mask, int col, int row) {
+    return (mask.visible[row] >> col) & 1;
+}
+
+// Tile rows a circle covers, clamped to the screen. Returns false if none.
+inline bool fogCircleRows(const FogCircle &circle, int &first, int &last) {
+    if (!circle.active) {
+        return false;
+    }
+    first = (circle.y - circle.radius) / FOG_TILE_SIZE;
+    last = (circle.y + circle.radius) / FOG_TILE_SIZE;
+    if (circle.y - circle.radius < 0) {
+        first = 0;
+    }
+    if (last >= FOG_ROWS) {
+        last = FOG_ROWS - 1;
+    }
+    return first <= last;
+}
+
+/////////////////////////////////////////////////////////////////
+// Visibility bits of one tile row for a circle. A tile is visible
+// when any part of it is inside the circle (nearest point test).
+/////////////////////////////////////////////////////////////////
+inline uint32_t fogCircleRowBits(const FogCircle &circle, int row) {
+    int top = row * FOG_TILE_SIZE;
+    int dy = 0;
+    if (circle.y < top) {
+        dy = top - circle.y;
+    } else if (circle.y > top + FOG_TILE_SIZE - 1) {
+        dy = circle.y - (top + FOG_TILE_SIZE - 1);
+    }
+    int32_t r2 = (int32_t)circle.radius * circle.radius;
+    int32_t dy2 = (int32_t)dy * dy;
+    if (dy2 > r2) {
+        return 0;
+    }
+
+    int firstCol = (circle.x - circle.radius) / FOG_TILE_SIZE;
+    int lastCol = (circle.x + circle.radius) / FOG_TILE_SIZE;
+    if (circle.x - circle.radius < 0) {
+        firstCol = 0;
+    }
+    if (lastCol >= FOG_COLS) {
+        lastCol = FOG_COLS - 1;
+    }
+
+    uint32_t bits = 0;
+    for (int c = firstCol; c <= lastCol; c++) {
+        int left = c * FOG_TILE_SIZE;
+        int dx = 0;
+        if (circle.x < left) {
+            dx = left - circle.x;
+        } else if (circle.x > left + FOG_TILE_SIZE - 1) {
+            dx = circle.x - (left + FOG_TILE_SIZE - 1);
+        }
+        if ((int32_t)dx * dx + dy2 <= r2) {
+            bits |= 1UL << c;
+        }
+    }
+    return bits;
+}
+
+/////////////////////////////////////////////////////////////////
+// Moves, resizes or switches a vision source on/off. Only the rows
+// covered by the old and the new circle are recomputed, and tiles
+// whose visibility changed are marked dirty.
+/////////////////////////////////////////////////////////////////
+inline void setFogSource(FogMask &mask, uint8_t source, int x, int y, int radius, bool active) {
+    FogCircle &circle = mask.sources[source];
+    if (circle.active == active && (!active ||
+        (circle.x == x && circle.y == y && circle.radius == radius))) {
+        return;
+    }
+
+    int oldFirst = 0, oldLast = -1;
+    fogCircleRows(circle, oldFirst, oldLast);
+    circle.x = x;
+    circle.y = y;
+    circle.radius = radius;
+    circle.active = active;
+    int newFirst = 0, newLast = -1;
+    fogCircleRows(circle, newFirst, newLast);
+
+    for (int r = 0; r < FOG_ROWS; r++) {
+        bool inOld = r >= oldFirst && r <= oldLast;
+        bool inNew = r >= newFirst && r <= newLast;
+        if (!inOld && !inNew) {
+            continue;
+        }
+        mask.sourceRows[source][r] = inNew ? fogCircleRowBits(circle, r) : 0;
+
+        uint32_t combined = 0;
+        for (int s = 0; s < FOG_SOURCE_COUNT; s++) {
+            combined |= mask.sourceRows[s][r];
+        }
+        mask.dirty[r] |= combined ^ mask.visible[r];
+        mask.visible[r] = combined;
+    }
+}
+
+inline void markFogTileDirty(FogMask &mask, int col, int row) {
+    mask.dirty[row] |= 1UL << col;
+}
+
+/////////////////////////////////////////////////////////////////
+// Marks the tiles under a pixel rectangle dirty (a sprite moved
+// or changed frame there)
+/////////////////////////////////////////////////////////////////
+inline void markFogRectDirty(FogMask &mask, int x, int y, int w, int h) {
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    int firstCol = x / FOG_TILE_SIZE, lastCol = (x + w - 1) / FOG_TILE_SIZE;
+    int firstRow = y / FOG_TILE_SIZE, lastRow = (y + h - 1) / FOG_TILE_SIZE;
+    if (x < 0) {
+        firstCol = 0;
+    }
+    if (y < 0) {
+        firstRow = 0;
+    }
+    if (lastCol >= FOG_COLS) {
+        lastCol = FOG_COLS - 1;
+    }
+    if (lastRow >= FOG_ROWS) {
+        lastRow = FOG_ROWS - 1;
+    }
+    if (firstCol > lastCol || firstRow > lastRow || x + w <= 0 || y + h <= 0) {
+        return;
+    }
+    uint32_t bits = (lastCol - firstCol == 31) ? 0xFFFFFFFFUL
+                    : (((1UL << (lastCol - firstCol + 1)) - 1) << firstCol);
+    for (int r = firstRow; r <= lastRow; r++) {
+        mask.dirty[r] |= bits;
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Hands every run of dirty tiles with the same visibility to
+// `draw` and clears the dirty bits. Returns the number of tiles
+// that were composited.
+/////////////////////////////////////////////////////////////////
+inline int compositeFog(FogMask &mask, FogRunDrawFn draw) {
+    int tiles = 0;
+    for (int r = 0; r < FOG_ROWS; r++) {
+        uint32_t dirty = mask.dirty[r];
+        int c = 0;
+        while (dirty != 0 && c < FOG_COLS) {
+            if (!((dirty >> c) & 1)) {
+                c++;
+                continue;
+            }
+            bool visible = isFogTileVisible(mask, c, r);
+            int start = c;
+            while (c < FOG_COLS && ((dirty >> c) & 1) && isFogTileVisible(mask, c, r) == visible) {
+                c++;
+            }
+            draw(start * FOG_TILE_SIZE, r * FOG_TILE_SIZE, (c - start) * FOG_TILE_SIZE, FOG_TILE_SIZE, visible);
+            tiles += c - start;
+        }
+        mask.dirty[r] = 0;
+    }
+    return tiles;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef GAME_FLOW_H
+#define GAME_FLOW_H
+/////////////////////////////////////////////////////////////////////////////
+// Game flow state machine shared by the client and the server.
+//
+// Everything that moves the game between screens is a typed event: a touch
+// on a button, a game state value from the peer, a catch or the timer
+// running out. The transition table below is the only place that decides
+// where an event leads; events that have no row for the current state are
+// ignored, so a late or repeated event can't end a game twice or redraw a
+// screen that is already up.
+//
+// Each role supplies the entry and exit actions of every state (drawing
+// the screen, telling the peer, resetting positions). They run exactly
+// once per real state change and get the state that was left and the
+// event that caused the change.
+//
+// Events are never handled where they happen. Touch handlers run inside
+// M5.update() with the LCD locked and raise them into a queue; BLE
+// callbacks run on the BLE task and post them into a lock-free queue of
+// their own (render_queue.h). loop() then runs them all with
+// runGameEvents(), so actions always run on the loop task, one transition
+// at a time. Game logic on the loop task can dispatch directly.
+// Nothing here touches the hardware, see tools/test_game_flow.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stddef.h>
+#include "render_queue.h"
+
+// Game states, in action table order
+enum GameState { S_WAITING, S_PLAYER_SELECT, S_TUTORIAL, S_GAME, S_GAME_OVER, S_STATE_COUNT };
+
+enum GameEvent {
+    EV_CONNECTED,         // BLE link up
+    EV_DISCONNECTED,      // BLE link lost
+    EV_TUTORIAL_OPENED,   // Tutorial tapped
+    EV_TUTORIAL_CLOSED,   // X tapped on the tutorial
+    EV_START,             // Start tapped
+    EV_REMOTE_START,      // the peer started the game
+    EV_CAUGHT,            // the sprites overlap
+    EV_TIME_UP,           // the countdown ran out
+    EV_REMOTE_CAUGHT,     // the peer ended the game, the sprites overlapped there
+    EV_REMOTE_TIME_UP,    // the peer ended the game, its countdown ran out
+    EV_PLAY_AGAIN,        // Play again tapped
+    EV_EVENT_COUNT
+};
+
+enum GameGuard {
+    GUARD_NONE,
+    GUARD_PLAYERS_CHOSEN  // both sides picked a character
+};
+
+const uint8_t S_ANY = 0xFF;                 // matches every state in the table
+const uint32_t GAME_EVENT_QUEUE_SIZE = 16;
+
+struct GameTransition {
+    uint8_t from;    // GameState or S_ANY
+    uint8_t event;   // GameEvent
+    uint8_t to;      // GameState
+    uint8_t guard;   // GameGuard
+};
+
+// from, event, to, guard; the first matching row wins
+const GameTransition gameTransitions [] = {
+    { S_WAITING,       EV_CONNECTED,        S_PLAYER_SELECT, GUARD_NONE },
+    { S_PLAYER_SELECT, EV_TUTORIAL_OPENED,  S_TUTORIAL,      GUARD_NONE },
+    { S_TUTORIAL,      EV_TUTORIAL_CLOSED,  S_PLAYER_SELECT, GUARD_NONE },
+    { S_PLAYER_SELECT, EV_START,            S_GAME,          GUARD_PLAYERS_CHOSEN },
+    { S_PLAYER_SELECT, EV_REMOTE_START,     S_GAME,          GUARD_NONE },
+    { S_TUTORIAL,      EV_REMOTE_START,     S_GAME,          GUARD_NONE },
+    { S_GAME_OVER,     EV_REMOTE_START,     S_GAME,          GUARD_NONE },
+    { S_GAME,          EV_CAUGHT,           S_GAME_OVER,     GUARD_NONE },
+    { S_GAME,          EV_TIME_UP,          S_GAME_OVER,     GUARD_NONE },
+    { S_GAME,          EV_REMOTE_CAUGHT,    S_GAME_OVER,     GUARD_NONE },
+    { S_GAME,          EV_REMOTE_TIME_UP,   S_GAME_OVER,     GUARD_NONE },
+    { S_GAME_OVER,     EV_PLAY_AGAIN,       S_PLAYER_SELECT, GUARD_NONE },
+    { S_ANY,           EV_DISCONNECTED,     S_WAITING,       GUARD_NONE },
+};
+
+// Why a game ended, sent after the game over state (MSG_GAME_STATE 4) so
+// the peer shows the same result
+enum GameOverReason { GAME_OVER_CAUGHT = 1, GAME_OVER_TIME_UP = 2 };
+
+inline uint8_t gameOverReason(uint8_t event) {
+    return (event == EV_TIME_UP || event == EV_REMOTE_TIME_UP) ? GAME_OVER_TIME_UP : GAME_OVER_CAUGHT;
+}
+
+// The event a peer's game over raises here; one without a reason was a catch
+inline uint8_t remoteGameOverEvent(uint8_t reason) {
+    return (reason == GAME_OVER_TIME_UP) ? EV_REMOTE_TIME_UP : EV_REMOTE_CAUGHT;
+}
+
+// Entry/exit action: the state that was left and the event that caused the change
+typedef void (*GameActionFn)(uint8_t from, uint8_t event);
+typedef bool (*GameGuardFn)(uint8_t guard);
+
+struct GameStateActions {
+    GameActionFn onEnter;   // either may be NULL
+    GameActionFn onExit;
+};
+
+struct GameFlow {
+    uint8_t state;
+    uint8_t cause;                          // event that entered the current state
+    uint8_t dispatching;                    // a transition is running
+    const GameStateActions *actions;        // S_STATE_COUNT entries
+    GameGuardFn guard;
+    RenderQueue<uint8_t, GAME_EVENT_QUEUE_SIZE> posted;   // from the BLE task
+    RenderQueue<uint8_t, GAME_EVENT_QUEUE_SIZE> raised;   // from the loop task
+};
+
+/////////////////////////////////////////////////////////////////
+// Starts the machine in `initial` without running its entry
+// action (setup() draws the first screen itself)
+/////////////////////////////////////////////////////////////////
+inline void initGameFlow(GameFlow &flow, uint8_t initial, const GameStateActions *actions, GameGuardFn guard) {
+    flow.state = initial;
+    flow.cause = EV_EVENT_COUNT;
+    flow.dispatching = 0;
+    flow.actions = actions;
+    flow.guard = guard;
+}
+
+// Row for an event in a state, or NULL if the event is ignored there
+inline const GameTransition *findGameTransition(uint8_t state, uint8_t event) {
+    for (size_t i = 0; i < sizeof(gameTransitions) / sizeof(gameTransitions[0]); i++) {
+        const GameTransition &t = gameTransitions[i];
+        if (t.event == event && (t.from == state || t.from == S_ANY) && t.to != state) {
+            return &t;
+        }
+    }
+    return NULL;
+}
+
+inline bool runGameTransition(GameFlow &flow, uint8_t event) {
+    const GameTransition *t = findGameTransition(flow.state, event);
+    if (t == NULL || (t->guard != GUARD_NONE && (flow.guard == NULL || !flow.guard(t->guard)))) {
+        return false;
+    }
+    uint8_t from = flow.state;
+    if (flow.actions[from].onExit) {
+        flow.actions[from].onExit(t->to, event);
+    }
+    flow.state = t->to;
+    flow.cause = event;
+    if (flow.actions[t->to].onEnter) {
+        flow.actions[t->to].onEnter(from, event);
+    }
+    return true;
+}
+
+// Queues an event on the loop task (touch handlers, actions)
+inline void raiseGameEvent(GameFlow &flow, uint8_t event) {
+    flow.raised.push(event);
+}
+
+// Queues an event from another task (BLE callbacks)
+inline void postGameEvent(GameFlow &flow, uint8_t event) {
+    flow.posted.push(event);
+}
+
+/////////////////////////////////////////////////////////////////
+// Handles an event on the loop task, followed by whatever the
+// actions raised. Returns true if the state changed. From inside
+// an action the event is only queued.
+/////////////////////////////////////////////////////////////////
+inline bool dispatchGameEvent(GameFlow &flow, uint8_t event) {
+    if (flow.dispatching) {
+        raiseGameEvent(flow, event);
+        return false;
+    }
+    flow.dispatching = 1;
+    bool changed = runGameTransition(flow, event);
+    uint8_t next;
+    while (flow.raised.pop(next)) {
+        changed = runGameTransition(flow, next) || changed;
+    }
+    flow.dispatching = 0;
+    return changed;
+}
+
+// Handles everything raised or posted since the last call (loop task)
+inline void runGameEvents(GameFlow &flow) {
+    uint8_t event;
+    while (flow.raised.pop(event)) {
+        dispatchGameEvent(flow, event);
+    }
+    while (flow.posted.pop(event)) {
+        dispatchGameEvent(flow, event);
+    }
+}
+
+#endif
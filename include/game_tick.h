@@ -0,0 +1,43 @@
+#ifndef GAME_TICK_H
+#define GAME_TICK_H
+/////////////////////////////////////////////////////////////////////////////
+// Fixed simulation tick.
+//
+// loop() runs as fast as BLE and drawing allow, so anything that should
+// happen at a fixed rate (animations, movement) counts ticks instead of
+// loop iterations. Call advanceTickClock() once per loop() and run the
+// returned number of ticks.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+
+const uint32_t SIM_TICK_MS = 20;           // 50 ticks per second
+const uint32_t SIM_MAX_TICKS_PER_LOOP = 5; // don't spiral after a long stall
+
+struct TickClock {
+    uint32_t lastMs;  // time the last tick was accounted for
+    uint32_t tick;    // ticks run since the clock was reset
+};
+
+inline void resetTickClock(TickClock &clock, uint32_t nowMs) {
+    clock.lastMs = nowMs;
+    clock.tick = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Returns how many ticks are due since the last call. After a
+// stall longer than SIM_MAX_TICKS_PER_LOOP ticks the extra time is
+// dropped instead of being caught up.
+/////////////////////////////////////////////////////////////////
+inline uint32_t advanceTickClock(TickClock &clock, uint32_t nowMs) {
+    uint32_t due = (nowMs - clock.lastMs) / SIM_TICK_MS;
+    if (due > SIM_MAX_TICKS_PER_LOOP) {
+        clock.lastMs = nowMs;
+        due = SIM_MAX_TICKS_PER_LOOP;
+    } else {
+        clock.lastMs += due * SIM_TICK_MS;
+    }
+    clock.tick += due;
+    return due;
+}
+
+#endif
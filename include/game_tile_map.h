@@ -0,0 +1,82 @@
+#ifndef GAME_TILE_MAP_H
+#define GAME_TILE_MAP_H
+/////////////////////////////////////////////////////////////////////////////
+// GENERATED by tools/build_tile_map.py from tools/maps/arena.txt.
+// Do not edit by hand; re-run the script after changing the map.
+/////////////////////////////////////////////////////////////////////////////
+#include "indexed_sprite.h"
+
+// Tile types, in tile set order
+enum TileType { TILE_FLOOR, TILE_WALL, TILE_ROCK, TILE_GRASS, TILE_TYPE_COUNT };
+
+// Spawn points in the map, in spawn table order
+enum MapSpawn { SPAWN_SERVER, SPAWN_CLIENT, SPAWN_COUNT };
+
+const int TILESET_TILE_SIZE = 16;
+const int TILESET_PALETTE_SIZE = 10;
+const uint16_t tilesetPalette [] PROGMEM = {
+	0x0000, 0x2104, 0x3186, 0x8a22, 0x4a49, 0x6b4d, 0x39c7, 0x9cd3, 0x0240, 0x0be3
+};
+// Same colours at 30% brightness, for tiles under the fog
+const uint16_t tilesetFogPalette [] PROGMEM = {
+	0x0000, 0x0841, 0x0861, 0x28a0, 0x10a2, 0x18e3, 0x1082, 0x2965, 0x00a0, 0x0120
+};
+
+// 64x16px, 4 tiles, 4bpp
+const uint8_t tilesetIndices [] PROGMEM = {
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x12, 0x11, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34,
+	0x11, 0x11, 0x17, 0x77, 0x77, 0x51, 0x11, 0x11, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x12, 0x11, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34,
+	0x11, 0x11, 0x77, 0x77, 0x75, 0x55, 0x11, 0x11, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x89,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	0x11, 0x17, 0x77, 0x77, 0x55, 0x55, 0x51, 0x11, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x89,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33,
+	0x11, 0x77, 0x77, 0x75, 0x55, 0x55, 0x55, 0x11, 0x89, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x12, 0x11, 0x11, 0x11, 0x11, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33,
+	0x17, 0x77, 0x77, 0x55, 0x55, 0x55, 0x55, 0x51, 0x89, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33,
+	0x17, 0x77, 0x75, 0x55, 0x55, 0x55, 0x55, 0x61, 0x88, 0x88, 0x88, 0x88, 0x89, 0x88, 0x88, 0x88,
+	0x11, 0x21, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	0x17, 0x77, 0x55, 0x55, 0x55, 0x55, 0x56, 0x61, 0x88, 0x88, 0x88, 0x88, 0x89, 0x89, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34,
+	0x17, 0x75, 0x55, 0x55, 0x55, 0x55, 0x66, 0x61, 0x88, 0x88, 0x88, 0x88, 0x88, 0x89, 0x89, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34,
+	0x17, 0x55, 0x55, 0x55, 0x55, 0x56, 0x66, 0x61, 0x88, 0x88, 0x88, 0x88, 0x88, 0x89, 0x89, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34,
+	0x15, 0x55, 0x55, 0x55, 0x55, 0x66, 0x66, 0x61, 0x88, 0x88, 0x88, 0x89, 0x88, 0x89, 0x88, 0x88,
+	0x12, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	0x11, 0x55, 0x55, 0x55, 0x56, 0x66, 0x66, 0x11, 0x89, 0x88, 0x88, 0x89, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33,
+	0x11, 0x15, 0x55, 0x55, 0x66, 0x66, 0x61, 0x11, 0x89, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x21, 0x11, 0x11, 0x11, 0x11, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33,
+	0x11, 0x11, 0x55, 0x56, 0x66, 0x66, 0x11, 0x11, 0x89, 0x88, 0x88, 0x98, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x33, 0x34, 0x33, 0x33, 0x33, 0x34, 0x33, 0x33,
+	0x11, 0x11, 0x15, 0x66, 0x66, 0x61, 0x11, 0x11, 0x88, 0x88, 0x88, 0x98, 0x88, 0x88, 0x88, 0x88,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+};
+const IndexedSprite tilesetSprite = { 64, 16, 4, 32, 10, tilesetPalette, tilesetIndices };
+
+// Arena: 40x30 tiles (640x480px), 236 bytes as a map file (1200 tiles)
+const uint8_t arenaMapData [] PROGMEM = {
+	0x54, 0x4d, 0x41, 0x50, 0x01, 0x10, 0x28, 0x00, 0x1e, 0x00, 0x06, 0x00, 0x02, 0x38, 0x00, 0xf8,
+	0x00, 0x48, 0x02, 0xf8, 0x00, 0xd5, 0x00, 0xf1, 0xf1, 0x81, 0xf0, 0xf0, 0x50, 0x11, 0xf0, 0xf0,
+	0x50, 0x11, 0xe0, 0x02, 0xf0, 0x50, 0x11, 0x70, 0x01, 0xf0, 0x30, 0x01, 0x70, 0x11, 0x30, 0x02,
+	0x20, 0x01, 0xf0, 0x30, 0x01, 0x70, 0x11, 0x70, 0x01, 0xf0, 0x30, 0x01, 0x20, 0x02, 0x30, 0x11,
+	0x70, 0x01, 0x40, 0x91, 0x40, 0x01, 0x70, 0x11, 0x70, 0x01, 0xf0, 0x30, 0x01, 0x70, 0x11, 0x10,
+	0x33, 0x10, 0x01, 0x30, 0x33, 0xb0, 0x01, 0x70, 0x11, 0x10, 0x33, 0x10, 0x01, 0x30, 0x33, 0x80,
+	0x02, 0x10, 0x01, 0x70, 0x11, 0x10, 0x33, 0x10, 0x01, 0x30, 0x33, 0xb0, 0x01, 0x70, 0x11, 0xf0,
+	0x10, 0x11, 0xf0, 0x10, 0x11, 0xf0, 0x10, 0x11, 0xf0, 0x10, 0x11, 0xb0, 0x02, 0x40, 0x11, 0xf0,
+	0x10, 0x11, 0xf0, 0x10, 0x11, 0x40, 0x02, 0xb0, 0x11, 0xf0, 0x10, 0x11, 0xf0, 0x10, 0x11, 0xf0,
+	0x10, 0x11, 0xf0, 0x10, 0x11, 0x70, 0x01, 0xb0, 0x33, 0x30, 0x01, 0x10, 0x33, 0x10, 0x11, 0x70,
+	0x01, 0x10, 0x02, 0x80, 0x33, 0x30, 0x01, 0x10, 0x33, 0x10, 0x11, 0x70, 0x01, 0xb0, 0x33, 0x30,
+	0x01, 0x10, 0x33, 0x10, 0x11, 0x70, 0x01, 0xf0, 0x30, 0x01, 0x70, 0x11, 0x40, 0x02, 0x10, 0x01,
+	0x40, 0x91, 0x40, 0x01, 0x70, 0x11, 0x70, 0x01, 0xf0, 0x30, 0x01, 0x70, 0x11, 0x70, 0x01, 0xf0,
+	0x30, 0x01, 0x10, 0x02, 0x40, 0x11, 0x70, 0x01, 0xf0, 0x30, 0x01, 0x70, 0x11, 0xf0, 0x50, 0x02,
+	0xe0, 0x11, 0xf0, 0xf0, 0x50, 0x11, 0xf0, 0xf0, 0x50, 0xf1, 0xf1, 0x81,
+};
+const uint32_t arenaMapSize = 236;
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef HUD_H
+#define HUD_H
+/////////////////////////////////////////////////////////////////////////////
+// In-game HUD (timer, distance, powerups left, acceleration)
+//
+// Digits are rasterised once into RGB565 glyphs per colour (the glyph
+// cache), and each field remembers the characters it is showing. Updating
+// a field formats the new value into a small char buffer and only redraws
+// the characters that changed, so the timer costs one glyph blit a second
+// instead of a full text redraw every loop. Glyphs are opaque, so they
+// erase whatever digit was there before without a fillRect().
+//
+// Drawing goes through a callback so this file stays display independent
+// (the M5 side lives in hud_draw.h).
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+
+// 5x7 font in a 6x8 cell, same footprint as setTextSize(1)
+const int HUD_GLYPH_W = 6;
+const int HUD_GLYPH_H = 8;
+const int HUD_FIELD_CHARS = 6;
+const int HUD_MAX_STYLES = 4;
+
+// Characters the glyph cache holds, in font table order
+const char HUD_GLYPHS[] = "0123456789:- ";
+const int HUD_GLYPH_COUNT = sizeof(HUD_GLYPHS) - 1;
+
+// One byte per row, low 5 bits used, bit 4 is the leftmost column
+const uint8_t hudFont[HUD_GLYPH_COUNT][7] = {
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, // 0
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E }, // 1
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, // 2
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E }, // 3
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, // 4
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E }, // 5
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, // 6
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // 7
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, // 8
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, // 9
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, // :
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, // -
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+};
+
+// Pre-rasterised glyphs for one foreground/background pair
+struct HudGlyphStyle {
+    uint16_t fg;
+    uint16_t bg;
+    uint16_t pixels[HUD_GLYPH_COUNT][HUD_GLYPH_W * HUD_GLYPH_H];
+};
+
+struct HudField {
+    int16_t x;                        // top left of the first character
+    int16_t y;
+    uint8_t style;                    // index into the glyph cache
+    char shown[HUD_FIELD_CHARS + 1];  // what is on the panel ("" = nothing)
+};
+
+// Called for every glyph that has to be drawn
+typedef void (*HudGlyphDrawFn)(int x, int y, const uint16_t *pixels, int w, int h);
+
+/////////////////////////////////////////////////////////////////
+// Rasterises every glyph of the font in the given colours
+/////////////////////////////////////////////////////////////////
+inline void buildHudGlyphStyle(HudGlyphStyle &style, uint16_t fg, uint16_t bg) {
+    style.fg = fg;
+    style.bg = bg;
+    for (int g = 0; g < HUD_GLYPH_COUNT; g++) {
+        uint16_t *px = style.pixels[g];
+        for (int y = 0; y < HUD_GLYPH_H; y++) {
+            uint8_t bits = (y < 7) ? hudFont[g][y] : 0;
+            for (int x = 0; x < HUD_GLYPH_W; x++) {
+                bool on = x < 5 && (bits & (0x10 >> x));
+                px[y * HUD_GLYPH_W + x] = on ? fg : bg;
+            }
+        }
+    }
+}
+
+inline int hudGlyphIndex(char c) {
+    for (int g = 0; g < HUD_GLYPH_COUNT; g++) {
+        if (HUD_GLYPHS[g] == c) {
+            return g;
+        }
+    }
+    return HUD_GLYPH_COUNT - 1; // unknown characters draw as a space
+}
+
+inline void initHudField(HudField &field, int x, int y, uint8_t style) {
+    field.x = x;
+    field.y = y;
+    field.style = style;
+    memset(field.shown, 0, sizeof(field.shown));
+}
+
+// Switches the field to another glyph style, redrawing it if needed
+inline void setHudFieldStyle(HudField &field, uint8_t style) {
+    if (field.style != style) {
+        field.style = style;
+        memset(field.shown, 0, sizeof(field.shown));
+    }
+}
+
+// Forgets what the field shows (e.g. after a fillScreen) so the next
+// update draws every character again
+inline void invalidateHudField(HudField &field) {
+    memset(field.shown, 0, sizeof(field.shown));
+}
+
+/////////////////////////////////////////////////////////////////
+// Shows `text` in the field, drawing only the characters that
+// differ from what is already on the panel. A shorter text blanks
+// the leftover characters. Returns the number of glyphs drawn.
+/////////////////////////////////////////////////////////////////
+inline int updateHudField(HudField &field, const char *text, const HudGlyphStyle *styles, HudGlyphDrawFn draw) {
+    const HudGlyphStyle &style = styles[field.style];
+    int drawn = 0;
+    bool ended = false;
+    for (int i = 0; i < HUD_FIELD_CHARS; i++) {
+        char c = ended ? '\0' : text[i];
+        if (c == '\0') {
+            ended = true;
+        }
+        char shown = field.shown[i];
+        if (c == shown) {
+            continue;
+        }
+        // Blank out characters that are no longer used
+        char glyph = (c == '\0') ? ' ' : c;
+        if (c == '\0' && shown == ' ') {
+            field.shown[i] = '\0';
+            continue;
+        }
+        draw(field.x + i * HUD_GLYPH_W, field.y, style.pixels[hudGlyphIndex(glyph)], HUD_GLYPH_W, HUD_GLYPH_H);
+        field.shown[i] = c;
+        drawn++;
+    }
+    return drawn;
+}
+
+// Widest numbers a field shows; anything past them shows as them
+const int32_t HUD_NUMBER_MAX = 999999;
+const int32_t HUD_NUMBER_MIN = -99999;
+const uint32_t HUD_TIME_MAX_MS = (999 * 60 + 59) * 1000UL;  // 999:59
+
+/////////////////////////////////////////////////////////////////
+// Integer formatting without String or printf. A value too wide
+// for the field is clamped, sign kept, rather than cut to its
+// low digits. `out` takes HUD_FIELD_CHARS + 1.
+/////////////////////////////////////////////////////////////////
+inline void formatHudNumber(char *out, int32_t value) {
+    if (value > HUD_NUMBER_MAX) {
+        value = HUD_NUMBER_MAX;
+    } else if (value < HUD_NUMBER_MIN) {
+        value = HUD_NUMBER_MIN;
+    }
+    char digits[HUD_FIELD_CHARS];
+    int n = 0;
+    bool negative = value < 0;
+    uint32_t v = negative ? (uint32_t)-value : (uint32_t)value;
+    do {
+        digits[n++] = '0' + (v % 10);
+        v /= 10;
+    } while (v != 0);
+    int i = 0;
+    if (negative) {
+        out[i++] = '-';
+    }
+    while (n > 0) {
+        out[i++] = digits[--n];
+    }
+    out[i] = '\0';
+}
+
+// Formats milliseconds as m:ss, up to 999:59
+inline void formatHudTime(char *out, uint32_t ms) {
+    if (ms > HUD_TIME_MAX_MS) {
+        ms = HUD_TIME_MAX_MS;
+    }
+    uint32_t minutes = (ms / 1000) / 60;
+    uint32_t seconds = (ms / 1000) % 60;
+    formatHudNumber(out, minutes);
+    int i = strlen(out);
+    out[i++] = ':';
+    out[i++] = '0' + seconds / 10;
+    out[i++] = '0' + seconds % 10;
+    out[i] = '\0';
+}
+
+#endif
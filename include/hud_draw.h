@@ -0,0 +1,121 @@
+#ifndef HUD_DRAW_H
+#define HUD_DRAW_H
+/////////////////////////////////////////////////////////////////////////////
+// M5Core2 side of the HUD (hud.h): glyph styles, field layout and the
+// glyph blit. Call setupHud() once in setup() and invalidateHudRect()
+// after anything repaints part of the screen; the fog compositor
+// (fog_draw.h) does so for every run it paints, whole-screen repaints too.
+// The link overlay (round trip and drop rate, link_telemetry.h) is off
+// until showHudOverlay() turns it on.
+/////////////////////////////////////////////////////////////////////////////
+#include <M5Core2.h>
+#include "hud.h"
+
+enum HudStyle { HUD_STYLE_TIMER, HUD_STYLE_PINK, HUD_STYLE_GREEN, HUD_STYLE_INFO };
+
+static HudGlyphStyle hudStyles[HUD_MAX_STYLES];
+static HudField hudTimer;
+static HudField hudDistance;
+static HudField hudPowerups;
+static HudField hudAcceleration;
+static HudField hudRttMedian;
+static HudField hudRttTail;
+static HudField hudLoss;
+static bool hudOverlayShown = false;
+
+inline void drawHudGlyph(int x, int y, const uint16_t *pixels, int w, int h) {
+    M5.Lcd.drawBitmap(x, y, w, h, pixels);
+}
+
+///////////////////////////////////////////////////////////////
+// Rasterises the glyphs and lays out the fields (distance top
+// left, timer top right, powerups/acceleration along the bottom,
+// the link overlay under the distance and the timer)
+///////////////////////////////////////////////////////////////
+inline void setupHud() {
+    buildHudGlyphStyle(hudStyles[HUD_STYLE_TIMER], TFT_WHITE, TFT_BLACK);
+    buildHudGlyphStyle(hudStyles[HUD_STYLE_PINK], TFT_PINK, TFT_BLACK);
+    buildHudGlyphStyle(hudStyles[HUD_STYLE_GREEN], TFT_GREEN, TFT_BLACK);
+    buildHudGlyphStyle(hudStyles[HUD_STYLE_INFO], TFT_CYAN, TFT_BLACK);
+
+    initHudField(hudDistance, 10, 20, HUD_STYLE_GREEN);
+    initHudField(hudTimer, 210, 20, HUD_STYLE_TIMER);
+    initHudField(hudPowerups, 34, 226, HUD_STYLE_INFO);
+    initHudField(hudAcceleration, 274, 226, HUD_STYLE_INFO);
+    initHudField(hudRttMedian, 34, 36, HUD_STYLE_INFO);
+    initHudField(hudRttTail, 76, 36, HUD_STYLE_INFO);
+    initHudField(hudLoss, 274, 36, HUD_STYLE_INFO);
+}
+
+// Static labels next to the bottom fields
+const int HUD_LABEL_PWR_X = 10;
+const int HUD_LABEL_ACC_X = 250;
+const int HUD_LABEL_Y = 226;
+const int HUD_LABEL_W = 3 * HUD_GLYPH_W;
+const int HUD_LABEL_RTT_X = 10;
+const int HUD_LABEL_DRP_X = 250;
+const int HUD_OVERLAY_Y = 36;
+
+inline void drawHudLabels() {
+    M5.Lcd.setTextSize(1);
+    M5.Lcd.setTextColor(TFT_CYAN);
+    M5.Lcd.setCursor(HUD_LABEL_PWR_X, HUD_LABEL_Y);
+    M5.Lcd.print("PWR");
+    M5.Lcd.setCursor(HUD_LABEL_ACC_X, HUD_LABEL_Y);
+    M5.Lcd.print("ACC");
+    if (hudOverlayShown) {
+        M5.Lcd.setCursor(HUD_LABEL_RTT_X, HUD_OVERLAY_Y);
+        M5.Lcd.print("RTT");
+        M5.Lcd.setCursor(HUD_LABEL_DRP_X, HUD_OVERLAY_Y);
+        M5.Lcd.print("DRP");
+    }
+}
+
+///////////////////////////////////////////////////////////////
+// Turns the link overlay on or off. Turning it off leaves its
+// pixels on the panel; the caller repaints the frame then.
+///////////////////////////////////////////////////////////////
+inline void showHudOverlay(bool shown) {
+    if (shown == hudOverlayShown) {
+        return;
+    }
+    hudOverlayShown = shown;
+    invalidateHudField(hudRttMedian);
+    invalidateHudField(hudRttTail);
+    invalidateHudField(hudLoss);
+}
+
+inline bool hudRectsOverlap(int ax, int ay, int aw, int ah, int bx, int by, int bw, int bh) {
+    return ax < bx + bw && bx < ax + aw && ay < by + bh && by < ay + ah;
+}
+
+inline void invalidateHudFieldInRect(HudField &field, int x, int y, int w, int h) {
+    if (hudRectsOverlap(field.x, field.y, HUD_FIELD_CHARS * HUD_GLYPH_W, HUD_GLYPH_H, x, y, w, h)) {
+        invalidateHudField(field);
+    }
+}
+
+///////////////////////////////////////////////////////////////
+// Called after part of the screen was repainted: only the fields
+// (and labels) under the rectangle are redrawn
+///////////////////////////////////////////////////////////////
+inline void invalidateHudRect(int x, int y, int w, int h) {
+    invalidateHudFieldInRect(hudTimer, x, y, w, h);
+    invalidateHudFieldInRect(hudDistance, x, y, w, h);
+    invalidateHudFieldInRect(hudPowerups, x, y, w, h);
+    invalidateHudFieldInRect(hudAcceleration, x, y, w, h);
+    if (hudOverlayShown) {
+        invalidateHudFieldInRect(hudRttMedian, x, y, w, h);
+        invalidateHudFieldInRect(hudRttTail, x, y, w, h);
+        invalidateHudFieldInRect(hudLoss, x, y, w, h);
+    }
+    if (hudRectsOverlap(HUD_LABEL_PWR_X, HUD_LABEL_Y, HUD_LABEL_W, HUD_GLYPH_H, x, y, w, h) ||
+        hudRectsOverlap(HUD_LABEL_ACC_X, HUD_LABEL_Y, HUD_LABEL_W, HUD_GLYPH_H, x, y, w, h) ||
+        (hudOverlayShown &&
+         (hudRectsOverlap(HUD_LABEL_RTT_X, HUD_OVERLAY_Y, HUD_LABEL_W, HUD_GLYPH_H, x, y, w, h) ||
+          hudRectsOverlap(HUD_LABEL_DRP_X, HUD_OVERLAY_Y, HUD_LABEL_W, HUD_GLYPH_H, x, y, w, h)))) {
+        drawHudLabels();
+    }
+}
+
+#endif
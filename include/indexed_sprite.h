@@ -0,0 +1,177 @@
+#ifndef INDEXED_SPRITE_H
+#define INDEXED_SPRITE_H
+/////////////////////////////////////////////////////////////////////////////
+// Palette-indexed sprites
+//
+// Sprites are stored as 4-bit or 8-bit palette indices plus a small RGB565
+// palette per asset instead of a full 16-bit RGB565 value per pixel. A 4-bit
+// sprite is a quarter of the size of the RGB565 original and an 8-bit sprite
+// is half of it, which leaves flash for animation frames and halves the
+// bytes read per blit.
+//
+// Palette index 0 is always transparent (the old "black pixel is not drawn"
+// rule), so the expanded span uses palette[0] as the transparent key colour.
+//
+// The assets themselves are generated from game_image_bitmaps.h by
+// tools/convert_indexed_sprites.py into game_indexed_bitmaps.h.
+//
+// Nothing in here touches the display, so it compiles on the host as well
+// (see tools/bench_indexed_blit.cpp).
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+// Index 0 of every palette is the transparent key
+const uint8_t INDEXED_TRANSPARENT = 0;
+
+struct IndexedSprite {
+    uint16_t width;           // pixels per row
+    uint16_t height;          // rows
+    uint8_t bpp;              // 4 or 8 bits per index
+    uint16_t stride;          // bytes per row of index data
+    uint8_t paletteSize;      // number of valid palette entries
+    const uint16_t *palette;  // RGB565, palette[0] is the transparent key
+    const uint8_t *pixels;    // stride * height bytes, high nibble first for 4bpp
+};
+
+/////////////////////////////////////////////////////////////////
+// Lookup table used by the expansion kernel. For 4-bit sprites
+// every possible source byte (two pixels) maps straight to a pair
+// of RGB565 values, so a byte expands with one 32-bit store. For
+// 8-bit sprites the first 256 entries of single hold the palette.
+/////////////////////////////////////////////////////////////////
+struct IndexedLut {
+    uint32_t pair[256];
+    uint16_t single[256];
+};
+
+/////////////////////////////////////////////////////////////////
+// Builds the expansion table for a palette. Only needs to run
+// when the palette changes (once per asset at startup).
+/////////////////////////////////////////////////////////////////
+inline void buildIndexedLut(const uint16_t *palette, uint8_t paletteSize, IndexedLut &lut) {
+    for (int i = 0; i < 256; i++) {
+        lut.single[i] = (i < paletteSize) ? palette[i] : palette[0];
+    }
+    for (int b = 0; b < 256; b++) {
+        // high nibble is the left pixel; the pair is stored so that a
+        // little-endian 32-bit write puts the left pixel first
+        uint32_t left = lut.single[b >> 4];
+        uint32_t right = lut.single[b & 0x0F];
+        lut.pair[b] = left | (right << 16);
+    }
+}
+
+inline void buildIndexedLut(const IndexedSprite &sprite, IndexedLut &lut) {
+    buildIndexedLut(sprite.palette, sprite.paletteSize, lut);
+}
+
+/////////////////////////////////////////////////////////////////
+// Reads a single palette index, mainly for tooling and tests of
+// the kernel. Use expandIndexedSpan() for drawing.
+/////////////////////////////////////////////////////////////////
+inline uint8_t indexedPixelAt(const IndexedSprite &sprite, int x, int y) {
+    const uint8_t *row = sprite.pixels + y * sprite.stride;
+    if (sprite.bpp == 8) {
+        return row[x];
+    }
+    uint8_t b = row[x >> 1];
+    return (x & 1) ? (b & 0x0F) : (b >> 4);
+}
+
+/////////////////////////////////////////////////////////////////
+// Expansion kernel: converts `count` indices of row `y` starting
+// at column `x0` into RGB565 values in `out`. Transparent pixels
+// come out as palette[0] so the caller can push the whole span
+// with that colour as the transparent key.
+/////////////////////////////////////////////////////////////////
+inline void expandIndexedSpan(const IndexedSprite &sprite, const IndexedLut &lut,
+                              int y, int x0, int count, uint16_t *out) {
+    const uint8_t *row = sprite.pixels + y * sprite.stride;
+
+    if (sprite.bpp == 8) {
+        const uint8_t *src = row + x0;
+        for (int i = 0; i < count; i++) {
+            out[i] = lut.single[src[i]];
+        }
+        return;
+    }
+
+    // 4bpp: handle a leading odd pixel so the main loop is byte aligned
+    int x = x0;
+    int end = x0 + count;
+    if ((x & 1) && x < end) {
+        *out++ = lut.single[row[x >> 1] & 0x0F];
+        x++;
+    }
+
+    // Two pixels per source byte, one table lookup each
+    const uint8_t *src = row + (x >> 1);
+    int pairs = (end - x) >> 1;
+    for (int i = 0; i < pairs; i++) {
+        uint32_t p = lut.pair[src[i]];
+        memcpy(out, &p, sizeof(p));
+        out += 2;
+    }
+    x += pairs * 2;
+
+    // trailing odd pixel
+    if (x < end) {
+        *out = lut.single[row[x >> 1] >> 4];
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Same as expandIndexedSpan() but writes the span right to left,
+// so a sprite can be drawn flipped without storing a flipped copy.
+// out[0] receives the pixel at x0 + count - 1.
+/////////////////////////////////////////////////////////////////
+inline void expandIndexedSpanMirrored(const IndexedSprite &sprite, const IndexedLut &lut,
+                                      int y, int x0, int count, uint16_t *out) {
+    const uint8_t *row = sprite.pixels + y * sprite.stride;
+    uint16_t *dst = out + count;
+
+    if (sprite.bpp == 8) {
+        const uint8_t *src = row + x0;
+        for (int i = 0; i < count; i++) {
+            *--dst = lut.single[src[i]];
+        }
+        return;
+    }
+
+    int x = x0;
+    int end = x0 + count;
+    if ((x & 1) && x < end) {
+        *--dst = lut.single[row[x >> 1] & 0x0F];
+        x++;
+    }
+
+    // Same pair table, halves swapped so the right pixel lands first
+    const uint8_t *src = row + (x >> 1);
+    int pairs = (end - x) >> 1;
+    for (int i = 0; i < pairs; i++) {
+        uint32_t p = lut.pair[src[i]];
+        p = (p >> 16) | (p << 16);
+        dst -= 2;
+        memcpy(dst, &p, sizeof(p));
+    }
+    x += pairs * 2;
+
+    if (x < end) {
+        *--dst = lut.single[row[x >> 1] >> 4];
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Size of the index data for a sprite (used by the benchmark and
+// to report flash savings)
+/////////////////////////////////////////////////////////////////
+inline uint32_t indexedSpriteBytes(const IndexedSprite &sprite) {
+    return (uint32_t)sprite.stride * sprite.height + sprite.paletteSize * sizeof(uint16_t);
+}
+
+#endif
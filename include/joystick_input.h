@@ -0,0 +1,195 @@
+#ifndef JOYSTICK_INPUT_H
+#define JOYSTICK_INPUT_H
+/////////////////////////////////////////////////////////////////////////////
+// Analog joystick calibration and response.
+//
+// A calibration holds where the stick rests (its centre and how much the
+// reading jitters there) and how far it reaches on each side. Readings are
+// normalised per side, so an off-centre stick still reaches full speed in
+// both directions, and then go through a radial deadzone (on the length of
+// the vector, so diagonals behave like the axes) and a response curve that
+// blends linear and cubic for finer control at small deflections.
+//
+// The result is a fixed-point vector with JOY_ONE as full deflection, the
+// same scale kinematics.h takes. Everything is integer maths, so both
+// devices map the same readings to the same vector.
+//
+// Sampling the stick and keeping the calibration in NVS lives in
+// joystick_setup.h; nothing in here touches the hardware.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+
+const int JOY_ONE = 127;                 // full deflection
+const int JOY_RAW_MAX = 1023;            // seesaw ADC range
+const int JOY_MIN_SPAN = 100;            // a side shorter than this is a failed calibration
+const uint8_t JOY_CALIBRATION_VERSION = 1;
+
+struct JoystickCalibration {
+    uint8_t version;
+    uint8_t noise;        // largest distance from the centre seen while resting
+    int16_t centreX;      // raw readings
+    int16_t centreY;
+    int16_t minX;
+    int16_t maxX;
+    int16_t minY;
+    int16_t maxY;
+};
+
+struct JoystickResponse {
+    uint8_t deadzone;     // radius in JOY_ONE units
+    uint8_t curve;        // 0 = linear ... 255 = cubic
+};
+
+struct JoystickVector {
+    int16_t x;            // -JOY_ONE..JOY_ONE, same directions as the raw readings
+    int16_t y;
+};
+
+// Accumulates samples while calibrating
+struct JoystickCalibrator {
+    int32_t sumX;
+    int32_t sumY;
+    uint16_t count;
+    int16_t minX;
+    int16_t maxX;
+    int16_t minY;
+    int16_t maxY;
+};
+
+const JoystickResponse defaultJoystickResponse = { 16, 128 };
+
+// Stand-in until the stick has been calibrated: centred, full range
+inline void initJoystickCalibration(JoystickCalibration &cal) {
+    cal.version = JOY_CALIBRATION_VERSION;
+    cal.noise = 0;
+    cal.centreX = cal.centreY = JOY_RAW_MAX / 2;
+    cal.minX = cal.minY = 0;
+    cal.maxX = cal.maxY = JOY_RAW_MAX;
+}
+
+inline bool isJoystickCalibrationValid(const JoystickCalibration &cal) {
+    return cal.version == JOY_CALIBRATION_VERSION &&
+           cal.centreX - cal.minX >= JOY_MIN_SPAN && cal.maxX - cal.centreX >= JOY_MIN_SPAN &&
+           cal.centreY - cal.minY >= JOY_MIN_SPAN && cal.maxY - cal.centreY >= JOY_MIN_SPAN;
+}
+
+inline void resetJoystickCalibrator(JoystickCalibrator &calibrator) {
+    calibrator.sumX = calibrator.sumY = 0;
+    calibrator.count = 0;
+    calibrator.minX = calibrator.minY = JOY_RAW_MAX;
+    calibrator.maxX = calibrator.maxY = 0;
+}
+
+// One reading, either of the resting stick or while it is being circled
+inline void addJoystickSample(JoystickCalibrator &calibrator, int rawX, int rawY) {
+    calibrator.sumX += rawX;
+    calibrator.sumY += rawY;
+    calibrator.count++;
+    calibrator.minX = rawX < calibrator.minX ? rawX : calibrator.minX;
+    calibrator.maxX = rawX > calibrator.maxX ? rawX : calibrator.maxX;
+    calibrator.minY = rawY < calibrator.minY ? rawY : calibrator.minY;
+    calibrator.maxY = rawY > calibrator.maxY ? rawY : calibrator.maxY;
+}
+
+/////////////////////////////////////////////////////////////////
+// Takes the centre and its jitter from the resting samples
+/////////////////////////////////////////////////////////////////
+inline void finishJoystickCentre(const JoystickCalibrator &resting, JoystickCalibration &cal) {
+    cal.version = JOY_CALIBRATION_VERSION;
+    cal.centreX = resting.count ? resting.sumX / resting.count : JOY_RAW_MAX / 2;
+    cal.centreY = resting.count ? resting.sumY / resting.count : JOY_RAW_MAX / 2;
+    int noise = 0;
+    int d[4] = { cal.centreX - resting.minX, resting.maxX - cal.centreX,
+                 cal.centreY - resting.minY, resting.maxY - cal.centreY };
+    for (int i = 0; i < 4; i++) {
+        noise = d[i] > noise ? d[i] : noise;
+    }
+    cal.noise = noise > 255 ? 255 : noise;
+}
+
+/////////////////////////////////////////////////////////////////
+// Takes the reach of each side from the samples taken while the
+// stick was circled. Returns false if the stick didn't move far
+// enough for a usable calibration.
+/////////////////////////////////////////////////////////////////
+inline bool finishJoystickRange(const JoystickCalibrator &circled, JoystickCalibration &cal) {
+    cal.minX = circled.minX;
+    cal.maxX = circled.maxX;
+    cal.minY = circled.minY;
+    cal.maxY = circled.maxY;
+    return isJoystickCalibrationValid(cal);
+}
+
+// Integer square root (floor)
+inline uint32_t joystickIsqrt(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+// One axis scaled to -JOY_ONE..JOY_ONE against the reach of its side; a
+// side without any reach (a broken calibration) reads as centred
+inline int normaliseJoystickAxis(int raw, int centre, int low, int high) {
+    int offset = raw - centre;
+    int reach = (offset >= 0) ? high - centre : centre - low;
+    if (reach <= 0) {
+        return 0;
+    }
+    int value = offset * JOY_ONE / reach;
+    return value > JOY_ONE ? JOY_ONE : (value < -JOY_ONE ? -JOY_ONE : value);
+}
+
+/////////////////////////////////////////////////////////////////
+// Maps raw readings to a stick vector: per-side normalisation,
+// radial deadzone (never smaller than the measured jitter), then
+// the response curve on the length of the vector
+/////////////////////////////////////////////////////////////////
+inline JoystickVector mapJoystick(const JoystickCalibration &cal, const JoystickResponse &response,
+                                  int rawX, int rawY) {
+    JoystickVector out = { 0, 0 };
+    int x = normaliseJoystickAxis(rawX, cal.centreX, cal.minX, cal.maxX);
+    int y = normaliseJoystickAxis(rawY, cal.centreY, cal.minY, cal.maxY);
+    int length = joystickIsqrt((uint32_t)(x * x + y * y));
+
+    // Jitter in JOY_ONE units, against the shortest side
+    int sides[4] = { cal.centreX - cal.minX, cal.maxX - cal.centreX, cal.centreY - cal.minY, cal.maxY - cal.centreY };
+    int span = sides[0];
+    for (int i = 1; i < 4; i++) {
+        span = sides[i] < span ? sides[i] : span;
+    }
+    int deadzone = response.deadzone;
+    int jitter = span > 0 ? (cal.noise * JOY_ONE + span - 1) / span + 1 : 0;
+    deadzone = jitter > deadzone ? jitter : deadzone;
+    if (deadzone >= JOY_ONE) {
+        deadzone = JOY_ONE - 1;
+    }
+    if (length <= deadzone) {
+        return out;
+    }
+
+    // Rescale so the deadzone edge is 0 and full deflection stays JOY_ONE
+    int32_t linear = (int32_t)(length - deadzone) * JOY_ONE / (JOY_ONE - deadzone);
+    if (linear > JOY_ONE) {
+        linear = JOY_ONE;
+    }
+    int32_t cubic = linear * linear / JOY_ONE * linear / JOY_ONE;
+    int32_t curved = (linear * (255 - response.curve) + cubic * response.curve) / 255;
+
+    out.x = x * curved / length;
+    out.y = y * curved / length;
+    return out;
+}
+
+#endif
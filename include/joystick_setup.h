@@ -0,0 +1,106 @@
+#ifndef JOYSTICK_SETUP_H
+#define JOYSTICK_SETUP_H
+/////////////////////////////////////////////////////////////////////////////
+// Device side of the joystick calibration (joystick_input.h): samples the
+// seesaw stick, keeps the calibration in NVS and reads the stick as a
+// vector during the game.
+//
+// The first start (or a start with the Start button held) asks the player
+// to leave the stick alone for a moment and then to circle it, and stores
+// the result. Later starts load it from NVS and skip the prompts.
+//
+// Drawing goes straight to the LCD, so this has to run in setup() before
+// the render task is started.
+/////////////////////////////////////////////////////////////////////////////
+#include <M5Core2.h>
+#include <Preferences.h>
+#include <Adafruit_seesaw.h>
+#include "joystick_input.h"
+
+const uint8_t JOYSTICK_PIN_X = 14;
+const uint8_t JOYSTICK_PIN_Y = 15;
+const uint32_t JOYSTICK_REST_MS = 1000;     // resting samples for the centre
+const uint32_t JOYSTICK_CIRCLE_MS = 4000;   // samples while the stick is circled
+const uint32_t JOYSTICK_SAMPLE_MS = 10;
+const char JOYSTICK_NVS_NAMESPACE[] = "joystick";
+const char JOYSTICK_NVS_KEY[] = "cal";
+
+static JoystickCalibration joystickCalibration;
+
+// Calibration from NVS; false if there is none or it is not usable
+inline bool loadJoystickCalibration(JoystickCalibration &cal) {
+    Preferences prefs;
+    prefs.begin(JOYSTICK_NVS_NAMESPACE, true);
+    size_t read = prefs.getBytes(JOYSTICK_NVS_KEY, &cal, sizeof(cal));
+    prefs.end();
+    return read == sizeof(cal) && isJoystickCalibrationValid(cal);
+}
+
+inline void saveJoystickCalibration(const JoystickCalibration &cal) {
+    Preferences prefs;
+    prefs.begin(JOYSTICK_NVS_NAMESPACE, false);
+    prefs.putBytes(JOYSTICK_NVS_KEY, &cal, sizeof(cal));
+    prefs.end();
+}
+
+inline void drawJoystickPrompt(const char *line1, const char *line2) {
+    M5.Lcd.fillScreen(TFT_BLACK);
+    M5.Lcd.setTextSize(2);
+    M5.Lcd.setTextColor(TFT_WHITE);
+    M5.Lcd.drawString(line1, 10, 100);
+    M5.Lcd.drawString(line2, 10, 125);
+}
+
+// Feeds the calibrator with readings for `ms` milliseconds
+inline void sampleJoystick(Adafruit_seesaw &pad, JoystickCalibrator &calibrator, uint32_t ms) {
+    resetJoystickCalibrator(calibrator);
+    uint32_t start = millis();
+    while (millis() - start < ms) {
+        addJoystickSample(calibrator, pad.analogRead(JOYSTICK_PIN_X), pad.analogRead(JOYSTICK_PIN_Y));
+        delay(JOYSTICK_SAMPLE_MS);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Loads the calibration, or measures and stores a new one when
+// there is none or `recalibrate` is set. Falls back to a centred
+// full range stick if the measurement fails.
+/////////////////////////////////////////////////////////////////
+inline void setupJoystick(Adafruit_seesaw &pad, bool recalibrate) {
+    if (!recalibrate && loadJoystickCalibration(joystickCalibration)) {
+        Serial.println("Joystick calibration loaded");
+        return;
+    }
+
+    JoystickCalibrator calibrator;
+    drawJoystickPrompt("Leave the joystick", "centred...");
+    sampleJoystick(pad, calibrator, JOYSTICK_REST_MS);
+    finishJoystickCentre(calibrator, joystickCalibration);
+
+    drawJoystickPrompt("Move the joystick", "around its edge...");
+    sampleJoystick(pad, calibrator, JOYSTICK_CIRCLE_MS);
+    if (finishJoystickRange(calibrator, joystickCalibration)) {
+        saveJoystickCalibration(joystickCalibration);
+        Serial.printf("Joystick calibrated: centre %d,%d x %d..%d y %d..%d noise %d\n",
+                      joystickCalibration.centreX, joystickCalibration.centreY,
+                      joystickCalibration.minX, joystickCalibration.maxX,
+                      joystickCalibration.minY, joystickCalibration.maxY, joystickCalibration.noise);
+    } else {
+        Serial.println("Joystick calibration failed, using defaults");
+        initJoystickCalibration(joystickCalibration);
+    }
+    M5.Lcd.fillScreen(TFT_BLACK);
+}
+
+/////////////////////////////////////////////////////////////////
+// The stick as a screen vector: x to the right, y down (the
+// stick's X reading grows to the left)
+/////////////////////////////////////////////////////////////////
+inline JoystickVector readJoystick(Adafruit_seesaw &pad) {
+    JoystickVector v = mapJoystick(joystickCalibration, defaultJoystickResponse,
+                                   pad.analogRead(JOYSTICK_PIN_X), pad.analogRead(JOYSTICK_PIN_Y));
+    v.x = -v.x;
+    return v;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+/////////////////////////////////////////////////////////////////////////////
+// Fixed-point character movement.
+//
+// Positions and velocities are 24.8 fixed point (world pixels, pixels per
+// simulation tick). Every tick the joystick accelerates the body in
+// proportion to how far the stick is pushed, drag takes a fixed share of
+// the velocity away, and the body moves by its velocity in one step per
+// axis. With KIN_DRAG = 1/4 a fully pushed stick settles at the speed
+// level in pixels per tick, so a half pushed stick walks at half speed.
+//
+// Only integer adds, multiplies and divides are used (division truncates
+// towards zero on every C++11 compiler), so the same inputs give the same
+// bits on both ESP32s and on the host, see tools/test_kinematics.cpp.
+//
+// Walls are checked through a callback on whole pixel positions. A move
+// that ends in a wall backs off one pixel at a time towards where it
+// started, which costs at most the top speed in checks per tick.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+
+const int KIN_FRAC_BITS = 8;
+const int32_t KIN_ONE = 1 << KIN_FRAC_BITS;     // one pixel
+const int KIN_AXIS_MAX = 127;                   // stick fully pushed (JOY_ONE, joystick_input.h)
+const int32_t KIN_DRAG = 64;                    // share of the velocity lost per tick, in 1/256
+const int32_t KIN_STOP_SPEED = KIN_ONE / 16;    // slower than this without input stops the body
+
+struct KinematicBody {
+    int32_t x;     // world pixels, 24.8
+    int32_t y;
+    int32_t vx;    // pixels per tick, 24.8
+    int32_t vy;
+};
+
+// Called with whole pixel positions; true if the body can't be there
+typedef bool (*KinematicsBlockedFn)(int x, int y);
+
+inline int32_t kinFromPixels(int pixels) {
+    return (int32_t)pixels * KIN_ONE;
+}
+
+// Whole pixel a position is in (rounds down for negative positions too)
+inline int kinToPixels(int32_t value) {
+    return (value >= 0) ? value / KIN_ONE : -((-value + KIN_ONE - 1) / KIN_ONE);
+}
+
+// Puts the body on a pixel, standing still
+inline void placeBody(KinematicBody &body, int x, int y) {
+    body.x = kinFromPixels(x);
+    body.y = kinFromPixels(y);
+    body.vx = 0;
+    body.vy = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Re-places the body if the game moved the character somewhere
+// else (spawns, a new round), otherwise keeps the sub-pixel part
+/////////////////////////////////////////////////////////////////
+inline void syncBody(KinematicBody &body, int x, int y) {
+    if (kinToPixels(body.x) != x || kinToPixels(body.y) != y) {
+        placeBody(body, x, y);
+    }
+}
+
+// Top speed of a speed level (the HUD "acceleration", 1..5)
+inline int32_t kinTopSpeed(int level) {
+    return (int32_t)level * KIN_ONE;
+}
+
+/////////////////////////////////////////////////////////////////
+// One tick of one velocity component: drag, then the stick's
+// acceleration, then the speed limit
+/////////////////////////////////////////////////////////////////
+inline int32_t stepVelocity(int32_t velocity, int axis, int level) {
+    int32_t top = kinTopSpeed(level);
+    velocity -= velocity * KIN_DRAG / 256;
+    velocity += (int32_t)axis * (top * KIN_DRAG / 256) / KIN_AXIS_MAX;
+    if (axis == 0 && velocity > -KIN_STOP_SPEED && velocity < KIN_STOP_SPEED) {
+        velocity = 0;
+    }
+    if (velocity > top) {
+        velocity = top;
+    } else if (velocity < -top) {
+        velocity = -top;
+    }
+    return velocity;
+}
+
+/////////////////////////////////////////////////////////////////
+// Moves one axis by `delta`. If the pixel it lands on is blocked
+// it backs off towards the start and stops at the first free
+// pixel. Returns false if it ran into something.
+/////////////////////////////////////////////////////////////////
+inline bool moveBodyAxis(int32_t &position, int32_t delta, int otherPixel, bool horizontal,
+                         KinematicsBlockedFn blocked) {
+    int32_t target = position + delta;
+    int from = kinToPixels(position);
+    int to = kinToPixels(target);
+    if (to == from) {
+        position = target;
+        return true;
+    }
+    int back = (to > from) ? -1 : 1;
+    for (int p = to; p != from; p += back) {
+        if (!blocked(horizontal ? p : otherPixel, horizontal ? otherPixel : p)) {
+            position = (p == to) ? target : kinFromPixels(p);
+            return p == to;
+        }
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////
+// Advances the body by one simulation tick. Running into a wall
+// stops the velocity along that axis, so the body slides along
+// walls it hits at an angle.
+/////////////////////////////////////////////////////////////////
+inline void stepBody(KinematicBody &body, int axisX, int axisY, int level, KinematicsBlockedFn blocked) {
+    body.vx = stepVelocity(body.vx, axisX, level);
+    body.vy = stepVelocity(body.vy, axisY, level);
+    if (!moveBodyAxis(body.x, body.vx, kinToPixels(body.y), true, blocked)) {
+        body.vx = 0;
+    }
+    if (!moveBodyAxis(body.y, body.vy, kinToPixels(body.x), false, blocked)) {
+        body.vy = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef LINK_TELEMETRY_H
+#define LINK_TELEMETRY_H
+/////////////////////////////////////////////////////////////////////////////
+// Round trip and link quality telemetry.
+//
+// Both devices ping each other every LINK_PING_MS over their own
+// characteristic, separate from the game traffic. A ping carries the
+// sender's millis(); the peer sends it straight back and the sender keeps
+// the last LINK_RTT_WINDOW round trips for the percentiles.
+//
+// Next to the round trips the telemetry counts the bytes each side put on
+// and took off the link, and on the server how many notifications to the
+// player the stack took or turned down. fillLinkReport() gathers
+// all of it, and encodeLinkReport() packs it into the record the server
+// exposes on its telemetry characteristic and both roles print as hex
+// (tools/link_telemetry.py decodes it). Record layout, little-endian:
+//
+//     0   uint8   version (1)
+//     1   uint8   round trips in the window
+//     2   uint16  rtt p50, p90, p99, max (ms)
+//     10  uint32  pings sent, replies received
+//     18  uint32  notifications sent, failed
+//     26  uint32  bytes sent, received
+//     34  uint32  snapshots received, lost
+//
+// Nothing here touches the radio; the role files hand in a send function.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+#include "render_queue.h"
+
+const uint32_t LINK_PING_MS = 500;
+const uint32_t LINK_PING_STALE_MS = 5000;   // a reply later than this belonged to another link
+const uint8_t LINK_RTT_WINDOW = 32;
+const uint8_t PING_PACKET_SIZE = 6;         // type, seq, sender's millis (32 bit)
+const uint8_t TELEMETRY_VERSION = 1;
+const uint8_t TELEMETRY_RECORD_SIZE = 42;
+
+enum PingType { PING_REQUEST = 1, PING_REPLY = 2 };
+
+struct PingPacket {
+    uint8_t bytes[PING_PACKET_SIZE];
+};
+
+typedef void (*PingSendFn)(const uint8_t *bytes, size_t length);
+
+struct LinkTelemetry {
+    uint16_t rttMs[LINK_RTT_WINDOW];   // ring of the latest round trips
+    uint8_t rttCount;
+    uint8_t rttNext;
+    uint8_t pingSeq;
+    uint32_t nextPingMs;
+    uint32_t pingsSent;
+    uint32_t repliesReceived;
+    uint32_t bytesSent;                // loop task, counted by the send functions
+    volatile uint32_t bytesReceived;   // BLE task
+    volatile uint32_t notifyOk;        // BLE task, server only
+    volatile uint32_t notifyFailed;
+    RenderQueue<PingPacket, 8> inbox;  // BLE task -> loop
+};
+
+struct LinkReport {
+    uint8_t samples;
+    uint16_t rttMedian;
+    uint16_t rttP90;
+    uint16_t rttTail;                  // p99
+    uint16_t rttMax;
+    uint32_t pingsSent;
+    uint32_t repliesReceived;
+    uint32_t notifyOk;
+    uint32_t notifyFailed;
+    uint32_t bytesSent;
+    uint32_t bytesReceived;
+    uint32_t snapshotsReceived;
+    uint32_t snapshotsLost;
+};
+
+/////////////////////////////////////////////////////////////////
+// A new connection: the old round trips say nothing about it.
+// The counters keep running, like the snapshot stats.
+/////////////////////////////////////////////////////////////////
+inline void resetLinkTelemetry(LinkTelemetry &telemetry, uint32_t now) {
+    telemetry.rttCount = telemetry.rttNext = 0;
+    telemetry.nextPingMs = now;
+    PingPacket stale;
+    while (telemetry.inbox.pop(stale)) {
+    }
+}
+
+// Called from the BLE callback with a packet as it arrived
+inline bool receivePingPacket(LinkTelemetry &telemetry, const uint8_t *bytes, size_t length) {
+    if (length != PING_PACKET_SIZE) {
+        return false;
+    }
+    PingPacket packet;
+    memcpy(packet.bytes, bytes, length);
+    return telemetry.inbox.push(packet);   // a lost ping is just a missing sample
+}
+
+inline void addRttSample(LinkTelemetry &telemetry, uint32_t rttMs) {
+    telemetry.rttMs[telemetry.rttNext] = rttMs > 0xFFFF ? 0xFFFF : (uint16_t)rttMs;
+    telemetry.rttNext = (telemetry.rttNext + 1) % LINK_RTT_WINDOW;
+    if (telemetry.rttCount < LINK_RTT_WINDOW) {
+        telemetry.rttCount++;
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Call every loop while connected: answers the peer's pings,
+// times the replies to ours and sends the next ping when due.
+/////////////////////////////////////////////////////////////////
+inline void servicePings(LinkTelemetry &telemetry, uint32_t now, PingSendFn send) {
+    PingPacket packet;
+    while (telemetry.inbox.pop(packet)) {
+        if (packet.bytes[0] == PING_REQUEST) {
+            packet.bytes[0] = PING_REPLY;
+            send(packet.bytes, PING_PACKET_SIZE);
+        } else if (packet.bytes[0] == PING_REPLY) {
+            uint32_t sentMs = packet.bytes[2] | (packet.bytes[3] << 8) | (packet.bytes[4] << 16) |
+                              ((uint32_t)packet.bytes[5] << 24);
+            uint32_t rttMs = now - sentMs;
+            if (rttMs <= LINK_PING_STALE_MS) {
+                telemetry.repliesReceived++;
+                addRttSample(telemetry, rttMs);
+            }
+        }
+    }
+
+    if ((int32_t)(now - telemetry.nextPingMs) < 0) {
+        return;
+    }
+    telemetry.nextPingMs = now + LINK_PING_MS;
+    uint8_t ping[PING_PACKET_SIZE] = {
+        PING_REQUEST, telemetry.pingSeq++,
+        (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24)
+    };
+    send(ping, PING_PACKET_SIZE);
+    telemetry.pingsSent++;
+}
+
+/////////////////////////////////////////////////////////////////
+// Nearest rank percentile of the round trips in the window, 0 if
+// there are none yet. `sorted` holds rttCount sorted samples.
+/////////////////////////////////////////////////////////////////
+inline uint16_t rttPercentile(const uint16_t *sorted, uint8_t count, uint8_t percent) {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t rank = ((uint32_t)count * percent + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+inline void fillLinkReport(LinkReport &report, const LinkTelemetry &telemetry,
+                           uint32_t snapshotsReceived, uint32_t snapshotsLost) {
+    // Insertion sort of at most LINK_RTT_WINDOW samples, once a report
+    uint16_t sorted[LINK_RTT_WINDOW];
+    uint8_t count = telemetry.rttCount;
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t v = telemetry.rttMs[i];
+        int j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    report.samples = count;
+    report.rttMedian = rttPercentile(sorted, count, 50);
+    report.rttP90 = rttPercentile(sorted, count, 90);
+    report.rttTail = rttPercentile(sorted, count, 99);
+    report.rttMax = count ? sorted[count - 1] : 0;
+    report.pingsSent = telemetry.pingsSent;
+    report.repliesReceived = telemetry.repliesReceived;
+    report.notifyOk = telemetry.notifyOk;
+    report.notifyFailed = telemetry.notifyFailed;
+    report.bytesSent = telemetry.bytesSent;
+    report.bytesReceived = telemetry.bytesReceived;
+    report.snapshotsReceived = snapshotsReceived;
+    report.snapshotsLost = snapshotsLost;
+}
+
+inline uint8_t *putLinkReport16(uint8_t *out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    return out + 2;
+}
+
+inline uint8_t *putLinkReport32(uint8_t *out, uint32_t value) {
+    out = putLinkReport16(out, (uint16_t)value);
+    return putLinkReport16(out, (uint16_t)(value >> 16));
+}
+
+// Packs a report into TELEMETRY_RECORD_SIZE bytes (layout at the top)
+inline void encodeLinkReport(const LinkReport &report, uint8_t *out) {
+    *out++ = TELEMETRY_VERSION;
+    *out++ = report.samples;
+    out = putLinkReport16(out, report.rttMedian);
+    out = putLinkReport16(out, report.rttP90);
+    out = putLinkReport16(out, report.rttTail);
+    out = putLinkReport16(out, report.rttMax);
+    out = putLinkReport32(out, report.pingsSent);
+    out = putLinkReport32(out, report.repliesReceived);
+    out = putLinkReport32(out, report.notifyOk);
+    out = putLinkReport32(out, report.notifyFailed);
+    out = putLinkReport32(out, report.bytesSent);
+    out = putLinkReport32(out, report.bytesReceived);
+    out = putLinkReport32(out, report.snapshotsReceived);
+    putLinkReport32(out, report.snapshotsLost);
+}
+
+#endif
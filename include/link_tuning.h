@@ -0,0 +1,161 @@
+#ifndef LINK_TUNING_H
+#define LINK_TUNING_H
+/////////////////////////////////////////////////////////////////////////////
+// Picks the BLE connection parameters for what the game is doing.
+//
+// In the menus and on the game over screen almost nothing goes over the
+// link, so a long connection interval saves power. A game wants a short
+// one, but how short is worth it depends on the link. Every LINK_WINDOW_MS
+// of a game the tuner looks at the round trip of the snapshots
+// (state_snapshot.h) and how many of the peer's were lost. A slow or lossy
+// window moves one step to a shorter interval. LINK_CALM_WINDOWS clean
+// windows in a row move one step back to a longer one.
+//
+// The server applies the parameters and the client (the central) accepts
+// them. A new set goes out only when the step changes.
+//
+// Nothing here touches the radio; the role files apply what
+// takeLinkRequest() hands out and log what the controller settled on.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+
+const uint16_t LINK_MTU = 185;                  // asked for on connect; the default is 23
+const uint32_t LINK_WINDOW_MS = 2000;
+const uint32_t LINK_RTT_BUDGET_MS = 100;        // a snapshot acked later than this is too slow
+const uint32_t LINK_LOSS_HIGH_PERCENT = 10;
+const uint32_t LINK_LOSS_LOW_PERCENT = 2;
+const uint8_t LINK_CALM_WINDOWS = 3;
+
+// Connection parameters in controller units
+struct LinkParams {
+    uint16_t minInterval;   // 1.25 ms
+    uint16_t maxInterval;
+    uint16_t latency;       // connection events the peripheral may skip
+    uint16_t timeout;       // 10 ms
+};
+
+// Menus and game over: 100-200 ms
+const LinkParams linkIdleParams = { 80, 160, 2, 600 };
+
+// A game, shortest interval first
+const uint8_t LINK_GAME_STEPS = 3;
+const LinkParams linkGameSteps[LINK_GAME_STEPS] = {
+    { 6, 9, 0, 400 },       // 7.5-11.25 ms
+    { 12, 18, 0, 400 },     // 15-22.5 ms
+    { 24, 36, 0, 400 },     // 30-45 ms
+};
+
+// Parameters the controllers agreed on, from the GAP event on the BLE task
+struct LinkUpdate {
+    uint16_t status;
+    uint16_t interval;      // 1.25 ms
+    uint16_t latency;
+    uint16_t timeout;       // 10 ms
+};
+
+struct LinkTuner {
+    uint8_t inGame;
+    uint8_t step;                // into linkGameSteps
+    uint8_t calmWindows;
+    uint8_t requestDue;          // the parameters changed since takeLinkRequest()
+    uint32_t windowStartMs;
+    // Counters at the start of the window (they only ever grow)
+    uint32_t startReceived, startLost, startRttSamples, startRttTotalMs;
+    // The last window, for the logs
+    uint32_t rttMs;
+    uint32_t lossPercent;
+};
+
+// Connection intervals in the logs are in ms
+inline uint32_t linkIntervalMs(uint16_t units) {
+    return units * 5 / 4;
+}
+
+inline const LinkParams &linkParams(const LinkTuner &tuner) {
+    return tuner.inGame ? linkGameSteps[tuner.step] : linkIdleParams;
+}
+
+inline void startLinkWindow(LinkTuner &tuner, uint32_t now, uint32_t received, uint32_t lost,
+                            uint32_t rttSamples, uint32_t rttTotalMs) {
+    tuner.windowStartMs = now;
+    tuner.startReceived = received;
+    tuner.startLost = lost;
+    tuner.startRttSamples = rttSamples;
+    tuner.startRttTotalMs = rttTotalMs;
+}
+
+// A new connection starts idle, with the idle parameters to request
+inline void resetLinkTuner(LinkTuner &tuner, uint32_t now) {
+    tuner.inGame = 0;
+    tuner.step = 0;
+    tuner.calmWindows = 0;
+    tuner.requestDue = 1;
+    tuner.rttMs = tuner.lossPercent = 0;
+    startLinkWindow(tuner, now, 0, 0, 0, 0);
+}
+
+/////////////////////////////////////////////////////////////////
+// Switches between the idle and the game parameters. A game
+// always starts on the shortest interval.
+/////////////////////////////////////////////////////////////////
+inline void setLinkInGame(LinkTuner &tuner, bool inGame) {
+    if (tuner.inGame == (uint8_t)inGame) {
+        return;
+    }
+    tuner.inGame = inGame;
+    tuner.step = 0;
+    tuner.calmWindows = 0;
+    tuner.requestDue = 1;
+}
+
+/////////////////////////////////////////////////////////////////
+// Call every loop with the snapshot link's running counters.
+// Returns true when a game window closed; rttMs and lossPercent
+// then hold what it measured.
+/////////////////////////////////////////////////////////////////
+inline bool updateLinkTuner(LinkTuner &tuner, uint32_t now, uint32_t received, uint32_t lost,
+                            uint32_t rttSamples, uint32_t rttTotalMs) {
+    if (!tuner.inGame) {
+        startLinkWindow(tuner, now, received, lost, rttSamples, rttTotalMs);
+        return false;
+    }
+    if (now - tuner.windowStartMs < LINK_WINDOW_MS) {
+        return false;
+    }
+    uint32_t windowReceived = received - tuner.startReceived;
+    uint32_t windowLost = lost - tuner.startLost;
+    uint32_t windowSamples = rttSamples - tuner.startRttSamples;
+    uint32_t windowRttMs = rttTotalMs - tuner.startRttTotalMs;
+    startLinkWindow(tuner, now, received, lost, rttSamples, rttTotalMs);
+    if (windowSamples == 0 || windowReceived + windowLost == 0) {
+        return false;   // nothing to go by
+    }
+    tuner.rttMs = windowRttMs / windowSamples;
+    tuner.lossPercent = windowLost * 100 / (windowReceived + windowLost);
+
+    if (tuner.rttMs > LINK_RTT_BUDGET_MS || tuner.lossPercent > LINK_LOSS_HIGH_PERCENT) {
+        tuner.calmWindows = 0;
+        if (tuner.step > 0) {
+            tuner.step--;
+            tuner.requestDue = 1;
+        }
+    } else if (tuner.rttMs <= LINK_RTT_BUDGET_MS / 2 && tuner.lossPercent <= LINK_LOSS_LOW_PERCENT) {
+        if (++tuner.calmWindows >= LINK_CALM_WINDOWS && tuner.step + 1 < LINK_GAME_STEPS) {
+            tuner.step++;
+            tuner.calmWindows = 0;
+            tuner.requestDue = 1;
+        }
+    } else {
+        tuner.calmWindows = 0;
+    }
+    return true;
+}
+
+// True once for every change of parameters; the caller requests linkParams()
+inline bool takeLinkRequest(LinkTuner &tuner) {
+    bool due = tuner.requestDue;
+    tuner.requestDue = 0;
+    return due;
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+/////////////////////////////////////////////////////////////////////////////
+// Deterministic lockstep for the input mode NET_LOCKSTEP (duel_sim.h).
+//
+// Only inputs cross the link. A tick runs once both players' inputs for it
+// are in, so both devices run exactly the same ticks on exactly the same
+// inputs and never have to correct anything. To hide the link, an input
+// read now is played LOCKSTEP_DELAY ticks later; as long as the peer's
+// inputs arrive within that, nobody waits. A slower link makes both sides
+// wait for each other rather than drift apart.
+//
+// Every LOCKSTEP_HASH_TICKS ticks each side hashes its state and sends the
+// hash along with its next few input packets. The peer compares it with
+// its own for the same tick; a difference means the simulations went
+// apart (a desync) and is counted with the first tick it showed on.
+//
+// Nothing here touches the radio; the role files hand in a send function.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+#include "duel_sim.h"
+
+const uint8_t LOCKSTEP_DELAY = 4;               // ticks between reading an input and playing it, 80 ms
+const uint8_t LOCKSTEP_HASH_TICKS = 25;         // a state hash every half second
+const uint8_t LOCKSTEP_HASH_SENDS = 4;          // packets that carry each hash
+const uint8_t LOCKSTEP_HASHES = 4;              // own hashes kept for the peer's to catch up
+const uint8_t LOCKSTEP_REPEAT = 1;              // inputs sent before that go again with the new ones
+const uint32_t LOCKSTEP_RESEND_MS = 40;         // unacknowledged inputs go again after this
+
+struct LockstepStats {
+    uint32_t waits;             // ticks due that had to wait for the peer
+    uint32_t checks;            // hashes compared
+    uint32_t desyncs;           // ... that differed
+    uint32_t firstDesyncTick;
+    uint32_t malformed;
+};
+
+struct LockstepSession {
+    uint8_t local;                              // our body: 0 server, 1 client
+    DuelState state;
+    DuelInput inputs[2][DUEL_INPUT_RING];       // by tick % DUEL_INPUT_RING
+    uint8_t known[DUEL_INPUT_RING];             // the peer's input for that slot arrived
+    uint32_t confirmed;                         // the peer's inputs are known for every tick before this
+    uint32_t scheduled;                         // ours are there for every tick before this
+    uint32_t acked;                             // the peer has ours for every tick before this
+    uint32_t sentTick;                          // ours went out once for every tick before this
+    uint32_t lastSendMs;
+    DuelHash hashes[LOCKSTEP_HASHES];           // ours, by (tick / LOCKSTEP_HASH_TICKS) % LOCKSTEP_HASHES
+    uint8_t hashSends;                          // packets the newest of ours still goes out with
+    DuelHash peerHash;                          // the peer's newest, compared once we are there
+    uint8_t peerHashPending;
+    uint32_t lastCheckTick;
+    RenderQueue<DuelPacket, 8> inbox;           // BLE task -> loop
+    LockstepStats stats;
+};
+
+/////////////////////////////////////////////////////////////////
+// A new game on both devices: the state at tick 0, and both
+// players standing still for the first LOCKSTEP_DELAY ticks
+/////////////////////////////////////////////////////////////////
+inline void resetLockstep(LockstepSession &session, uint8_t local, const TileMap &map,
+                          uint8_t serverCharacter, uint8_t clientCharacter, uint8_t level) {
+    session.local = local;
+    resetDuel(session.state, map, serverCharacter, clientCharacter);
+    DuelInput still = {0, 0, level};
+    for (uint8_t t = 0; t < LOCKSTEP_DELAY; t++) {
+        session.inputs[0][t] = session.inputs[1][t] = still;
+    }
+    memset(session.known, 0, sizeof(session.known));
+    session.confirmed = session.scheduled = session.acked = LOCKSTEP_DELAY;
+    session.sentTick = LOCKSTEP_DELAY;
+    session.lastSendMs = 0;
+    memset(session.hashes, 0xFF, sizeof(session.hashes));
+    session.hashSends = 0;
+    session.peerHashPending = 0;
+    session.lastCheckTick = 0;
+    memset(&session.stats, 0, sizeof(session.stats));
+    DuelPacket stale;
+    while (session.inbox.pop(stale)) {
+    }
+}
+
+// Called from the BLE callback with a packet as it arrived
+inline bool receiveLockstepPacket(LockstepSession &session, const uint8_t *bytes, size_t length) {
+    return queueDuelPacket(session.inbox, bytes, length);
+}
+
+// Compares the peer's hash with ours once we have one for its tick
+inline void checkLockstepHash(LockstepSession &session) {
+    if (!session.peerHashPending || (int32_t)(session.peerHash.tick - session.state.tick) > 0) {
+        return;   // we aren't there yet
+    }
+    session.peerHashPending = 0;
+    const DuelHash &own = session.hashes[session.peerHash.tick / LOCKSTEP_HASH_TICKS % LOCKSTEP_HASHES];
+    if (own.tick != session.peerHash.tick) {
+        return;   // too old to tell
+    }
+    session.lastCheckTick = own.tick;
+    session.stats.checks++;
+    if (own.value != session.peerHash.value) {
+        if (!session.stats.desyncs) {
+            session.stats.firstDesyncTick = own.tick;
+        }
+        session.stats.desyncs++;
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Takes in the peer's packets: its inputs, how far it has ours
+// and its latest hash. Call every loop before advanceLockstep().
+/////////////////////////////////////////////////////////////////
+inline void receiveLockstepInputs(LockstepSession &session) {
+    uint8_t remote = 1 - session.local;
+    DuelPacket packet;
+    DuelPacketView view;
+    while (session.inbox.pop(packet)) {
+        if (!decodeDuelPacket(packet, session.confirmed, session.acked, view)) {
+            session.stats.malformed++;
+            continue;
+        }
+        if ((int32_t)(view.ack - session.acked) > 0 && (int32_t)(view.ack - session.scheduled) <= 0) {
+            session.acked = view.ack;
+        }
+        for (uint8_t i = 0; i < view.count; i++) {
+            uint32_t tick = view.first + i;
+            if ((int32_t)(tick - session.confirmed) >= 0 && tick - session.confirmed < DUEL_INPUT_RING) {
+                session.inputs[remote][tick % DUEL_INPUT_RING] = decodeDuelInput(view.inputs + i * DUEL_INPUT_SIZE);
+                session.known[tick % DUEL_INPUT_RING] = 1;
+            }
+        }
+        while (session.known[session.confirmed % DUEL_INPUT_RING]) {
+            session.known[session.confirmed % DUEL_INPUT_RING] = 0;   // the slot is reused DUEL_INPUT_RING later
+            session.confirmed++;
+        }
+        if (view.hasHash && (int32_t)(view.hash.tick - session.lastCheckTick) > 0 &&
+            (!session.peerHashPending || (int32_t)(view.hash.tick - session.peerHash.tick) > 0)) {
+            session.peerHash = view.hash;
+            session.peerHashPending = 1;
+        }
+    }
+    checkLockstepHash(session);
+}
+
+/////////////////////////////////////////////////////////////////
+// Runs up to `ticks` ticks, as far as the peer's inputs go. Each
+// tick that runs schedules `input` LOCKSTEP_DELAY ticks on.
+// Returns how many ran.
+/////////////////////////////////////////////////////////////////
+inline uint32_t advanceLockstep(LockstepSession &session, const DuelInput &input, uint32_t ticks) {
+    uint32_t ran = 0;
+    for (; ran < ticks; ran++) {
+        uint32_t tick = session.state.tick;
+        if ((int32_t)(tick - session.confirmed) >= 0 ||
+            (int32_t)(session.scheduled - session.acked) >= (int32_t)DUEL_INPUT_RING - 1) {
+            session.stats.waits += ticks - ran;
+            break;
+        }
+        stepDuel(session.state, session.inputs[0][tick % DUEL_INPUT_RING], session.inputs[1][tick % DUEL_INPUT_RING]);
+        session.inputs[session.local][session.scheduled % DUEL_INPUT_RING] = input;
+        session.scheduled++;
+
+        if (session.state.tick % LOCKSTEP_HASH_TICKS == 0) {
+            DuelHash &own = session.hashes[session.state.tick / LOCKSTEP_HASH_TICKS % LOCKSTEP_HASHES];
+            own.tick = session.state.tick;
+            own.value = duelStateHash(session.state);
+            session.hashSends = LOCKSTEP_HASH_SENDS;
+        }
+    }
+    checkLockstepHash(session);
+    return ran;
+}
+
+/////////////////////////////////////////////////////////////////
+// Sends our inputs that haven't gone out yet (and the one before,
+// so a single lost packet costs nothing), or, if nothing new
+// went out for LOCKSTEP_RESEND_MS, the oldest the peer hasn't
+// acknowledged. Every packet carries our ack, and our newest
+// hash for a few packets after it is taken. Call every loop
+// after advanceLockstep().
+/////////////////////////////////////////////////////////////////
+inline void sendLockstepInputs(LockstepSession &session, uint32_t now, DuelSendFn send) {
+    bool fresh = (int32_t)(session.scheduled - session.sentTick) > 0;
+    if (!fresh && now - session.lastSendMs < LOCKSTEP_RESEND_MS) {
+        return;
+    }
+    const DuelHash *hash = NULL;
+    uint8_t room = DUEL_PACKET_INPUTS;
+    if (session.hashSends) {
+        hash = &session.hashes[(session.state.tick / LOCKSTEP_HASH_TICKS) % LOCKSTEP_HASHES];
+        session.hashSends--;
+        room--;
+    }
+    uint32_t first = session.acked;
+    if (fresh && (int32_t)(session.sentTick - LOCKSTEP_REPEAT - session.acked) > 0) {
+        first = session.sentTick - LOCKSTEP_REPEAT;
+    }
+    uint32_t count = session.scheduled - first;
+    if (count > room) {
+        count = room;
+    }
+
+    uint8_t packet[DUEL_PACKET_SIZE];
+    send(packet, encodeDuelPacket(packet, session.inputs[session.local], first, count, session.confirmed, hash));
+    if (fresh) {
+        session.sentTick = first + count;
+    }
+    session.lastSendMs = now;
+}
+
+#endif
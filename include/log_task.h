@@ -0,0 +1,67 @@
+#ifndef LOG_TASK_H
+#define LOG_TASK_H
+/////////////////////////////////////////////////////////////////////////////
+// The firmware's log (binary_log.h) and the task that writes it out.
+//
+// logEvent() can be called from any task and never blocks: it queues a
+// record and returns. Every LOG_DRAIN_MS the log task encodes what came in
+// and writes it to Serial in one go, at the lowest priority above idle and
+// off the loop's core, so the UART only ever waits on this task.
+//
+// Text written straight to Serial still works (setup runs before the task).
+// The telemetry record and the match recording go through the log as bytes
+// (logEventBytes()); tools/decode_log.py prints them as the lines of hex
+// their tools read, so pipe its output into those tools.
+/////////////////////////////////////////////////////////////////////////////
+#include <Arduino.h>
+#include "binary_log.h"
+
+#ifdef ARDUINO_RUNNING_CORE
+const BaseType_t LOG_CORE = (ARDUINO_RUNNING_CORE == 0) ? 1 : 0;
+#else
+const BaseType_t LOG_CORE = 0;
+#endif
+const uint32_t LOG_STACK_SIZE = 3072;
+const UBaseType_t LOG_PRIORITY = 1;
+const uint32_t LOG_DRAIN_MS = 50;
+const size_t LOG_DRAIN_BYTES = 256;
+
+static BinaryLog eventLog;
+static TaskHandle_t logTaskHandle = NULL;
+
+// Logs `site` with its integer arguments (binary_log.h)
+template <typename... Args>
+inline void logEvent(uint8_t site, Args... args) {
+    if (logSiteEnabled(site)) {
+        logRecord(eventLog, site, millis(), args...);
+    }
+}
+
+// Logs `length` bytes for a %h site (binary_log.h); false if any part was dropped
+inline bool logEventBytes(uint8_t site, const uint8_t *bytes, size_t length) {
+    return logBytes(eventLog, site, millis(), bytes, length);
+}
+
+// Records the queue can take right now; bulk logging (the match dump)
+// leaves room for everything else
+inline uint32_t logSpace() {
+    return eventLog.queue.space();
+}
+
+inline void logTask(void *) {
+    static uint8_t out[LOG_DRAIN_BYTES];
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+        size_t length;
+        while ((length = drainBinaryLog(eventLog, millis(), out, sizeof(out))) > 0) {
+            Serial.write(out, length);
+        }
+    }
+}
+
+// Starts the log task; records queued before this wait for it
+inline void startLogTask() {
+    xTaskCreatePinnedToCore(logTask, "log", LOG_STACK_SIZE, NULL, LOG_PRIORITY, &logTaskHandle, LOG_CORE);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef MATCH_BEACON_H
+#define MATCH_BEACON_H
+/////////////////////////////////////////////////////////////////////////////
+// The server's match status, in the manufacturer data of its advertising.
+//
+// Clients used to connect to the first server advertising the service with
+// the right name, and only found out after the connection and the service
+// discovery whether it already had a player. The name is in the scan
+// response, so it also took an active scan. Now the advertising packet
+// itself says whether there is room, and a client picks a server in the scan
+// callback without connecting:
+//
+//     0   uint16  company id (0xFFFF, the one kept for tests and prototypes)
+//     2   uint8   MATCH_BEACON_MAGIC
+//     3   uint8   version << 4 | network mode (NET_MODE, duel_sim.h)
+//     4   uint8   game state | the server's character << 4 (1 princess,
+//                 2 dragon, 3 unchosen)
+//     5   uint8   free player slots | free spectator slots << 4
+//
+// With the flags and the 128 bit service UUID this still fits the 31 bytes
+// of a legacy advertising packet. A server only joins players built for the
+// same network mode, and a spectator (spectator_feed.h) only a server
+// whose player slot is taken. The server refreshes the data whenever any of
+// it changes. Nothing here touches the radio, see
+// tools/test_match_beacon.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stddef.h>
+
+const uint16_t MATCH_BEACON_COMPANY = 0xFFFF;
+const uint8_t MATCH_BEACON_MAGIC = 0xF1;
+const uint8_t MATCH_BEACON_VERSION = 1;
+const uint8_t MATCH_BEACON_SIZE = 6;
+const uint8_t MATCH_BEACON_ADVERTISING_SIZE = 31;   // a legacy advertising packet, AD headers included
+
+struct MatchBeacon {
+    uint8_t netMode;
+    uint8_t state;              // GameState (game_flow.h)
+    uint8_t character;          // the server player's
+    uint8_t freePlayers;
+    uint8_t freeSpectators;
+};
+
+inline uint8_t encodeMatchBeacon(const MatchBeacon &beacon, uint8_t *out) {
+    out[0] = (uint8_t)MATCH_BEACON_COMPANY;
+    out[1] = (uint8_t)(MATCH_BEACON_COMPANY >> 8);
+    out[2] = MATCH_BEACON_MAGIC;
+    out[3] = MATCH_BEACON_VERSION << 4 | (beacon.netMode & 0x0F);
+    out[4] = (beacon.state & 0x0F) | (beacon.character & 0x03) << 4;
+    out[5] = (beacon.freePlayers & 0x0F) | (beacon.freeSpectators & 0x0F) << 4;
+    return MATCH_BEACON_SIZE;
+}
+
+/////////////////////////////////////////////////////////////////
+// Reads the manufacturer data of an advertisement. False for
+// anything that isn't a beacon of this version, which includes
+// every other device around.
+/////////////////////////////////////////////////////////////////
+inline bool decodeMatchBeacon(const uint8_t *bytes, size_t length, MatchBeacon &beacon) {
+    if (length != MATCH_BEACON_SIZE || bytes[0] != (uint8_t)MATCH_BEACON_COMPANY ||
+        bytes[1] != (uint8_t)(MATCH_BEACON_COMPANY >> 8) || bytes[2] != MATCH_BEACON_MAGIC ||
+        (bytes[3] >> 4) != MATCH_BEACON_VERSION) {
+        return false;
+    }
+    beacon.netMode = bytes[3] & 0x0F;
+    beacon.state = bytes[4] & 0x0F;
+    beacon.character = (bytes[4] >> 4) & 0x03;
+    beacon.freePlayers = bytes[5] & 0x0F;
+    beacon.freeSpectators = bytes[5] >> 4;
+    return true;
+}
+
+inline bool sameMatchBeacon(const MatchBeacon &a, const MatchBeacon &b) {
+    return a.netMode == b.netMode && a.state == b.state && a.character == b.character &&
+           a.freePlayers == b.freePlayers && a.freeSpectators == b.freeSpectators;
+}
+
+// A player built for `netMode` can join this server
+inline bool matchBeaconJoinable(const MatchBeacon &beacon, uint8_t netMode) {
+    return beacon.freePlayers > 0 && beacon.netMode == netMode;
+}
+
+// A spectator can watch: somebody plays, and there is room to watch
+inline bool matchBeaconWatchable(const MatchBeacon &beacon) {
+    return beacon.freePlayers == 0 && beacon.freeSpectators > 0;
+}
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef MATCH_RECORD_H
+#define MATCH_RECORD_H
+/////////////////////////////////////////////////////////////////////////////
+// Match recording and deterministic replay.
+//
+// While a game runs each device records, on its simulation tick, what went
+// into its own simulation: the stick and button inputs it read, the
+// opponent positions and channel messages it took in, and where the game
+// ended. Every MATCH_CHECK_TICKS it also records a hash of the state those
+// produced. replayMatch() runs the same entries through the same code
+// (kinematics.h, powerups.h, character_collision.h) on the host and checks
+// every hash, so a match that went wrong on a device can be stepped
+// through offline (tools/replay_match.cpp).
+//
+// The simulation only moves on ticks, so an entry stamped with tick T
+// happened after tick T ran and before tick T + 1. The recording stays in
+// a RAM buffer; when the match is over the roles log it, and the decoded
+// serial log (tools/decode_log.py) has it as hex lines for the replayer. A match that outgrows
+// the buffer keeps its first MATCH_RECORD_SIZE bytes and is replayed up
+// to there.
+//
+// Entry layout: a header byte, low nibble the type and high nibble the
+// ticks since the last entry (15: a varint with the full count follows),
+// then the payload. Multi-byte fields are little-endian.
+//
+//     MATCH_START      role, character, opponent, level,
+//                      int16 x, y, opponent x, opponent y
+//     MATCH_INPUT      int8 stick x, stick y, uint8 level, flags
+//     MATCH_OPPONENT   int16 opponent x, y
+//     MATCH_STEP       int8 opponent dx, dy (since the last position)
+//     MATCH_MESSAGE    type, length, payload (reliable_channel.h)
+//     MATCH_CHECK      uint32 state hash, uint16 time left (0.1 s)
+//     MATCH_END        the game flow event that ended the game
+//
+// Nothing here touches the radio or the display.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+#include "kinematics.h"
+#include "powerups.h"
+#include "character_collision.h"
+#include "reliable_channel.h"
+#include "game_flow.h"
+
+const uint8_t MATCH_RECORD_VERSION = 1;
+const uint32_t MATCH_RECORD_SIZE = 32768;
+const uint32_t MATCH_CHECK_TICKS = 25;          // a hash every half second
+const uint8_t MATCH_MAX_ENTRY = 1 + 5 + 12;     // header, tick varint, largest payload
+const uint8_t MATCH_INPUT_POWERUP = 1;          // flags: SELECT went down
+const uint32_t MATCH_DUMP_BYTES = 28;           // per line of the dump, one log record (binary_log.h)
+
+enum MatchRole { MATCH_ROLE_SERVER, MATCH_ROLE_CLIENT };
+
+enum MatchEntryType {
+    MATCH_START = 1,
+    MATCH_INPUT,
+    MATCH_OPPONENT,
+    MATCH_STEP,
+    MATCH_MESSAGE,
+    MATCH_CHECK,
+    MATCH_END,
+    MATCH_TYPE_COUNT
+};
+
+// Payload bytes of each type; 0xFF: the second byte is a length
+const uint8_t matchPayloadSizes[MATCH_TYPE_COUNT] = { 0, 12, 4, 4, 2, 0xFF, 6, 1 };
+
+struct MatchRecorder {
+    uint8_t bytes[MATCH_RECORD_SIZE];
+    uint32_t length;
+    uint32_t lastTick;          // of the last entry
+    uint32_t lastCheckTick;
+    uint32_t lastInputAt;       // offset of the last input entry
+    uint8_t recording;
+    uint8_t ended;              // only further ends are recorded
+    uint8_t truncated;          // ran out of room
+    int8_t moveX, moveY;        // what the last input entry said
+    uint8_t level;
+    int16_t opponentX, opponentY;
+};
+
+struct MatchEntry {
+    uint8_t type;
+    uint32_t tick;
+    const uint8_t *payload;
+    uint8_t length;
+};
+
+/////////////////////////////////////////////////////////////////
+// Hash of everything a tick of the match decides. Both the roles
+// and the replayer hash with this, so it holds no wall clock
+// values.
+/////////////////////////////////////////////////////////////////
+inline uint32_t matchHashMix(uint32_t hash, int32_t value) {
+    hash ^= (uint32_t)value;
+    return hash * 16777619UL;
+}
+
+inline uint32_t matchStateHash(uint32_t tick, const KinematicBody &body, int opponentX, int opponentY,
+                               const Powerups &powerups) {
+    uint32_t hash = 2166136261UL;
+    hash = matchHashMix(hash, tick);
+    hash = matchHashMix(hash, body.x);
+    hash = matchHashMix(hash, body.y);
+    hash = matchHashMix(hash, body.vx);
+    hash = matchHashMix(hash, body.vy);
+    hash = matchHashMix(hash, opponentX);
+    hash = matchHashMix(hash, opponentY);
+    hash = matchHashMix(hash, powerups.left);
+    hash = matchHashMix(hash, isPowerupActive(powerups.own, tick) ? (int32_t)powerups.own.startTick : -1);
+    hash = matchHashMix(hash, isPowerupActive(powerups.opponent, tick) ? (int32_t)powerups.opponent.startTick : -1);
+    return hash;
+}
+
+inline void putMatch16(uint8_t *out, int32_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+inline int16_t getMatch16(const uint8_t *in) {
+    return (int16_t)(uint16_t)(in[0] | (in[1] << 8));
+}
+
+/////////////////////////////////////////////////////////////////
+// Writes an entry header and returns where the payload goes, or
+// NULL (and stops the recording) if the buffer is full
+/////////////////////////////////////////////////////////////////
+inline uint8_t *beginMatchEntry(MatchRecorder &recorder, uint8_t type, uint32_t tick, uint8_t payloadLength) {
+    if (!recorder.recording || (recorder.ended && type != MATCH_END)) {
+        return NULL;
+    }
+    if (recorder.length + MATCH_MAX_ENTRY > MATCH_RECORD_SIZE) {
+        recorder.recording = 0;
+        recorder.truncated = 1;
+        return NULL;
+    }
+    uint32_t delta = tick - recorder.lastTick;
+    recorder.lastTick = tick;
+    uint8_t *out = recorder.bytes + recorder.length;
+    uint8_t *p = out;
+    *p++ = type | ((delta < 15 ? delta : 15) << 4);
+    if (delta >= 15) {
+        do {
+            *p++ = (delta & 0x7F) | (delta >= 0x80 ? 0x80 : 0);
+            delta >>= 7;
+        } while (delta);
+    }
+    recorder.length += (p - out) + payloadLength;
+    return p;
+}
+
+// Opponent position as the game applied it; small moves as a step
+inline void recordMatchOpponent(MatchRecorder &recorder, uint32_t tick, int x, int y) {
+    int dx = x - recorder.opponentX;
+    int dy = y - recorder.opponentY;
+    if (dx == 0 && dy == 0) {
+        return;
+    }
+    uint8_t *p;
+    if (dx >= -128 && dx <= 127 && dy >= -128 && dy <= 127) {
+        p = beginMatchEntry(recorder, MATCH_STEP, tick, 2);
+        if (p) {
+            p[0] = (uint8_t)(int8_t)dx;
+            p[1] = (uint8_t)(int8_t)dy;
+        }
+    } else {
+        p = beginMatchEntry(recorder, MATCH_OPPONENT, tick, 4);
+        if (p) {
+            putMatch16(p, x);
+            putMatch16(p + 2, y);
+        }
+    }
+    if (p) {
+        recorder.opponentX = x;
+        recorder.opponentY = y;
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// A new game. Called once its tick clock and powerups are reset,
+// with the positions it starts from. Characters in PlayerType
+// order (0 princess, 1 dragon).
+/////////////////////////////////////////////////////////////////
+inline void startMatchRecord(MatchRecorder &recorder, uint8_t role, uint8_t character, uint8_t opponent,
+                             uint8_t level, int x, int y, int opponentX, int opponentY) {
+    recorder.length = 0;
+    recorder.lastTick = recorder.lastCheckTick = 0;
+    recorder.lastInputAt = MATCH_RECORD_SIZE;
+    recorder.recording = 1;
+    recorder.ended = recorder.truncated = 0;
+    recorder.bytes[recorder.length++] = MATCH_RECORD_VERSION;
+    uint8_t *p = beginMatchEntry(recorder, MATCH_START, 0, matchPayloadSizes[MATCH_START]);
+    p[0] = role;
+    p[1] = character;
+    p[2] = opponent;
+    p[3] = level;
+    putMatch16(p + 4, x);
+    putMatch16(p + 6, y);
+    putMatch16(p + 8, opponentX);
+    putMatch16(p + 10, opponentY);
+    recorder.moveX = recorder.moveY = 0;
+    recorder.level = level;
+    recorder.opponentX = opponentX;
+    recorder.opponentY = opponentY;
+}
+
+/////////////////////////////////////////////////////////////////
+// The inputs a loop read before running its ticks. Only changes
+// are recorded; a change on the same tick as the entry before it
+// overwrites that entry, since no tick ran in between.
+/////////////////////////////////////////////////////////////////
+inline void recordMatchInput(MatchRecorder &recorder, uint32_t tick, int moveX, int moveY, int level,
+                             bool powerupPressed) {
+    if (!recorder.recording || recorder.ended) {
+        return;
+    }
+    if (moveX == recorder.moveX && moveY == recorder.moveY && level == recorder.level && !powerupPressed) {
+        return;
+    }
+    uint8_t *p;
+    uint8_t flags = powerupPressed ? MATCH_INPUT_POWERUP : 0;
+    if (recorder.lastInputAt + 1 + matchPayloadSizes[MATCH_INPUT] == recorder.length &&
+        recorder.lastTick == tick) {
+        p = recorder.bytes + recorder.lastInputAt + 1;
+        flags |= p[3];   // a second press on a tick is in the cooldown anyway
+    } else {
+        recorder.lastInputAt = recorder.length;
+        p = beginMatchEntry(recorder, MATCH_INPUT, tick, matchPayloadSizes[MATCH_INPUT]);
+        if (!p) {
+            return;
+        }
+        if (p != recorder.bytes + recorder.lastInputAt + 1) {
+            recorder.lastInputAt = MATCH_RECORD_SIZE;   // header had a varint, never overwritten
+        }
+    }
+    p[0] = (uint8_t)(int8_t)moveX;
+    p[1] = (uint8_t)(int8_t)moveY;
+    p[2] = (uint8_t)level;
+    p[3] = flags;
+    recorder.moveX = moveX;
+    recorder.moveY = moveY;
+    recorder.level = level;
+}
+
+// A message from the peer's event channel, as the game took it in
+inline void recordMatchMessage(MatchRecorder &recorder, uint32_t tick, const ReliableMessage &message) {
+    uint8_t *p = beginMatchEntry(recorder, MATCH_MESSAGE, tick, 2 + message.length);
+    if (p) {
+        p[0] = message.type;
+        p[1] = message.length;
+        memcpy(p + 2, message.payload, message.length);
+    }
+}
+
+// Call every loop of a game; records a hash every MATCH_CHECK_TICKS
+inline void recordMatchCheck(MatchRecorder &recorder, uint32_t tick, uint32_t hash, uint32_t remainingMs) {
+    if (tick - recorder.lastCheckTick < MATCH_CHECK_TICKS) {
+        return;
+    }
+    recorder.lastCheckTick = tick;
+    uint8_t *p = beginMatchEntry(recorder, MATCH_CHECK, tick, matchPayloadSizes[MATCH_CHECK]);
+    if (p) {
+        putMatch16(p, hash);
+        putMatch16(p + 2, hash >> 16);
+        putMatch16(p + 4, remainingMs / 100);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// The game flow left S_GAME because of `event`. The recording
+// keeps taking ends (a second one is a bug worth seeing) but
+// nothing else.
+/////////////////////////////////////////////////////////////////
+inline void recordMatchEnd(MatchRecorder &recorder, uint32_t tick, uint8_t event) {
+    uint8_t *p = beginMatchEntry(recorder, MATCH_END, tick, 1);
+    if (p) {
+        p[0] = event;
+    }
+    recorder.ended = 1;
+}
+
+/////////////////////////////////////////////////////////////////
+// Reads the entry at `pos` and moves past it. Returns false at
+// the end of the data or on an entry that doesn't add up.
+/////////////////////////////////////////////////////////////////
+inline bool readMatchEntry(const uint8_t *data, uint32_t length, uint32_t &pos, uint32_t &tick,
+                           MatchEntry &entry) {
+    if (pos >= length) {
+        return false;
+    }
+    uint8_t header = data[pos++];
+    entry.type = header & 0x0F;
+    uint32_t delta = header >> 4;
+    if (delta == 15) {
+        delta = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (pos >= length || shift > 28) {
+                return false;
+            }
+            uint8_t b = data[pos++];
+            delta |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+    }
+    if (entry.type == 0 || entry.type >= MATCH_TYPE_COUNT) {
+        return false;
+    }
+    uint32_t size = matchPayloadSizes[entry.type];
+    if (size == 0xFF) {
+        if (pos + 2 > length || data[pos + 1] > RELIABLE_MAX_PAYLOAD) {
+            return false;
+        }
+        size = 2 + data[pos + 1];
+    }
+    if (pos + size > length) {
+        return false;
+    }
+    tick += delta;
+    entry.tick = tick;
+    entry.payload = data + pos;
+    entry.length = (uint8_t)size;
+    pos += size;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// Replay
+/////////////////////////////////////////////////////////////////
+
+// What the replayer simulates: one device's side of the match
+struct MatchSim {
+    uint32_t tick;
+    uint8_t role;
+    uint8_t character;
+    uint8_t opponent;
+    int moveX, moveY;
+    int level;
+    KinematicBody body;
+    int opponentX, opponentY;
+    Powerups powerups;
+};
+
+struct MatchReplayResult {
+    uint32_t entries;
+    uint32_t ticks;
+    uint32_t checks;
+    uint32_t mismatches;
+    uint32_t firstMismatchTick;
+    uint32_t ends;
+    uint8_t endEvent;
+    uint8_t caughtOnReplay;     // the sprites overlap on the tick of the end
+    uint8_t complete;           // every byte was a valid entry
+};
+
+// Called after every replayed tick, for traces and frame dumps
+typedef void (*MatchTickFn)(const MatchSim &sim);
+// Called for every check: the hash recorded and the one replayed
+typedef void (*MatchCheckFn)(const MatchSim &sim, uint32_t recorded, uint32_t replayed, uint32_t remainingMs);
+
+static const TileMap *matchReplayMap = NULL;
+static int matchReplayCharacter = 0;
+
+inline bool matchReplayBlocked(int x, int y) {
+    return characterBlocked(*matchReplayMap, matchReplayCharacter, x, y);
+}
+
+/////////////////////////////////////////////////////////////////
+// Re-runs a recorded match on `map` and checks every recorded
+// hash. Ticks are run the way the device ran them: one stepBody()
+// per tick with the inputs the last entry before it recorded.
+/////////////////////////////////////////////////////////////////
+inline MatchReplayResult replayMatch(const uint8_t *data, uint32_t length, const TileMap &map,
+                                     MatchSim &sim, MatchTickFn onTick, MatchCheckFn onCheck) {
+    MatchReplayResult result;
+    memset(&result, 0, sizeof(result));
+    memset(&sim, 0, sizeof(sim));
+    resetPowerups(sim.powerups);
+    if (length == 0 || data[0] != MATCH_RECORD_VERSION) {
+        return result;
+    }
+    matchReplayMap = &map;
+
+    uint32_t pos = 1;
+    uint32_t tick = 0;
+    MatchEntry entry;
+    bool started = false;
+    while (readMatchEntry(data, length, pos, tick, entry)) {
+        result.entries++;
+        const uint8_t *p = entry.payload;
+        if (entry.type == MATCH_START) {
+            sim.role = p[0];
+            sim.character = p[1];
+            sim.opponent = p[2];
+            sim.level = p[3];
+            placeBody(sim.body, getMatch16(p + 4), getMatch16(p + 6));
+            sim.opponentX = getMatch16(p + 8);
+            sim.opponentY = getMatch16(p + 10);
+            matchReplayCharacter = sim.character;
+            started = true;
+            continue;
+        }
+        if (!started) {
+            return result;
+        }
+        while (sim.tick < entry.tick) {
+            stepBody(sim.body, sim.moveX, sim.moveY, sim.level, matchReplayBlocked);
+            sim.tick++;
+            result.ticks++;
+            if (onTick) {
+                onTick(sim);
+            }
+        }
+        if (entry.type == MATCH_INPUT) {
+            sim.moveX = (int8_t)p[0];
+            sim.moveY = (int8_t)p[1];
+            sim.level = p[2];
+            if (p[3] & MATCH_INPUT_POWERUP) {
+                pressPowerup(sim.powerups, sim.tick);
+            }
+        } else if (entry.type == MATCH_OPPONENT) {
+            sim.opponentX = getMatch16(p);
+            sim.opponentY = getMatch16(p + 2);
+        } else if (entry.type == MATCH_STEP) {
+            sim.opponentX += (int8_t)p[0];
+            sim.opponentY += (int8_t)p[1];
+        } else if (entry.type == MATCH_MESSAGE) {
+            if (p[0] == MSG_POWERUP && p[1] == POWERUP_MESSAGE_SIZE) {
+                startOpponentPowerup(sim.powerups, decodePowerupTick(p + 2, sim.tick));
+            }
+        } else if (entry.type == MATCH_CHECK) {
+            uint32_t recorded = (uint16_t)getMatch16(p) | ((uint32_t)(uint16_t)getMatch16(p + 2) << 16);
+            uint32_t replayed = matchStateHash(sim.tick, sim.body, sim.opponentX, sim.opponentY, sim.powerups);
+            result.checks++;
+            if (recorded != replayed && result.mismatches++ == 0) {
+                result.firstMismatchTick = sim.tick;
+            }
+            if (onCheck) {
+                onCheck(sim, recorded, replayed, (uint32_t)(uint16_t)getMatch16(p + 4) * 100);
+            }
+        } else if (entry.type == MATCH_END) {
+            if (result.ends++ == 0) {
+                result.endEvent = p[0];
+                result.caughtOnReplay = charactersOverlap(sim.character, kinToPixels(sim.body.x), kinToPixels(sim.body.y),
+                                                          sim.opponent, sim.opponentX, sim.opponentY);
+            }
+        }
+    }
+    result.complete = (pos == length);
+    return result;
+}
+
+#endif
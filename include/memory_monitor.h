@@ -0,0 +1,98 @@
+#ifndef MEMORY_MONITOR_H
+#define MEMORY_MONITOR_H
+/////////////////////////////////////////////////////////////////////////////
+// Samples the memory headroom on the device and logs it (memory_watch.h).
+//
+// startMemoryMonitor() in setup(), once the tasks are running, picks up
+// the loop task (setup() runs on it), the render and log tasks and the
+// Bluedroid task the BLE callbacks run on; the server adds its spectator
+// task with watchTaskStack(). monitorMemory() from loop() samples every
+// MEMORY_SAMPLE_MS: two records with the numbers, one per alarm raised
+// and one per alarm cleared. Sampling walks the heap, a few hundred
+// microseconds, so it stays off the game tick.
+/////////////////////////////////////////////////////////////////////////////
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include "memory_watch.h"
+#include "render_task.h"
+#include "log_task.h"
+
+// Where BLE callbacks (onWrite(), onNotify() and the like) run
+#define MEMORY_BLE_TASK_NAME "BTC_TASK"
+
+static MemoryWatch memoryWatch;
+static TaskHandle_t memoryTasks[MEM_TASK_COUNT];
+static uint32_t memorySampledMs = 0;
+
+inline void watchTaskStack(uint8_t task, TaskHandle_t handle) {
+    memoryTasks[task] = handle;
+}
+
+inline void startMemoryMonitor() {
+    resetMemoryWatch(memoryWatch);
+    watchTaskStack(MEM_TASK_LOOP, xTaskGetCurrentTaskHandle());
+    watchTaskStack(MEM_TASK_RENDER, renderTaskHandle);
+    watchTaskStack(MEM_TASK_LOG, logTaskHandle);
+    watchTaskStack(MEM_TASK_BLE, xTaskGetHandle(MEMORY_BLE_TASK_NAME));
+    memorySampledMs = millis();
+}
+
+inline void sampleMemory(MemorySample &sample) {
+    const uint32_t caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    sample.ms = millis();
+    sample.heapFree = heap_caps_get_free_size(caps);
+    sample.heapMinFree = heap_caps_get_minimum_free_size(caps);
+    sample.largestBlock = heap_caps_get_largest_free_block(caps);
+    sample.psramSize = heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
+    sample.psramFree = sample.psramSize ? heap_caps_get_free_size(MALLOC_CAP_SPIRAM) : 0;
+    for (uint8_t t = 0; t < MEM_TASK_COUNT; t++) {
+        // High water marks are in bytes on the ESP32
+        sample.stackFree[t] = memoryTasks[t] ? uxTaskGetStackHighWaterMark(memoryTasks[t]) : MEMORY_NO_TASK;
+    }
+}
+
+inline void logMemoryAlarms(const MemoryWatch &watch, const MemoryAlarmChange &change) {
+    const MemorySample &sample = watch.latest;
+    if (change.raised & MEM_ALARM_HEAP) {
+        logEvent(LOG_MEMORY_LOW, sample.heapFree, MEMORY_HEAP_FLOOR);
+    }
+    if (change.raised & MEM_ALARM_BLOCK) {
+        logEvent(LOG_MEMORY_FRAGMENTED, sample.largestBlock, MEMORY_BLOCK_FLOOR, sample.heapFree);
+    }
+    if (change.raised & MEM_ALARM_SHRINKING) {
+        logEvent(LOG_MEMORY_SHRINKING, watch.trend, memoryMinutesLeft(watch));
+    }
+    for (uint8_t t = 0; t < MEM_TASK_COUNT; t++) {
+        if (change.stacksRaised & (1 << t)) {
+            logEvent(LOG_STACK_LOW, t, sample.stackFree[t]);
+        }
+    }
+    if (change.raised & MEM_ALARM_PSRAM) {
+        logEvent(LOG_PSRAM_LOW, sample.psramFree, MEMORY_PSRAM_FLOOR);
+    }
+    for (uint8_t a = 0; a < MEM_ALARM_COUNT; a++) {
+        if (change.cleared & (1 << a)) {
+            logEvent(LOG_MEMORY_CLEARED, a);
+        }
+    }
+}
+
+// Samples and logs every MEMORY_SAMPLE_MS. Call from loop().
+inline void monitorMemory() {
+    uint32_t now = millis();
+    if (now - memorySampledMs < MEMORY_SAMPLE_MS) {
+        return;
+    }
+    memorySampledMs = now;
+    MemorySample sample;
+    sampleMemory(sample);
+    MemoryAlarmChange change = updateMemoryWatch(memoryWatch, sample);
+    logEvent(LOG_MEMORY_HEAP, sample.heapFree, sample.heapMinFree, sample.largestBlock,
+             memoryFragmentation(sample), memoryWatch.trend, sample.psramFree);
+    logEvent(LOG_MEMORY_STACKS, (int32_t)sample.stackFree[MEM_TASK_LOOP], (int32_t)sample.stackFree[MEM_TASK_RENDER],
+             (int32_t)sample.stackFree[MEM_TASK_LOG], (int32_t)sample.stackFree[MEM_TASK_BLE],
+             (int32_t)sample.stackFree[MEM_TASK_SPECTATORS]);
+    logMemoryAlarms(memoryWatch, change);
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef MEMORY_WATCH_H
+#define MEMORY_WATCH_H
+/////////////////////////////////////////////////////////////////////////////
+// Memory headroom: trends and alarms from periodic samples.
+//
+// Every MEMORY_SAMPLE_MS the role samples the internal heap (free, lowest
+// ever free, largest free block), PSRAM and how much stack each of our
+// tasks has never touched (memory_monitor.h). The watch keeps the free
+// heap of the last MEMORY_WINDOW samples and fits a line through them, so
+// a slow leak shows as bytes per minute long before the heap runs out.
+//
+// The BLE stack allocates on every connection and GATT operation, and it
+// is the largest free block that decides whether that works: a heap with
+// plenty free in small pieces fails just the same. The alarms go off ahead
+// of that, each with some hysteresis so a value sitting on its floor
+// doesn't flap:
+//
+//     heap low        free heap under MEMORY_HEAP_FLOOR
+//     block small     largest free block under MEMORY_BLOCK_FLOOR
+//     heap shrinking  the trend reaches MEMORY_HEAP_FLOOR within
+//                     MEMORY_LEAK_HORIZON_MIN minutes
+//     stack low       a task with under MEMORY_STACK_FLOOR bytes unused
+//     psram low       PSRAM (if there is any) under MEMORY_PSRAM_FLOOR
+//
+// Nothing here touches the hardware, see tools/test_memory_watch.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+
+const uint32_t MEMORY_SAMPLE_MS = 10000;
+const uint8_t MEMORY_WINDOW = 30;                 // samples in the trend, 5 minutes
+const uint32_t MEMORY_HEAP_FLOOR = 24 * 1024;
+const uint32_t MEMORY_BLOCK_FLOOR = 10 * 1024;
+const uint32_t MEMORY_STACK_FLOOR = 512;
+const uint32_t MEMORY_PSRAM_FLOOR = 64 * 1024;
+const uint32_t MEMORY_LEAK_HORIZON_MIN = 30;
+const int32_t MEMORY_LEAK_MIN_SLOPE = 64;         // B/min, below this it's noise
+const uint32_t MEMORY_NO_TASK = 0xFFFFFFFF;       // stack of a task not running
+
+// The tasks whose stacks are watched; in the log's order
+enum MemoryTask { MEM_TASK_LOOP, MEM_TASK_RENDER, MEM_TASK_LOG, MEM_TASK_BLE, MEM_TASK_SPECTATORS, MEM_TASK_COUNT };
+
+// A bit each, in the log's order (binary_log.h)
+enum MemoryAlarm {
+    MEM_ALARM_HEAP = 1 << 0,
+    MEM_ALARM_BLOCK = 1 << 1,
+    MEM_ALARM_SHRINKING = 1 << 2,
+    MEM_ALARM_STACK = 1 << 3,
+    MEM_ALARM_PSRAM = 1 << 4
+};
+const uint8_t MEM_ALARM_COUNT = 5;
+
+struct MemorySample {
+    uint32_t ms;
+    uint32_t heapFree;
+    uint32_t heapMinFree;           // lowest since boot
+    uint32_t largestBlock;
+    uint32_t psramSize;             // 0 without PSRAM
+    uint32_t psramFree;
+    uint32_t stackFree[MEM_TASK_COUNT];
+};
+
+struct MemoryWatch {
+    uint32_t sampleMs[MEMORY_WINDOW];   // ring of the latest samples
+    uint32_t heapFree[MEMORY_WINDOW];
+    uint8_t count;
+    uint8_t next;
+    uint8_t alarms;                     // MemoryAlarm bits raised now
+    uint8_t stacksLow;                  // a bit per MemoryTask
+    int32_t trend;                      // free heap, B/min
+    MemorySample latest;
+};
+
+struct MemoryAlarmChange {
+    uint8_t raised;
+    uint8_t cleared;
+    uint8_t stacksRaised;               // tasks that just went low
+};
+
+inline void resetMemoryWatch(MemoryWatch &watch) {
+    memset(&watch, 0, sizeof(watch));
+}
+
+/////////////////////////////////////////////////////////////////
+// Free heap trend over the window in bytes per minute, by least
+// squares; 0 until there are two samples
+/////////////////////////////////////////////////////////////////
+inline int32_t memoryTrend(const MemoryWatch &watch) {
+    if (watch.count < 2) {
+        return 0;
+    }
+    uint8_t first = (watch.next + MEMORY_WINDOW - watch.count) % MEMORY_WINDOW;
+    int64_t n = watch.count, sumT = 0, sumH = 0, sumTT = 0, sumTH = 0;
+    for (uint8_t i = 0; i < watch.count; i++) {
+        uint8_t at = (first + i) % MEMORY_WINDOW;
+        int64_t t = (int64_t)(watch.sampleMs[at] - watch.sampleMs[first]);
+        int64_t h = (int64_t)watch.heapFree[at] - (int64_t)watch.heapFree[first];
+        sumT += t;
+        sumH += h;
+        sumTT += t * t;
+        sumTH += t * h;
+    }
+    int64_t spread = n * sumTT - sumT * sumT;
+    if (spread == 0) {
+        return 0;
+    }
+    return (int32_t)((n * sumTH - sumT * sumH) * 60000 / spread);
+}
+
+// Minutes until the trend takes the free heap to its floor, 0 if
+// it is there already, UINT32_MAX if it isn't shrinking
+inline uint32_t memoryMinutesLeft(const MemoryWatch &watch) {
+    if (watch.trend >= 0) {
+        return UINT32_MAX;
+    }
+    if (watch.latest.heapFree <= MEMORY_HEAP_FLOOR) {
+        return 0;
+    }
+    return (watch.latest.heapFree - MEMORY_HEAP_FLOOR) / (uint32_t)(-watch.trend);
+}
+
+// Percent of the free heap not in the largest block
+inline uint8_t memoryFragmentation(const MemorySample &sample) {
+    if (sample.heapFree == 0 || sample.largestBlock >= sample.heapFree) {
+        return 0;
+    }
+    return (uint8_t)(100 - (uint64_t)sample.largestBlock * 100 / sample.heapFree);
+}
+
+// Raised under `floor`, cleared again only a quarter above it
+inline bool underFloor(bool raised, uint32_t value, uint32_t floor) {
+    return raised ? value < floor + floor / 4 : value < floor;
+}
+
+/////////////////////////////////////////////////////////////////
+// Takes in a sample; says which alarms went off or cleared
+/////////////////////////////////////////////////////////////////
+inline MemoryAlarmChange updateMemoryWatch(MemoryWatch &watch, const MemorySample &sample) {
+    watch.sampleMs[watch.next] = sample.ms;
+    watch.heapFree[watch.next] = sample.heapFree;
+    watch.next = (watch.next + 1) % MEMORY_WINDOW;
+    if (watch.count < MEMORY_WINDOW) {
+        watch.count++;
+    }
+    watch.latest = sample;
+    watch.trend = memoryTrend(watch);
+
+    uint8_t stacksLow = 0;
+    for (uint8_t t = 0; t < MEM_TASK_COUNT; t++) {
+        if (sample.stackFree[t] != MEMORY_NO_TASK &&
+                underFloor(watch.stacksLow & (1 << t), sample.stackFree[t], MEMORY_STACK_FLOOR)) {
+            stacksLow |= 1 << t;
+        }
+    }
+
+    uint8_t alarms = 0;
+    if (underFloor(watch.alarms & MEM_ALARM_HEAP, sample.heapFree, MEMORY_HEAP_FLOOR)) {
+        alarms |= MEM_ALARM_HEAP;
+    }
+    if (underFloor(watch.alarms & MEM_ALARM_BLOCK, sample.largestBlock, MEMORY_BLOCK_FLOOR)) {
+        alarms |= MEM_ALARM_BLOCK;
+    }
+    // Only on a full window, and cleared once the floor is twice the horizon away
+    if (watch.count == MEMORY_WINDOW && watch.trend <= -MEMORY_LEAK_MIN_SLOPE) {
+        uint32_t horizon = (watch.alarms & MEM_ALARM_SHRINKING) ? 2 * MEMORY_LEAK_HORIZON_MIN : MEMORY_LEAK_HORIZON_MIN;
+        if (memoryMinutesLeft(watch) < horizon) {
+            alarms |= MEM_ALARM_SHRINKING;
+        }
+    }
+    if (stacksLow) {
+        alarms |= MEM_ALARM_STACK;
+    }
+    if (sample.psramSize && underFloor(watch.alarms & MEM_ALARM_PSRAM, sample.psramFree, MEMORY_PSRAM_FLOOR)) {
+        alarms |= MEM_ALARM_PSRAM;
+    }
+
+    MemoryAlarmChange change;
+    change.raised = alarms & ~watch.alarms;
+    change.cleared = watch.alarms & ~alarms;
+    change.stacksRaised = stacksLow & ~watch.stacksLow;
+    watch.alarms = alarms;
+    watch.stacksLow = stacksLow;
+    return change;
+}
+
+// Too little heap to take on another BLE connection safely
+inline bool memoryTight(const MemoryWatch &watch) {
+    return watch.alarms & (MEM_ALARM_HEAP | MEM_ALARM_BLOCK);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+/////////////////////////////////////////////////////////////////////////////
+// A fixed number of objects in static storage, handed out and taken back.
+//
+// What the BLE code used to get with new and never delete (a record per
+// server found, again on every rescan) comes out of a pool instead: the
+// memory is part of the pool, acquire() constructs in a free slot and
+// release() destroys and frees it. A pool that runs out returns NULL and
+// counts it, nothing falls back to the heap.
+//
+// One task acquires and releases; readers on other tasks need their own
+// handover (a flag set after the pointer, like the rest of the BLE code).
+//
+// Nothing here touches the hardware, see tools/test_object_pool.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+
+template <typename T, uint8_t Capacity>
+class ObjectPool {
+    static_assert(Capacity > 0 && Capacity <= 32, "capacity must be 1 to 32");
+
+public:
+    ObjectPool() : used(0), exhaustedCount(0) {}
+
+    ~ObjectPool() {
+        for (uint8_t i = 0; i < Capacity; i++) {
+            if (used & (1UL << i)) {
+                object(i)->~T();
+            }
+        }
+    }
+
+    // A new T built from `args`, or NULL if every slot is taken
+    template <typename... Args>
+    T *acquire(Args &&...args) {
+        for (uint8_t i = 0; i < Capacity; i++) {
+            if (!(used & (1UL << i))) {
+                used |= 1UL << i;
+                return new (slots[i].bytes) T(std::forward<Args>(args)...);
+            }
+        }
+        exhaustedCount++;
+        return NULL;
+    }
+
+    // Gives back what acquire() returned; NULL or a stranger is ignored
+    void release(T *released) {
+        for (uint8_t i = 0; i < Capacity; i++) {
+            if ((used & (1UL << i)) && object(i) == released) {
+                released->~T();
+                used &= ~(1UL << i);
+                return;
+            }
+        }
+    }
+
+    uint8_t inUse() const {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < Capacity; i++) {
+            count += (used >> i) & 1;
+        }
+        return count;
+    }
+
+    uint32_t exhausted() const { return exhaustedCount; }
+
+private:
+    ObjectPool(const ObjectPool &);
+    ObjectPool &operator=(const ObjectPool &);
+
+    T *object(uint8_t i) { return reinterpret_cast<T *>(slots[i].bytes); }
+
+    struct Slot {
+        alignas(T) uint8_t bytes[sizeof(T)];
+    };
+    Slot slots[Capacity];
+    uint32_t used;                  // a bit per slot
+    uint32_t exhaustedCount;
+};
+
+#endif
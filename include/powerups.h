@@ -0,0 +1,101 @@
+#ifndef POWERUPS_H
+#define POWERUPS_H
+/////////////////////////////////////////////////////////////////////////////
+// Powerup timers on the match tick (game_tick.h) instead of millis().
+//
+// Both devices reset their tick clock when a game starts, so a tick number
+// means the same moment on both, give or take the one-way latency of the
+// start message. A powerup goes to the peer (reliable_channel.h) as the
+// tick it started on, and the peer ends it on that same tick however late
+// the message arrived. One that has already run out by then never shows.
+//
+// SELECT is edge triggered and then ignored for a short cooldown, which
+// replaces the blocking delay() that used to debounce it.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include "game_tick.h"
+
+const uint32_t POWERUP_TICKS = 3000 / SIM_TICK_MS;          // a powerup lasts 3 seconds
+const uint32_t POWERUP_COOLDOWN_TICKS = 500 / SIM_TICK_MS;  // presses ignored after one
+const uint8_t POWERUPS_PER_GAME = 3;
+const uint8_t POWERUP_MESSAGE_SIZE = 3;                     // character, start tick (16 bit)
+
+struct PowerupTimer {
+    uint8_t active;
+    uint32_t startTick;
+};
+
+struct Powerups {
+    PowerupTimer own;
+    PowerupTimer opponent;   // as the peer reported it
+    uint8_t left;
+    uint32_t readyTick;      // SELECT does nothing before this tick
+};
+
+// A new game: all powerups back, none running
+inline void resetPowerups(Powerups &powerups) {
+    powerups.own.active = powerups.opponent.active = 0;
+    powerups.own.startTick = powerups.opponent.startTick = 0;
+    powerups.left = POWERUPS_PER_GAME;
+    powerups.readyTick = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// True while the timer runs. A peer's clock can be a tick or two
+// ahead of ours, so a start tick in the near future counts too.
+/////////////////////////////////////////////////////////////////
+inline bool isPowerupActive(const PowerupTimer &timer, uint32_t tick) {
+    return timer.active && (int32_t)(tick - timer.startTick) < (int32_t)POWERUP_TICKS;
+}
+
+/////////////////////////////////////////////////////////////////
+// SELECT went down on `tick`. Starts our powerup if one is left,
+// none is running and the cooldown is over; returns true if so.
+/////////////////////////////////////////////////////////////////
+inline bool pressPowerup(Powerups &powerups, uint32_t tick) {
+    if ((int32_t)(tick - powerups.readyTick) < 0) {
+        return false;
+    }
+    powerups.readyTick = tick + POWERUP_COOLDOWN_TICKS;
+    if (powerups.left == 0 || isPowerupActive(powerups.own, tick)) {
+        return false;
+    }
+    powerups.left--;
+    powerups.own.active = 1;
+    powerups.own.startTick = tick;
+    return true;
+}
+
+inline void startOpponentPowerup(Powerups &powerups, uint32_t startTick) {
+    powerups.opponent.active = 1;
+    powerups.opponent.startTick = startTick;
+}
+
+/////////////////////////////////////////////////////////////////
+// Stops the timers that ran out. Returns true if ours just did,
+// since the screen has to lose the reveal then.
+/////////////////////////////////////////////////////////////////
+inline bool expirePowerups(Powerups &powerups, uint32_t tick) {
+    if (powerups.opponent.active && !isPowerupActive(powerups.opponent, tick)) {
+        powerups.opponent.active = 0;
+    }
+    if (powerups.own.active && !isPowerupActive(powerups.own, tick)) {
+        powerups.own.active = 0;
+        return true;
+    }
+    return false;
+}
+
+inline void encodePowerupMessage(uint8_t *payload, uint8_t character, uint32_t startTick) {
+    payload[0] = character;
+    payload[1] = (uint8_t)startTick;
+    payload[2] = (uint8_t)(startTick >> 8);
+}
+
+// Full start tick of a message: the one closest to our own tick
+inline uint32_t decodePowerupTick(const uint8_t *payload, uint32_t tick) {
+    uint16_t low = (uint16_t)(payload[1] | (payload[2] << 8));
+    return tick + (int16_t)(uint16_t)(low - (uint16_t)tick);
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef RELIABLE_CHANNEL_H
+#define RELIABLE_CHANNEL_H
+/////////////////////////////////////////////////////////////////////////////
+// Reliable, ordered delivery of discrete game messages (game state changes,
+// player selection, powerups) over one BLE characteristic.
+//
+// Writes without response and notifications can be lost, and a lost game
+// over used to leave one device in the game forever. Every message here
+// carries a sequence number and every packet carries a cumulative ack (the
+// next sequence number the sender expects), so a message is resent until
+// the peer has it. Up to RELIABLE_WINDOW messages are in flight; if the
+// oldest is not acked within RELIABLE_RETRY_MS all of them are sent again
+// (go-back-N). The receiver delivers only the next message in order and
+// drops everything else, which also drops duplicates.
+//
+// Packet: [seq][ack][type][length][payload...]. A packet of type MSG_ACK
+// has no payload and is not sequenced; it is sent when a message arrived
+// and there was nothing to piggyback the ack on.
+//
+// Positions don't go through here: an old position is useless by the time
+// it would be resent, so they go in the snapshots (state_snapshot.h).
+//
+// The BLE callback only copies the packet into a lock-free queue; the loop
+// task does everything else in serviceReliableChannel(). Nothing here
+// touches the hardware, see tools/test_reliable_channel.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "render_queue.h"
+
+const uint8_t RELIABLE_HEADER_SIZE = 4;
+const uint8_t RELIABLE_MAX_PAYLOAD = 4;
+const uint8_t RELIABLE_PACKET_SIZE = RELIABLE_HEADER_SIZE + RELIABLE_MAX_PAYLOAD;
+const uint8_t RELIABLE_OUTBOX_SIZE = 16;    // queued and unacknowledged messages, divides 256
+const uint8_t RELIABLE_WINDOW = 4;          // of those, in flight at once
+const uint32_t RELIABLE_INBOX_SIZE = 8;     // packets from the BLE task, power of two
+const uint32_t RELIABLE_RETRY_MS = 150;
+
+// Message types; the payload of each is listed next to it
+enum GameMessageType {
+    MSG_ACK,               // none, acknowledgement only
+    MSG_GAME_STATE,        // state: 1 select, 2 tutorial, 3 game, 4 game over (then GameOverReason)
+    MSG_PLAYER_SELECTION,  // character: 1 princess, 2 dragon, 3 unchosen
+    MSG_POWERUP            // character, start tick (powerups.h)
+};
+
+struct ReliableMessage {
+    uint8_t type;
+    uint8_t length;
+    uint8_t payload[RELIABLE_MAX_PAYLOAD];
+};
+
+struct ReliablePacket {
+    uint8_t length;
+    uint8_t bytes[RELIABLE_PACKET_SIZE];
+};
+
+struct ReliableStats {
+    uint32_t sent;         // packets with a message, first sends and resends
+    uint32_t resent;
+    uint32_t delivered;
+    uint32_t duplicates;   // out of order or already delivered
+    uint32_t overflows;    // messages refused because the outbox was full
+    uint32_t malformed;
+};
+
+// Hands a packet to the radio (write without response / notify)
+typedef void (*ReliableSendFn)(const uint8_t *bytes, size_t length);
+// Called on the loop task with each message, in the order it was sent
+typedef void (*ReliableDeliverFn)(const ReliableMessage &message);
+
+struct ReliableChannel {
+    uint8_t nextSeq;        // sequence number of the next message queued
+    uint8_t oldestSeq;      // oldest message not acked yet
+    uint8_t sendSeq;        // next message to put on the air
+    uint8_t sentSeq;        // one past the newest message ever sent
+    uint8_t expectedSeq;    // next message wanted from the peer
+    uint8_t ackDue;         // the peer is waiting for an ack
+    uint32_t retryAt;       // when the messages in flight are sent again
+    ReliableMessage outbox[RELIABLE_OUTBOX_SIZE];   // by sequence number
+    RenderQueue<ReliablePacket, RELIABLE_INBOX_SIZE> inbox;
+    ReliableStats stats;
+};
+
+/////////////////////////////////////////////////////////////////
+// Forgets everything queued and received. Both sides call it
+// when the link drops, so a new connection starts at zero.
+// Loop task only.
+/////////////////////////////////////////////////////////////////
+inline void resetReliableChannel(ReliableChannel &channel) {
+    channel.nextSeq = channel.oldestSeq = channel.sendSeq = channel.sentSeq = 0;
+    channel.expectedSeq = 0;
+    channel.ackDue = 0;
+    channel.retryAt = 0;
+    ReliablePacket stale;
+    while (channel.inbox.pop(stale)) {
+    }
+}
+
+// Messages queued or in flight that the peer hasn't acked
+inline uint8_t reliableUnacked(const ReliableChannel &channel) {
+    return (uint8_t)(channel.nextSeq - channel.oldestSeq);
+}
+
+/////////////////////////////////////////////////////////////////
+// Queues a message (loop task). Returns false if the outbox is
+// full, which only happens when the peer has stopped answering.
+/////////////////////////////////////////////////////////////////
+inline bool sendReliableMessage(ReliableChannel &channel, uint8_t type, const uint8_t *payload, uint8_t length) {
+    if (reliableUnacked(channel) >= RELIABLE_OUTBOX_SIZE || length > RELIABLE_MAX_PAYLOAD || type == MSG_ACK) {
+        channel.stats.overflows++;
+        return false;
+    }
+    ReliableMessage &message = channel.outbox[channel.nextSeq % RELIABLE_OUTBOX_SIZE];
+    message.type = type;
+    message.length = length;
+    memcpy(message.payload, payload, length);
+    channel.nextSeq++;
+    return true;
+}
+
+// One byte messages, which is all the game sends
+inline bool sendReliableByte(ReliableChannel &channel, uint8_t type, uint8_t value) {
+    return sendReliableMessage(channel, type, &value, 1);
+}
+
+// Called from the BLE callback with a packet as it arrived
+inline bool receiveReliablePacket(ReliableChannel &channel, const uint8_t *bytes, size_t length) {
+    if (length > RELIABLE_PACKET_SIZE) {
+        return false;   // not ours; counting it here would race the loop task
+    }
+    ReliablePacket packet;
+    packet.length = (uint8_t)length;
+    memcpy(packet.bytes, bytes, length);
+    return channel.inbox.push(packet);   // a dropped packet is sent again
+}
+
+inline void sendReliablePacket(ReliableChannel &channel, uint8_t seq, const ReliableMessage *message,
+                               ReliableSendFn send) {
+    uint8_t bytes[RELIABLE_PACKET_SIZE];
+    bytes[0] = seq;
+    bytes[1] = channel.expectedSeq;
+    bytes[2] = message ? message->type : (uint8_t)MSG_ACK;
+    bytes[3] = message ? message->length : 0;
+    if (message) {
+        memcpy(bytes + RELIABLE_HEADER_SIZE, message->payload, message->length);
+    }
+    send(bytes, RELIABLE_HEADER_SIZE + bytes[3]);
+    channel.ackDue = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Takes in one packet from the peer: frees what it acks and
+// delivers its message if it is the next one in order
+/////////////////////////////////////////////////////////////////
+inline void handleReliablePacket(ReliableChannel &channel, const ReliablePacket &packet, uint32_t now,
+                                 ReliableDeliverFn deliver) {
+    if (packet.length < RELIABLE_HEADER_SIZE || packet.bytes[3] > RELIABLE_MAX_PAYLOAD ||
+        packet.length < RELIABLE_HEADER_SIZE + packet.bytes[3]) {
+        channel.stats.malformed++;
+        return;
+    }
+    uint8_t seq = packet.bytes[0];
+    uint8_t ack = packet.bytes[1];
+
+    // Everything before `ack` arrived; ignore acks for messages never sent
+    uint8_t acked = (uint8_t)(ack - channel.oldestSeq);
+    if (acked != 0 && acked <= (uint8_t)(channel.sentSeq - channel.oldestSeq)) {
+        if ((uint8_t)(channel.sendSeq - channel.oldestSeq) < acked) {
+            channel.sendSeq = ack;   // a resend got overtaken by the ack
+        }
+        channel.oldestSeq = ack;
+        channel.retryAt = now + RELIABLE_RETRY_MS;
+    }
+
+    if (packet.bytes[2] == MSG_ACK) {
+        return;
+    }
+    channel.ackDue = 1;
+    if (seq != channel.expectedSeq) {
+        channel.stats.duplicates++;
+        return;
+    }
+    ReliableMessage message;
+    message.type = packet.bytes[2];
+    message.length = packet.bytes[3];
+    memcpy(message.payload, packet.bytes + RELIABLE_HEADER_SIZE, message.length);
+    channel.expectedSeq++;
+    channel.stats.delivered++;
+    deliver(message);
+}
+
+/////////////////////////////////////////////////////////////////
+// Runs the channel, once per loop on the loop task: handles what
+// arrived, resends on timeout, sends what the window allows and
+// acks what wasn't acked on the way
+/////////////////////////////////////////////////////////////////
+inline void serviceReliableChannel(ReliableChannel &channel, uint32_t now, ReliableSendFn send,
+                                   ReliableDeliverFn deliver) {
+    ReliablePacket packet;
+    while (channel.inbox.pop(packet)) {
+        handleReliablePacket(channel, packet, now, deliver);
+    }
+
+    if (channel.sentSeq != channel.oldestSeq && (int32_t)(now - channel.retryAt) >= 0) {
+        channel.sendSeq = channel.oldestSeq;   // go back and send the window again
+    }
+
+    while (channel.sendSeq != channel.nextSeq &&
+           (uint8_t)(channel.sendSeq - channel.oldestSeq) < RELIABLE_WINDOW) {
+        if (channel.sendSeq == channel.oldestSeq) {
+            channel.retryAt = now + RELIABLE_RETRY_MS;
+        }
+        sendReliablePacket(channel, channel.sendSeq, &channel.outbox[channel.sendSeq % RELIABLE_OUTBOX_SIZE], send);
+        if (channel.sendSeq == channel.sentSeq) {
+            channel.sentSeq++;
+        } else {
+            channel.stats.resent++;
+        }
+        channel.sendSeq++;
+        channel.stats.sent++;
+    }
+
+    if (channel.ackDue) {
+        sendReliablePacket(channel, channel.nextSeq, NULL, send);
+    }
+}
+
+#endif
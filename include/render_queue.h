@@ -0,0 +1,85 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+/////////////////////////////////////////////////////////////////////////////
+// Lock-free single producer / single consumer ring buffer.
+//
+// The game loop (producer, core 1) pushes draw commands and the render task
+// (consumer, core 0) pops them. Head and tail are only ever written by one
+// side each, so acquire/release atomics are enough and neither side blocks
+// or disables interrupts. Only depends on <atomic>, so the same header is
+// used by host tests with pthreads.
+//
+// Capacity must be a power of two; one slot is never used so that a full
+// queue can be told apart from an empty one.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, uint32_t Capacity>
+class RenderQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    RenderQueue() : head(0), tail(0), highWater(0), dropped(0) {}
+
+    /////////////////////////////////////////////////////////////////
+    // Producer side. Returns false (and counts a drop) if the queue
+    // is full; the item is not copied in that case.
+    /////////////////////////////////////////////////////////////////
+    bool push(const T &item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t next = (t + 1) & (Capacity - 1);
+        if (next == head.load(std::memory_order_acquire)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[t] = item;
+        tail.store(next, std::memory_order_release);
+
+        uint32_t depth = (next - head.load(std::memory_order_relaxed)) & (Capacity - 1);
+        if (depth > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(depth, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /////////////////////////////////////////////////////////////////
+    // Consumer side. Returns false if the queue is empty.
+    /////////////////////////////////////////////////////////////////
+    bool pop(T &item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots[h];
+        head.store((h + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: the next item without removing it, or NULL
+    const T *peek() const {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots[h];
+    }
+
+    // Approximate when called from the side that is not changing it
+    uint32_t depth() const {
+        return (tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire)) & (Capacity - 1);
+    }
+
+    uint32_t capacity() const { return Capacity - 1; }
+    uint32_t maxDepth() const { return highWater.load(std::memory_order_relaxed); }
+    uint32_t drops() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    T slots[Capacity];
+    std::atomic<uint32_t> head;       // next slot to read, written by the consumer
+    std::atomic<uint32_t> tail;       // next slot to write, written by the producer
+    std::atomic<uint32_t> highWater;  // deepest the queue has been
+    std::atomic<uint32_t> dropped;    // pushes rejected because it was full
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef RENDER_TASK_H
+#define RENDER_TASK_H
+/////////////////////////////////////////////////////////////////////////////
+// Render task pinned to the core that does not run loop().
+//
+// loop() (BLE, seesaw input, simulation) never draws during a match. It
+// pushes either a FrameSnapshot (everything needed to draw one game frame)
+// or a screen function (menus, game over) into a lock-free queue, and the
+// render task does the SPI work on the other core. Slow blits no longer
+// delay input sampling or position sends.
+//
+// Consecutive frame snapshots are coalesced: if the renderer falls behind
+// it only draws the newest one, with any repaint the skipped ones asked for
+// (draw_command.h). Screen functions are never dropped.
+//
+// The LCD mutex is only there for the few places the M5 library draws on
+// its own from loop() (button press feedback in M5.update(), in the menus;
+// a game has no buttons on screen, so loop() never waits for a frame).
+/////////////////////////////////////////////////////////////////////////////
+#include <M5Core2.h>
+#include "render_queue.h"
+#include "draw_command.h"
+#include "log_task.h"
+
+#ifdef ARDUINO_RUNNING_CORE
+const BaseType_t RENDER_CORE = (ARDUINO_RUNNING_CORE == 0) ? 1 : 0;
+#else
+const BaseType_t RENDER_CORE = 0;
+#endif
+const uint32_t RENDER_STACK_SIZE = 8192;
+const UBaseType_t RENDER_PRIORITY = 1;
+const uint32_t RENDER_QUEUE_SIZE = 16;
+const uint32_t RENDER_STATS_WINDOW_MS = 1000;
+const uint32_t RENDER_STATS_LOG_MS = 5000;
+
+struct RenderStats {
+    uint32_t queueDepth;       // commands waiting right now
+    uint32_t queueMaxDepth;    // deepest the queue has been
+    uint32_t queueDrops;       // frames dropped because the queue was full
+    uint32_t framesRendered;
+    uint32_t framesCoalesced;  // older snapshots skipped for a newer one
+    uint8_t renderCoreLoad;    // % of the last window the render task was busy
+    uint8_t loopCoreLoad;      // % of the last window spent inside loop()
+};
+
+// Implemented by each role: draws one game frame. fullRedraw is set for
+// the first frame after a screen function and when a forceRedraw was asked
+// for, by this frame or one skipped for it.
+void renderFrame(const FrameSnapshot &frame, bool fullRedraw);
+
+static RenderQueue<DrawCommand, RENDER_QUEUE_SIZE> renderQueue;
+static TaskHandle_t renderTaskHandle = NULL;
+static SemaphoreHandle_t lcdMutex = NULL;
+static RenderStats renderStats;
+
+// Busy time totals; the render total is only written by the render task
+// and the stats keep the value seen at the start of the window
+static volatile uint32_t renderBusyUs = 0;
+static uint32_t renderBusyWindowStartUs = 0;
+static uint32_t loopBusyUs = 0;
+static uint32_t loopStartUs = 0;
+static uint32_t statsWindowStartMs = 0;
+static uint32_t statsLoggedMs = 0;
+static volatile uint32_t framesRendered = 0;
+static volatile uint32_t framesCoalesced = 0;
+
+inline void lockLcd() {
+    if (lcdMutex != NULL) {
+        xSemaphoreTake(lcdMutex, portMAX_DELAY);
+    }
+}
+
+inline void unlockLcd() {
+    if (lcdMutex != NULL) {
+        xSemaphoreGive(lcdMutex);
+    }
+}
+
+///////////////////////////////////////////////////////////////
+// The render task: sleeps until notified, then drains the queue
+///////////////////////////////////////////////////////////////
+static void renderTask(void *param) {
+    DrawCommand command;
+    FrameCoalescer coalescer;
+    resetFrameCoalescer(coalescer);
+    bool fullRedraw;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+        while (nextDrawCommand(renderQueue, coalescer, command, fullRedraw)) {
+            framesCoalesced = coalescer.coalesced;
+            uint32_t start = micros();
+            lockLcd();
+            if (command.type == DRAW_SCREEN) {
+                command.screen();
+            } else {
+                renderFrame(command.frame, fullRedraw);
+                framesRendered++;
+            }
+            unlockLcd();
+            renderBusyUs += micros() - start;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////
+// Starts the render task. Everything drawn before this (title
+// screens in setup()) is drawn directly.
+///////////////////////////////////////////////////////////////
+inline void startRenderTask() {
+    lcdMutex = xSemaphoreCreateMutex();
+    statsWindowStartMs = millis();
+    xTaskCreatePinnedToCore(renderTask, "render", RENDER_STACK_SIZE, NULL,
+                            RENDER_PRIORITY, &renderTaskHandle, RENDER_CORE);
+}
+
+///////////////////////////////////////////////////////////////
+// Queues a game frame. Dropped if the queue is full, the next
+// snapshot supersedes it anyway; false then, so the caller asks
+// for its forceRedraw again.
+///////////////////////////////////////////////////////////////
+inline bool postFrame(const FrameSnapshot &frame) {
+    DrawCommand command;
+    command.type = DRAW_FRAME;
+    command.screen = NULL;
+    command.frame = frame;
+    bool queued = renderQueue.push(command);
+    xTaskNotifyGive(renderTaskHandle);
+    return queued;
+}
+
+///////////////////////////////////////////////////////////////
+// Queues a whole-screen draw function (menus, game over). These
+// must not be lost, so wait for space if the queue is full.
+///////////////////////////////////////////////////////////////
+inline void postScreen(void (*screen)()) {
+    if (renderTaskHandle == NULL) {
+        screen();
+        return;
+    }
+    DrawCommand command;
+    command.type = DRAW_SCREEN;
+    command.screen = screen;
+    while (!renderQueue.push(command)) {
+        xTaskNotifyGive(renderTaskHandle);
+        vTaskDelay(1);
+    }
+    xTaskNotifyGive(renderTaskHandle);
+}
+
+// Bracket the body of loop() to measure how busy its core is
+inline void beginLoopTiming() {
+    loopStartUs = micros();
+}
+
+inline void endLoopTiming() {
+    loopBusyUs += micros() - loopStartUs;
+}
+
+///////////////////////////////////////////////////////////////
+// Refreshes renderStats once per window. Call from loop().
+///////////////////////////////////////////////////////////////
+inline const RenderStats &updateRenderStats() {
+    uint32_t now = millis();
+    uint32_t elapsedMs = now - statsWindowStartMs;
+    renderStats.queueDepth = renderQueue.depth();
+    renderStats.queueMaxDepth = renderQueue.maxDepth();
+    renderStats.queueDrops = renderQueue.drops();
+    renderStats.framesRendered = framesRendered;
+    renderStats.framesCoalesced = framesCoalesced;
+    if (elapsedMs >= RENDER_STATS_WINDOW_MS) {
+        uint32_t windowUs = elapsedMs * 1000;
+        uint32_t renderTotalUs = renderBusyUs;
+        uint32_t renderUs = renderTotalUs - renderBusyWindowStartUs;
+        renderBusyWindowStartUs = renderTotalUs;
+        renderStats.renderCoreLoad = (uint8_t)min<uint32_t>(100, (uint64_t)renderUs * 100 / windowUs);
+        renderStats.loopCoreLoad = (uint8_t)min<uint32_t>(100, (uint64_t)loopBusyUs * 100 / windowUs);
+        loopBusyUs = 0;
+        statsWindowStartMs = now;
+    }
+    return renderStats;
+}
+
+// Logs the render stats every RENDER_STATS_LOG_MS. Call from loop().
+inline void logRenderStats() {
+    const RenderStats &stats = updateRenderStats();
+    uint32_t now = millis();
+    if (now - statsLoggedMs < RENDER_STATS_LOG_MS) {
+        return;
+    }
+    statsLoggedMs = now;
+    logEvent(LOG_RENDER_STATS, stats.queueDepth, stats.queueMaxDepth, stats.queueDrops, stats.framesRendered,
+             stats.framesCoalesced, stats.renderCoreLoad, stats.loopCoreLoad);
+}
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+/////////////////////////////////////////////////////////////////////////////
+// Rollback netcode for the input mode (NET_ROLLBACK, duel_sim.h).
+//
+// Each device runs both characters ahead on its own input and a predicted
+// input for the peer: whatever the peer did on the last tick we heard
+// about. Before every tick it keeps the state in a ring of
+// ROLLBACK_WINDOW. When the peer's real input for a tick arrives and
+// differs from the prediction, the state of that tick comes back out of
+// the ring and the ticks since are run again with what is known now. The
+// local character never waits for the link, and the opponent is drawn
+// where it most likely is rather than a round trip late.
+//
+// The simulation never runs more than ROLLBACK_WINDOW ticks past the
+// last tick the peer's input is known for, so a correction always finds
+// its state in the ring and the work it causes is bounded. A catch counts
+// once every input up to its tick is known; both devices then agree on
+// it, since they ran the same inputs.
+//
+// Inputs travel on their own characteristic, as the packets of duel_sim.h:
+// up to DUEL_PACKET_INPUTS of ours the peer hasn't acknowledged, and our
+// acknowledgement of theirs. Nothing here touches the radio; the role
+// files hand in a send function.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+#include "duel_sim.h"
+
+const uint8_t ROLLBACK_WINDOW = 16;             // ticks of prediction, 320 ms
+const uint32_t ROLLBACK_RESEND_MS = 50;         // an idle link still gets our acks
+
+struct RollbackStats {
+    uint32_t rollbacks;         // corrections that rewound the state
+    uint32_t resimulated;       // ticks run again because of them
+    uint32_t deepest;           // most ticks rewound at once
+    uint32_t stalls;            // ticks held back at the end of the window
+    uint32_t malformed;
+};
+
+struct RollbackSession {
+    uint8_t local;                              // our body: 0 server, 1 client
+    DuelState state;                            // latest, predicted
+    DuelState saved[ROLLBACK_WINDOW];           // state at tick t in t % ROLLBACK_WINDOW
+    DuelInput inputs[2][DUEL_INPUT_RING];       // by tick % DUEL_INPUT_RING; the peer's may be predicted
+    uint8_t known[DUEL_INPUT_RING];             // the peer's input for that slot arrived
+    uint32_t confirmed;                         // the peer's inputs are known for every tick before this
+    uint32_t firstWrong;                        // earliest tick run on a wrong prediction
+    uint8_t mispredicted;
+    uint32_t acked;                             // the peer has our inputs for every tick before this
+    uint8_t sendOldest;                         // alternates with the newest when far behind
+    uint8_t ackDue;
+    uint32_t sentTick;                          // newest tick of ours sent so far
+    uint32_t lastSendMs;
+    DuelInput lastKnown;                        // the peer's latest known input, the prediction
+    RenderQueue<DuelPacket, 8> inbox;           // BLE task -> loop
+    RollbackStats stats;
+};
+
+/////////////////////////////////////////////////////////////////
+// A new game on both devices: the state at tick 0 and no inputs
+/////////////////////////////////////////////////////////////////
+inline void resetRollback(RollbackSession &session, uint8_t local, const TileMap &map,
+                          uint8_t serverCharacter, uint8_t clientCharacter, uint8_t level) {
+    session.local = local;
+    resetDuel(session.state, map, serverCharacter, clientCharacter);
+    memset(session.known, 0, sizeof(session.known));
+    session.confirmed = session.acked = 0;
+    session.mispredicted = 0;
+    session.sendOldest = session.ackDue = 0;
+    session.sentTick = session.lastSendMs = 0;
+    session.lastKnown.x = session.lastKnown.y = 0;
+    session.lastKnown.level = level;
+    memset(&session.stats, 0, sizeof(session.stats));
+    DuelPacket stale;
+    while (session.inbox.pop(stale)) {
+    }
+}
+
+// Called from the BLE callback with a packet as it arrived
+inline bool receiveRollbackPacket(RollbackSession &session, const uint8_t *bytes, size_t length) {
+    return queueDuelPacket(session.inbox, bytes, length);
+}
+
+/////////////////////////////////////////////////////////////////
+// One input of the peer. A tick we already ran on a prediction
+// that turns out wrong is marked for the next advanceRollback().
+/////////////////////////////////////////////////////////////////
+inline void takeRemoteInput(RollbackSession &session, uint32_t tick, const DuelInput &input) {
+    uint8_t remote = 1 - session.local;
+    if ((int32_t)(tick - session.confirmed) < 0 || tick - session.confirmed >= DUEL_INPUT_RING) {
+        return;   // known already, or too far ahead to keep (it comes again)
+    }
+    uint32_t slot = tick % DUEL_INPUT_RING;
+    if (session.known[slot]) {
+        return;
+    }
+    if ((int32_t)(tick - session.state.tick) < 0 && !sameDuelInput(session.inputs[remote][slot], input)) {
+        if (!session.mispredicted || (int32_t)(tick - session.firstWrong) < 0) {
+            session.firstWrong = tick;
+        }
+        session.mispredicted = 1;
+    }
+    session.inputs[remote][slot] = input;
+    session.known[slot] = 1;
+    while (session.known[session.confirmed % DUEL_INPUT_RING]) {
+        session.lastKnown = session.inputs[remote][session.confirmed % DUEL_INPUT_RING];
+        session.known[session.confirmed % DUEL_INPUT_RING] = 0;   // the slot is reused DUEL_INPUT_RING later
+        session.confirmed++;
+        session.ackDue = 1;
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Takes in the peer's packets: its inputs and how far it has
+// ours. Call every loop before advanceRollback().
+/////////////////////////////////////////////////////////////////
+inline void receiveRollbackInputs(RollbackSession &session) {
+    DuelPacket packet;
+    DuelPacketView view;
+    while (session.inbox.pop(packet)) {
+        if (!decodeDuelPacket(packet, session.confirmed, session.acked, view)) {
+            session.stats.malformed++;
+            continue;
+        }
+        if ((int32_t)(view.ack - session.acked) > 0 && (int32_t)(view.ack - session.state.tick) <= 0) {
+            session.acked = view.ack;
+        }
+        for (uint8_t i = 0; i < view.count; i++) {
+            takeRemoteInput(session, view.first + i, decodeDuelInput(view.inputs + i * DUEL_INPUT_SIZE));
+        }
+    }
+}
+
+// The peer's input for a tick: what it sent, or the prediction
+inline const DuelInput &remoteInput(RollbackSession &session, uint32_t tick) {
+    uint8_t remote = 1 - session.local;
+    uint32_t slot = tick % DUEL_INPUT_RING;
+    if ((int32_t)(tick - session.confirmed) >= 0 && !session.known[slot]) {
+        session.inputs[remote][slot] = session.lastKnown;
+    }
+    return session.inputs[remote][slot];
+}
+
+inline void runRollbackTick(RollbackSession &session) {
+    uint32_t tick = session.state.tick;
+    session.saved[tick % ROLLBACK_WINDOW] = session.state;
+    const DuelInput &own = session.inputs[session.local][tick % DUEL_INPUT_RING];
+    const DuelInput &peer = remoteInput(session, tick);
+    if (session.local == 0) {
+        stepDuel(session.state, own, peer);
+    } else {
+        stepDuel(session.state, peer, own);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Rewinds to the first mispredicted tick and runs the ticks since
+// again, then runs up to `ticks` new ones on our `input`. Returns
+// how many new ticks ran; fewer than asked if the window is full.
+/////////////////////////////////////////////////////////////////
+inline uint32_t advanceRollback(RollbackSession &session, const DuelInput &input, uint32_t ticks) {
+    if (session.mispredicted) {
+        session.mispredicted = 0;
+        uint32_t now = session.state.tick;
+        uint32_t depth = now - session.firstWrong;
+        session.state = session.saved[session.firstWrong % ROLLBACK_WINDOW];
+        while (session.state.tick != now) {
+            runRollbackTick(session);
+        }
+        session.stats.rollbacks++;
+        session.stats.resimulated += depth;
+        if (depth > session.stats.deepest) {
+            session.stats.deepest = depth;
+        }
+    }
+
+    uint32_t ran = 0;
+    for (; ran < ticks; ran++) {
+        uint32_t tick = session.state.tick;
+        if ((int32_t)(tick - session.confirmed) >= ROLLBACK_WINDOW ||
+            (int32_t)(tick - session.acked) >= (int32_t)DUEL_INPUT_RING - 1) {
+            session.stats.stalls += ticks - ran;
+            break;
+        }
+        session.inputs[session.local][tick % DUEL_INPUT_RING] = input;
+        runRollbackTick(session);
+    }
+    return ran;
+}
+
+// True once the catch is certain: every input up to it is known
+inline bool rollbackCaught(const RollbackSession &session) {
+    return session.state.caught && !session.mispredicted &&
+           (int32_t)(session.state.caughtTick - session.confirmed) <= 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Sends the inputs the peer hasn't acknowledged (the oldest and
+// the newest in turn when there are more than fit) and our ack.
+// Call every loop after advanceRollback().
+/////////////////////////////////////////////////////////////////
+inline void sendRollbackInputs(RollbackSession &session, uint32_t now, DuelSendFn send) {
+    uint32_t newest = session.state.tick;
+    if (newest == session.sentTick && !session.ackDue && now - session.lastSendMs < ROLLBACK_RESEND_MS) {
+        return;
+    }
+    uint32_t first = session.acked;
+    uint32_t count = newest - session.acked;
+    if (count > DUEL_PACKET_INPUTS) {
+        if (!session.sendOldest) {
+            first = newest - DUEL_PACKET_INPUTS;
+        }
+        session.sendOldest = !session.sendOldest;
+        count = DUEL_PACKET_INPUTS;
+    }
+
+    uint8_t packet[DUEL_PACKET_SIZE];
+    send(packet, encodeDuelPacket(packet, session.inputs[session.local], first, count, session.confirmed, NULL));
+    session.sentTick = newest;
+    session.ackDue = 0;
+    session.lastSendMs = now;
+}
+
+#endif
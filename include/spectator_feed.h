@@ -0,0 +1,188 @@
+#ifndef SPECTATOR_FEED_H
+#define SPECTATOR_FEED_H
+/////////////////////////////////////////////////////////////////////////////
+// The match as spectators see it: one read-only stream from the server.
+//
+// Any central that connects after the other player is a spectator. It
+// subscribes to the spectator characteristic and gets the whole match
+// state (game state, both characters and positions, the timer and both
+// players' powerups) as frames of at most SPECTATOR_FRAME_SIZE bytes:
+//
+//     [version << 4 | flags][seq][changed][short][fields...]
+//
+// The fields are coded like a snapshot's (state_snapshot.h): only what
+// changed since the frame before, with small moves as one byte. Every
+// SPECTATOR_KEYFRAME_MS a keyframe carries every field, so a spectator that
+// just joined or missed a frame is back within a second. At most one frame
+// goes out every SPECTATOR_FRAME_MS, and none while nothing changed.
+//
+// A frame is built once, into the feed, however many spectators there are;
+// the server hands it to a task of its own that notifies it to each of them
+// by connection, so spectators add no work per spectator to the game loop
+// and the player's own traffic goes to the player only. Spectators never
+// write: nothing they do reaches the game. tools/spectate.py is a host
+// stand-in. Nothing here touches the radio, see
+// tools/test_spectator_feed.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+#include "state_snapshot.h"
+
+const uint8_t SPECTATOR_VERSION = 1;
+const uint8_t SPECTATOR_HEADER_SIZE = 2;
+const uint8_t SPECTATOR_FRAME_SIZE = 20;        // one notification at the default MTU
+const uint32_t SPECTATOR_FRAME_MS = 100;        // ten frames a second at most
+const uint32_t SPECTATOR_KEYFRAME_MS = 1000;
+const uint8_t SPECTATOR_MAX = 2;                // the controller takes 3 links by default, one is the player
+
+const uint8_t SPECTATOR_KEYFRAME = 0x01;        // header flag: every field, no frame before needed
+
+enum SpectatorField {
+    SPF_STATE,              // GameState | server character << 4 | client character << 6
+    SPF_SERVER_X,           // world pixels
+    SPF_SERVER_Y,
+    SPF_CLIENT_X,
+    SPF_CLIENT_Y,
+    SPF_TIMER,              // tenths of a second left in the game
+    SPF_POWERUPS_LEFT,      // server's << 4 | client's
+    SPF_POWERUPS_ACTIVE,    // bit 0 the server's, bit 1 the client's
+    SPF_FIELD_COUNT
+};
+
+const uint8_t spectatorFieldKinds[SPF_FIELD_COUNT] = {
+    0,                                    // SPF_STATE
+    SNAPSHOT_WIDE | SNAPSHOT_SIGNED,      // SPF_SERVER_X
+    SNAPSHOT_WIDE | SNAPSHOT_SIGNED,      // SPF_SERVER_Y
+    SNAPSHOT_WIDE | SNAPSHOT_SIGNED,      // SPF_CLIENT_X
+    SNAPSHOT_WIDE | SNAPSHOT_SIGNED,      // SPF_CLIENT_Y
+    SNAPSHOT_WIDE,                        // SPF_TIMER
+    0,                                    // SPF_POWERUPS_LEFT
+    0,                                    // SPF_POWERUPS_ACTIVE
+};
+
+struct SpectatorFrame {
+    int32_t field[SPF_FIELD_COUNT];
+};
+
+struct SpectatorPacket {
+    uint8_t length;
+    uint8_t bytes[SPECTATOR_FRAME_SIZE];
+};
+
+struct SpectatorFeedStats {
+    uint32_t frames;
+    uint32_t keyframes;     // of those
+    uint32_t bytes;
+};
+
+// Server side: the frame every spectator gets, built once
+struct SpectatorFeed {
+    SpectatorFrame last;        // what the newest frame leaves spectators with
+    uint8_t seq;                // of the next frame
+    uint8_t sentAny;            // cleared, the next frame is a keyframe
+    uint32_t lastFrameMs;
+    uint32_t lastKeyframeMs;
+    SpectatorPacket packet;     // the newest frame, encoded
+    SpectatorFeedStats stats;
+};
+
+struct SpectatorViewStats {
+    uint32_t received;
+    uint32_t missed;        // gaps in the sequence numbers
+    uint32_t skipped;       // frames that came while waiting for a keyframe
+    uint32_t malformed;
+};
+
+// Spectator side: the match as the frames so far tell it
+struct SpectatorView {
+    SpectatorFrame frame;
+    uint8_t valid;          // `frame` is the newest frame's state
+    uint8_t lastSeq;
+    SpectatorViewStats stats;
+};
+
+inline void setSpectatorField(SpectatorFrame &frame, uint8_t field, int32_t value) {
+    setRecordField(spectatorFieldKinds, frame.field, field, value);
+}
+
+// SPF_STATE from the game state and both characters (1 princess, 2 dragon, 3 unchosen)
+inline uint8_t spectatorStateField(uint8_t state, uint8_t serverCharacter, uint8_t clientCharacter) {
+    return (state & 0x0F) | (serverCharacter & 0x03) << 4 | (clientCharacter & 0x03) << 6;
+}
+
+inline void resetSpectatorFeed(SpectatorFeed &feed) {
+    memset(&feed, 0, sizeof(feed));
+}
+
+// The next frame carries every field, as soon as it can go (a spectator joined)
+inline void requestSpectatorKeyframe(SpectatorFeed &feed) {
+    feed.sentAny = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+// Encodes `frame` into the feed if one is due: not within
+// SPECTATOR_FRAME_MS of the last, and only if something changed
+// or a keyframe is due. True if feed.packet holds a new frame.
+/////////////////////////////////////////////////////////////////
+inline bool buildSpectatorFrame(SpectatorFeed &feed, const SpectatorFrame &frame, uint32_t now) {
+    if (feed.sentAny && now - feed.lastFrameMs < SPECTATOR_FRAME_MS) {
+        return false;
+    }
+    bool keyframe = !feed.sentAny || now - feed.lastKeyframeMs >= SPECTATOR_KEYFRAME_MS;
+    if (!keyframe && memcmp(&frame, &feed.last, sizeof(frame)) == 0) {
+        return false;
+    }
+    uint8_t *out = feed.packet.bytes;
+    out[0] = SPECTATOR_VERSION << 4 | (keyframe ? SPECTATOR_KEYFRAME : 0);
+    out[1] = feed.seq++;
+    feed.packet.length = SPECTATOR_HEADER_SIZE +
+        encodeRecordFields(spectatorFieldKinds, SPF_FIELD_COUNT, keyframe ? NULL : feed.last.field, frame.field,
+                           out + SPECTATOR_HEADER_SIZE);
+    feed.last = frame;
+    feed.sentAny = 1;
+    feed.lastFrameMs = now;
+    if (keyframe) {
+        feed.lastKeyframeMs = now;
+        feed.stats.keyframes++;
+    }
+    feed.stats.frames++;
+    feed.stats.bytes += feed.packet.length;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// Spectator side: takes in a frame as it arrived. A delta after
+// a gap can't be decoded and waits for the next keyframe. True
+// if view.frame changed to the frame's state.
+/////////////////////////////////////////////////////////////////
+inline bool readSpectatorFrame(SpectatorView &view, const uint8_t *bytes, size_t length) {
+    if (length < SPECTATOR_HEADER_SIZE || (bytes[0] >> 4) != SPECTATOR_VERSION) {
+        view.stats.malformed++;
+        return false;
+    }
+    bool keyframe = (bytes[0] & SPECTATOR_KEYFRAME) != 0;
+    uint8_t seq = bytes[1];
+    if (view.stats.received) {
+        view.stats.missed += (uint8_t)(seq - view.lastSeq - 1);
+    }
+    bool follows = view.valid && seq == (uint8_t)(view.lastSeq + 1);
+    view.stats.received++;
+    view.lastSeq = seq;
+    if (!keyframe && !follows) {
+        view.valid = 0;
+        view.stats.skipped++;
+        return false;
+    }
+    SpectatorFrame decoded;
+    if (!decodeRecordFields(spectatorFieldKinds, SPF_FIELD_COUNT, keyframe ? NULL : view.frame.field,
+                            bytes + SPECTATOR_HEADER_SIZE, length - SPECTATOR_HEADER_SIZE, decoded.field)) {
+        view.valid = 0;
+        view.stats.malformed++;
+        return false;
+    }
+    view.frame = decoded;
+    view.valid = 1;
+    return true;
+}
+
+#endif
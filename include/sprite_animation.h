@@ -0,0 +1,128 @@
+#ifndef SPRITE_ANIMATION_H
+#define SPRITE_ANIMATION_H
+/////////////////////////////////////////////////////////////////////////////
+// Sprite animations played out of a packed texture atlas.
+//
+// All frames of all characters live in one indexed atlas image
+// (game_sprite_atlas.h, generated at build time by
+// tools/build_sprite_atlas.py). A frame is a rectangle in the atlas plus
+// where that rectangle sits inside the character's 100x100 cell, so frames
+// can be trimmed and identical pixel data can be shared between frames.
+//
+// Animations advance on the fixed simulation tick (game_tick.h), not on
+// loop() iterations, and everything here is plain structs so nothing is
+// allocated at runtime.
+//
+// Each character has one clip table per facing. Left is the right-facing
+// clips drawn with the mirrored blit, so it costs no pixel data; up/down
+// only exist when the atlas has art for them.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stddef.h>
+
+struct AtlasFrame {
+    uint16_t x;        // top left of the frame in the atlas
+    uint16_t y;
+    uint8_t w;         // size of the (trimmed) frame
+    uint8_t h;
+    int8_t offsetX;    // where the frame sits inside the character cell
+    int8_t offsetY;
+};
+
+struct AnimationClip {
+    uint8_t firstFrame;    // index into the atlas frame table
+    uint8_t frameCount;
+    uint8_t ticksPerFrame; // simulation ticks each frame is shown for
+    uint8_t palette;       // index into the atlas palette table
+};
+
+// Animations every character has, in clip table order
+enum AnimationId { ANIM_IDLE, ANIM_WALK, ANIM_POWERUP, ANIM_COUNT };
+
+// Directions a character can face, in facing table order
+enum SpriteFacing { FACE_RIGHT, FACE_LEFT, FACE_UP, FACE_DOWN, FACE_COUNT };
+
+struct FacingVariant {
+    const AnimationClip *clips;  // NULL when there is no art for the facing
+    uint8_t mirrored;            // draw the frames flipped left/right
+};
+
+struct SpriteAnimator {
+    uint8_t clip;        // AnimationId currently playing
+    uint8_t frame;       // frame within the clip
+    uint8_t ticksLeft;   // ticks until the next frame
+    uint8_t facing;      // SpriteFacing being displayed
+};
+
+/////////////////////////////////////////////////////////////////
+// Switches to another clip. Restarting the clip that is already
+// playing does nothing, so it is safe to call every tick.
+/////////////////////////////////////////////////////////////////
+inline void playAnimation(SpriteAnimator &anim, const AnimationClip *clips, uint8_t clip) {
+    if (anim.clip == clip && anim.ticksLeft != 0) {
+        return;
+    }
+    anim.clip = clip;
+    anim.frame = 0;
+    anim.ticksLeft = clips[clip].ticksPerFrame;
+}
+
+/////////////////////////////////////////////////////////////////
+// Advances the animation by one simulation tick. Returns true if
+// the displayed frame changed.
+/////////////////////////////////////////////////////////////////
+inline bool advanceAnimation(SpriteAnimator &anim, const AnimationClip *clips) {
+    const AnimationClip &clip = clips[anim.clip];
+    if (anim.ticksLeft > 1) {
+        anim.ticksLeft--;
+        return false;
+    }
+    anim.ticksLeft = clip.ticksPerFrame;
+    uint8_t next = (anim.frame + 1 < clip.frameCount) ? anim.frame + 1 : 0;
+    if (next == anim.frame) {
+        return false;
+    }
+    anim.frame = next;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// Turns the character towards its velocity. The larger component
+// wins; facings without art (and standing still) keep the current
+// facing.
+/////////////////////////////////////////////////////////////////
+inline void faceVelocity(SpriteAnimator &anim, const FacingVariant *facings, int32_t dx, int32_t dy) {
+    if (dx == 0 && dy == 0) {
+        return;
+    }
+    int32_t ax = dx < 0 ? -dx : dx;
+    int32_t ay = dy < 0 ? -dy : dy;
+    uint8_t facing;
+    if (ax >= ay) {
+        facing = dx > 0 ? FACE_RIGHT : FACE_LEFT;
+    } else {
+        facing = dy > 0 ? FACE_DOWN : FACE_UP;
+    }
+    if (facing == anim.facing || facings[facing].clips == NULL) {
+        return;
+    }
+
+    // A different clip table may have fewer frames, so restart it
+    if (facings[facing].clips != facings[anim.facing].clips) {
+        anim.frame = 0;
+        anim.ticksLeft = facings[facing].clips[anim.clip].ticksPerFrame;
+    }
+    anim.facing = facing;
+}
+
+// Clip table for the facing being displayed
+inline const AnimationClip *facingClips(const SpriteAnimator &anim, const FacingVariant *facings) {
+    return facings[anim.facing].clips;
+}
+
+// Index into the atlas frame table of the frame being displayed
+inline uint8_t currentAtlasFrame(const SpriteAnimator &anim, const AnimationClip *clips) {
+    return clips[anim.clip].firstFrame + anim.frame;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SPRITE_DRAW_H
+#define SPRITE_DRAW_H
+/////////////////////////////////////////////////////////////////////////////
+// Draws palette-indexed sprites (indexed_sprite.h) on the M5Core2 panel.
+//
+// Rows are expanded to RGB565 with the LUT kernel into a small static
+// buffer and pushed to the display a few rows at a time with palette[0] as
+// the transparent key, instead of one drawPixel() call per pixel. Atlas
+// frames (sprite_animation.h) are drawn as sub-rectangles of the atlas,
+// optionally mirrored by the kernel while expanding.
+/////////////////////////////////////////////////////////////////////////////
+#include <M5Core2.h>
+#include "indexed_sprite.h"
+#include "sprite_animation.h"
+
+// Largest scaled row we push (100px sprite at 3x) and rows per push
+const int SPRITE_BLIT_MAX_WIDTH = 300;
+const int SPRITE_BLIT_ROWS = 4;
+
+static uint16_t spriteBlitBuffer[SPRITE_BLIT_MAX_WIDTH * SPRITE_BLIT_ROWS];
+static uint16_t spriteRowBuffer[SPRITE_BLIT_MAX_WIDTH];
+static IndexedLut spriteLut;
+static const uint16_t *spriteLutPalette = NULL;
+
+/////////////////////////////////////////////////////////////////
+// Rebuilds the shared expansion table only when a sprite with a
+// different palette is drawn
+/////////////////////////////////////////////////////////////////
+inline const IndexedLut &lutForPalette(const uint16_t *palette, uint8_t paletteSize) {
+    if (spriteLutPalette != palette) {
+        buildIndexedLut(palette, paletteSize, spriteLut);
+        spriteLutPalette = palette;
+    }
+    return spriteLut;
+}
+
+/////////////////////////////////////////////////////////////////
+// Draws the w x h region of the sprite starting at (srcX, srcY)
+// with its top left corner at (xOffset, yOffset), using the given
+// palette and scaled by resizeMult (each source pixel becomes a
+// resizeMult x resizeMult square). Transparent pixels are skipped.
+// mirrored flips the region left/right while it is expanded.
+/////////////////////////////////////////////////////////////////
+inline void drawIndexedRegion(const IndexedSprite &sprite, const uint16_t *palette,
+                              int srcX, int srcY, int w, int h,
+                              int xOffset, int yOffset, int resizeMult, bool mirrored = false) {
+    if (resizeMult < 1) {
+        resizeMult = 1;
+    }
+    int scaledWidth = w * resizeMult;
+    if (scaledWidth > SPRITE_BLIT_MAX_WIDTH || resizeMult > SPRITE_BLIT_ROWS) {
+        return;
+    }
+    const IndexedLut &lut = lutForPalette(palette, sprite.paletteSize);
+    uint16_t transparent = palette[0];
+
+    int rowsBuffered = 0;
+    int bufferY = yOffset;
+    for (int y = 0; y < h; y++) {
+        if (resizeMult == 1) {
+            uint16_t *dst = spriteBlitBuffer + rowsBuffered * scaledWidth;
+            if (mirrored) {
+                expandIndexedSpanMirrored(sprite, lut, srcY + y, srcX, w, dst);
+            } else {
+                expandIndexedSpan(sprite, lut, srcY + y, srcX, w, dst);
+            }
+            rowsBuffered++;
+        } else {
+            // Scale horizontally once, then repeat the row vertically
+            if (mirrored) {
+                expandIndexedSpanMirrored(sprite, lut, srcY + y, srcX, w, spriteRowBuffer);
+            } else {
+                expandIndexedSpan(sprite, lut, srcY + y, srcX, w, spriteRowBuffer);
+            }
+            uint16_t *dst = spriteBlitBuffer + rowsBuffered * scaledWidth;
+            for (int x = 0; x < w; x++) {
+                for (int i = 0; i < resizeMult; i++) {
+                    *dst++ = spriteRowBuffer[x];
+                }
+            }
+            rowsBuffered++;
+            for (int j = 1; j < resizeMult && rowsBuffered < SPRITE_BLIT_ROWS; j++) {
+                memcpy(spriteBlitBuffer + rowsBuffered * scaledWidth,
+                       spriteBlitBuffer + (rowsBuffered - 1) * scaledWidth,
+                       scaledWidth * sizeof(uint16_t));
+                rowsBuffered++;
+            }
+        }
+
+        // Flush when the buffer cannot take another (scaled) source row
+        if (rowsBuffered + resizeMult > SPRITE_BLIT_ROWS || y == h - 1) {
+            M5.Lcd.drawBitmap(xOffset, bufferY, scaledWidth, rowsBuffered, spriteBlitBuffer, transparent);
+            bufferY += rowsBuffered;
+            rowsBuffered = 0;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+// Draws a whole sprite with its own palette
+/////////////////////////////////////////////////////////////////
+inline void drawIndexedSprite(const IndexedSprite &sprite, int xOffset, int yOffset, int resizeMult) {
+    drawIndexedRegion(sprite, sprite.palette, 0, 0, sprite.width, sprite.height, xOffset, yOffset, resizeMult);
+}
+
+/////////////////////////////////////////////////////////////////
+// Draws one atlas frame in a cellSize x cellSize character cell
+// whose top left corner is (cellX, cellY). A mirrored frame is
+// also mirrored within the cell.
+/////////////////////////////////////////////////////////////////
+inline void drawAtlasFrame(const IndexedSprite &atlas, const AtlasFrame &frame, const uint16_t *palette,
+                           int cellX, int cellY, int cellSize, bool mirrored) {
+    int offsetX = mirrored ? cellSize - frame.offsetX - frame.w : frame.offsetX;
+    drawIndexedRegion(atlas, palette, frame.x, frame.y, frame.w, frame.h,
+                      cellX + offsetX, cellY + frame.offsetY, 1, mirrored);
+}
+
+// Screen position of an atlas frame drawn by drawAtlasFrame()
+inline void atlasFramePosition(const AtlasFrame &frame, int cellX, int cellY, int cellSize, bool mirrored,
+                               int &x, int &y) {
+    x = cellX + (mirrored ? cellSize - frame.offsetX - frame.w : frame.offsetX);
+    y = cellY + frame.offsetY;
+}
+
+/////////////////////////////////////////////////////////////////
+// Same as drawAtlasFrame() but only draws the part of the frame
+// inside the clip rectangle, so a frame can be composited one
+// tile run at a time
+/////////////////////////////////////////////////////////////////
+inline void drawAtlasFrameClipped(const IndexedSprite &atlas, const AtlasFrame &frame, const uint16_t *palette,
+                                  int cellX, int cellY, int cellSize, bool mirrored,
+                                  int clipX, int clipY, int clipW, int clipH) {
+    int dstX, dstY;
+    atlasFramePosition(frame, cellX, cellY, cellSize, mirrored, dstX, dstY);
+    int x0 = max(dstX, clipX);
+    int y0 = max(dstY, clipY);
+    int x1 = min(dstX + (int)frame.w, clipX + clipW);
+    int y1 = min(dstY + (int)frame.h, clipY + clipH);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    // A mirrored frame reads its columns from the right hand side
+    int srcX = mirrored ? frame.x + (dstX + frame.w - x1) : frame.x + (x0 - dstX);
+    drawIndexedRegion(atlas, palette, srcX, frame.y + (y0 - dstY), x1 - x0, y1 - y0, x0, y0, 1, mirrored);
+}
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef STATE_SNAPSHOT_H
+#define STATE_SNAPSHOT_H
+/////////////////////////////////////////////////////////////////////////////
+// Each device's share of the game state as one binary record, sent as a
+// delta against the last record the peer acknowledged.
+//
+// Positions used to take four characteristics, one notification or ASCII
+// write per axis with a delay() after each. A snapshot holds everything a
+// device owns (state, character, position, timer, powerups, match tick) and
+// always fits one notification at the default MTU (20 bytes):
+//
+//   [version << 4 | flags][seq][base][ack][changed][short][fields...]
+//
+// `changed` has a bit for each field present, in SnapshotField order; an
+// absent field is the same as in snapshot `base`. A 16 bit field with its
+// `short` bit set is sent as a signed one byte difference from the base,
+// which covers a character moving between two sends. A keyframe has no
+// base and carries every field.
+//
+// `ack` is the newest snapshot received from the peer, so both directions
+// acknowledge each other for free. Each side deltas against the newest of
+// its own snapshots the peer acknowledged, which the peer still has in its
+// history; a lost packet only makes the next one a little longer. Keyframes
+// go out until the first ack arrives (a new connection) and when the peer
+// asks for one because it could not decode a delta.
+//
+// Nothing is sent while the record stays the same, except a heartbeat every
+// SNAPSHOT_HEARTBEAT_MS that carries the ack, the timer and the tick, and an
+// ack for every SNAPSHOT_HISTORY / 4 snapshots from a peer that keeps moving.
+//
+// Game state changes and powerups also go through the event channel
+// (reliable_channel.h), which makes sure they arrive; the copies here are
+// just the latest values. The BLE callback only queues the packet; the loop
+// task does the rest in serviceSnapshotLink(). Nothing here touches the
+// hardware, see tools/test_state_snapshot.cpp.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "render_queue.h"
+
+const uint8_t SNAPSHOT_VERSION = 1;
+const uint8_t SNAPSHOT_HEADER_SIZE = 6;
+const uint8_t SNAPSHOT_PACKET_SIZE = 20;     // ATT payload at the default MTU of 23
+const uint8_t SNAPSHOT_HISTORY = 16;         // snapshots kept each way, divides 256
+const uint32_t SNAPSHOT_INBOX_SIZE = 8;      // packets from the BLE task, power of two
+const uint32_t SNAPSHOT_HEARTBEAT_MS = 200;
+
+// Header flags, low nibble of the first byte
+const uint8_t SNAPSHOT_KEYFRAME = 0x01;        // no base, every field present
+const uint8_t SNAPSHOT_ACK_VALID = 0x02;       // `ack` holds a snapshot we received
+const uint8_t SNAPSHOT_WANT_KEYFRAME = 0x04;   // a delta could not be decoded
+
+enum SnapshotField {
+    SF_STATE,           // GameState (game_flow.h)
+    SF_CHARACTER,       // 1 princess, 2 dragon, 3 unchosen
+    SF_X,               // world pixels
+    SF_Y,
+    SF_TIMER,           // tenths of a second left in the game
+    SF_POWERUPS_LEFT,
+    SF_POWERUP_ACTIVE,
+    SF_TICK,            // match tick (game_tick.h), low 16 bits
+    SF_FIELD_COUNT
+};
+
+// How each field is stored and sent
+const uint8_t SNAPSHOT_WIDE = 0x01;       // 16 bits instead of 8
+const uint8_t SNAPSHOT_SIGNED = 0x02;
+const uint8_t SNAPSHOT_VOLATILE = 0x04;   // changes all the time, waits for the heartbeat
+
+const uint8_t snapshotFieldKinds[SF_FIELD_COUNT] = {
+    0,                                    // SF_STATE
+    0,                                    // SF_CHARACTER
+    SNAPSHOT_WIDE | SNAPSHOT_SIGNED,      // SF_X
+    SNAPSHOT_WIDE | SNAPSHOT_SIGNED,      // SF_Y
+    SNAPSHOT_WIDE | SNAPSHOT_VOLATILE,    // SF_TIMER
+    0,                                    // SF_POWERUPS_LEFT
+    0,                                    // SF_POWERUP_ACTIVE
+    SNAPSHOT_WIDE | SNAPSHOT_VOLATILE,    // SF_TICK
+};
+
+struct GameSnapshot {
+    int32_t field[SF_FIELD_COUNT];
+};
+
+struct SnapshotPacket {
+    uint8_t length;
+    uint8_t bytes[SNAPSHOT_PACKET_SIZE];
+};
+
+struct SnapshotStats {
+    uint32_t sent;
+    uint32_t keyframes;     // of those
+    uint32_t bytes;         // in all sent packets
+    uint32_t received;
+    uint32_t lost;          // gaps in the peer's sequence numbers
+    uint32_t rttSamples;    // snapshots of ours acked...
+    uint32_t rttTotalMs;    // ...and the sum of their round trips
+    uint32_t undecodable;   // deltas whose base was gone; a keyframe was asked for
+    uint32_t malformed;
+};
+
+// Hands a packet to the radio (write without response / notify)
+typedef void (*SnapshotSendFn)(const uint8_t *bytes, size_t length);
+
+struct SnapshotLink {
+    uint8_t nextSeq;             // sequence number of our next snapshot
+    uint8_t sentAny;             // since the reset
+    uint8_t peerAck;             // newest of ours the peer has...
+    uint8_t peerAcked;           // ...once it has any
+    uint8_t peerWantsKeyframe;
+    uint8_t lastReceived;        // newest of the peer's we have...
+    uint8_t received;            // ...once we have any
+    uint8_t wantKeyframe;        // asks the peer for a keyframe
+    uint8_t unacked;             // snapshots received since we last sent
+    uint32_t lastSendMs;
+    GameSnapshot sent[SNAPSHOT_HISTORY];       // ours, by sequence number
+    uint32_t sentMs[SNAPSHOT_HISTORY];         // when each went out
+    GameSnapshot history[SNAPSHOT_HISTORY];    // the peer's, by sequence number
+    uint8_t historySeq[SNAPSHOT_HISTORY];
+    uint8_t historyValid[SNAPSHOT_HISTORY];
+    RenderQueue<SnapshotPacket, SNAPSHOT_INBOX_SIZE> inbox;
+    SnapshotStats stats;
+};
+
+// The same for any record of up to 8 fields described by `kinds`
+inline void setRecordField(const uint8_t *kinds, int32_t *fields, uint8_t field, int32_t value) {
+    uint8_t kind = kinds[field];
+    if (!(kind & SNAPSHOT_WIDE)) {
+        fields[field] = (uint8_t)value;
+    } else if (kind & SNAPSHOT_SIGNED) {
+        fields[field] = (int16_t)value;
+    } else {
+        fields[field] = (uint16_t)value;
+    }
+}
+
+// Stores a value the way it goes on the air, so comparisons see what the peer sees
+inline void setSnapshotField(GameSnapshot &snapshot, uint8_t field, int32_t value) {
+    setRecordField(snapshotFieldKinds, snapshot.field, field, value);
+}
+
+/////////////////////////////////////////////////////////////////
+// Writes the `changed` and `short` bytes and the fields of a
+// record that differ from `base` (all of them without a base).
+// `kinds` describes the `count` fields. Returns the number of
+// bytes written.
+/////////////////////////////////////////////////////////////////
+inline uint8_t encodeRecordFields(const uint8_t *kinds, uint8_t count, const int32_t *base, const int32_t *fields,
+                                  uint8_t *out) {
+    uint8_t changed = 0;
+    uint8_t shortened = 0;
+    uint8_t length = 2;
+    for (uint8_t f = 0; f < count; f++) {
+        int32_t value = fields[f];
+        if (base && base[f] == value) {
+            continue;
+        }
+        changed |= 1 << f;
+        if (!(kinds[f] & SNAPSHOT_WIDE)) {
+            out[length++] = (uint8_t)value;
+            continue;
+        }
+        int16_t delta = base ? (int16_t)(uint16_t)(value - base[f]) : 0;
+        if (base && delta >= -128 && delta <= 127) {
+            shortened |= 1 << f;
+            out[length++] = (uint8_t)(int8_t)delta;
+        } else {
+            out[length++] = (uint8_t)value;
+            out[length++] = (uint8_t)(value >> 8);
+        }
+    }
+    out[0] = changed;
+    out[1] = shortened;
+    return length;
+}
+
+/////////////////////////////////////////////////////////////////
+// Reverses encodeRecordFields(). Returns false if the bytes
+// don't add up, in which case `fields` is left unusable.
+/////////////////////////////////////////////////////////////////
+inline bool decodeRecordFields(const uint8_t *kinds, uint8_t count, const int32_t *base, const uint8_t *bytes,
+                               size_t length, int32_t *fields) {
+    if (length < 2) {
+        return false;
+    }
+    uint8_t changed = bytes[0];
+    uint8_t shortened = bytes[1];
+    uint8_t all = (uint8_t)((1 << count) - 1);
+    if ((changed & ~all) || (!base && changed != all)) {
+        return false;   // a keyframe has every field
+    }
+    if (shortened & ~changed) {
+        return false;
+    }
+    size_t at = 2;
+    for (uint8_t f = 0; f < count; f++) {
+        if (!(changed & (1 << f))) {
+            fields[f] = base[f];
+            continue;
+        }
+        uint8_t kind = kinds[f];
+        if (!(kind & SNAPSHOT_WIDE) || (shortened & (1 << f))) {
+            if (at + 1 > length) {
+                return false;
+            }
+        } else if (at + 2 > length) {
+            return false;
+        }
+        if (!(kind & SNAPSHOT_WIDE)) {
+            fields[f] = bytes[at++];
+        } else if (shortened & (1 << f)) {
+            if (!base) {
+                return false;
+            }
+            setRecordField(kinds, fields, f, base[f] + (int8_t)bytes[at++]);
+        } else {
+            setRecordField(kinds, fields, f, bytes[at] | (bytes[at + 1] << 8));
+            at += 2;
+        }
+    }
+    return at == length;
+}
+
+// A snapshot's fields against `base` (a keyframe without one)
+inline uint8_t encodeSnapshotFields(const GameSnapshot *base, const GameSnapshot &snapshot, uint8_t *out) {
+    return encodeRecordFields(snapshotFieldKinds, SF_FIELD_COUNT, base ? base->field : NULL, snapshot.field, out);
+}
+
+inline bool decodeSnapshotFields(const GameSnapshot *base, const uint8_t *bytes, size_t length,
+                                 GameSnapshot &snapshot) {
+    return decodeRecordFields(snapshotFieldKinds, SF_FIELD_COUNT, base ? base->field : NULL, bytes, length,
+                              snapshot.field);
+}
+
+/////////////////////////////////////////////////////////////////
+// Forgets both histories, so the next snapshot each way is a
+// keyframe. Both sides call it when the link drops. Loop task.
+/////////////////////////////////////////////////////////////////
+inline void resetSnapshotLink(SnapshotLink &link) {
+    link.nextSeq = link.sentAny = 0;
+    link.peerAck = link.peerAcked = link.peerWantsKeyframe = 0;
+    link.lastReceived = link.received = link.wantKeyframe = link.unacked = 0;
+    link.lastSendMs = 0;
+    memset(link.historyValid, 0, sizeof(link.historyValid));
+    SnapshotPacket stale;
+    while (link.inbox.pop(stale)) {
+    }
+}
+
+// Called from the BLE callback with a packet as it arrived
+inline bool receiveSnapshotPacket(SnapshotLink &link, const uint8_t *bytes, size_t length) {
+    if (length > SNAPSHOT_PACKET_SIZE) {
+        return false;   // not ours; counting it here would race the loop task
+    }
+    SnapshotPacket packet;
+    packet.length = (uint8_t)length;
+    memcpy(packet.bytes, bytes, length);
+    return link.inbox.push(packet);   // a lost snapshot is overtaken by the next
+}
+
+/////////////////////////////////////////////////////////////////
+// Takes in one packet from the peer. Returns true and fills in
+// `peer` if it held a snapshot newer than the last one. A new
+// ack times the round trip of the snapshot it acks.
+/////////////////////////////////////////////////////////////////
+inline bool handleSnapshotPacket(SnapshotLink &link, const SnapshotPacket &packet, uint32_t now,
+                                 GameSnapshot &peer) {
+    if (packet.length < SNAPSHOT_HEADER_SIZE || (packet.bytes[0] >> 4) != SNAPSHOT_VERSION) {
+        link.stats.malformed++;
+        return false;
+    }
+    uint8_t flags = packet.bytes[0] & 0x0F;
+    uint8_t seq = packet.bytes[1];
+    uint8_t base = packet.bytes[2];
+    uint8_t ack = packet.bytes[3];
+
+    // Only acks for snapshots we sent, and only newer ones
+    uint8_t ackAge = (uint8_t)(link.nextSeq - ack);
+    if ((flags & SNAPSHOT_ACK_VALID) && ackAge >= 1 && ackAge <= SNAPSHOT_HISTORY &&
+        (!link.peerAcked || (int8_t)(ack - link.peerAck) > 0)) {
+        link.peerAck = ack;
+        link.peerAcked = 1;
+        link.stats.rttSamples++;
+        link.stats.rttTotalMs += now - link.sentMs[ack % SNAPSHOT_HISTORY];
+    }
+    if (flags & SNAPSHOT_WANT_KEYFRAME) {
+        link.peerWantsKeyframe = 1;
+    }
+    if (link.received && (int8_t)(seq - link.lastReceived) <= 0) {
+        return false;   // old or duplicate
+    }
+
+    const GameSnapshot *baseSnapshot = NULL;
+    if (!(flags & SNAPSHOT_KEYFRAME)) {
+        uint8_t slot = base % SNAPSHOT_HISTORY;
+        if (!link.historyValid[slot] || link.historySeq[slot] != base) {
+            link.stats.undecodable++;
+            link.wantKeyframe = 1;
+            return false;
+        }
+        baseSnapshot = &link.history[slot];
+    }
+    GameSnapshot snapshot;
+    if (!decodeSnapshotFields(baseSnapshot, packet.bytes + SNAPSHOT_HEADER_SIZE - 2,
+                              packet.length - (SNAPSHOT_HEADER_SIZE - 2), snapshot)) {
+        link.stats.malformed++;
+        return false;
+    }
+    uint8_t slot = seq % SNAPSHOT_HISTORY;
+    link.history[slot] = snapshot;
+    link.historySeq[slot] = seq;
+    link.historyValid[slot] = 1;
+    if (link.received) {
+        link.stats.lost += (uint8_t)(seq - link.lastReceived - 1);
+    }
+    link.lastReceived = seq;
+    link.received = 1;
+    link.wantKeyframe = 0;
+    link.unacked++;
+    link.stats.received++;
+    peer = snapshot;
+    return true;
+}
+
+// True if `snapshot` differs from the last one sent in anything but the volatile fields
+inline bool snapshotChanged(const SnapshotLink &link, const GameSnapshot &snapshot) {
+    if (!link.sentAny) {
+        return true;
+    }
+    const GameSnapshot &last = link.sent[(uint8_t)(link.nextSeq - 1) % SNAPSHOT_HISTORY];
+    for (uint8_t f = 0; f < SF_FIELD_COUNT; f++) {
+        if (!(snapshotFieldKinds[f] & SNAPSHOT_VOLATILE) && last.field[f] != snapshot.field[f]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////
+// Sends `snapshot` as a delta against the newest one the peer
+// acknowledged, or as a keyframe if there is none to use
+/////////////////////////////////////////////////////////////////
+inline void sendSnapshot(SnapshotLink &link, const GameSnapshot &snapshot, uint32_t now, SnapshotSendFn send) {
+    uint8_t ackAge = (uint8_t)(link.nextSeq - link.peerAck);
+    bool keyframe = !link.peerAcked || link.peerWantsKeyframe || ackAge < 1 || ackAge > SNAPSHOT_HISTORY;
+    const GameSnapshot *base = keyframe ? NULL : &link.sent[link.peerAck % SNAPSHOT_HISTORY];
+
+    uint8_t bytes[SNAPSHOT_PACKET_SIZE];
+    uint8_t flags = (keyframe ? SNAPSHOT_KEYFRAME : 0) | (link.received ? SNAPSHOT_ACK_VALID : 0) |
+                    (link.wantKeyframe ? SNAPSHOT_WANT_KEYFRAME : 0);
+    bytes[0] = (SNAPSHOT_VERSION << 4) | flags;
+    bytes[1] = link.nextSeq;
+    bytes[2] = keyframe ? 0 : link.peerAck;
+    bytes[3] = link.lastReceived;
+    uint8_t length = SNAPSHOT_HEADER_SIZE - 2 + encodeSnapshotFields(base, snapshot, bytes + SNAPSHOT_HEADER_SIZE - 2);
+    send(bytes, length);
+
+    link.sent[link.nextSeq % SNAPSHOT_HISTORY] = snapshot;
+    link.sentMs[link.nextSeq % SNAPSHOT_HISTORY] = now;
+    link.nextSeq++;
+    link.sentAny = 1;
+    link.lastSendMs = now;
+    link.unacked = 0;
+    if (keyframe) {
+        link.peerWantsKeyframe = 0;
+        link.stats.keyframes++;
+    }
+    link.stats.sent++;
+    link.stats.bytes += length;
+}
+
+/////////////////////////////////////////////////////////////////
+// Runs the link, once per loop on the loop task: takes in what
+// arrived and sends `snapshot` if it changed, the peer wants a
+// keyframe or an ack, or the heartbeat is due. Returns true and
+// fills in `peer` if a newer snapshot arrived from the peer.
+/////////////////////////////////////////////////////////////////
+inline bool serviceSnapshotLink(SnapshotLink &link, const GameSnapshot &snapshot, uint32_t now,
+                                SnapshotSendFn send, GameSnapshot &peer) {
+    bool updated = false;
+    SnapshotPacket packet;
+    while (link.inbox.pop(packet)) {
+        updated |= handleSnapshotPacket(link, packet, now, peer);
+    }
+
+    // A peer sending every loop needs acks before its history runs out
+    if (link.peerWantsKeyframe || link.unacked >= SNAPSHOT_HISTORY / 4 || snapshotChanged(link, snapshot) ||
+        now - link.lastSendMs >= SNAPSHOT_HEARTBEAT_MS) {
+        sendSnapshot(link, snapshot, now, send);
+    }
+    return updated;
+}
+
+#endif
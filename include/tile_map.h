@@ -0,0 +1,152 @@
+#ifndef TILE_MAP_H
+#define TILE_MAP_H
+/////////////////////////////////////////////////////////////////////////////
+// Tile map of the arena and the camera that scrolls over it.
+//
+// The world is a grid of tiles, larger than the screen. Maps are stored in
+// a small binary format (run-length coded tile types, see
+// tools/build_tile_map.py for the layout) and decoded once into RAM by
+// loadTileMap(). Tile types index into a tile set strip, and each type can
+// be marked solid to block movement.
+//
+// The camera follows the local player but only moves in whole tiles, so
+// after a scroll every screen tile slot still lines up with a world tile.
+// The renderer can then keep every slot whose tile type did not change and
+// only redraws the ones that did.
+//
+// Nothing in here touches the display (the M5 side lives in
+// tile_map_draw.h), so it compiles on the host as well.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string.h>
+
+const uint8_t TILE_MAP_VERSION = 1;
+const int TILE_MAP_MAX_TILES = 64 * 64;
+const int TILE_MAP_MAX_SPAWNS = 4;
+
+struct TileMap {
+    uint16_t width;        // in tiles
+    uint16_t height;
+    uint8_t tileSize;      // in pixels
+    uint16_t solidMask;    // bit n set = tile type n blocks movement
+    uint8_t spawnCount;
+    int16_t spawnX[TILE_MAP_MAX_SPAWNS];  // world pixels
+    int16_t spawnY[TILE_MAP_MAX_SPAWNS];
+    uint8_t tiles[TILE_MAP_MAX_TILES];    // one tile type per byte, row by row
+};
+
+// Top left corner of the screen in world pixels
+struct TileCamera {
+    int16_t x;
+    int16_t y;
+};
+
+inline uint16_t readMapU16(const uint8_t *data) {
+    return data[0] | (data[1] << 8);
+}
+
+/////////////////////////////////////////////////////////////////
+// Decodes a binary map. Returns false (and leaves the map
+// unusable) if the data is truncated, from another version or
+// does not fit.
+/////////////////////////////////////////////////////////////////
+inline bool loadTileMap(const uint8_t *data, uint32_t size, TileMap &map) {
+    if (size < 13 || memcmp(data, "TMAP", 4) != 0 || data[4] != TILE_MAP_VERSION) {
+        return false;
+    }
+    map.tileSize = data[5];
+    map.width = readMapU16(data + 6);
+    map.height = readMapU16(data + 8);
+    map.solidMask = readMapU16(data + 10);
+    map.spawnCount = data[12];
+    uint32_t tileCount = (uint32_t)map.width * map.height;
+    if (map.tileSize == 0 || tileCount == 0 || tileCount > TILE_MAP_MAX_TILES ||
+        map.spawnCount > TILE_MAP_MAX_SPAWNS) {
+        return false;
+    }
+
+    uint32_t pos = 13;
+    if (pos + map.spawnCount * 4 + 2 > size) {
+        return false;
+    }
+    for (int i = 0; i < map.spawnCount; i++) {
+        map.spawnX[i] = readMapU16(data + pos);
+        map.spawnY[i] = readMapU16(data + pos + 2);
+        pos += 4;
+    }
+
+    uint32_t runBytes = readMapU16(data + pos);
+    pos += 2;
+    if (pos + runBytes > size) {
+        return false;
+    }
+    uint32_t filled = 0;
+    for (uint32_t i = 0; i < runBytes; i++) {
+        uint8_t run = (data[pos + i] >> 4) + 1;
+        uint8_t tile = data[pos + i] & 0x0F;
+        if (filled + run > tileCount) {
+            return false;
+        }
+        memset(map.tiles + filled, tile, run);
+        filled += run;
+    }
+    return filled == tileCount;
+}
+
+inline int tileMapWidthPx(const TileMap &map) {
+    return map.width * map.tileSize;
+}
+
+inline int tileMapHeightPx(const TileMap &map) {
+    return map.height * map.tileSize;
+}
+
+// Tile type at a tile position; outside the map counts as the first solid type
+inline uint8_t tileAt(const TileMap &map, int col, int row) {
+    if (col < 0 || row < 0 || col >= map.width || row >= map.height) {
+        for (uint8_t t = 0; t < 16; t++) {
+            if (map.solidMask & (1 << t)) {
+                return t;
+            }
+        }
+        return 0;
+    }
+    return map.tiles[row * map.width + col];
+}
+
+/////////////////////////////////////////////////////////////////
+// True if the world pixel is inside a solid tile or outside the
+// map
+/////////////////////////////////////////////////////////////////
+inline bool tileMapSolidAt(const TileMap &map, int x, int y) {
+    if (x < 0 || y < 0) {
+        return true;
+    }
+    uint8_t tile = tileAt(map, x / map.tileSize, y / map.tileSize);
+    return (map.solidMask >> tile) & 1;
+}
+
+/////////////////////////////////////////////////////////////////
+// Centres the camera on a world position, snapped to whole tiles
+// and clamped so it never shows anything outside the map
+/////////////////////////////////////////////////////////////////
+inline void followTileCamera(TileCamera &camera, const TileMap &map, int x, int y,
+                             int screenWidth, int screenHeight) {
+    int ts = map.tileSize;
+    int cx = x - screenWidth / 2 + ts / 2;
+    int cy = y - screenHeight / 2 + ts / 2;
+    cx = (cx < 0) ? 0 : cx - cx % ts;
+    cy = (cy < 0) ? 0 : cy - cy % ts;
+    int maxX = tileMapWidthPx(map) - screenWidth;
+    int maxY = tileMapHeightPx(map) - screenHeight;
+    if (cx > maxX) {
+        cx = maxX > 0 ? maxX : 0;
+    }
+    if (cy > maxY) {
+        cy = maxY > 0 ? maxY : 0;
+    }
+    camera.x = cx;
+    camera.y = cy;
+}
+
+#endif
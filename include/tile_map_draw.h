@@ -0,0 +1,60 @@
+#ifndef TILE_MAP_DRAW_H
+#define TILE_MAP_DRAW_H
+/////////////////////////////////////////////////////////////////////////////
+// M5Core2 side of the tile map (tile_map.h): loads the arena generated
+// into game_tile_map.h and draws runs of tiles.
+//
+// A run of tiles on one tile row is expanded a few pixel rows at a time
+// into a single buffer and pushed with one drawBitmap() per chunk. Tiles
+// are opaque, so there is no transparent key. Tiles under the fog use the
+// darkened palette; both expansion tables are kept built.
+/////////////////////////////////////////////////////////////////////////////
+#include <M5Core2.h>
+#include "tile_map.h"
+#include "game_tile_map.h"
+
+const int TILE_RUN_MAX_WIDTH = 320;
+const int TILE_RUN_ROWS = 4;
+
+static TileMap arenaMap;
+static uint16_t tileRunBuffer[TILE_RUN_MAX_WIDTH * TILE_RUN_ROWS];
+static IndexedLut tileLut;
+static IndexedLut tileFogLut;
+
+///////////////////////////////////////////////////////////////
+// Decodes the arena and builds the tile expansion tables. Returns
+// false if the generated map data is not usable.
+///////////////////////////////////////////////////////////////
+inline bool setupTileMap() {
+    buildIndexedLut(tilesetPalette, TILESET_PALETTE_SIZE, tileLut);
+    buildIndexedLut(tilesetFogPalette, TILESET_PALETTE_SIZE, tileFogLut);
+    return loadTileMap(arenaMapData, arenaMapSize, arenaMap) &&
+           arenaMap.tileSize == TILESET_TILE_SIZE && arenaMap.spawnCount >= SPAWN_COUNT;
+}
+
+///////////////////////////////////////////////////////////////
+// Draws `count` tiles of tile row `row`, starting at tile column
+// `col`, with the top left corner at screen (x, y)
+///////////////////////////////////////////////////////////////
+inline void drawTileRun(const TileMap &map, int col, int row, int count, int x, int y, bool fogged) {
+    const IndexedLut &lut = fogged ? tileFogLut : tileLut;
+    int ts = map.tileSize;
+    if (count * ts > TILE_RUN_MAX_WIDTH) {
+        count = TILE_RUN_MAX_WIDTH / ts;
+    }
+    int width = count * ts;
+
+    for (int ty = 0; ty < ts; ty += TILE_RUN_ROWS) {
+        int rows = (ts - ty < TILE_RUN_ROWS) ? ts - ty : TILE_RUN_ROWS;
+        for (int r = 0; r < rows; r++) {
+            uint16_t *dst = tileRunBuffer + r * width;
+            for (int i = 0; i < count; i++) {
+                uint8_t tile = tileAt(map, col + i, row);
+                expandIndexedSpan(tilesetSprite, lut, ty + r, tile * ts, ts, dst + i * ts);
+            }
+        }
+        M5.Lcd.drawBitmap(x, y + ty, width, rows, tileRunBuffer);
+    }
+}
+
+#endif
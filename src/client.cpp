@@ -5,54 +5,106 @@
 #include <BLE2902.h>
 #include <M5Core2.h>
 #include <Adafruit_seesaw.h>
-#include "../include/game_image_bitmaps.h"
+#include "../include/game_indexed_bitmaps.h"
+#include "../include/game_sprite_atlas.h"
+#include "../include/sprite_draw.h"
+#include "../include/game_tick.h"
+#include "../include/hud_draw.h"
+#include "../include/render_task.h"
+#include "../include/fog_draw.h"
+#include "../include/character_collision.h"
+#include "../include/kinematics.h"
+#include "../include/joystick_setup.h"
+#include "../include/game_flow.h"
+#include "../include/reliable_channel.h"
+#include "../include/powerups.h"
+#include "../include/state_snapshot.h"
+#include "../include/link_tuning.h"
+#include "../include/link_telemetry.h"
+#include "../include/match_record.h"
+#include "../include/rollback.h"
+#include "../include/lockstep.h"
+#include "../include/match_beacon.h"
+#include "../include/alloc_guard.h"
+#include "../include/log_task.h"
+#include "../include/memory_monitor.h"
+#include "../include/object_pool.h"
 
 ///////////////////////////////////////////////////////////////
 // Variables
 ///////////////////////////////////////////////////////////////
 
 //Connection Variables
-static BLEAdvertisedDevice *bleRemoteServer;
+// A server found by the scan: all connecting needs, nothing on the heap
+struct DiscoveredServer {
+    DiscoveredServer(BLEAdvertisedDevice &device, const MatchBeacon &beacon)
+        : address(device.getAddress()), addressType(device.getAddressType()), beacon(beacon) {}
+    BLEAddress address;
+    esp_ble_addr_type_t addressType;
+    MatchBeacon beacon;
+};
+// Two, so the one loop() may be connecting to stays put while the scan finds the next
+static ObjectPool<DiscoveredServer, 2> discoveredServers;
+static DiscoveredServer *bleRemoteServer = NULL;
+static BLEClient *bleClient = NULL;     // created once, every connection reuses it
 static boolean doConnect = false;
 static boolean doScan = false;
 bool deviceConnected = false;
 
 
 
-// Location Characteristics/Variables
-BLERemoteCharacteristic *bleReadXCharacteristic;
-BLERemoteCharacteristic *bleReadYCharacteristic;
-BLERemoteCharacteristic *bleReadWriteXCharacteristic;
-BLERemoteCharacteristic *bleReadWriteYCharacteristic;
-bool locationWasUpdated = true;
+// Location, timer and the rest of our state, both ways (state_snapshot.h)
+BLERemoteCharacteristic *bleSnapshotCharacteristic;
+static SnapshotLink snapshotLink;
+static GameSnapshot opponentSnapshot;   // the server's latest
+uint32_t linkStatsLoggedMs = 0;
+uint32_t linkStatsBytes = 0;
+uint32_t linkStatsRttSamples = 0;
+uint32_t linkStatsRttTotalMs = 0;
 
-// Gameplay Characteristics/Variables
-bool screenUpdated = false;
-bool gameEnded = false;
-bool playingAgain = false;
+// Connection parameters the server asked for and we agreed to (link_tuning.h)
+static RenderQueue<LinkUpdate, 4> linkUpdates;
 
-//Characteristics for each player's player type (2) and when an opponents powerup is used (2), and gamestate (1)
+// Pings and link quality (link_telemetry.h); the server also exposes its record
+BLERemoteCharacteristic *blePingCharacteristic;
+static LinkTelemetry linkTelemetry;
+uint32_t linkStatsReceived = 0;
+uint32_t linkStatsLost = 0;
+uint8_t linkDropPercent = 0;   // snapshots lost in the last stats window
+bool linkOverlay = false;      // BtnB shows the round trip and drops on the HUD
 
-BLERemoteCharacteristic *bleLocalPlayerSelectionCharacteristic; // Our local, corresponds to server's opponent
-BLERemoteCharacteristic *bleOpponentPlayerSelectionCharacteristic; // Our opponent, corresponds to server's local
-BLERemoteCharacteristic *bleGameStateCharacteristic;
+// Each game's inputs and what came in, for tools/replay_match.cpp (match_record.h)
+static MatchRecorder matchRecorder;
+uint32_t matchDumped = 0;      // bytes of the recording printed so far
+
+// Input modes (duel_sim.h, NET_MODE): both sides' inputs on their own
+// characteristic, both characters simulated here
+BLERemoteCharacteristic *bleInputCharacteristic;
+static RollbackSession rollback;
+static LockstepSession lockstep;
+uint32_t duelWorstUs = 0;      // longest simulation advance since the last stats line
+
+// Gameplay Characteristics/Variables
+bool redrawGame = false; // next game frame redraws everything (a powerup ended)
+
+// Game state, player selection and powerups, both ways (reliable_channel.h)
+BLERemoteCharacteristic *bleEventChannelCharacteristic;
+static ReliableChannel eventChannel;
 
 // Location Unique IDs
 static BLEUUID SERVICE_UUID("7d7a7768-a9d0-4fb8-bf2b-fc994c662eb6");
-static BLEUUID READ_X_CHARACTERISTIC_UUID("563c64b2-9634-4f7a-9f4f-d9e3231faa56");
-static BLEUUID READ_Y_CHARACTERISTIC_UUID("aa88ac15-3e2b-4735-92ff-4c712173e9f3");
-static BLEUUID READ_WRITE_X_CHARACTERISTIC_UUID("1da468d6-993d-4387-9e71-1c826b10fff9");
-static BLEUUID READ_WRITE_Y_CHARACTERISTIC_UUID("cf7b4787-d412-4e69-8b61-e2cfba89ff19");
+static BLEUUID SNAPSHOT_UUID("3f1c9a52-6d0e-4b87-9a3e-2c5d7e81b4f6");
 
 // Gameplay Unique IDs
-static BLEUUID LOCAL_PLAYER_SELECTION_UUID("cad4571b-2ca1-47c9-ae9d-75bbce0d814f"); // REMEMBER IT CORRESPONDS TO SERVER'S OPPONENT
-static BLEUUID OPPONENT_PLAYER_SELECTION_UUID("ecaaac5c-5057-49dc-83ab-e0e2322f2703"); // REMEMBER IT CORRESPONDS TO SERVER'S LOCAL
-static BLEUUID GAME_STATE_UUID("07471f02-b963-449e-a39c-9a44ae312b78");
+static BLEUUID EVENT_CHANNEL_UUID("ebbd4b49-ce56-4aea-aeca-08d53d41cb10");
+static BLEUUID INPUT_UUID("5b2e8f14-7c93-4a6d-b1e0-3d9a6c47f825");
+
+// Telemetry Unique IDs
+static BLEUUID PING_UUID("c4a1e7d2-5f38-4b6e-9d21-7a0b3e8f1c54");
 
 
-// State
-enum Gameplay { S_PLAYER_SELECT, S_TUTORIAL, S_GAME, S_GAME_OVER };
-static Gameplay gameState = S_PLAYER_SELECT;
+// State (game_flow.h)
+static GameFlow gameFlow;
 
 enum PlayerType { PRINCESS, DRAGON, UNCHOSEN };
 static PlayerType chosenPlayer = UNCHOSEN;
@@ -77,8 +129,8 @@ Button START(210, 190, 100, 50, false, "Start", offColStart, onCol);
 Button ENDTUTORIAL(210, 10, 100, 50, false, "X", offColTut, onCol);
 Button PLAYAGAIN(100, 190, 100, 50, false, "Play again", offColStart, onCol);
 
-// coordinates
-int xServer = 0, yServer = 0, xClient = 300, yClient = 120;
+// coordinates (world pixels, start on the map's spawn points)
+int xServer = 0, yServer = 0, xClient = 0, yClient = 0;
 
 // acceleration
 int acceleration = 5;
@@ -87,16 +139,19 @@ int acceleration = 5;
 int countdownTime = 120000; // Two minutes to catch them
 int prevTime = 0;
 int currTime = 0;
-bool timerHasBeenStarted = false; 
+unsigned long remainingTime = 0;
 bool timeRanOut = false;
 
-// Powerup
-int powerupsLeft = 3; // players start with 3 powerups
-bool powerupsStillAvailable = true; 
-int powerupTime = 3000; // powerups last 3 seconds
-int powerupStartTime = 0;
-bool dragonPowerupActive = false;
-bool princessPowerupActive = false;
+// Powerups (powerups.h), timed on simClock ticks from the start of the game
+Powerups powerups;
+
+// Movement and animation
+TickClock simClock;
+KinematicBody localBody;   // sub-pixel position and velocity of the local character
+SpriteAnimator localAnimator;
+int moveX = 0, moveY = 0; // joystick axes (-127..127), drive the movement and the facing
+bool startWasDown = false;
+bool selectWasDown = false;
 
 ///////////////////////////////////////////////////////////////
 // Forward Declarations
@@ -105,7 +160,7 @@ bool princessPowerupActive = false;
 // Gameplay (Order of appearance)
 void drawTitleScreen();
 void drawWaitingScreen();
-void drawCenteredBackgroundImage(String iconName, int resizeMult);
+void drawCenteredBackgroundImage(const char *iconName, int resizeMult);
 void chooseCharacter();
 void drawSelectedCharacterName();
 void princessTapped(Event& e);
@@ -116,87 +171,89 @@ void startTutorial();
 void endTutorialTapped(Event& e);
 void playAgainTapped(Event& e);
 void hideButtons();
-void drawCharacters(uint32_t serverX, uint32_t serverY, uint32_t clientX, uint32_t clientY);
-void drawCharacterImage(String iconName, int resizeMult, int xLoc, int yLoc);
-void printDistance();
+void sendGameState(int value);
+void sendPlayerSelection(int value);
+void sendEventPacket(const uint8_t *bytes, size_t length);
+void receiveGameMessage(const ReliableMessage &message);
+void takeSnapshot(GameSnapshot &snapshot);
+void receiveSnapshot(const GameSnapshot &snapshot);
+void sendSnapshotPacket(const uint8_t *bytes, size_t length);
+void sendPingPacket(const uint8_t *bytes, size_t length);
+void sendInputPacket(const uint8_t *bytes, size_t length);
+void logLinkStats();
+void tuneLink();
+bool queueMatchDump();
+void dumpMatchRecord();
+void finishMatchDump();
+void stepSimulation();
+void stepInputMode(uint32_t ticks);
+bool localBlocked(int x, int y);
 void checkTimeAndPrint();
-void addressPowerup();
+void updateHud(const FrameSnapshot &frame);
+void addressPowerup(FrameSnapshot &frame);
+void postGameFrame();
+void drawGameOverScreen();
 
 void clientAccelIncrement();
-String milis_to_seconds(long milis);
 void playGame();
-void endGame();
+void endGame(uint8_t event);
 bool checkDistance();
 void usePowerup();
 
+// Game flow (entry/exit actions and guards)
+void enterWaiting(uint8_t from, uint8_t event);
+void enterPlayerSelect(uint8_t from, uint8_t event);
+void enterTutorial(uint8_t from, uint8_t event);
+void enterGame(uint8_t from, uint8_t event);
+void enterGameOver(uint8_t from, uint8_t event);
+void leaveMenu(uint8_t to, uint8_t event);
+bool checkGameGuard(uint8_t guard);
+
+// What each state does on entry and exit, in GameState order
+const GameStateActions gameStateActions[S_STATE_COUNT] = {
+    { enterWaiting,      NULL },       // S_WAITING
+    { enterPlayerSelect, leaveMenu },  // S_PLAYER_SELECT
+    { enterTutorial,     leaveMenu },  // S_TUTORIAL
+    { enterGame,         NULL },       // S_GAME
+    { enterGameOver,     leaveMenu },  // S_GAME_OVER
+};
+
 ///////////////////////////////////////////////////////////////
 // BLE Client Callback Methods
 // This method is called when the server that this client is
 // connected to NOTIFIES this client (or any client listening)
 // that it has changed the remote characteristic
 ///////////////////////////////////////////////////////////////
-static void notifyXCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+// Decoded in loop(), against the snapshots it keeps
+static void notifySnapshotCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
 {
-    String characteristicUUID = pBLERemoteCharacteristic->getUUID().toString().c_str();
-      xServer = (int32_t)(pData[3] << 24 | pData[2] << 16 | pData[1] << 8 | pData[0]);
-      delay(10);
+    linkTelemetry.bytesReceived += length;
+    receiveSnapshotPacket(snapshotLink, pData, length);
 }
 
-static void notifyYCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+// Packets only get queued here, loop() runs the channel
+static void notifyEventChannelCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
 {
-    String characteristicUUID = pBLERemoteCharacteristic->getUUID().toString().c_str();
-    yServer = (int32_t)(pData[3] << 24 | pData[2] << 16 | pData[1] << 8 | pData[0]);
-    delay(10);
+    linkTelemetry.bytesReceived += length;
+    receiveReliablePacket(eventChannel, pData, length);
 }
 
-static void notifyOpponentCharacterCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+// Answered and timed in loop()
+static void notifyPingCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
 {
-    String characteristicUUID = pBLERemoteCharacteristic->getUUID().toString().c_str();
-    Serial.printf("Notify callback for characteristic %s of data length %d\n", pBLERemoteCharacteristic->getUUID().toString().c_str(), length);
-    Serial.println((int32_t)pData);
-    int32_t opponentVal = (int32_t)(pData[3] << 24 | pData[2] << 16 | pData[1] << 8 | pData[0]);
-    if (opponentVal == 1) {
-      opponentPlayer = PRINCESS;
-      Serial.println("\tOpponent is: Princess");
-    } else if (opponentVal == 2) {
-      opponentPlayer = DRAGON;
-      Serial.println("\tOpponent is: Dragon");
-    } else {
-      opponentPlayer = UNCHOSEN;
-      Serial.println("\tOpponent is: Unchosen");
-    }
-    Serial.printf("\tValue was: %i", opponentVal);
-    delay(10);
+    linkTelemetry.bytesReceived += length;
+    receivePingPacket(linkTelemetry, pData, length);
 }
 
-static void notifyGameStateCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+// The server's inputs, taken in by stepInputMode()
+static void notifyInputCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
 {
-    String characteristicUUID = pBLERemoteCharacteristic->getUUID().toString().c_str();
-    Serial.printf("Notify callback for characteristic %s of data length %d\n", pBLERemoteCharacteristic->getUUID().toString().c_str(), length);
-    int32_t gameVal = (int32_t)(pData[3] << 24 | pData[2] << 16 | pData[1] << 8 | pData[0]);
-    if (gameVal == 1 || gameVal == 2) {
-      gameState = gameState;
-    } else if (gameVal == 3) {
-      if (gameState == S_GAME_OVER) {
-        xClient = 300, yClient = 120;
-        String x = String(xClient);
-        bleReadWriteXCharacteristic->writeValue(x.c_str(), false);
-        String y = String(yClient);
-        bleReadWriteYCharacteristic->writeValue(y.c_str(), false);
-        String cha = String(3);
-        bleLocalPlayerSelectionCharacteristic->writeValue(cha.c_str(), false);
-        playingAgain = true;
-      } else {
-        prevTime = millis();
-      }
-      gameState = S_GAME;
-      gameEnded = true;
+    linkTelemetry.bytesReceived += length;
+    if (netMode == NET_LOCKSTEP) {
+        receiveLockstepPacket(lockstep, pData, length);
     } else {
-      gameState = S_GAME_OVER;
+        receiveRollbackPacket(rollback, pData, length);
     }
-    Serial.printf("\tValue was: %i", gameVal);
-    screenUpdated = true;
-    delay(10);
 }
 
 ///////////////////////////////////////////////////////////////
@@ -209,33 +266,41 @@ class MyClientCallback : public BLEClientCallbacks
     void onConnect(BLEClient *pclient)
     {
         deviceConnected = true;
-        screenUpdated = true;
-        Serial.println("Device connected...");
+        postGameEvent(gameFlow, EV_CONNECTED);
+        logEvent(LOG_DEVICE_CONNECTED);
     }
 
     void onDisconnect(BLEClient *pclient)
     {
         deviceConnected = false;
-        screenUpdated = false;
-        Serial.println("Device disconnected...");
+        postGameEvent(gameFlow, EV_DISCONNECTED);
+        logEvent(LOG_DEVICE_DISCONNECTED);
     }
 };
+static MyClientCallback clientCallbacks;
 
 ///////////////////////////////////////////////////////////////
 // Method is called to connect to server
 ///////////////////////////////////////////////////////////////
 bool connectToServer()
 {
-    // Create the client
-    Serial.printf("Forming a connection to %s\n", bleRemoteServer->getName().c_str());
-    BLEClient *bleClient = BLEDevice::createClient();
-    bleClient->setClientCallbacks(new MyClientCallback());
+    // Create the client the first time; reconnecting reuses it
+    Serial.printf("Forming a connection to %s\n", bleRemoteServer->address.toString().c_str());
+    if (bleClient == NULL) {
+        bleClient = BLEDevice::createClient();
+        bleClient->setClientCallbacks(&clientCallbacks);
+    }
     Serial.println("\tClient connected");
 
     // Connect to the remote BLE Server.
-    if (!bleClient->connect(bleRemoteServer))
-      Serial.printf("FAILED to connect to server (%s)\n", bleRemoteServer->getName().c_str());
-      Serial.printf("\tConnected to server (%s)\n", bleRemoteServer->getName().c_str());
+    if (!bleClient->connect(bleRemoteServer->address, bleRemoteServer->addressType)) {
+        Serial.printf("FAILED to connect to server (%s)\n", bleRemoteServer->address.toString().c_str());
+        // Give its slot back so the next scan can find another one
+        discoveredServers.release(bleRemoteServer);
+        bleRemoteServer = NULL;
+        return false;
+    }
+    Serial.printf("\tConnected to server (%s)\n", bleRemoteServer->address.toString().c_str());
 
     // Obtain a reference to the service we are after in the remote BLE server.
     BLERemoteService *bleRemoteService = bleClient->getService(SERVICE_UUID);
@@ -247,113 +312,117 @@ bool connectToServer()
 
     Serial.printf("\tFound our service UUID: %s\n", SERVICE_UUID.toString().c_str());
 
+    // Only the central can start the MTU exchange
+    bleClient->setMTU(LINK_MTU);
+    Serial.printf("\tMTU is %u\n", bleClient->getMTU());
+
     // Obtain a reference to the characteristic in the service of the remote BLE server.
-    bleReadXCharacteristic = bleRemoteService->getCharacteristic(READ_X_CHARACTERISTIC_UUID);
-    if (bleReadXCharacteristic == nullptr) {
-        Serial.printf("Failed to find our characteristic UUID: %s\n", READ_X_CHARACTERISTIC_UUID.toString().c_str());
-        bleClient->disconnect();
-        return false;
-    }
-    Serial.printf("\tFound our characteristic UUID: %s\n", READ_X_CHARACTERISTIC_UUID.toString().c_str());
-    bleReadYCharacteristic = bleRemoteService->getCharacteristic(READ_Y_CHARACTERISTIC_UUID);
-    if (bleReadYCharacteristic == nullptr) {
-        Serial.printf("Failed to find our characteristic UUID: %s\n", READ_Y_CHARACTERISTIC_UUID.toString().c_str());
-        bleClient->disconnect();
-        return false;
-    }
-    Serial.printf("\tFound our characteristic UUID: %s\n", READ_Y_CHARACTERISTIC_UUID.toString().c_str());
-    
-    bleReadWriteXCharacteristic = bleRemoteService->getCharacteristic(READ_WRITE_X_CHARACTERISTIC_UUID);
-    if (bleReadWriteXCharacteristic == nullptr) {
-        Serial.printf("Failed to find our characteristic UUID: %s\n", READ_WRITE_X_CHARACTERISTIC_UUID.toString().c_str());
+    bleSnapshotCharacteristic = bleRemoteService->getCharacteristic(SNAPSHOT_UUID);
+    if (bleSnapshotCharacteristic == nullptr) {
+        Serial.printf("Failed to find our characteristic UUID: %s\n", SNAPSHOT_UUID.toString().c_str());
         bleClient->disconnect();
         return false;
     }
-    Serial.printf("\tFound our characteristic UUID: %s\n", READ_WRITE_X_CHARACTERISTIC_UUID.toString().c_str());
+    Serial.printf("\tFound our characteristic UUID: %s\n", SNAPSHOT_UUID.toString().c_str());
 
-    bleReadWriteYCharacteristic = bleRemoteService->getCharacteristic(READ_WRITE_Y_CHARACTERISTIC_UUID);
-    if (bleReadWriteYCharacteristic == nullptr) {
-        Serial.printf("Failed to find our characteristic UUID: %s\n", READ_WRITE_Y_CHARACTERISTIC_UUID.toString().c_str());
+    bleEventChannelCharacteristic = bleRemoteService->getCharacteristic(EVENT_CHANNEL_UUID);
+    if (bleEventChannelCharacteristic == nullptr) {
+        Serial.printf("Failed to find our characteristic UUID: %s\n", EVENT_CHANNEL_UUID.toString().c_str());
         bleClient->disconnect();
         return false;
     }
-    Serial.printf("\tFound our characteristic UUID: %s\n", READ_WRITE_Y_CHARACTERISTIC_UUID.toString().c_str());
-    
-    // ADDED THESE
+    Serial.printf("\tFound our characteristic UUID: %s\n", EVENT_CHANNEL_UUID.toString().c_str());
 
-    bleOpponentPlayerSelectionCharacteristic = bleRemoteService->getCharacteristic(OPPONENT_PLAYER_SELECTION_UUID);
-    if (bleOpponentPlayerSelectionCharacteristic == nullptr) {
-        Serial.printf("Failed to find our characteristic UUID: %s\n", OPPONENT_PLAYER_SELECTION_UUID.toString().c_str());
+    blePingCharacteristic = bleRemoteService->getCharacteristic(PING_UUID);
+    if (blePingCharacteristic == nullptr) {
+        Serial.printf("Failed to find our characteristic UUID: %s\n", PING_UUID.toString().c_str());
         bleClient->disconnect();
         return false;
     }
-    Serial.printf("\tFound our characteristic UUID: %s\n", OPPONENT_PLAYER_SELECTION_UUID.toString().c_str());
+    Serial.printf("\tFound our characteristic UUID: %s\n", PING_UUID.toString().c_str());
 
-    bleGameStateCharacteristic = bleRemoteService->getCharacteristic(GAME_STATE_UUID);
-    if (bleGameStateCharacteristic == nullptr) {
-        Serial.printf("Failed to find our characteristic UUID: %s\n", GAME_STATE_UUID.toString().c_str());
+    bleInputCharacteristic = bleRemoteService->getCharacteristic(INPUT_UUID);
+    if (bleInputCharacteristic == nullptr) {
+        Serial.printf("Failed to find our characteristic UUID: %s\n", INPUT_UUID.toString().c_str());
         bleClient->disconnect();
         return false;
     }
-    Serial.printf("\tFound our characteristic UUID: %s\n", GAME_STATE_UUID.toString().c_str());
-
-    bleLocalPlayerSelectionCharacteristic = bleRemoteService->getCharacteristic(LOCAL_PLAYER_SELECTION_UUID);
-    if (bleLocalPlayerSelectionCharacteristic == nullptr) {
-        Serial.printf("Failed to find our characteristic UUID: %s\n", LOCAL_PLAYER_SELECTION_UUID.toString().c_str());
-        bleClient->disconnect();
-        return false;
-    }
-    Serial.printf("\tFound our characteristic UUID: %s\n", LOCAL_PLAYER_SELECTION_UUID.toString().c_str());
-
+    Serial.printf("\tFound our characteristic UUID: %s\n", INPUT_UUID.toString().c_str());
 
     // Check if server's characteristic can notify client of changes and register to listen if so
-    if (bleReadXCharacteristic->canNotify()) {
-      Serial.println("X can notify");
-      bleReadXCharacteristic->registerForNotify(notifyXCallback);
+    if (bleSnapshotCharacteristic->canNotify()) {
+      Serial.println("Snapshot can notify");
+      bleSnapshotCharacteristic->registerForNotify(notifySnapshotCallback);
     }
-    if (bleReadYCharacteristic->canNotify()) {
-      Serial.println("Y can notify");
-      bleReadYCharacteristic->registerForNotify(notifyYCallback);
+    if (bleEventChannelCharacteristic->canNotify()) {
+      Serial.println("Event channel can notify");
+      bleEventChannelCharacteristic->registerForNotify(notifyEventChannelCallback);
     }
-    if (bleOpponentPlayerSelectionCharacteristic->canNotify()) {
-      Serial.println("Opponent Character can notify");
-      bleOpponentPlayerSelectionCharacteristic->registerForNotify(notifyOpponentCharacterCallback);
+    if (blePingCharacteristic->canNotify()) {
+      Serial.println("Ping can notify");
+      blePingCharacteristic->registerForNotify(notifyPingCallback);
     }
-    if (bleGameStateCharacteristic->canNotify()) {
-      Serial.println("Game State can notify");
-      bleGameStateCharacteristic->registerForNotify(notifyGameStateCallback);
+    if (bleInputCharacteristic->canNotify()) {
+      Serial.println("Input can notify");
+      bleInputCharacteristic->registerForNotify(notifyInputCallback);
     }
 
     return true;
 }
 
 ///////////////////////////////////////////////////////////////
-// Scan for BLE servers and find the first one that advertises
-// the service we are looking for.
+// Scan for BLE servers and take the first one that advertises
+// the service with a free player slot for our network mode
+// (match_beacon.h). Servers that are full or built for another
+// mode are passed over without connecting.
 ///////////////////////////////////////////////////////////////
 class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks
 {
     /**
-     * Called for each advertising BLE server.
+     * Called for every advertisement (a full server may free up).
      */
     void onResult(BLEAdvertisedDevice advertisedDevice)
     {
-        // Print device found
-        Serial.print("BLE Advertised Device found:");
-        Serial.printf("\tName: %s\n", advertisedDevice.getName().c_str());
-
-        if (advertisedDevice.haveServiceUUID() && 
-                advertisedDevice.isAdvertisingService(SERVICE_UUID) && 
-                advertisedDevice.getName() == "Princess of Fire") {
+        if (doConnect || !advertisedDevice.haveManufacturerData() || !advertisedDevice.haveServiceUUID() ||
+                !advertisedDevice.isAdvertisingService(SERVICE_UUID)) {
+            return;
+        }
+        std::string data = advertisedDevice.getManufacturerData();
+        MatchBeacon beacon;
+        if (decodeMatchBeacon((const uint8_t *)data.data(), data.length(), beacon) &&
+                matchBeaconJoinable(beacon, netMode)) {
+            DiscoveredServer *found = discoveredServers.acquire(advertisedDevice, beacon);
+            if (found == NULL) {
+                return;
+            }
+            logEvent(LOG_SERVER_FOUND, beacon.state, beacon.freeSpectators);
             BLEDevice::getScan()->stop();
-            bleRemoteServer = new BLEAdvertisedDevice(advertisedDevice);
+            // The last one found is done with: loop() only reads it while doConnect is set
+            discoveredServers.release(bleRemoteServer);
+            bleRemoteServer = found;
             doConnect = true;
             doScan = true;
         }
 
     }     
 };
+static MyAdvertisedDeviceCallbacks advertisedDeviceCallbacks;
+
 
+///////////////////////////////////////////////////////////////
+// GAP events (BLE task). Only the connection parameter updates
+// matter; loop() logs them.
+///////////////////////////////////////////////////////////////
+static void linkGapHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) {
+        LinkUpdate update;
+        update.status = param->update_conn_params.status;
+        update.interval = param->update_conn_params.conn_int;
+        update.latency = param->update_conn_params.latency;
+        update.timeout = param->update_conn_params.timeout;
+        linkUpdates.push(update);
+    }
+}
 
 ///////////////////////////////////////////////////////////////
 // Put your setup code here, to run once
@@ -364,10 +433,26 @@ void setup()
     M5.begin();
     M5.Lcd.setTextSize(3);
 
+    // setup() draws the waiting screen itself; the BLE callbacks can
+    // post events as soon as BLE is up
+    initGameFlow(gameFlow, S_WAITING, gameStateActions, checkGameGuard);
+
     // Init M5Core2 as a BLE Client
     Serial.print("Starting BLE...");
-    String bleClientDeviceName = "";
-    BLEDevice::init(bleClientDeviceName.c_str());
+    BLEDevice::init("");
+    // The server picks the connection parameters, we log what they became
+    BLEDevice::setMTU(LINK_MTU);
+    BLEDevice::setCustomGapHandler(linkGapHandler);
+
+    // Gamepad, and the joystick calibration before any other screen is
+    // drawn. Holding Start while booting measures the stick again.
+    if(!gamePad.begin(0x50)){
+        Serial.println("ERROR! seesaw not found");
+        while(1) delay(1);
+    }
+    gamePad.pinModeBulk(button_mask, INPUT_PULLUP);
+    gamePad.setGPIOInterrupts(button_mask, 1);
+    setupJoystick(gamePad, !(gamePad.digitalReadBulk(button_mask) & (1UL << BUTTON_START)));
 
     // Draw the game intro screen
     drawTitleScreen();
@@ -376,22 +461,24 @@ void setup()
     drawWaitingScreen();
 
     // Retrieve a Scanner and set the callback we want to use to be informed when we
-    // have detected a new device.  Specify that we want active scanning and start the
-    // scan to run for 5 seconds.
+    // have detected a new device. The advertisement itself says whether a server
+    // has room (match_beacon.h), so a passive scan will do, and every one of them
+    // is reported in case a full server frees up.
     BLEScan *pBLEScan = BLEDevice::getScan();
-    pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
+    pBLEScan->setAdvertisedDeviceCallbacks(&advertisedDeviceCallbacks, true);
     pBLEScan->setInterval(1349);
     pBLEScan->setWindow(449);
-    pBLEScan->setActiveScan(true);
+    pBLEScan->setActiveScan(false);
     pBLEScan->start(0, false);
     
     // Gameplay setup
-    if(!gamePad.begin(0x50)){
-        Serial.println("ERROR! seesaw not found");
+    setupHud();
+    if (!setupTileMap()) {
+        Serial.println("ERROR! arena map is invalid");
         while(1) delay(1);
     }
-    gamePad.pinModeBulk(button_mask, INPUT_PULLUP);
-    gamePad.setGPIOInterrupts(button_mask, 1);
+    xServer = arenaMap.spawnX[SPAWN_SERVER], yServer = arenaMap.spawnY[SPAWN_SERVER];
+    xClient = arenaMap.spawnX[SPAWN_CLIENT], yClient = arenaMap.spawnY[SPAWN_CLIENT];
 
     PRINCESS_BTN.addHandler(princessTapped, E_TAP);
     DRAGON_BTN.addHandler(dragonTapped, E_TAP);
@@ -399,6 +486,11 @@ void setup()
     START.addHandler(startTapped, E_TAP);
     ENDTUTORIAL.addHandler(endTutorialTapped, E_TAP);
     PLAYAGAIN.addHandler(playAgainTapped, E_TAP);
+
+    // From here on only the render task draws
+    startRenderTask();
+    startLogTask();
+    startMemoryMonitor();
 }
 
 ///////////////////////////////////////////////////////////////
@@ -406,24 +498,43 @@ void setup()
 ///////////////////////////////////////////////////////////////
 void loop()
 {
+    beginLoopTiming();
+
+    // Button feedback draws, so it shares the panel with the render task.
+    // A game shows no buttons (leaveMenu() hid them): no waiting on a blit.
+    bool buttonsShown = gameFlow.state != S_GAME;
+    if (buttonsShown) {
+      lockLcd();
+    }
     M5.update();
-    
+    if (buttonsShown) {
+      unlockLcd();
+    }
+
+    // BtnB toggles the link overlay; the next frame repaints under it
+    if (M5.BtnB.wasPressed()) {
+      linkOverlay = !linkOverlay;
+      redrawGame = true;
+    }
+
+    // Screen changes asked for by the taps above and the BLE callbacks
+    runGameEvents(gameFlow);
+
     // If the flag "doConnect" is true then we have scanned for and found the desired
     // BLE Server with which we wish to connect.  Now we connect to it.  Once we are
     // connected we set the connected flag to be false.
     if (doConnect == true)
     {
         if (connectToServer()) {
+            // Our first snapshot (a keyframe) goes out on the next loop
             Serial.println("We are now connected to the BLE Server.");
-            String x = String(xClient);
-            bleReadWriteXCharacteristic->writeValue(x.c_str(), false);
-            String y = String(yClient);
-            bleReadWriteYCharacteristic->writeValue(y.c_str(), false);
             doConnect = false;
             delay(3000);
         }
         else {
-            Serial.println("We have failed to connect to the server; there is nothing more we will do.");
+            // Scan again (doScan is still set); onResult() ignores servers while doConnect is
+            Serial.println("We have failed to connect to the server; scanning again.");
+            doConnect = false;
             delay(3000);
         }
     }
@@ -432,55 +543,56 @@ void loop()
     // with the current time since boot.
     if (deviceConnected)
     {
-      if (gameState != S_GAME && gameState != S_GAME_OVER) {
-        if (gameState == S_PLAYER_SELECT && screenUpdated || playingAgain) {
-          chooseCharacter();
-          playingAgain = false;
-        } else if (gameState == S_TUTORIAL && screenUpdated) {
-          startTutorial();
-        }
-        prevTime = millis();
-      } else {
-        timerHasBeenStarted = true;
-        M5.Lcd.fillRect(0, 0, 50, 50, TFT_BLACK);
-        M5.Lcd.fillRect(200, 10, 50, 50, TFT_BLACK);
-        if (gameState == S_GAME) {
-          checkTimeAndPrint();
-          if (checkDistance()) {
-            playGame();
-            if (locationWasUpdated || playingAgain) {
-                M5.Lcd.fillScreen(TFT_BLACK);
-                drawCharacters(xServer, yServer, xClient, yClient); 
-                playingAgain = false;
-            } 
-            currTime = millis();
-            // Have power up if powerup time > current time > powerup time - 3000
-            if ((currTime - powerupStartTime < powerupTime) && (dragonPowerupActive || princessPowerupActive)) {
-              addressPowerup();
-              Serial.println("Powerup is active");
-            } 
-            if (!((currTime - powerupStartTime < powerupTime)) && (dragonPowerupActive || princessPowerupActive)) {
-              Serial.println("Powerup has ended");
-              playingAgain = true;
-              if (dragonPowerupActive) {
-                dragonPowerupActive = false;
-              } else {
-                princessPowerupActive = false;
-              }
-            }
-          }
-            locationWasUpdated = false;
-        } else {
-          if (gameEnded) {
-            endGame();
-            gameEnded = false;
+      // The menus only change on events; a game runs every loop, off the
+      // heap (alloc_guard.h checks in debug builds)
+      if (gameFlow.state == S_GAME) {
+        beginAllocCheck();
+        checkTimeAndPrint();
+        if (gameFlow.state == S_GAME && checkDistance()) {
+          playGame();
+          stepSimulation();
+          if (expirePowerups(powerups, simClock.tick)) {
+            logEvent(LOG_POWERUP_ENDED);
+            redrawGame = true;
           }
+          postGameFrame();
         }
+        endAllocCheck("game tick");
+      }
+
+      // Sends what this loop queued, resends what wasn't acked
+      serviceReliableChannel(eventChannel, millis(), sendEventPacket, receiveGameMessage);
+
+      // Our snapshot if anything in it changed, the server's as it arrives
+      GameSnapshot snapshot;
+      takeSnapshot(snapshot);
+      if (serviceSnapshotLink(snapshotLink, snapshot, millis(), sendSnapshotPacket, opponentSnapshot)) {
+        receiveSnapshot(opponentSnapshot);
       }
-      screenUpdated = false;
+      // Answers the server's pings and times ours
+      servicePings(linkTelemetry, millis(), sendPingPacket);
+      if (netMode == NET_ROLLBACK && gameFlow.state == S_GAME) {
+        // Our inputs the server hasn't acknowledged, and our ack of its
+        sendRollbackInputs(rollback, millis(), sendInputPacket);
+      } else if (netMode == NET_LOCKSTEP && gameFlow.state == S_GAME) {
+        // The same, with our state hash now and then
+        sendLockstepInputs(lockstep, millis(), sendInputPacket);
+      }
+      if (gameFlow.state == S_GAME) {
+        // Every MATCH_CHECK_TICKS, the state the replay has to arrive at
+        recordMatchCheck(matchRecorder, simClock.tick,
+                         matchStateHash(simClock.tick, localBody, xServer, yServer, powerups), remainingTime);
+      }
+      tuneLink();
+      logLinkStats();
     } else if (doScan) {
         BLEDevice::getScan()->start(0); // this is just example to start scan after disconnect, most likely there is better way to do it in arduino
     }
+
+    endLoopTiming();
+    logRenderStats();
+    monitorMemory();
+    dumpMatchRecord();
 }
 
 ///////////////////////////////////////////////////////////////
@@ -544,6 +656,7 @@ void chooseCharacter() {
 // Draws the name of the currently selected character
 ///////////////////////////////////////////////////////////////
 void drawSelectedCharacterName() {
+  M5.Lcd.fillRect(120, 60, 48, 8, TFT_BLACK);
   M5.Lcd.setTextColor(TFT_WHITE);
   M5.Lcd.setCursor(120, 40);
   M5.Lcd.setTextSize(1);
@@ -569,10 +682,8 @@ void drawSelectedCharacterName() {
 void princessTapped(Event& e) {
   if (opponentPlayer != PRINCESS) {
     chosenPlayer = PRINCESS;
-    String val = String(1);
-    bleLocalPlayerSelectionCharacteristic->writeValue(val.c_str(), false);
-    delay(10);
-    screenUpdated = true;
+    sendPlayerSelection(1);
+    postScreen(drawSelectedCharacterName);
   }
 }
 
@@ -582,10 +693,8 @@ void princessTapped(Event& e) {
 void dragonTapped(Event& e) {
   if (opponentPlayer != DRAGON) {
     chosenPlayer = DRAGON;
-    String val = String(2);
-    bleLocalPlayerSelectionCharacteristic->writeValue(val.c_str(), false);
-    delay(10);
-    screenUpdated = true;
+    sendPlayerSelection(2);
+    postScreen(drawSelectedCharacterName);
   }
 }
 
@@ -593,42 +702,18 @@ void dragonTapped(Event& e) {
 // Starts tutorial
 ///////////////////////////////////////////////////////////////
 void tutorialTapped(Event& e) {
-  gameState = S_TUTORIAL;
-  String val = String(2);
-  screenUpdated = true;
-  bleGameStateCharacteristic->writeValue(val.c_str(), false);
-  delay(10);
- }
+  raiseGameEvent(gameFlow, EV_TUTORIAL_OPENED);
+}
 
 ///////////////////////////////////////////////////////////////
-// Starts game
+// Starts game (once both players have picked a character)
 ///////////////////////////////////////////////////////////////
 void startTapped(Event& e) {
-  hideButtons();
-  if (opponentPlayer != UNCHOSEN && chosenPlayer != UNCHOSEN) {
-    gameState = S_GAME;
-    screenUpdated = true;
-    String val = String(3);
-    bleGameStateCharacteristic->writeValue(val.c_str(), false);
-    delay(10);
-    prevTime = millis();
-  }
+  raiseGameEvent(gameFlow, EV_START);
 }
 
 void playAgainTapped(Event& e) {
-  hideButtons();
-  playingAgain = true;
-  gameState = S_PLAYER_SELECT;
-  chosenPlayer = UNCHOSEN;
-  screenUpdated = true;
-  String val = String(1);
-  String val2 = String(3);
-  bleGameStateCharacteristic->writeValue(val.c_str(), false);
-  bleLocalPlayerSelectionCharacteristic->writeValue(val2.c_str(), false);
-  delay(10);
-  powerupsLeft = 3;
-  powerupsStillAvailable = true;
-  prevTime = millis();
+  raiseGameEvent(gameFlow, EV_PLAY_AGAIN);
 }
 
 void hideButtons() {
@@ -663,75 +748,347 @@ void startTutorial() {
 // Ends the tutorial
 ///////////////////////////////////////////////////////////////
 void endTutorialTapped(Event& e) {
-  gameState = S_PLAYER_SELECT;
-  screenUpdated = true;
-  String x = String(1);
-  bleGameStateCharacteristic->writeValue(x.c_str(), false);
+  raiseGameEvent(gameFlow, EV_TUTORIAL_CLOSED);
+}
+
+// Tells the server which screen we are on (1 select, 2 tutorial, 3 game; the
+// game over goes with its reason, from endGame())
+void sendGameState(int value) {
+  sendReliableByte(eventChannel, MSG_GAME_STATE, value);
 }
 
-String milis_to_seconds(long milis) {
-    unsigned long seconds = milis / 1000;
-    String secondStr = seconds < 10 ? "0" + String(seconds) : String(seconds);
-    unsigned long miliseconds = milis % 60;
-    String milisecondsStr = miliseconds < 10 ? "0" + String(miliseconds) : String(miliseconds);
-    return secondStr + "." + milisecondsStr + "s";
+// Tells the server our character (1 princess, 2 dragon, 3 unchosen)
+void sendPlayerSelection(int value) {
+  sendReliableByte(eventChannel, MSG_PLAYER_SELECTION, value);
+}
+
+// Puts a channel packet on the air; the channel resends it if it is lost
+void sendEventPacket(const uint8_t *bytes, size_t length) {
+  if (bleEventChannelCharacteristic == nullptr) {
+    return;   // connected, but the service lookup hasn't finished
+  }
+  bleEventChannelCharacteristic->writeValue((uint8_t *)bytes, length, false);
+  linkTelemetry.bytesSent += length;
+}
+
+///////////////////////////////////////////////////////////////
+// Handles a message from the server, in the order it was sent.
+// Only the start and the end of a game are shared, the menus are
+// local; the game flow decides if an event means anything now.
+///////////////////////////////////////////////////////////////
+void receiveGameMessage(const ReliableMessage &message) {
+  recordMatchMessage(matchRecorder, simClock.tick, message);
+  if (message.type == MSG_GAME_STATE) {
+    if (message.payload[0] == 3) {
+      raiseGameEvent(gameFlow, EV_REMOTE_START);
+    } else if (message.payload[0] == 4) {
+      raiseGameEvent(gameFlow, remoteGameOverEvent(message.length > 1 ? message.payload[1] : 0));
+    }
+  } else if (message.type == MSG_PLAYER_SELECTION) {
+    opponentPlayer = (message.payload[0] == 1) ? PRINCESS : (message.payload[0] == 2) ? DRAGON : UNCHOSEN;
+    logEvent(LOG_OPPONENT_CHOSE, message.payload[0]);
+  } else if (message.type == MSG_POWERUP && message.length == POWERUP_MESSAGE_SIZE) {
+    // Ends on the tick it ends on the server, however late this arrived
+    startOpponentPowerup(powerups, decodePowerupTick(message.payload, simClock.tick));
+    logEvent(LOG_OPPONENT_POWERUP);
+  }
+}
+
+// Our share of the game state, as the server gets it (state_snapshot.h)
+void takeSnapshot(GameSnapshot &snapshot) {
+  setSnapshotField(snapshot, SF_STATE, gameFlow.state);
+  setSnapshotField(snapshot, SF_CHARACTER, (chosenPlayer == PRINCESS) ? 1 : (chosenPlayer == DRAGON) ? 2 : 3);
+  setSnapshotField(snapshot, SF_X, xClient);
+  setSnapshotField(snapshot, SF_Y, yClient);
+  setSnapshotField(snapshot, SF_TIMER, (gameFlow.state == S_GAME) ? remainingTime / 100 : 0);
+  setSnapshotField(snapshot, SF_POWERUPS_LEFT, powerups.left);
+  setSnapshotField(snapshot, SF_POWERUP_ACTIVE, powerups.own.active);
+  setSnapshotField(snapshot, SF_TICK, simClock.tick);
+}
+
+///////////////////////////////////////////////////////////////
+// Takes in the server's latest snapshot. Its position is ours
+// to draw (in rollback mode we simulate it instead); state
+// changes and powerups arrive on the event channel and are only
+// logged here.
+///////////////////////////////////////////////////////////////
+void receiveSnapshot(const GameSnapshot &snapshot) {
+  if (netMode == NET_SNAPSHOTS) {
+    xServer = snapshot.field[SF_X];
+    yServer = snapshot.field[SF_Y];
+    recordMatchOpponent(matchRecorder, simClock.tick, xServer, yServer);
+  }
+  static int32_t lastState = -1;
+  if (snapshot.field[SF_STATE] != lastState) {
+    lastState = snapshot.field[SF_STATE];
+    logEvent(LOG_OPPONENT_STATE, lastState);
+  }
+}
+
+// Writes without response; a lost snapshot is overtaken by the next
+void sendSnapshotPacket(const uint8_t *bytes, size_t length) {
+  if (bleSnapshotCharacteristic == nullptr) {
+    return;   // connected, but the service lookup hasn't finished
+  }
+  bleSnapshotCharacteristic->writeValue((uint8_t *)bytes, length, false);
+  linkTelemetry.bytesSent += length;
+}
+
+void sendPingPacket(const uint8_t *bytes, size_t length) {
+  if (blePingCharacteristic == nullptr) {
+    return;   // connected, but the service lookup hasn't finished
+  }
+  blePingCharacteristic->writeValue((uint8_t *)bytes, length, false);
+  linkTelemetry.bytesSent += length;
+}
+
+// Unacknowledged inputs go out again with the next packet
+void sendInputPacket(const uint8_t *bytes, size_t length) {
+  if (bleInputCharacteristic == nullptr) {
+    return;   // connected, but the service lookup hasn't finished
+  }
+  bleInputCharacteristic->writeValue((uint8_t *)bytes, length, false);
+  linkTelemetry.bytesSent += length;
+}
+
+///////////////////////////////////////////////////////////////
+// Prints what the snapshots cost on the link every
+// RENDER_STATS_LOG_MS, then logs the telemetry record as bytes
+// (tools/decode_log.py prints the hex tools/link_telemetry.py
+// decodes). Writes without response
+// report no status, so our notification counters stay at 0.
+///////////////////////////////////////////////////////////////
+void logLinkStats() {
+  uint32_t now = millis();
+  if (now - linkStatsLoggedMs < RENDER_STATS_LOG_MS) {
+    return;
+  }
+  const SnapshotStats &stats = snapshotLink.stats;
+  uint32_t samples = stats.rttSamples - linkStatsRttSamples;
+  logEvent(LOG_LINK_STATS, stats.sent, stats.keyframes, (stats.bytes - linkStatsBytes) * 1000 / (now - linkStatsLoggedMs),
+           stats.received, stats.lost, stats.undecodable,
+           samples ? (stats.rttTotalMs - linkStatsRttTotalMs) / samples : 0);
+  linkStatsLoggedMs = now;
+  linkStatsBytes = stats.bytes;
+  linkStatsRttSamples = stats.rttSamples;
+  linkStatsRttTotalMs = stats.rttTotalMs;
+
+  uint32_t received = stats.received - linkStatsReceived;
+  uint32_t lost = stats.lost - linkStatsLost;
+  linkDropPercent = (received + lost) ? lost * 100 / (received + lost) : 0;
+  linkStatsReceived = stats.received;
+  linkStatsLost = stats.lost;
+
+  if (netMode == NET_ROLLBACK) {
+    const RollbackStats &rollbackStats = rollback.stats;
+    logEvent(LOG_ROLLBACK_STATS, rollbackStats.rollbacks, rollbackStats.resimulated, rollbackStats.deepest,
+             rollbackStats.stalls, duelWorstUs);
+    duelWorstUs = 0;
+  } else if (netMode == NET_LOCKSTEP) {
+    const LockstepStats &lockstepStats = lockstep.stats;
+    logEvent(LOG_LOCKSTEP_STATS, lockstepStats.waits, lockstepStats.checks, lockstepStats.desyncs,
+             lockstepStats.firstDesyncTick, duelWorstUs);
+    duelWorstUs = 0;
+  }
+
+  LinkReport report;
+  fillLinkReport(report, linkTelemetry, stats.received, stats.lost);
+  uint8_t record[TELEMETRY_RECORD_SIZE];
+  encodeLinkReport(report, record);
+  logEventBytes(LOG_TELEMETRY, record, TELEMETRY_RECORD_SIZE);
+}
+
+// The server picks the connection parameters; we only log what they became
+void tuneLink() {
+  LinkUpdate update;
+  while (linkUpdates.pop(update)) {
+    logEvent(LOG_LINK_UPDATED, linkIntervalMs(update.interval), update.latency, update.timeout * 10, update.status);
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Queues the next lines of the last game's recording for
+// tools/replay_match.cpp while the log has half its room to
+// spare; the log task writes them out, tools/decode_log.py
+// prints them. True once all of it is queued. Nothing more goes
+// into the recording once this started.
+///////////////////////////////////////////////////////////////
+bool queueMatchDump() {
+  if (matchDumped >= matchRecorder.length || !logSiteEnabled(LOG_MATCH_BYTES)) {
+    return true;
+  }
+  while (logSpace() > LOG_QUEUE_SIZE / 2) {
+    if (matchDumped == 0) {
+      matchRecorder.recording = 0;
+      logEvent(LOG_MATCH_BEGIN, matchRecorder.length, matchRecorder.truncated);
+    }
+    uint32_t end = matchDumped + MATCH_DUMP_BYTES;
+    if (end > matchRecorder.length) {
+      end = matchRecorder.length;
+    }
+    // Sent again if the log had no room after all (the replayer
+    // takes a repeated "match begin" as the same start)
+    if (!logEventBytes(LOG_MATCH_BYTES, matchRecorder.bytes + matchDumped, end - matchDumped)) {
+      return false;
+    }
+    matchDumped = end;
+    if (matchDumped == matchRecorder.length) {
+      logEvent(LOG_MATCH_END);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Dumps the recording from loop() once the game is over
+void dumpMatchRecord() {
+  if (gameFlow.state != S_GAME) {
+    queueMatchDump();
+  }
+}
+
+// A new game records over the last one: whatever of it the log
+// has not taken yet goes first, however long the UART needs
+void finishMatchDump() {
+  while (!queueMatchDump()) {
+    vTaskDelay(1);
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Game flow actions (game_flow.h). Each runs once, on the loop
+// task, when the state is really entered or left.
+///////////////////////////////////////////////////////////////
+void enterWaiting(uint8_t from, uint8_t event) {
+  // Whatever was in flight belonged to the old connection
+  resetReliableChannel(eventChannel);
+  resetSnapshotLink(snapshotLink);
+  resetLinkTelemetry(linkTelemetry, millis());
+  postScreen(drawWaitingScreen);
+}
+
+void enterPlayerSelect(uint8_t from, uint8_t event) {
+  if (event == EV_PLAY_AGAIN) {
+    chosenPlayer = UNCHOSEN;
+    sendPlayerSelection(3);
+  }
+  if (event == EV_PLAY_AGAIN || event == EV_TUTORIAL_CLOSED) {
+    sendGameState(1);
+  }
+  postScreen(chooseCharacter);
+}
+
+void enterTutorial(uint8_t from, uint8_t event) {
+  sendGameState(2);
+  postScreen(startTutorial);
+}
+
+void enterGame(uint8_t from, uint8_t event) {
+  finishMatchDump();
+  // A remote start was sent by the server, ours goes out here
+  if (event == EV_START) {
+    sendGameState(3);
+  }
+  prevTime = millis();
+  // Tick 0 of the game on both sides, the powerup timers count from it
+  resetTickClock(simClock, millis());
+  resetPowerups(powerups);
+  // Standing on the spawn point
+  placeBody(localBody, xClient, yClient);
+  if (netMode == NET_ROLLBACK) {
+    // Both characters, from the spawn points on both sides (rollback.h)
+    resetRollback(rollback, 1, arenaMap, (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS,
+                  (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON, acceleration);
+  } else if (netMode == NET_LOCKSTEP) {
+    // The same, a few ticks of standing still ahead (lockstep.h)
+    resetLockstep(lockstep, 1, arenaMap, (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS,
+                  (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON, acceleration);
+  } else {
+    // Recorded from here on (match_record.h)
+    startMatchRecord(matchRecorder, MATCH_ROLE_CLIENT, (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON,
+                     (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS, acceleration, xClient, yClient, xServer, yServer);
+    matchDumped = 0;
+  }
+}
+
+void enterGameOver(uint8_t from, uint8_t event) {
+  timeRanOut = (gameOverReason(event) == GAME_OVER_TIME_UP);
+  recordMatchEnd(matchRecorder, simClock.tick, event);
+  endGame(event);
+}
+
+// The menu buttons must not take taps once their screen is gone
+void leaveMenu(uint8_t to, uint8_t event) {
+  lockLcd();
+  hideButtons();
+  unlockLcd();
+}
+
+bool checkGameGuard(uint8_t guard) {
+  if (guard == GUARD_PLAYERS_CHOSEN) {
+    return opponentPlayer != UNCHOSEN && chosenPlayer != UNCHOSEN;
+  }
+  return true;
 }
 
 bool checkDistance() {
-  long distance = abs(sqrt(pow((xServer - xClient), 2) + pow((yServer - yClient), 2)));
-  if (distance <= 10) {
-    screenUpdated = true;
-    gameEnded = true;
-    gameState = S_GAME_OVER;
+  // Caught as soon as the two sprites overlap (character_collision.h); in
+  // rollback mode once every input up to that tick is in, so both sides agree.
+  // Lockstep only ever runs ticks whose inputs are all in.
+  PlayerType character = (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON;
+  PlayerType opponent = (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS;
+  bool caught = (netMode == NET_ROLLBACK) ? rollbackCaught(rollback)
+               : (netMode == NET_LOCKSTEP) ? lockstep.state.caught
+                                           : charactersOverlap(character, xClient, yClient, opponent, xServer, yServer);
+  if (caught) {
+    dispatchGameEvent(gameFlow, EV_CAUGHT);
     return false;
   }
   return true;
 }
 
-void printDistance() {
-  long distance = abs(sqrt(pow((xServer - xClient), 2) + pow((yServer - yClient), 2)));
-  M5.Lcd.fillRect(10, 20, 10, 10, TFT_BLACK);
-  M5.Lcd.setCursor(10, 20);
-  if (chosenPlayer == DRAGON) {
-    M5.Lcd.setTextColor(TFT_PINK);
-  } else {
-    M5.Lcd.setTextColor(TFT_GREEN);
+///////////////////////////////////////////////////////////////
+// Redraws the HUD characters whose value changed since the last
+// frame (nothing at all on most frames). Runs on the render task.
+///////////////////////////////////////////////////////////////
+void updateHud(const FrameSnapshot &frame) {
+  char text[HUD_FIELD_CHARS + 1];
+  setHudFieldStyle(hudTimer, frame.timerStyle);
+  formatHudTime(text, frame.remainingMs);
+  updateHudField(hudTimer, text, hudStyles, drawHudGlyph);
+
+  // Distance is shown in the opponent's colour
+  setHudFieldStyle(hudDistance, frame.distanceStyle);
+  formatHudNumber(text, frame.distance);
+  updateHudField(hudDistance, text, hudStyles, drawHudGlyph);
+
+  formatHudNumber(text, frame.powerupsLeft);
+  updateHudField(hudPowerups, text, hudStyles, drawHudGlyph);
+
+  formatHudNumber(text, frame.acceleration);
+  updateHudField(hudAcceleration, text, hudStyles, drawHudGlyph);
+
+  if (frame.linkOverlay) {
+    formatHudNumber(text, frame.rttMedian);
+    updateHudField(hudRttMedian, text, hudStyles, drawHudGlyph);
+    formatHudNumber(text, frame.rttTail);
+    updateHudField(hudRttTail, text, hudStyles, drawHudGlyph);
+    formatHudNumber(text, frame.dropPercent);
+    updateHudField(hudLoss, text, hudStyles, drawHudGlyph);
   }
-  M5.Lcd.setTextSize(1);
-  M5.Lcd.print(distance);
 }
 
 // countdown timer
 void checkTimeAndPrint() {
   currTime = millis();
-  unsigned long remainingTime = 0;
+  remainingTime = 0;
   if (countdownTime - (currTime - prevTime) >= 0) {
     remainingTime = countdownTime - (currTime - prevTime);
   }
   if (remainingTime <= 0) {
-    gameState = S_GAME_OVER;
-    String x = String(4);
-    bleGameStateCharacteristic->writeValue(x.c_str(), false);
-    timeRanOut = true;
-    gameEnded = true;
-    screenUpdated = true;
-    endGame();
-  }
-  unsigned long minutes = (remainingTime / 1000) / 60;
-  unsigned long seconds = (remainingTime  / 1000) % 60;
-
-  if (gameState == S_GAME && remainingTime >= 0) {
-    M5.Lcd.setTextSize(1);
-    M5.Lcd.setCursor(210, 20);
-    M5.Lcd.print(minutes);
-    M5.Lcd.print(":");
-    if (seconds < 10) {
-      String secs = String(seconds);
-      M5.Lcd.print("0"+secs);
-    } else {
-      M5.Lcd.print(seconds);
-    }
+    dispatchGameEvent(gameFlow, EV_TIME_UP);
   }
+  // The HUD draws remainingTime in updateHud()
 }
 
 void clientAccelIncrement() {
@@ -742,15 +1099,21 @@ void clientAccelIncrement() {
   }
 }
 
-void endGame() {
-  String x = String(4);
-  bleGameStateCharacteristic->writeValue(x.c_str(), false);
-  xClient = 300, yClient = 120;
-  String xx = String(xClient);
-  bleReadWriteXCharacteristic->writeValue(xx.c_str(), false);
-  String y = String(yClient);
-  bleReadWriteYCharacteristic->writeValue(y.c_str(), false);
+void endGame(uint8_t event) {
+  // Why, so the server shows the same result if this reached it first
+  uint8_t gameOver[2] = { 4, gameOverReason(event) };
+  sendReliableMessage(eventChannel, MSG_GAME_STATE, gameOver, sizeof(gameOver));
+  // The next snapshot takes us back to the spawn point on the server too
+  xClient = arenaMap.spawnX[SPAWN_CLIENT], yClient = arenaMap.spawnY[SPAWN_CLIENT];
+
+  postScreen(drawGameOverScreen);
+  sendPlayerSelection(3);
+}
 
+///////////////////////////////////////////////////////////////
+// Draws the result screen (posted to the render task by endGame)
+///////////////////////////////////////////////////////////////
+void drawGameOverScreen() {
   M5.Lcd.fillScreen(TFT_BLACK);
   M5.Lcd.setTextColor(TFT_RED);
   M5.Lcd.setTextSize(3);
@@ -765,225 +1128,207 @@ void endGame() {
     M5.Lcd.drawString("YOU WON", M5.Lcd.width() / 4, M5.Lcd.height() / 2 - 30);
   }
   PLAYAGAIN.draw();
-  String cha = String(3);
-  bleLocalPlayerSelectionCharacteristic->writeValue(cha.c_str(), false);
 }
 
-void drawCharacters(uint32_t serverX, uint32_t serverY, uint32_t clientX, uint32_t clientY){
-  if (chosenPlayer == PRINCESS) {
-    drawCharacterImage("princess", 1, clientX, clientY);
+///////////////////////////////////////////////////////////////
+// Runs the simulation ticks that are due: moves the local
+// character (kinematics.h) and advances its animation. The
+// renderer works out from the frame snapshot whether anything
+// has to be redrawn.
+///////////////////////////////////////////////////////////////
+void stepSimulation() {
+  PlayerType character = (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON;
+  const FacingVariant *facings = characterFacings[character];
+
+  uint32_t ticks = advanceTickClock(simClock, millis());
+  if (netMode != NET_SNAPSHOTS) {
+    stepInputMode(ticks);
+  } else {
+    // Spawns and new rounds set the pixel position directly
+    syncBody(localBody, xClient, yClient);
+    for (uint32_t i = 0; i < ticks; i++) {
+      stepBody(localBody, moveX, moveY, acceleration, localBlocked);
+    }
+  }
+  int x = kinToPixels(localBody.x);
+  int y = kinToPixels(localBody.y);
+  // The next snapshot tells the server if the pixel position changed
+  xClient = x;
+  yClient = y;
+
+  faceVelocity(localAnimator, facings, moveX, moveY);
+  const AnimationClip *clips = facingClips(localAnimator, facings);
+
+  // Pick the clip from what the character is doing right now
+  if (isPowerupActive(powerups.own, simClock.tick)) {
+    playAnimation(localAnimator, clips, ANIM_POWERUP);
+  } else if (localBody.vx != 0 || localBody.vy != 0) {
+    playAnimation(localAnimator, clips, ANIM_WALK);
   } else {
-    drawCharacterImage("dragon", 1, clientX, clientY);
+    playAnimation(localAnimator, clips, ANIM_IDLE);
+  }
+  for (uint32_t i = 0; i < ticks; i++) {
+    advanceAnimation(localAnimator, clips);
   }
 }
 
-void playGame() {
-  printDistance();
-  // Reverse x/y values to match joystick orientation
-  int x = 1023 - gamePad.analogRead(14);
-  int y = 1023 - gamePad.analogRead(15);
-
-  // Left & Right For Joystick
-  if (x > 600) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((xClient + 1) < 320) {
-        xClient++;
-        String x = String(xClient);
-        bleReadWriteXCharacteristic->writeValue(x.c_str(), false);
-        locationWasUpdated = true;
-      } else {
-        xClient = 0;
-        String x = String(xClient);
-        bleReadWriteXCharacteristic->writeValue(x.c_str(), false);
-        locationWasUpdated = true;
-      }
-    }
-  } else if (x < 500) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((xClient - 1) > 0) {
-        xClient--;
-        String x = String(xClient);
-        bleReadWriteXCharacteristic->writeValue(x.c_str(), false);
-        locationWasUpdated = true;
-      } else {
-        xClient = 320;
-        String x = String(xClient);
-        bleReadWriteXCharacteristic->writeValue(x.c_str(), false);
-        locationWasUpdated = true;
-      }
-    }
+///////////////////////////////////////////////////////////////
+// Input modes: both characters move on both sides' inputs. In
+// rollback mode (rollback.h) ours goes in as it is now and the
+// server's is predicted until it arrives; in lockstep mode
+// (lockstep.h) ours is played a few ticks on and nothing runs
+// ahead of the server's.
+///////////////////////////////////////////////////////////////
+void stepInputMode(uint32_t ticks) {
+  DuelInput input = {(int8_t)moveX, (int8_t)moveY, (uint8_t)acceleration};
+  const DuelState *state = &rollback.state;
+  uint32_t start = micros();
+  if (netMode == NET_ROLLBACK) {
+    receiveRollbackInputs(rollback);
+    advanceRollback(rollback, input, ticks);
+  } else {
+    receiveLockstepInputs(lockstep);
+    advanceLockstep(lockstep, input, ticks);
+    state = &lockstep.state;
+  }
+  uint32_t took = micros() - start;
+  if (took > duelWorstUs) {
+    duelWorstUs = took;
   }
+  localBody = state->body[1];
+  xServer = kinToPixels(state->body[0].x);
+  yServer = kinToPixels(state->body[0].y);
+}
 
-  if (y < 480) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((yClient + 1) < 240) {
-        yClient++;
-        String y = String(yClient);
-        bleReadWriteYCharacteristic->writeValue(y.c_str(), false);
-        locationWasUpdated = true;
-      } else {
-        yClient = 0;
-        String y = String(yClient);
-        bleReadWriteYCharacteristic->writeValue(y.c_str(), false);
-        locationWasUpdated = true;
-      }
-    }
-  } else if (y > 560) {
-    for (int i = 0; i < acceleration; i++) {
-      if ((yClient - 1) > 0) {
-        yClient--;
-        String y = String(yClient);
-        bleReadWriteYCharacteristic->writeValue(y.c_str(), false);
-        locationWasUpdated = true;
-      } else {
-        yClient = 240;
-        String y = String(yClient);
-        bleReadWriteYCharacteristic->writeValue(y.c_str(), false);
-        locationWasUpdated = true;
-      }
-    }
+// Walls block the local character's feet
+bool localBlocked(int x, int y) {
+  return characterBlocked(arenaMap, (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON, x, y);
+}
+
+///////////////////////////////////////////////////////////////
+// Hands everything this loop's frame needs to the render task.
+// Nothing in here touches the display.
+///////////////////////////////////////////////////////////////
+void postGameFrame() {
+  PlayerType character = (chosenPlayer == PRINCESS) ? PRINCESS : DRAGON;
+  const FacingVariant *facings = characterFacings[character];
+  const AnimationClip *clips = facingClips(localAnimator, facings);
+
+  FrameSnapshot frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.x = xClient;
+  frame.y = yClient;
+  frame.atlasFrame = currentAtlasFrame(localAnimator, clips);
+  frame.palette = clips[localAnimator.clip].palette;
+  frame.mirrored = facings[localAnimator.facing].mirrored;
+  addressPowerup(frame);
+
+  frame.remainingMs = remainingTime;
+  frame.distance = characterDistance(xServer, yServer, xClient, yClient);
+  frame.distanceStyle = (chosenPlayer == DRAGON) ? HUD_STYLE_PINK : HUD_STYLE_GREEN;
+  frame.powerupsLeft = powerups.left;
+  // The timer turns the opponent's colour while their powerup shows them where we are
+  frame.timerStyle = !powerups.opponent.active ? HUD_STYLE_TIMER :
+                     (chosenPlayer == DRAGON) ? HUD_STYLE_PINK : HUD_STYLE_GREEN;
+  frame.acceleration = acceleration;
+  // Median and tail round trip of the pings, snapshots lost lately
+  frame.linkOverlay = linkOverlay;
+  if (linkOverlay) {
+    LinkReport report;
+    fillLinkReport(report, linkTelemetry, snapshotLink.stats.received, snapshotLink.stats.lost);
+    frame.rttMedian = report.rttMedian;
+    frame.rttTail = report.rttTail;
+    frame.dropPercent = linkDropPercent;
   }
+  frame.forceRedraw = redrawGame;
+  // A full queue drops the frame; the repaint goes with the next one then
+  if (postFrame(frame)) {
+    redrawGame = false;
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Draws one game frame. Runs on the render task. The fog of war
+// composites only the tiles that changed; the HUD only redraws
+// the characters that did.
+///////////////////////////////////////////////////////////////
+void renderFrame(const FrameSnapshot &frame, bool fullRedraw) {
+  showHudOverlay(frame.linkOverlay);
+  renderFoggedFrame(frame, fullRedraw);
+  updateHud(frame);
+}
+
+void playGame() {
+  // Calibrated stick vector (joystick_setup.h). Only reads the stick
+  // here; stepSimulation() moves the character once per tick.
+  JoystickVector stick = readJoystick(gamePad);
+  moveX = stick.x;
+  moveY = stick.y;
 
   // For the gamepad buttons
   uint32_t buttons = gamePad.digitalReadBulk(button_mask);
-  if (! (buttons & (1UL << BUTTON_SELECT))) {
+  // Start cycles the speed level shown on the HUD
+  bool startDown = !(buttons & (1UL << BUTTON_START));
+  if (startDown && !startWasDown) {
+    clientAccelIncrement();
+  }
+  startWasDown = startDown;
+  // Select starts a powerup; usePowerup() ignores presses during the cooldown
+  bool selectDown = !(buttons & (1UL << BUTTON_SELECT));
+  bool selectPressed = selectDown && !selectWasDown;
+  if (selectPressed) {
     usePowerup();
-    delay(500);
   }
+  selectWasDown = selectDown;
+  // The inputs this loop's ticks run on, for the replay
+  recordMatchInput(matchRecorder, simClock.tick, moveX, moveY, acceleration, selectPressed);
 }
 
 void usePowerup() {
-  Serial.print("Made it to powerup");
-  if (powerupsStillAvailable) {
-    if (chosenPlayer == DRAGON && !dragonPowerupActive) {
-      dragonPowerupActive = true;
-      // Update the amount of powerups left 
-      if (powerupsStillAvailable && powerupsLeft > 0) {
-        powerupsLeft--; 
-      } else {
-        powerupsStillAvailable = false;
-      }
-      powerupStartTime = millis();
-    } else if (chosenPlayer == PRINCESS && !princessPowerupActive) {
-      princessPowerupActive = true;
-      powerupStartTime = millis();
-      // Update the amount of powerups left 
-      if (powerupsStillAvailable && powerupsLeft > 0) {
-        powerupsLeft--; 
-      } else {
-        powerupsStillAvailable = false;
-      }
-    }
+  if (pressPowerup(powerups, simClock.tick)) {
+    logEvent(LOG_POWERUP_STARTED);
+    uint8_t payload[POWERUP_MESSAGE_SIZE];
+    encodePowerupMessage(payload, (chosenPlayer == PRINCESS) ? 1 : 2, powerups.own.startTick);
+    sendReliableMessage(eventChannel, MSG_POWERUP, payload, POWERUP_MESSAGE_SIZE);
   }
-  screenUpdated = true;
-  locationWasUpdated = true;
 }
 
-void addressPowerup() {
-  if (dragonPowerupActive && chosenPlayer == DRAGON) {
-    M5.Lcd.fillScreen(TFT_BLACK);
-    drawCharacters(xServer, yServer, xClient, yClient); 
-    M5.Lcd.drawPixel(xServer, yServer, TFT_PINK);
-  }
-
-  if (princessPowerupActive && chosenPlayer == PRINCESS) {
-    M5.Lcd.fillScreen(TFT_BLACK);
-    drawCharacters(xServer, yServer, xClient, yClient); 
-    M5.Lcd.drawPixel(xServer, yServer, TFT_GREEN);
-  }
+///////////////////////////////////////////////////////////////
+// Fills in the reveal part of the frame: while our own powerup
+// is active the fog opens around the opponent
+///////////////////////////////////////////////////////////////
+void addressPowerup(FrameSnapshot &frame) {
+  frame.reveal = powerups.own.active;
+  frame.revealColor = (chosenPlayer == DRAGON) ? TFT_PINK : TFT_GREEN;
+  frame.revealX = frame.reveal ? xServer : 0;
+  frame.revealY = frame.reveal ? yServer : 0;
+
+  // The opponent is shown standing, facing right
+  PlayerType opponent = (chosenPlayer == PRINCESS) ? DRAGON : PRINCESS;
+  const AnimationClip &idle = characterFacings[opponent][FACE_RIGHT].clips[ANIM_IDLE];
+  frame.revealFrame = idle.firstFrame;
+  frame.revealPalette = idle.palette;
 }
 
 /////////////////////////////////////////////////////////////////
-// This method takes in an image icon string (from API) and a 
-// resize multiple and draws the corresponding image (bitmap byte
-// arrays found in EGR425_Phase1_weather_bitmap_images.h) to scale (for 
-// example, if resizeMult==2, will draw the image as 200x200 instead
-// of the native 100x100 pixels) on the right-hand side of the
-// screen (centered vertically). 
+// This method takes in an image icon string and a resize multiple
+// and draws the corresponding indexed sprite (generated into
+// game_indexed_bitmaps.h) to scale (for example, if resizeMult==2,
+// will draw the image as 200x200 instead of the native 100x100
+// pixels) centered on the screen.
 /////////////////////////////////////////////////////////////////
-void drawCenteredBackgroundImage(String iconName, int resizeMult) {
-    // Get the corresponding byte array
-    const uint16_t * iconBitmap = getIconBitmap(iconName);
-
-    // Compute offsets so that the image is centered vertically and is
-    // right-aligned
-    int yOffset = -(resizeMult * imgSqDim - M5.Lcd.height()) / 2;
-    // int xOffset = sWidth - (imgSqDim*resizeMult*.8); // Right align (image doesn't take up entire array)
-    int xOffset = (M5.Lcd.width() / 2) - (imgSqDim * resizeMult / 2); // center horizontally
-    
-    // Iterate through each pixel of the imgSqDim x imgSqDim (100 x 100) array
-    for (int y = 0; y < imgSqDim; y++) {
-        for (int x = 0; x < imgSqDim; x++) {
-            // Compute the linear index in the array and get pixel value
-            int pixNum = (y * imgSqDim) + x;
-            uint16_t pixel = iconBitmap[pixNum];
-
-            // If the pixel is black, do NOT draw (treat it as transparent);
-            // otherwise, draw the value
-            if (pixel != 0) {
-                // 16-bit RBG565 values give the high 5 pixels to red, the middle
-                // 6 pixels to green and the low 5 pixels to blue as described
-                // here: http://www.barth-dev.de/online/rgb565-color-picker/
-                byte red = (pixel >> 11) & 0b0000000000011111;
-                red = red << 3;
-                byte green = (pixel >> 5) & 0b0000000000111111;
-                green = green << 2;
-                byte blue = pixel & 0b0000000000011111;
-                blue = blue << 3;
-
-                // Scale image; for example, if resizeMult == 2, draw a 2x2
-                // filled square for each original pixel
-                for (int i = 0; i < resizeMult; i++) {
-                    for (int j = 0; j < resizeMult; j++) {
-                        int xDraw = x * resizeMult + i + xOffset;
-                        int yDraw = y * resizeMult + j + yOffset;
-                        M5.Lcd.drawPixel(xDraw, yDraw, M5.Lcd.color565(red, green, blue));
-                    }
-                }
-            }
-        }
+void drawCenteredBackgroundImage(const char *iconName, int resizeMult) {
+    // Get the corresponding indexed sprite
+    const IndexedSprite *sprite = getIndexedSprite(iconName);
+    if (sprite == NULL) {
+        return;
     }
-}
 
-void drawCharacterImage(String iconName, int resizeMult, int xLoc, int yLoc) {
-    // Get the corresponding byte array
-    const uint16_t * iconBitmap = getIconBitmap(iconName);
+    // Compute offsets so that the image is centered
+    int yOffset = -(resizeMult * sprite->height - M5.Lcd.height()) / 2;
+    int xOffset = (M5.Lcd.width() / 2) - (sprite->width * resizeMult / 2); // center horizontally
+
+    // Transparent (index 0) pixels are skipped by the blit
+    drawIndexedSprite(*sprite, xOffset, yOffset, resizeMult);
+}
 
-    // Compute offsets so that the image is centered vertically and is
-    // right-aligned
-    int yOffset = yLoc - (imgSqDim * resizeMult / 2); // center vertically    // int xOffset = sWidth - (imgSqDim*resizeMult*.8); // Right align (image doesn't take up entire array)
-    int xOffset = xLoc - (imgSqDim * resizeMult / 2); // center horizontally
-    
-    // Iterate through each pixel of the imgSqDim x imgSqDim (100 x 100) array
-    for (int y = 0; y < imgSqDim; y++) {
-        for (int x = 0; x < imgSqDim; x++) {
-            // Compute the linear index in the array and get pixel value
-            int pixNum = (y * imgSqDim) + x;
-            uint16_t pixel = iconBitmap[pixNum];
-
-            // If the pixel is black, do NOT draw (treat it as transparent);
-            // otherwise, draw the value
-            if (pixel != 0) {
-                // 16-bit RBG565 values give the high 5 pixels to red, the middle
-                // 6 pixels to green and the low 5 pixels to blue as described
-                // here: http://www.barth-dev.de/online/rgb565-color-picker/
-                byte red = (pixel >> 11) & 0b0000000000011111;
-                red = red << 3;
-                byte green = (pixel >> 5) & 0b0000000000111111;
-                green = green << 2;
-                byte blue = pixel & 0b0000000000011111;
-                blue = blue << 3;
-
-                // Scale image; for example, if resizeMult == 2, draw a 2x2
-                // filled square for each original pixel
-                for (int i = 0; i < resizeMult; i++) {
-                    for (int j = 0; j < resizeMult; j++) {
-                        int xDraw = x * resizeMult + i + xOffset;
-                        int yDraw = y * resizeMult + j + yOffset;
-                        M5.Lcd.drawPixel(xDraw, yDraw, M5.Lcd.color565(red, green, blue));
-                    }
-                }
-            }
-        }
-    }
-}
\ No newline at end of file
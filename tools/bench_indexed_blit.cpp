@@ -0,0 +1,102 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host benchmark for the indexed sprite expansion kernel.
+//
+// Compares reading RGB565 images against expanding the generated 4-bit
+// assets and character atlas (and an 8-bit re-pack of them) into RGB565
+// spans, using the real game assets. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/bench_indexed_blit tools/bench_indexed_blit.cpp
+//     /tmp/bench_indexed_blit
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "../include/game_indexed_bitmaps.h"
+#include "../include/game_sprite_atlas.h"
+
+static const int ITERATIONS = 2000;
+
+// Keeps the compiler from dropping the work
+static volatile uint32_t sink = 0;
+
+static uint32_t checksum(const uint16_t *span, int count) {
+    uint32_t sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += span[i];
+    }
+    return sum;
+}
+
+static double nsPerPixel(std::chrono::steady_clock::duration elapsed, const IndexedSprite &sprite) {
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    return ns / ((double)ITERATIONS * sprite.width * sprite.height);
+}
+
+// Re-packs a 4-bit sprite as 8-bit so both kernel paths run on the same art
+static IndexedSprite repackAs8Bit(const IndexedSprite &sprite, std::vector<uint8_t> &storage) {
+    storage.resize(sprite.width * sprite.height);
+    for (int y = 0; y < sprite.height; y++) {
+        for (int x = 0; x < sprite.width; x++) {
+            storage[y * sprite.width + x] = indexedPixelAt(sprite, x, y);
+        }
+    }
+    IndexedSprite repacked = sprite;
+    repacked.bpp = 8;
+    repacked.stride = sprite.width;
+    repacked.pixels = storage.data();
+    return repacked;
+}
+
+static void benchSprite(const char *name, const IndexedSprite &sprite) {
+    IndexedLut lut;
+    buildIndexedLut(sprite, lut);
+    std::vector<uint16_t> span(sprite.width);
+
+    // Baseline: the RGB565 image as it used to be stored
+    std::vector<uint16_t> rgb(sprite.width * sprite.height);
+    for (int y = 0; y < sprite.height; y++) {
+        expandIndexedSpan(sprite, lut, y, 0, sprite.width, &rgb[y * sprite.width]);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int y = 0; y < sprite.height; y++) {
+            memcpy(span.data(), &rgb[y * sprite.width], sprite.width * sizeof(uint16_t));
+            sink += checksum(span.data(), sprite.width);
+        }
+    }
+    double rgbNs = nsPerPixel(std::chrono::steady_clock::now() - start, sprite);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int y = 0; y < sprite.height; y++) {
+            expandIndexedSpan(sprite, lut, y, 0, sprite.width, span.data());
+            sink += checksum(span.data(), sprite.width);
+        }
+    }
+    double fourNs = nsPerPixel(std::chrono::steady_clock::now() - start, sprite);
+
+    std::vector<uint8_t> storage;
+    IndexedSprite eight = repackAs8Bit(sprite, storage);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int y = 0; y < eight.height; y++) {
+            expandIndexedSpan(eight, lut, y, 0, eight.width, span.data());
+            sink += checksum(span.data(), eight.width);
+        }
+    }
+    double eightNs = nsPerPixel(std::chrono::steady_clock::now() - start, eight);
+
+    printf("%-14s rgb565 %6u B %6.2f ns/px | 4bpp %5u B %6.2f ns/px | 8bpp %5u B %6.2f ns/px\n",
+           name, (unsigned)(sprite.width * sprite.height * 2), rgbNs,
+           (unsigned)indexedSpriteBytes(sprite), fourNs,
+           (unsigned)indexedSpriteBytes(eight), eightNs);
+}
+
+int main() {
+    benchSprite("crossedSwords", crossedSwordsSprite);
+    benchSprite("cave", caveSprite);
+    benchSprite("atlas", atlasSprite);
+    return 0;
+}
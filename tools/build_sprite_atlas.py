@@ -0,0 +1,337 @@
+#!/usr/bin/env python3
+"""
+Builds the character animation atlas (include/game_sprite_atlas.h).
+
+Every animation frame of every character is cut from the source images in
+include/game_image_bitmaps.h, trimmed to its opaque pixels, de-duplicated
+and shelf-packed into a single 4-bit indexed atlas image. The header holds
+the atlas, the frame rectangles and the per-character clip tables used by
+include/sprite_animation.h.
+
+It also holds the collision masks used by include/collision.h: a 1-bit
+mask per frame (normal and mirrored, sharing words between identical
+frames), and per character a footprint mask for walls, which is the bottom
+FOOTPRINT_ROWS rows of every frame of the character in both orientations
+OR-ed together, so changing frame or facing can never push a character
+into a wall.
+
+Until real multi-frame art exists the frames are derived from the single
+character drawings: walking leans the sprite (a row shear) and bobs it,
+idle bobs it slowly, and the powerup clip replays the walk frames with the
+powerup palette so it costs no extra pixel data.
+
+Direction variants: the side view faces right and is drawn mirrored for
+left (no extra pixels, see expandIndexedSpanMirrored()). If the source
+header also has "<character>Up" / "<character>Down" images, they get their
+own frames and clips; otherwise those facings are left empty and the
+character keeps its last left/right facing while moving vertically.
+
+Usage:
+    python3 tools/build_sprite_atlas.py
+
+Also runs as a PlatformIO pre-build script (see platformio.ini), in which
+case the header is only regenerated when the inputs changed.
+"""
+import os
+import sys
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO/SCons)
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+sys.path.insert(0, os.path.join(ROOT, "tools"))
+import convert_indexed_sprites as indexed  # noqa: E402
+
+OUTPUT = os.path.join(ROOT, "include", "game_sprite_atlas.h")
+
+# Characters in PlayerType order (PRINCESS, DRAGON)
+CHARACTERS = ["princess", "dragon"]
+
+# Optional extra views: facing name -> source image suffix
+VERTICAL_VIEWS = [("FACE_UP", "Up"), ("FACE_DOWN", "Down")]
+
+# Palette variants; each entry maps a source colour to its variant colour
+POWERUP_COLOUR = 0xFFE0  # yellow glow while a powerup is active
+PALETTES = ["normal", "powerup"]
+
+# (transform, shear, bob) per frame; shear leans the top of the sprite by
+# that many pixels, bob moves the whole frame up/down in the cell
+FRAME_SETS = {
+    "idle": [(0, 0), (0, -1)],
+    "walk": [(0, 0), (3, -2), (0, 0), (-3, -2)],
+}
+
+# clip name -> (frame set, ticks per frame, palette)
+CLIPS = [
+    ("ANIM_IDLE", "idle", 25, "normal"),
+    ("ANIM_WALK", "walk", 5, "normal"),
+    ("ANIM_POWERUP", "walk", 5, "powerup"),
+]
+
+ATLAS_WIDTHS = range(128, 513, 16)
+
+# Rows at the bottom of a character that collide with walls (its feet); the
+# sprites are much larger than the gaps between walls
+FOOTPRINT_ROWS = 12
+
+
+def shear(pixels, dim, amount):
+    """Shifts each row horizontally, most at the top, none at the bottom."""
+    if amount == 0:
+        return list(pixels)
+    out = [0] * (dim * dim)
+    for y in range(dim):
+        shift = int(round(amount * (dim - 1 - y) / float(dim - 1)))
+        for x in range(dim):
+            sx = x - shift
+            if 0 <= sx < dim:
+                out[y * dim + x] = pixels[y * dim + sx]
+    return out
+
+
+def trim(indices, dim):
+    """Returns (x, y, w, h, rows) of the opaque part of a cell."""
+    xs = [i % dim for i, v in enumerate(indices) if v]
+    ys = [i // dim for i, v in enumerate(indices) if v]
+    if not xs:
+        return 0, 0, 1, 1, [[0]]
+    x0, x1, y0, y1 = min(xs), max(xs), min(ys), max(ys)
+    rows = [indices[y * dim + x0:y * dim + x1 + 1] for y in range(y0, y1 + 1)]
+    return x0, y0, x1 - x0 + 1, y1 - y0 + 1, rows
+
+
+def shelf_pack(rects, width):
+    """rects: [(w, h)] -> [(x, y)], height. Tallest first, left to right."""
+    order = sorted(range(len(rects)), key=lambda i: (-rects[i][1], -rects[i][0]))
+    placed = [None] * len(rects)
+    x = y = shelf_h = 0
+    for i in order:
+        w, h = rects[i]
+        if w > width:
+            return None, None
+        if x + w > width:
+            y += shelf_h
+            x = shelf_h = 0
+        placed[i] = (x, y)
+        x += w
+        shelf_h = max(shelf_h, h)
+    return placed, y + shelf_h
+
+
+def up_to_date():
+    return indexed.up_to_date(OUTPUT, [indexed.SOURCE, os.path.abspath(__file__)])
+
+
+def mask_words(rows, mirrored):
+    """Packs the opaque pixels of rows into 32-bit words, leftmost pixel in bit 31."""
+    words_per_row = (len(rows[0]) + 31) // 32
+    words = []
+    for row in rows:
+        bits = [1 if v else 0 for v in (row[::-1] if mirrored else row)]
+        bits += [0] * (words_per_row * 32 - len(bits))
+        for i in range(0, len(bits), 32):
+            word = 0
+            for b in bits[i:i + 32]:
+                word = (word << 1) | b
+            words.append(word)
+    return words_per_row, words
+
+
+def footprint(frames, unique, dim):
+    """Bottom FOOTPRINT_ROWS rows of the union of frames, both orientations.
+    Returns (x, y, rows) in cell coordinates."""
+    cell = [0] * (dim * dim)
+    for u, ox, oy in frames:
+        w, h, rows = unique[u]
+        for mirrored in (False, True):
+            x0 = dim - ox - w if mirrored else ox
+            for ry, row in enumerate(rows):
+                for rx, v in enumerate(row[::-1] if mirrored else row):
+                    cy, cx = oy + ry, x0 + rx
+                    if v and 0 <= cy < dim and 0 <= cx < dim:
+                        cell[cy * dim + cx] = 1
+    x, y, w, h, rows = trim(cell, dim)
+    keep = min(FOOTPRINT_ROWS, h)
+    return x, y + h - keep, rows[h - keep:]
+
+
+def main(force=True):
+    if not force and up_to_date():
+        return
+    dim, images = indexed.read_images(indexed.SOURCE)
+    images = dict(images)
+
+    # One palette shared by the whole atlas keeps it a single 4-bit image
+    palette = indexed.build_palette("atlas", [p for c in CHARACTERS for p in images[c]])
+    if len(palette) > 16:
+        sys.exit("atlas characters use %d colours; at most 16 fit a 4-bit atlas" % len(palette))
+    lookup = {c: i for i, c in enumerate(palette)}
+    variants = {
+        "normal": palette,
+        "powerup": [palette[0]] + [POWERUP_COLOUR] * (len(palette) - 1),
+    }
+
+    # Views to cut per character: (clip table name, source image)
+    views = []
+    for character in CHARACTERS:
+        views.append((character, character))
+        for _, suffix in VERTICAL_VIEWS:
+            if character + suffix in images:
+                views.append((character + suffix, character + suffix))
+
+    # Cut every frame, de-duplicating identical pixel rectangles
+    unique = []        # [(w, h, rows)]
+    unique_keys = {}
+    frames = []        # [(unique index, offsetX, offsetY)]
+    clips = {}         # view -> [(firstFrame, count, ticks, palette)]
+    character_frames = {c: [] for c in CHARACTERS}
+    for view, source in views:
+        set_start = {}
+        for name in sorted(FRAME_SETS):
+            set_start[name] = len(frames)
+            for amount, bob in FRAME_SETS[name]:
+                cell = [lookup[p] for p in shear(images[source], dim, amount)]
+                x, y, w, h, rows = trim(cell, dim)
+                key = tuple(tuple(r) for r in rows)
+                if key not in unique_keys:
+                    unique_keys[key] = len(unique)
+                    unique.append((w, h, rows))
+                frames.append((unique_keys[key], x, y + bob))
+                character_frames[[c for c in CHARACTERS if view.startswith(c)][0]].append(frames[-1])
+        clips[view] = [(set_start[s], len(FRAME_SETS[s]), ticks, PALETTES.index(pal))
+                       for _, s, ticks, pal in CLIPS]
+
+    if len(frames) > 255:
+        sys.exit("too many atlas frames (%d)" % len(frames))
+
+    # Pick the atlas width with the smallest area
+    best = None
+    for width in ATLAS_WIDTHS:
+        placed, height = shelf_pack([(w, h) for w, h, _ in unique], width)
+        if placed is not None and (best is None or width * height < best[0] * best[1]):
+            best = (width, height, placed)
+    width, height, placed = best
+
+    atlas = [0] * (width * height)
+    for (w, h, rows), (ax, ay) in zip(unique, placed):
+        for ry, row in enumerate(rows):
+            atlas[(ay + ry) * width + ax:(ay + ry) * width + ax + w] = row
+    data, stride = indexed.pack([palette[i] for i in atlas], palette, width, height, 4)
+
+    out = []
+    out.append("#ifndef GAME_SPRITE_ATLAS_H")
+    out.append("#define GAME_SPRITE_ATLAS_H")
+    out.append("/////////////////////////////////////////////////////////////////////////////")
+    out.append("// GENERATED by tools/build_sprite_atlas.py from game_image_bitmaps.h.")
+    out.append("// Do not edit by hand; re-run the script after changing the source images.")
+    out.append("/////////////////////////////////////////////////////////////////////////////")
+    out.append('#include "indexed_sprite.h"')
+    out.append('#include "sprite_animation.h"')
+    out.append('#include "collision.h"')
+    out.append("")
+    out.append("// Size of the square cell every frame is positioned in")
+    out.append("const int ATLAS_CELL_SIZE = %d;" % dim)
+    out.append("")
+    out.append("// Palette variants (index 0 is transparent in all of them)")
+    out.append("const int ATLAS_PALETTE_SIZE = %d;" % len(palette))
+    out.append("const uint16_t atlasPalettes [][%d] PROGMEM = {" % len(palette))
+    for name in PALETTES:
+        out.append("\t{ " + ", ".join("0x%04x" % c for c in variants[name]) + " }, // %s" % name)
+    out.append("};")
+    out.append("")
+    out.append("// %dx%dpx, %d unique frames, 4bpp" % (width, height, len(unique)))
+    out.append("const uint8_t atlasIndices [] PROGMEM = {")
+    out.append(indexed.emit_bytes(data))
+    out.append("};")
+    out.append("const IndexedSprite atlasSprite = { %d, %d, 4, %d, %d, atlasPalettes[0], atlasIndices };"
+               % (width, height, stride, len(palette)))
+    out.append("")
+    out.append("// x, y, w, h, offsetX, offsetY")
+    out.append("const AtlasFrame atlasFrames [] = {")
+    for u, ox, oy in frames:
+        w, h, _ = unique[u]
+        ax, ay = placed[u]
+        out.append("\t{ %d, %d, %d, %d, %d, %d }," % (ax, ay, w, h, ox, oy))
+    out.append("};")
+    out.append("")
+    # Collision masks: words per unique frame and orientation, shared by the frames using them
+    mask_data = []
+    mask_start = {}
+    for u, (w, h, rows) in enumerate(unique):
+        for mirrored in (0, 1):
+            words_per_row, words = mask_words(rows, mirrored)
+            mask_start[(u, mirrored)] = (len(mask_data), words_per_row)
+            mask_data.extend(words)
+    footprints = []
+    for character in CHARACTERS:
+        x, y, rows = footprint(character_frames[character], unique, dim)
+        words_per_row, words = mask_words(rows, False)
+        footprints.append((character, x, y, len(rows[0]), len(rows), words_per_row, len(mask_data)))
+        mask_data.extend(words)
+
+    out.append("// 1-bit collision masks (collision.h), %d bytes" % (len(mask_data) * 4))
+    out.append("const uint32_t atlasMaskWords [] PROGMEM = {")
+    for i in range(0, len(mask_data), 8):
+        out.append("\t" + ", ".join("0x%08x" % w for w in mask_data[i:i + 8]) + ",")
+    out.append("};")
+    out.append("")
+    out.append("// offsetX, offsetY, w, h, wordsPerRow, words per atlas frame: { normal, mirrored }")
+    out.append("const CollisionMask atlasMasks [][2] = {")
+    for u, ox, oy in frames:
+        w, h, _ = unique[u]
+        entries = []
+        for mirrored in (0, 1):
+            start, words_per_row = mask_start[(u, mirrored)]
+            entries.append("{ %d, %d, %d, %d, %d, atlasMaskWords + %d }"
+                           % (dim - ox - w if mirrored else ox, oy, w, h, words_per_row, start))
+        out.append("\t{ " + ", ".join(entries) + " },")
+    out.append("};")
+    out.append("")
+    out.append("// Feet of each character, blocked by walls (in PlayerType order)")
+    out.append("const CollisionMask characterFootprints [] = {")
+    for character, x, y, w, h, words_per_row, start in footprints:
+        out.append("\t{ %d, %d, %d, %d, %d, atlasMaskWords + %d }, // %s"
+                   % (x, y, w, h, words_per_row, start, character))
+    out.append("};")
+    out.append("")
+    out.append("// firstFrame, frameCount, ticksPerFrame, palette (in AnimationId order)")
+    for view, _ in views:
+        out.append("const AnimationClip %sClips [ANIM_COUNT] = {" % view)
+        for (clip_name, _, _, _), clip in zip(CLIPS, clips[view]):
+            out.append("\t{ %d, %d, %d, %d }, // %s" % (clip + (clip_name,)))
+        out.append("};")
+    out.append("")
+    out.append("// clips, mirrored (in SpriteFacing order); NULL clips means no art for")
+    out.append("// that facing, so the character keeps its current facing")
+    for character in CHARACTERS:
+        out.append("const FacingVariant %sFacings [FACE_COUNT] = {" % character)
+        out.append("\t{ %sClips, 0 }, // FACE_RIGHT" % character)
+        out.append("\t{ %sClips, 1 }, // FACE_LEFT" % character)
+        for facing, suffix in VERTICAL_VIEWS:
+            if character + suffix in clips:
+                out.append("\t{ %s%sClips, 0 }, // %s" % (character, suffix, facing))
+            else:
+                out.append("\t{ NULL, 0 }, // %s" % facing)
+        out.append("};")
+    out.append("")
+    out.append("// Facing tables in PlayerType order")
+    out.append("const FacingVariant * const characterFacings [] = { %s };"
+               % ", ".join("%sFacings" % c for c in CHARACTERS))
+    out.append("")
+    out.append("// Atlas: %d bytes (the separate RGB565 character images were %d bytes)"
+               % (len(data) + len(palette) * 2 * len(PALETTES), len(CHARACTERS) * dim * dim * 2))
+    out.append("")
+    out.append("#endif")
+
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(out) + "\n")
+    print("Wrote %s (%dx%d atlas, %d frames, %d unique)"
+          % (os.path.relpath(OUTPUT, ROOT), width, height, len(frames), len(unique)))
+
+
+if __name__ == "__main__":
+    main()
+elif "env" in globals():
+    main(force=False)
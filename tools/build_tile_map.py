@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+"""
+Builds the arena tile set and map (include/game_tile_map.h).
+
+The map is drawn as text in tools/maps/arena.txt, one character per tile:
+
+    .  floor        #  wall (solid)     o  rock (solid)     ,  grass
+    S  server spawn C  client spawn     (both on floor)
+
+It is converted into the compact binary format read by loadTileMap() in
+include/tile_map.h (little-endian):
+
+    0   "TMAP"
+    4   uint8   version (1)
+    5   uint8   tile size in pixels
+    6   uint16  width in tiles
+    8   uint16  height in tiles
+    10  uint16  solid mask, bit n set = tile type n blocks movement
+    12  uint8   spawn count, followed by uint16 x, uint16 y per spawn
+            (world pixels, centre of the spawn tile)
+    ..  uint16  number of RLE bytes, followed by the RLE bytes:
+            high nibble = run length - 1, low nibble = tile type
+
+The tile graphics are generated here as well: one 4-bit indexed strip with
+a tile per type, plus a darkened copy of its palette used for tiles under
+the fog of war (same pixels, different LUT).
+
+Usage:
+    python3 tools/build_tile_map.py
+
+Also runs as a PlatformIO pre-build script (see platformio.ini), in which
+case the header is only regenerated when the inputs changed.
+"""
+import os
+import random
+import struct
+import sys
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO/SCons)
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+sys.path.insert(0, os.path.join(ROOT, "tools"))
+import convert_indexed_sprites as indexed  # noqa: E402
+
+SOURCE = os.path.join(ROOT, "tools", "maps", "arena.txt")
+OUTPUT = os.path.join(ROOT, "include", "game_tile_map.h")
+
+TILE_SIZE = 16
+FORMAT_VERSION = 1
+
+# Tile types in TileType order: (enum name, map characters, solid)
+TILE_TYPES = [
+    ("TILE_FLOOR", ".SC", False),
+    ("TILE_WALL", "#", True),
+    ("TILE_ROCK", "o", True),
+    ("TILE_GRASS", ",", False),
+]
+
+# Spawn markers in MapSpawn order
+SPAWNS = ["S", "C"]
+
+# Shared tile set palette (RGB565); index 0 is unused by the tiles
+PALETTE = [
+    0x0000,
+    0x2104,  # floor
+    0x3186,  # floor speck
+    0x8a22,  # brick
+    0x4a49,  # mortar
+    0x6b4d,  # rock
+    0x39c7,  # rock shadow
+    0x9cd3,  # rock highlight
+    0x0240,  # grass
+    0x0be3,  # grass blade
+]
+FLOOR, SPECK, BRICK, MORTAR, ROCK, SHADOW, HIGHLIGHT, GRASS, BLADE = range(1, 10)
+
+# Fogged tiles keep this fraction of their brightness
+FOG_BRIGHTNESS = 0.3
+
+
+def draw_floor(rng):
+    tile = [FLOOR] * (TILE_SIZE * TILE_SIZE)
+    for _ in range(6):
+        tile[rng.randrange(TILE_SIZE * TILE_SIZE)] = SPECK
+    return tile
+
+
+def draw_wall(rng):
+    tile = []
+    for y in range(TILE_SIZE):
+        offset = 0 if (y // 4) % 2 == 0 else 4
+        for x in range(TILE_SIZE):
+            mortar = y % 4 == 3 or (x + offset) % 8 == 7
+            tile.append(MORTAR if mortar else BRICK)
+    return tile
+
+
+def draw_rock(rng):
+    tile = []
+    centre = (TILE_SIZE - 1) / 2.0
+    radius = TILE_SIZE / 2.0 - 1
+    for y in range(TILE_SIZE):
+        for x in range(TILE_SIZE):
+            dx, dy = x - centre, y - centre
+            if dx * dx + dy * dy > radius * radius:
+                tile.append(FLOOR)
+            elif dx + dy < -radius * 0.6:
+                tile.append(HIGHLIGHT)
+            elif dx + dy > radius * 0.6:
+                tile.append(SHADOW)
+            else:
+                tile.append(ROCK)
+    return tile
+
+
+def draw_grass(rng):
+    tile = [GRASS] * (TILE_SIZE * TILE_SIZE)
+    for _ in range(10):
+        x = rng.randrange(TILE_SIZE)
+        y = rng.randrange(2, TILE_SIZE)
+        tile[y * TILE_SIZE + x] = BLADE
+        tile[(y - 1) * TILE_SIZE + x] = BLADE
+    return tile
+
+
+TILE_ART = [draw_floor, draw_wall, draw_rock, draw_grass]
+
+
+def fog_colour(c):
+    r = int(((c >> 11) & 0x1F) * FOG_BRIGHTNESS)
+    g = int(((c >> 5) & 0x3F) * FOG_BRIGHTNESS)
+    b = int((c & 0x1F) * FOG_BRIGHTNESS)
+    return (r << 11) | (g << 5) | b
+
+
+def read_map(path):
+    with open(path) as f:
+        rows = [line.rstrip("\n") for line in f if line.strip()]
+    width = len(rows[0])
+    if any(len(row) != width for row in rows):
+        raise SystemExit("%s: all rows must have the same length" % path)
+    lookup = {}
+    for tile, (_, chars, _) in enumerate(TILE_TYPES):
+        for ch in chars:
+            lookup[ch] = tile
+    tiles = []
+    spawns = {}
+    for y, row in enumerate(rows):
+        for x, ch in enumerate(row):
+            if ch not in lookup:
+                raise SystemExit("%s:%d: unknown tile '%s'" % (path, y + 1, ch))
+            tiles.append(lookup[ch])
+            if ch in SPAWNS:
+                spawns[ch] = (x * TILE_SIZE + TILE_SIZE // 2, y * TILE_SIZE + TILE_SIZE // 2)
+    missing = [s for s in SPAWNS if s not in spawns]
+    if missing:
+        raise SystemExit("%s: missing spawn(s) %s" % (path, ", ".join(missing)))
+    return width, len(rows), tiles, [spawns[s] for s in SPAWNS]
+
+
+def rle(tiles):
+    out = []
+    i = 0
+    while i < len(tiles):
+        run = 1
+        while i + run < len(tiles) and tiles[i + run] == tiles[i] and run < 16:
+            run += 1
+        out.append(((run - 1) << 4) | tiles[i])
+        i += run
+    return out
+
+
+def encode_map(width, height, tiles, spawns):
+    solid = 0
+    for tile, (_, _, is_solid) in enumerate(TILE_TYPES):
+        if is_solid:
+            solid |= 1 << tile
+    data = bytearray(b"TMAP")
+    data += struct.pack("<BBHHH", FORMAT_VERSION, TILE_SIZE, width, height, solid)
+    data += struct.pack("<B", len(spawns))
+    for x, y in spawns:
+        data += struct.pack("<HH", x, y)
+    runs = rle(tiles)
+    data += struct.pack("<H", len(runs))
+    data += bytes(runs)
+    return data
+
+
+def main(force=True):
+    if not force and indexed.up_to_date(OUTPUT, [SOURCE, os.path.abspath(__file__)]):
+        return
+    width, height, tiles, spawns = read_map(SOURCE)
+    blob = encode_map(width, height, tiles, spawns)
+
+    # Tile set: all tiles side by side in one strip
+    rng = random.Random(425)
+    art = [draw(rng) for draw in TILE_ART]
+    strip_w = TILE_SIZE * len(art)
+    strip = []
+    for y in range(TILE_SIZE):
+        for tile in art:
+            strip.extend(tile[y * TILE_SIZE:(y + 1) * TILE_SIZE])
+    # The art already holds palette indices, so pack them through an identity palette
+    identity = list(range(len(PALETTE)))
+    data, stride = indexed.pack(strip, identity, strip_w, TILE_SIZE, 4)
+
+    out = []
+    out.append("#ifndef GAME_TILE_MAP_H")
+    out.append("#define GAME_TILE_MAP_H")
+    out.append("/////////////////////////////////////////////////////////////////////////////")
+    out.append("// GENERATED by tools/build_tile_map.py from tools/maps/arena.txt.")
+    out.append("// Do not edit by hand; re-run the script after changing the map.")
+    out.append("/////////////////////////////////////////////////////////////////////////////")
+    out.append('#include "indexed_sprite.h"')
+    out.append("")
+    out.append("// Tile types, in tile set order")
+    out.append("enum TileType { %s, TILE_TYPE_COUNT };" % ", ".join(name for name, _, _ in TILE_TYPES))
+    out.append("")
+    out.append("// Spawn points in the map, in spawn table order")
+    out.append("enum MapSpawn { SPAWN_SERVER, SPAWN_CLIENT, SPAWN_COUNT };")
+    out.append("")
+    out.append("const int TILESET_TILE_SIZE = %d;" % TILE_SIZE)
+    out.append("const int TILESET_PALETTE_SIZE = %d;" % len(PALETTE))
+    out.append("const uint16_t tilesetPalette [] PROGMEM = {")
+    out.append("\t" + ", ".join("0x%04x" % c for c in PALETTE))
+    out.append("};")
+    out.append("// Same colours at %d%% brightness, for tiles under the fog" % int(FOG_BRIGHTNESS * 100))
+    out.append("const uint16_t tilesetFogPalette [] PROGMEM = {")
+    out.append("\t" + ", ".join("0x%04x" % fog_colour(c) for c in PALETTE))
+    out.append("};")
+    out.append("")
+    out.append("// %dx%dpx, %d tiles, 4bpp" % (strip_w, TILE_SIZE, len(art)))
+    out.append("const uint8_t tilesetIndices [] PROGMEM = {")
+    out.append(indexed.emit_bytes(data))
+    out.append("};")
+    out.append("const IndexedSprite tilesetSprite = { %d, %d, 4, %d, %d, tilesetPalette, tilesetIndices };"
+               % (strip_w, TILE_SIZE, stride, len(PALETTE)))
+    out.append("")
+    out.append("// Arena: %dx%d tiles (%dx%dpx), %d bytes as a map file (%d tiles)"
+               % (width, height, width * TILE_SIZE, height * TILE_SIZE, len(blob), width * height))
+    out.append("const uint8_t arenaMapData [] PROGMEM = {")
+    out.append(indexed.emit_bytes(list(blob)))
+    out.append("};")
+    out.append("const uint32_t arenaMapSize = %d;" % len(blob))
+    out.append("")
+    out.append("#endif")
+
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(out) + "\n")
+    print("Wrote %s (%dx%d tiles, %d byte map)" % (os.path.relpath(OUTPUT, ROOT), width, height, len(blob)))
+
+
+if __name__ == "__main__":
+    main()
+elif "env" in globals():
+    main(force=False)
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""
+Converts the RGB565 image arrays in include/game_image_bitmaps.h into the
+palette-indexed format described in include/indexed_sprite.h and writes
+include/game_indexed_bitmaps.h.
+
+game_image_bitmaps.h stays the source asset (it is what image2cpp produces);
+the firmware only includes the generated header.
+
+Usage:
+    python3 tools/convert_indexed_sprites.py
+
+Also runs as a PlatformIO pre-build script (see platformio.ini), in which
+case the header is only regenerated when the source images changed.
+"""
+import os
+import re
+import sys
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO/SCons)
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SOURCE = os.path.join(ROOT, "include", "game_image_bitmaps.h")
+OUTPUT = os.path.join(ROOT, "include", "game_indexed_bitmaps.h")
+
+# Transparent key colour in the source images (black is never drawn)
+TRANSPARENT = 0x0000
+
+# The characters are packed into the animation atlas by build_sprite_atlas.py
+# instead of being converted on their own
+SKIP = ["dragon", "princess"]
+
+
+def read_images(path):
+    """Returns [(name, [rgb565, ...])] in the order they appear in the header."""
+    text = open(path).read()
+    dim = int(re.search(r"const int imgSqDim = (\d+);", text).group(1))
+    images = []
+    for m in re.finditer(r"const uint16_t (\w+) \[\] PROGMEM = \{(.*?)\};", text, re.S):
+        pixels = [int(v, 16) for v in re.findall(r"0x[0-9a-fA-F]{4}", m.group(2))]
+        if len(pixels) != dim * dim:
+            sys.exit("%s: expected %d pixels, found %d" % (m.group(1), dim * dim, len(pixels)))
+        images.append((m.group(1), pixels))
+    return dim, images
+
+
+def build_palette(name, pixels):
+    """Index 0 is always the transparent key; the rest in order of first use."""
+    palette = [TRANSPARENT]
+    for p in pixels:
+        if p not in palette:
+            palette.append(p)
+    if len(palette) > 256:
+        sys.exit("%s uses %d colours; reduce it below 256 before converting" % (name, len(palette)))
+    return palette
+
+
+def pack(pixels, palette, width, height, bpp):
+    lookup = {c: i for i, c in enumerate(palette)}
+    indices = [lookup[p] for p in pixels]
+    if bpp == 8:
+        return indices, width
+    stride = (width + 1) // 2
+    data = []
+    for y in range(height):
+        row = indices[y * width:(y + 1) * width]
+        if width & 1:
+            row.append(0)
+        for x in range(0, len(row), 2):
+            data.append((row[x] << 4) | row[x + 1])
+    return data, stride
+
+
+def emit_bytes(data, per_line=16):
+    lines = []
+    for i in range(0, len(data), per_line):
+        lines.append("\t" + ", ".join("0x%02x" % b for b in data[i:i + per_line]) + ",")
+    return "\n".join(lines)
+
+
+def up_to_date(output, sources):
+    if not os.path.exists(output):
+        return False
+    built = os.path.getmtime(output)
+    return all(os.path.getmtime(src) <= built for src in sources)
+
+
+def main(force=True):
+    if not force and up_to_date(OUTPUT, [SOURCE]):
+        return
+    dim, images = read_images(SOURCE)
+    images = [(name, pixels) for name, pixels in images if name not in SKIP]
+    out = []
+    out.append("#ifndef GAME_INDEXED_BITMAPS_H")
+    out.append("#define GAME_INDEXED_BITMAPS_H")
+    out.append("/////////////////////////////////////////////////////////////////////////////")
+    out.append("// GENERATED by tools/convert_indexed_sprites.py from game_image_bitmaps.h.")
+    out.append("// Do not edit by hand; re-run the script after changing the source images.")
+    out.append("/////////////////////////////////////////////////////////////////////////////")
+    out.append('#include "indexed_sprite.h"')
+    out.append("")
+    out.append("const int indexedImgSqDim = %d;" % dim)
+    out.append("")
+
+    total_rgb = 0
+    total_indexed = 0
+    for name, pixels in images:
+        palette = build_palette(name, pixels)
+        bpp = 4 if len(palette) <= 16 else 8
+        data, stride = pack(pixels, palette, dim, dim, bpp)
+        total_rgb += dim * dim * 2
+        total_indexed += len(data) + len(palette) * 2
+
+        out.append("// '%s', %dx%dpx, %d colours, %dbpp" % (name, dim, dim, len(palette), bpp))
+        out.append("const uint16_t %sPalette [] PROGMEM = {" % name)
+        out.append("\t" + ", ".join("0x%04x" % c for c in palette))
+        out.append("};")
+        out.append("const uint8_t %sIndices [] PROGMEM = {" % name)
+        out.append(emit_bytes(data))
+        out.append("};")
+        out.append("const IndexedSprite %sSprite = { %d, %d, %d, %d, %d, %sPalette, %sIndices };"
+                   % (name, dim, dim, bpp, stride, len(palette), name, name))
+        out.append("")
+
+    out.append("// RGB565: %d bytes, indexed: %d bytes" % (total_rgb, total_indexed))
+    out.append("")
+    out.append("/////////////////////////////////////////////////////////////////")
+    out.append("// Looks up an indexed sprite by the same icon names that")
+    out.append("// getIconBitmap() accepted")
+    out.append("/////////////////////////////////////////////////////////////////")
+    out.append("inline const IndexedSprite * getIndexedSprite(const char *iconId) {")
+    for i, (name, _) in enumerate(images):
+        keyword = "if" if i == 0 else "} else if"
+        out.append('    %s (strncmp(iconId, "%s", %d) == 0) {' % (keyword, name, len(name)))
+        out.append("        return &%sSprite;" % name)
+    out.append("    }")
+    out.append("    return NULL;")
+    out.append("}")
+    out.append("")
+    out.append("#endif")
+
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(out) + "\n")
+    print("Wrote %s (%d -> %d bytes)" % (os.path.relpath(OUTPUT, ROOT), total_rgb, total_indexed))
+
+
+if __name__ == "__main__":
+    main()
+elif "env" in globals():
+    main(force=False)
@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+"""
+Prints the firmware's binary log (include/binary_log.h) as text.
+
+The log task writes each record as a frame instead of a line:
+
+    0   uint8   0xA5
+    1   uint8   site, the entry's index in LOG_SITES
+    2   uint8   records of the site held back by its rate limit just before
+    3   uint8   argument count
+    4   uint32  millis() when it was logged (little-endian)
+    8   ...     arguments, each a zigzag LEB128 varint
+    n   uint8   xor of all the bytes before
+
+The format strings are read out of LOG_SITES in binary_log.h, so the
+firmware and this tool have to come from the same tree. %{a|b|c} prints
+the choice the argument indexes; %d, %u and %x are printf's. A %h site
+logs bytes instead of arguments (0x80 set in the count, the low six bits
+how many, 0x40 if another part follows; byte 2 numbers the parts), and
+its parts come out as one line of hex after the prefix. Those are the
+telemetry and match lines the other tools read, so the output can go on
+into them; text the firmware still prints as lines (setup) passes through
+as it is:
+
+    python3 tools/decode_log.py /dev/ttyUSB0 | python3 tools/link_telemetry.py
+    python3 tools/decode_log.py < serial.bin | /tmp/replay_match
+
+Usage:
+    python3 tools/decode_log.py /dev/ttyUSB0     (needs pyserial)
+    python3 tools/decode_log.py < serial.bin
+"""
+import os
+import re
+import sys
+
+FRAME_SYNC = 0xA5
+FRAME_HEADER = 8
+MAX_ARGS = 7
+BYTES = 0x80
+BYTES_MORE = 0x40
+BYTES_COUNT = 0x3F
+BYTES_MAX = MAX_ARGS * 4
+FRAME_MAX = FRAME_HEADER + MAX_ARGS * 5 + 1
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "include", "binary_log.h")
+SITE_LINE = re.compile(r'^\s*X\((\w+),\s*(\w+),\s*(\d+),\s*"(.*)"\)')
+FORMAT_TOKEN = re.compile(r"%(\{[^}]*\}|%|h|-?\d*[dux])")
+
+
+def load_sites(path=HEADER):
+    """Returns (name, format) for every log site, in site order."""
+    sites = []
+    with open(path) as header:
+        for line in header:
+            match = SITE_LINE.match(line)
+            if match:
+                sites.append((match.group(1), match.group(4)))
+    return sites
+
+
+def parse_frame(raw):
+    """Returns (length, record) for a frame at the start of raw, (0, None)
+    if more bytes are needed or (-1, None) if it isn't a frame."""
+    if len(raw) < FRAME_HEADER + 1:
+        return 0, None
+    site, suppressed, argc = raw[1], raw[2], raw[3]
+    if argc & BYTES:
+        count = argc & BYTES_COUNT
+        if count > BYTES_MAX:
+            return -1, None
+    elif argc > MAX_ARGS:
+        return -1, None
+    ms = int.from_bytes(raw[4:8], "little")
+    args = []
+    at = FRAME_HEADER
+    if argc & BYTES:
+        if at + count >= len(raw):
+            return 0, None
+        args = bytes(raw[at:at + count])
+        at += count
+        argc = 0
+    for _ in range(argc):
+        value = shift = 0
+        while True:
+            if at >= len(raw):
+                return 0, None
+            if shift > 28:
+                return -1, None
+            byte = raw[at]
+            at += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        args.append((value >> 1) ^ -(value & 1))
+    if at >= len(raw):
+        return 0, None
+    check = 0
+    for byte in raw[:at]:
+        check ^= byte
+    if check != raw[at]:
+        return -1, None
+    return at + 1, (ms, site, suppressed, args)
+
+
+def format_record(sites, record):
+    ms, site, suppressed, args = record
+    if site >= len(sites):
+        return "%10.3f unknown site %d %s" % (ms / 1000.0, site, list(args))
+    name, fmt = sites[site]
+    remaining = list(args)
+
+    def substitute(match):
+        token = match.group(1)
+        if token == "%":
+            return "%"
+        if token == "h":
+            return bytes(args).hex()
+        value = remaining.pop(0) if remaining else 0
+        if token.startswith("{"):
+            choices = token[1:-1].split("|")
+            return choices[value] if 0 <= value < len(choices) else str(value)
+        if token[-1] in "ux":
+            value &= 0xFFFFFFFF
+        return ("%" + token) % value
+
+    line = "%10.3f %s" % (ms / 1000.0, FORMAT_TOKEN.sub(substitute, fmt))
+    if suppressed:
+        line += " (+%d suppressed)" % suppressed
+    return line
+
+
+def join_parts(parts, raw, record):
+    """Collects the parts of a bytes record; returns the whole record once
+    its last part is in, None before that or if a part went missing."""
+    ms, site, part, data = record
+    if part == 0:
+        parts[site] = (0, bytearray())
+    expected = parts.get(site)
+    if expected is None or expected[0] != part:
+        parts.pop(site, None)
+        return None
+    expected[1].extend(data)
+    if raw[3] & BYTES_MORE:
+        parts[site] = (part + 1, expected[1])
+        return None
+    del parts[site]
+    return (ms, site, 0, bytes(expected[1]))
+
+
+def follow(chunks, sites, out=sys.stdout):
+    """Splits the byte stream into frames and text lines and prints both."""
+    pending = bytearray()
+    text = bytearray()
+    parts = {}
+    for chunk in chunks:
+        if not chunk:
+            continue
+        pending += chunk
+        at = 0
+        while at < len(pending):
+            byte = pending[at]
+            if byte == FRAME_SYNC:
+                length, record = parse_frame(pending[at:at + FRAME_MAX])
+                if length == 0 and len(pending) - at < FRAME_MAX:
+                    break           # wait for the rest of the frame
+                if length > 0:
+                    if pending[at + 3] & BYTES:
+                        record = join_parts(parts, pending[at:at + length], record)
+                    if record is not None:
+                        out.write(format_record(sites, record) + "\n")
+                    at += length
+                    continue
+            at += 1
+            if byte == ord("\n"):
+                out.write(text.decode("ascii", "replace").rstrip("\r") + "\n")
+                text.clear()
+            else:
+                text.append(byte)
+        del pending[:at]
+        out.flush()
+    if text:
+        out.write(text.decode("ascii", "replace") + "\n")
+
+
+def main(argv):
+    sites = load_sites()
+    if not sites:
+        sys.exit("no LOG_SITES found in %s" % HEADER)
+    if argv:
+        import serial  # pyserial, only needed for a live port
+        with serial.Serial(argv[0], 115200, timeout=0.1) as port:
+            try:
+                follow(iter(lambda: port.read(port.in_waiting or 1), None), sites)
+            except KeyboardInterrupt:
+                pass
+        return 0
+    stdin = sys.stdin.buffer
+    follow(iter(lambda: stdin.read1(4096) if hasattr(stdin, "read1") else stdin.read(4096), b""), sites)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
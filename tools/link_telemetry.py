@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""
+Decodes the link telemetry records (include/link_telemetry.h).
+
+Both roles log a record every few seconds, which tools/decode_log.py
+prints as a line of hex:
+
+    telemetry: 0120...
+
+and the server also keeps the latest one on its telemetry characteristic
+(9e6d2b7a-1c84-4f3e-b5a0-68d4c2e91f07), so the same bytes can be read from
+a phone or any BLE tool and pasted in with --hex. Record layout
+(little-endian):
+
+    0   uint8   version (1)
+    1   uint8   round trips in the window
+    2   uint16  rtt p50, p90, p99, max (ms)
+    10  uint32  pings sent, replies received
+    18  uint32  notifications sent, failed
+    26  uint32  bytes sent, received
+    34  uint32  snapshots received, lost
+
+Each record is printed as one line, with the rates worked out from the
+record before it (drops, bytes per second) so rubber-banding reports can be
+lined up with what the link was doing at the time.
+
+Usage:
+    python3 tools/decode_log.py /dev/ttyUSB0 | python3 tools/link_telemetry.py
+    python3 tools/link_telemetry.py < serial.log     (decoded)
+    python3 tools/link_telemetry.py --hex 0120...
+"""
+import struct
+import sys
+import time
+
+TELEMETRY_VERSION = 1
+RECORD_FORMAT = "<BB4H8I"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+FIELDS = ("version", "samples", "p50", "p90", "p99", "max",
+          "pings", "replies", "notify_ok", "notify_failed",
+          "bytes_sent", "bytes_received", "snapshots", "lost")
+PREFIX = "telemetry: "
+
+
+def decode(hex_text):
+    """Returns the record as a dict, or None if it isn't one we know."""
+    try:
+        raw = bytes.fromhex(hex_text.strip())
+    except ValueError:
+        return None
+    if len(raw) != RECORD_SIZE or raw[0] != TELEMETRY_VERSION:
+        return None
+    return dict(zip(FIELDS, struct.unpack(RECORD_FORMAT, raw)))
+
+
+def describe(record, previous, seconds):
+    line = "rtt p50 %4d p90 %4d p99 %4d max %4d ms (%2d samples)" % (
+        record["p50"], record["p90"], record["p99"], record["max"], record["samples"])
+    line += ", pings %d/%d" % (record["replies"], record["pings"])
+    line += ", notify %d ok %d failed" % (record["notify_ok"], record["notify_failed"])
+    if previous is not None and seconds > 0:
+        snapshots = record["snapshots"] - previous["snapshots"]
+        lost = record["lost"] - previous["lost"]
+        total = snapshots + lost
+        line += ", dropped %d%%" % (lost * 100 // total if total else 0)
+        line += ", %d B/s out %d B/s in" % (
+            (record["bytes_sent"] - previous["bytes_sent"]) / seconds,
+            (record["bytes_received"] - previous["bytes_received"]) / seconds)
+    return line
+
+
+def follow(lines):
+    previous = None
+    previous_time = None
+    for line in lines:
+        if isinstance(line, bytes):
+            line = line.decode("ascii", "replace")
+        at = line.find(PREFIX)
+        if at < 0:
+            continue
+        record = decode(line[at + len(PREFIX):])
+        if record is None:
+            print("undecodable record: %s" % line.strip())
+            continue
+        now = time.time()
+        # Logs come in every few seconds; a file read at once has no clock
+        seconds = (now - previous_time) if previous_time is not None else 0
+        if seconds < 0.5:
+            seconds = 5.0
+        print(time.strftime("%H:%M:%S ") + describe(record, previous, seconds))
+        sys.stdout.flush()
+        previous = record
+        previous_time = now
+
+
+def main(argv):
+    if len(argv) >= 2 and argv[0] == "--hex":
+        record = decode(argv[1])
+        if record is None:
+            print("not a version %d record of %d bytes" % (TELEMETRY_VERSION, RECORD_SIZE))
+            return 1
+        print(describe(record, None, 0))
+        return 0
+    if argv:
+        import serial  # pyserial, only needed for a live port
+        with serial.Serial(argv[0], 115200, timeout=1) as port:
+            follow(iter(port.readline, None))
+        return 0
+    follow(sys.stdin)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
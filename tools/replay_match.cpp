@@ -0,0 +1,127 @@
+/////////////////////////////////////////////////////////////////////////////
+// Replays the matches recorded by the devices (include/match_record.h).
+//
+// At the end of every game each role logs its recording, which
+// tools/decode_log.py prints between "match begin" and "match end" lines.
+// This reads such a log, re-runs every match in it through the game code
+// the devices run and reports whether each recorded state hash came out
+// the same, how the game ended, and how long the replay took per tick.
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/replay_match tools/replay_match.cpp
+//     python3 tools/decode_log.py < serial.bin > serial.log
+//     /tmp/replay_match < serial.log
+//     /tmp/replay_match --trace < serial.log     (one line per tick)
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../include/match_record.h"
+#include "../include/game_tile_map.h"
+
+static const char *eventNames[EV_EVENT_COUNT] = {
+    "connected", "disconnected", "tutorial opened", "tutorial closed", "start", "remote start",
+    "caught", "time up", "remote caught", "remote time up", "play again"
+};
+
+static uint8_t data[MATCH_RECORD_SIZE];
+static bool trace = false;
+
+static void traceTick(const MatchSim &sim) {
+    if (trace) {
+        printf("  tick %5lu  x %4d y %4d  vx %5d vy %5d  stick %4d %4d  opponent %4d %4d\n",
+               (unsigned long)sim.tick, kinToPixels(sim.body.x), kinToPixels(sim.body.y),
+               (int)sim.body.vx, (int)sim.body.vy, sim.moveX, sim.moveY, sim.opponentX, sim.opponentY);
+    }
+}
+
+static void reportCheck(const MatchSim &sim, uint32_t recorded, uint32_t replayed, uint32_t remainingMs) {
+    if (recorded != replayed || trace) {
+        printf("  check at tick %lu: %08lx recorded, %08lx replayed%s (%lu.%lu s left)\n",
+               (unsigned long)sim.tick, (unsigned long)recorded, (unsigned long)replayed,
+               recorded != replayed ? " MISMATCH" : "", (unsigned long)(remainingMs / 1000),
+               (unsigned long)(remainingMs % 1000 / 100));
+    }
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool replay(const TileMap &map, uint32_t length, int number) {
+    MatchSim sim;
+    clock_t start = clock();
+    MatchReplayResult result = replayMatch(data, length, map, sim, traceTick, reportCheck);
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("match %d: %s, %s vs %s, %lu bytes, %lu ticks (%lu.%02lu s)\n", number,
+           sim.role == MATCH_ROLE_SERVER ? "server" : "client",
+           sim.character == 0 ? "princess" : "dragon", sim.opponent == 0 ? "princess" : "dragon",
+           (unsigned long)length, (unsigned long)result.ticks,
+           (unsigned long)(result.ticks * SIM_TICK_MS / 1000), (unsigned long)(result.ticks * SIM_TICK_MS % 1000 / 10));
+    printf("  %lu checks, %lu mismatched", (unsigned long)result.checks, (unsigned long)result.mismatches);
+    if (result.mismatches) {
+        printf(", first at tick %lu", (unsigned long)result.firstMismatchTick);
+    }
+    printf("\n");
+    if (result.ends) {
+        printf("  ended by %s on tick %lu%s", result.endEvent < EV_EVENT_COUNT ? eventNames[result.endEvent] : "?",
+               (unsigned long)sim.tick, result.caughtOnReplay ? ", sprites overlap" : "");
+        if (result.endEvent == EV_CAUGHT && !result.caughtOnReplay) {
+            printf(" (but they don't on the replay)");
+        }
+        printf("\n");
+        if (result.ends > 1) {
+            printf("  ENDED %lu TIMES\n", (unsigned long)result.ends);
+        }
+    } else {
+        printf("  no end recorded (recording full or cut short)\n");
+    }
+    if (!result.complete) {
+        printf("  stopped at an entry that doesn't add up\n");
+    }
+    if (result.ticks) {
+        printf("  replay took %.1f us per tick\n", seconds * 1e6 / result.ticks);
+    }
+    return result.complete && result.mismatches == 0;
+}
+
+int main(int argc, char **argv) {
+    trace = argc > 1 && strcmp(argv[1], "--trace") == 0;
+    TileMap map;
+    if (!loadTileMap(arenaMapData, arenaMapSize, map)) {
+        printf("arena map is invalid\n");
+        return 1;
+    }
+
+    char line[512];
+    bool inMatch = false;
+    uint32_t length = 0;
+    int matches = 0, failed = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        if (strstr(line, "match begin")) {
+            inMatch = true;
+            length = 0;
+        } else if (inMatch && strstr(line, "match end")) {
+            inMatch = false;
+            failed += !replay(map, length, ++matches);
+        } else if (inMatch) {
+            const char *hex = strstr(line, "match: ");
+            if (!hex) {
+                continue;   // other log lines in between
+            }
+            for (hex += 7; hexValue(hex[0]) >= 0 && hexValue(hex[1]) >= 0 && length < MATCH_RECORD_SIZE; hex += 2) {
+                data[length++] = (uint8_t)(hexValue(hex[0]) << 4 | hexValue(hex[1]));
+            }
+        }
+    }
+    if (matches == 0) {
+        printf("no recorded match in the log\n");
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
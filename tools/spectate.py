@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""
+Watches a match as a spectator (include/spectator_feed.h).
+
+Any central that connects to the server after the other player is a
+spectator. It subscribes to the spectator characteristic
+(2a8f6c31-e4b7-4d92-8c05-b1d7e3a96f48) and gets frames of at most 20 bytes:
+
+    0   uint8   version (1) << 4 | flags (0x01 keyframe)
+    1   uint8   sequence number
+    2   uint8   changed: a bit per field present, in field order
+    3   uint8   short: a bit per 16 bit field sent as a one byte difference
+    4   ...     the fields present, in order
+
+    state       uint8   game state | server character << 4 | client character << 6
+    server x/y  int16   world pixels
+    client x/y  int16
+    timer       uint16  tenths of a second left
+    powerups    uint8   left: server's << 4 | client's
+    active      uint8   bit 0 the server's powerup, bit 1 the client's
+
+A field that isn't present is the same as in the frame before; a keyframe
+(every second) has them all. A delta after a lost frame can't be decoded,
+so the view waits for the next keyframe. Each frame decoded is printed as
+one line.
+
+Without an address, the scan takes the first server whose advertising
+data (include/match_beacon.h) says a game has a player and room to watch,
+so the spectator never takes the player's slot.
+
+Usage:
+    python3 tools/spectate.py                   (needs bleak)
+    python3 tools/spectate.py --address AA:BB:CC:DD:EE:FF
+    python3 tools/spectate.py --hex 1100ff00... 1101...
+"""
+import asyncio
+import struct
+import sys
+
+SPECTATOR_VERSION = 1
+SPECTATOR_KEYFRAME = 0x01
+SERVER_NAME = "Princess of Fire"
+SPECTATOR_UUID = "2a8f6c31-e4b7-4d92-8c05-b1d7e3a96f48"
+BEACON_COMPANY = 0xFFFF
+BEACON_MAGIC = 0xF1
+BEACON_VERSION = 1
+
+# name, 16 bit, signed; in SpectatorField order
+FIELDS = (("state", False, False),
+          ("server_x", True, True), ("server_y", True, True),
+          ("client_x", True, True), ("client_y", True, True),
+          ("timer", True, False),
+          ("powerups_left", False, False),
+          ("powerups_active", False, False))
+STATES = ("waiting", "player select", "tutorial", "game", "game over")
+CHARACTERS = ("?", "princess", "dragon", "unchosen")
+
+
+def wrap(value, signed):
+    value &= 0xFFFF
+    return value - 0x10000 if signed and value >= 0x8000 else value
+
+
+class View:
+    """The match as the frames so far tell it, like SpectatorView."""
+
+    def __init__(self):
+        self.fields = None
+        self.last_seq = None
+        self.received = self.missed = self.skipped = self.malformed = 0
+
+    def read(self, raw):
+        """Takes in a frame; returns the fields if it could be decoded."""
+        if len(raw) < 4 or raw[0] >> 4 != SPECTATOR_VERSION:
+            self.malformed += 1
+            return None
+        keyframe = raw[0] & SPECTATOR_KEYFRAME
+        seq = raw[1]
+        follows = self.fields is not None and seq == (self.last_seq + 1) & 0xFF
+        if self.last_seq is not None:
+            self.missed += (seq - self.last_seq - 1) & 0xFF
+        self.received += 1
+        self.last_seq = seq
+        if not keyframe and not follows:
+            self.fields = None
+            self.skipped += 1
+            return None
+        fields = self.decode(raw[2:], None if keyframe else self.fields)
+        if fields is None:
+            self.malformed += 1
+        self.fields = fields
+        return fields
+
+    @staticmethod
+    def decode(raw, base):
+        changed, short = raw[0], raw[1]
+        if (base is None and changed != 0xFF) or short & ~changed:
+            return None
+        fields = []
+        at = 2
+        for f, (_, wide, signed) in enumerate(FIELDS):
+            if not changed & (1 << f):
+                fields.append(base[f])
+            elif not wide:
+                if at + 1 > len(raw):
+                    return None
+                fields.append(raw[at])
+                at += 1
+            elif short & (1 << f):
+                if at + 1 > len(raw):
+                    return None
+                fields.append(wrap(base[f] + struct.unpack_from("<b", raw, at)[0], signed))
+                at += 1
+            else:
+                if at + 2 > len(raw):
+                    return None
+                fields.append(wrap(struct.unpack_from("<H", raw, at)[0], False) if not signed
+                              else struct.unpack_from("<h", raw, at)[0])
+                at += 2
+        return fields if at == len(raw) else None
+
+
+def describe(fields):
+    state, sx, sy, cx, cy, timer, left, active = fields
+    game = state & 0x0F
+    line = "%-13s" % (STATES[game] if game < len(STATES) else game)
+    line += " server %-8s (%4d, %4d)" % (CHARACTERS[state >> 4 & 3], sx, sy)
+    line += " client %-8s (%4d, %4d)" % (CHARACTERS[state >> 6 & 3], cx, cy)
+    line += " %5.1f s" % (timer / 10.0)
+    line += " powerups %d%s/%d%s" % (left >> 4, "*" if active & 1 else "",
+                                      left & 0x0F, "*" if active & 2 else "")
+    return line
+
+
+def watchable(advertisement):
+    """True if a server's beacon says there is a game to watch and room to."""
+    data = advertisement.manufacturer_data.get(BEACON_COMPANY)
+    if data is None or len(data) != 4 or data[0] != BEACON_MAGIC or data[1] >> 4 != BEACON_VERSION:
+        return False
+    free_players, free_spectators = data[3] & 0x0F, data[3] >> 4
+    return free_players == 0 and free_spectators > 0
+
+
+def show(view, raw):
+    fields = view.read(raw)
+    if fields is not None:
+        print(describe(fields))
+    elif view.fields is None and view.malformed == 0:
+        print("(waiting for a keyframe)")
+
+
+async def watch(address):
+    from bleak import BleakClient, BleakScanner
+    if address is None:
+        print("Looking for a game of %s to watch..." % SERVER_NAME)
+        device = await BleakScanner.find_device_by_filter(lambda _, adv: watchable(adv), timeout=20.0)
+        if device is None:
+            sys.exit("no server found")
+        address = device.address
+    view = View()
+    async with BleakClient(address) as client:
+        print("Watching %s" % address)
+        await client.start_notify(SPECTATOR_UUID, lambda _, data: show(view, bytes(data)))
+        try:
+            while client.is_connected:
+                await asyncio.sleep(1.0)
+        finally:
+            print("%d frames, %d missed, %d skipped, %d malformed" %
+                  (view.received, view.missed, view.skipped, view.malformed))
+
+
+def main():
+    args = sys.argv[1:]
+    if args and args[0] == "--hex":
+        view = View()
+        for text in args[1:]:
+            try:
+                show(view, bytes.fromhex(text))
+            except ValueError:
+                print("not hex: %s" % text)
+        return
+    address = None
+    if len(args) == 2 and args[0] == "--address":
+        address = args[1]
+    elif args:
+        sys.exit(__doc__)
+    try:
+        asyncio.run(watch(address))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
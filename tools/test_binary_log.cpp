@@ -0,0 +1,233 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the binary log (include/binary_log.h).
+//
+// Sites below the log level must never be queued, a rate limited site must
+// log once per interval and say how many it held back, and every record
+// must come back out of its frame the same while a damaged frame is
+// refused; bytes longer than a record go out in numbered parts. Several
+// threads logging at once stand in for loop, the BLE callbacks and the
+// render task: every record has to reach the drain exactly once or be
+// counted as dropped. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -pthread -o /tmp/test_binary_log tools/test_binary_log.cpp
+//     /tmp/test_binary_log
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "../include/binary_log.h"
+
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+// Decodes every frame in `bytes`; false if any doesn't decode
+static bool decodeAll(const uint8_t *bytes, size_t length, std::vector<LogRecord> &records) {
+    size_t at = 0;
+    while (at < length) {
+        LogRecord record;
+        size_t frame = decodeLogRecord(bytes + at, length - at, record);
+        if (frame == 0) {
+            return false;
+        }
+        records.push_back(record);
+        at += frame;
+    }
+    return true;
+}
+
+static bool drainAll(BinaryLog &log, uint32_t now, std::vector<LogRecord> &records) {
+    uint8_t out[256];
+    size_t length;
+    while ((length = drainBinaryLog(log, now, out, sizeof(out))) > 0) {
+        if (!decodeAll(out, length, records)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    // Levels: a debug site is compiled out at the default level
+    {
+        static BinaryLog log;
+        expect("debug site off", !logSiteEnabled(LOG_CHARACTERISTIC_READ));
+        expect("debug site not queued", !logRecord(log, LOG_CHARACTERISTIC_READ, 0, 1));
+        expect("info site queued", logRecord(log, LOG_DEVICE_CONNECTED, 0));
+        std::vector<LogRecord> records;
+        expect("drain decodes", drainAll(log, 0, records));
+        expect("one record", records.size() == 1 && records[0].site == LOG_DEVICE_CONNECTED);
+    }
+
+    // Rate limit: once a second, with the count held back
+    {
+        static BinaryLog log;
+        uint32_t queued = 0;
+        for (uint32_t ms = 0; ms < 3000; ms += 100) {
+            queued += logRecord(log, LOG_NOTIFY_FAILED, ms, 4, 3);
+        }
+        std::vector<LogRecord> records;
+        expect("rate limited drain decodes", drainAll(log, 3000, records));
+        expect("once per interval", queued == 3 && records.size() == 3);
+        expect("first says none held back", records.size() == 3 && records[0].suppressed == 0);
+        expect("later say 9 held back", records.size() == 3 && records[1].suppressed == 9 &&
+                                        records[2].suppressed == 9 && records[2].ms == 2000);
+    }
+
+    // Round trip, negative and large arguments included
+    {
+        LogRecord record;
+        record.ms = 0xDEADBEEF;
+        record.site = LOG_LINK_STATS;
+        record.suppressed = 255;
+        record.argc = LOG_MAX_ARGS;
+        const int32_t args[LOG_MAX_ARGS] = {0, 1, -1, 63, -64, INT32_MAX, INT32_MIN};
+        memcpy(record.args, args, sizeof(args));
+        uint8_t frame[LOG_FRAME_MAX + 1];
+        uint8_t length = encodeLogRecord(record, frame);
+        expect("frame fits", length <= LOG_FRAME_MAX);
+        LogRecord decoded;
+        expect("frame decodes", decodeLogRecord(frame, length, decoded) == length);
+        expect("record round trips", decoded.ms == record.ms && decoded.site == record.site &&
+                                     decoded.suppressed == record.suppressed && decoded.argc == record.argc &&
+                                     memcmp(decoded.args, record.args, sizeof(args)) == 0);
+
+        // Any single bit flipped after the sync byte, or the frame cut short, is refused
+        uint32_t accepted = 0;
+        for (uint8_t i = 1; i < length; i++) {
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                frame[i] ^= 1 << bit;
+                accepted += decodeLogRecord(frame, length, decoded) == length;
+                frame[i] ^= 1 << bit;
+            }
+        }
+        expect("damaged frame refused", accepted == 0);
+        expect("short frame refused", decodeLogRecord(frame, length - 1, decoded) == 0);
+    }
+
+    // Bytes: a telemetry-sized record goes out in numbered parts and comes back whole
+    {
+        static BinaryLog log;
+        uint8_t bytes[42];
+        for (uint8_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = (uint8_t)(i * 37) ^ LOG_FRAME_SYNC;
+        }
+        expect("bytes queued", logBytes(log, LOG_TELEMETRY, 500, bytes, sizeof(bytes)));
+        std::vector<LogRecord> records;
+        expect("bytes drain decodes", drainAll(log, 500, records));
+        expect("two parts", records.size() == 2 && records[0].suppressed == 0 && records[1].suppressed == 1);
+        expect("first part full, more follows",
+               records.size() == 2 && records[0].argc == (LOG_BYTES | LOG_BYTES_MORE | LOG_BYTES_MAX));
+        expect("last part the rest", records.size() == 2 && records[1].argc == (LOG_BYTES | (42 - LOG_BYTES_MAX)));
+        expect("bytes round trip", records.size() == 2 && memcmp(records[0].bytes, bytes, LOG_BYTES_MAX) == 0 &&
+                                   memcmp(records[1].bytes, bytes + LOG_BYTES_MAX, 42 - LOG_BYTES_MAX) == 0);
+
+        // A part is refused if its count is out of range or the frame is cut short
+        LogRecord record = records[0];
+        uint8_t frame[LOG_FRAME_MAX];
+        uint8_t length = encodeLogRecord(record, frame);
+        LogRecord decoded;
+        expect("bytes frame fits", length == LOG_FRAME_HEADER + LOG_BYTES_MAX + 1);
+        expect("short bytes frame refused", decodeLogRecord(frame, length - 1, decoded) == 0);
+        frame[3] = LOG_BYTES | (LOG_BYTES_MAX + 1);
+        expect("long bytes frame refused", decodeLogRecord(frame, length, decoded) == 0);
+
+        // A single short part, and a full queue giving up part way
+        records.clear();
+        expect("short bytes queued", logBytes(log, LOG_MATCH_BYTES, 600, bytes, 3));
+        drainAll(log, 600, records);
+        expect("one part", records.size() == 1 && records[0].argc == (LOG_BYTES | 3) && records[0].suppressed == 0);
+        for (uint32_t i = 0; i < LOG_QUEUE_SIZE - 1; i++) {
+            logRecord(log, LOG_POWERUP_STARTED, i);
+        }
+        expect("full queue refuses bytes", !logBytes(log, LOG_TELEMETRY, 700, bytes, sizeof(bytes)));
+        records.clear();
+        drainAll(log, 700, records);
+        expect("only the first part queued", records.size() == LOG_QUEUE_SIZE + 1 &&
+                                             records.back().argc == (LOG_BYTES | LOG_BYTES_MORE | LOG_BYTES_MAX));
+    }
+
+    // A full queue drops, and the drain says how many
+    {
+        static BinaryLog log;
+        uint32_t queued = 0;
+        for (uint32_t i = 0; i < LOG_QUEUE_SIZE + 10; i++) {
+            queued += logRecord(log, LOG_POWERUP_STARTED, i);
+        }
+        expect("queue holds its size", queued == LOG_QUEUE_SIZE && log.queue.space() == 0);
+        std::vector<LogRecord> records;
+        expect("full drain decodes", drainAll(log, 100, records));
+        expect("drops reported first", records.size() == LOG_QUEUE_SIZE + 1 && records[0].site == LOG_DROPPED &&
+                                       records[0].args[0] == 10);
+        expect("drained queue all space", log.queue.space() == LOG_QUEUE_SIZE);
+        records.clear();
+        logRecord(log, LOG_POWERUP_ENDED, 200);
+        expect("space counts the record", log.queue.space() == LOG_QUEUE_SIZE - 1);
+        drainAll(log, 200, records);
+        expect("drops reported once", records.size() == 1 && records[0].site == LOG_POWERUP_ENDED);
+    }
+
+    // Producers on several threads, one drain
+    {
+        static BinaryLog log;
+        const uint32_t PRODUCERS = 4;
+        const uint32_t EACH = 20000;
+        std::atomic<uint32_t> running(PRODUCERS);
+        std::vector<std::thread> producers;
+        for (uint32_t p = 0; p < PRODUCERS; p++) {
+            producers.push_back(std::thread([&running, p]() {
+                for (uint32_t i = 0; i < EACH; i++) {
+                    if (!logRecord(log, LOG_LINK_WINDOW, i, p, i, -(int32_t)i)) {
+                        std::this_thread::yield();
+                    }
+                }
+                running--;
+            }));
+        }
+        std::vector<LogRecord> records;
+        std::vector<uint32_t> next(PRODUCERS, 0);
+        uint32_t received = 0, dropped = 0, outOfOrder = 0, torn = 0;
+        bool decoded = true;
+        for (;;) {
+            bool done = running == 0;
+            records.clear();
+            decoded = drainAll(log, 0, records) && decoded;
+            for (size_t r = 0; r < records.size(); r++) {
+                const LogRecord &record = records[r];
+                if (record.site == LOG_DROPPED) {
+                    dropped += record.args[0];
+                } else if (record.argc != 3 || record.args[0] >= (int32_t)PRODUCERS ||
+                           record.args[2] != -record.args[1]) {
+                    torn++;
+                } else {
+                    // Each producer's records come out in the order it logged them
+                    outOfOrder += (uint32_t)record.args[1] < next[record.args[0]];
+                    next[record.args[0]] = record.args[1] + 1;
+                    received++;
+                }
+            }
+            if (done && records.empty()) {
+                break;
+            }
+        }
+        for (size_t p = 0; p < producers.size(); p++) {
+            producers[p].join();
+        }
+        printf("%lu records from %lu threads: %lu received, %lu dropped\n", (unsigned long)(PRODUCERS * EACH),
+               (unsigned long)PRODUCERS, (unsigned long)received, (unsigned long)dropped);
+        expect("concurrent drain decodes", decoded);
+        expect("no torn records", torn == 0);
+        expect("in order per thread", outOfOrder == 0);
+        expect("every record received or dropped", received + dropped == PRODUCERS * EACH);
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,273 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the pixel collision (include/collision.h and
+// include/character_collision.h).
+//
+// Catches and walls have to come out the same on both devices, so every
+// test here is checked against a plain pixel-by-pixel reference: masks
+// wider than a word lined up at every shift across the 32-bit word
+// boundaries, negative cell positions and offsets and partial overlaps,
+// masks against solid tiles and the outside of the map, and the broad
+// phase grid handing each overlapping pair over exactly once, however many
+// cells the two share. The game's own masks go through the same reference.
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_collision tools/test_collision.cpp
+//     /tmp/test_collision
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/character_collision.h"
+
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+const int MAX_WORDS = 4 * 100;
+
+struct TestMask {
+    CollisionMask mask;
+    uint32_t words[MAX_WORDS];
+};
+
+// Pixel (x, y) of a mask, read straight from its words
+static bool maskPixel(const CollisionMask &mask, int x, int y) {
+    if (x < 0 || y < 0 || x >= mask.w || y >= mask.h) {
+        return false;
+    }
+    return (mask.words[y * mask.wordsPerRow + (x >> 5)] >> (31 - (x & 31))) & 1;
+}
+
+static void setMaskPixel(TestMask &test, int x, int y) {
+    test.words[y * test.mask.wordsPerRow + (x >> 5)] |= 0x80000000UL >> (x & 31);
+}
+
+static void makeMask(TestMask &test, int w, int h, int offsetX, int offsetY) {
+    test.mask.offsetX = offsetX;
+    test.mask.offsetY = offsetY;
+    test.mask.w = w;
+    test.mask.h = h;
+    test.mask.wordsPerRow = (w + 31) / 32;
+    test.mask.words = test.words;
+    memset(test.words, 0, sizeof(test.words));
+}
+
+// Every pixel set with about `percent` odds
+static void randomMask(TestMask &test, int w, int h, int offsetX, int offsetY, int percent) {
+    makeMask(test, w, h, offsetX, offsetY);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (rand() % 100 < percent) {
+                setMaskPixel(test, x, y);
+            }
+        }
+    }
+}
+
+static bool referenceOverlap(const CollisionMask &a, int ax, int ay, const CollisionMask &b, int bx, int by) {
+    for (int y = 0; y < a.h; y++) {
+        for (int x = 0; x < a.w; x++) {
+            if (maskPixel(a, x, y) && maskPixel(b, ax + a.offsetX + x - bx - b.offsetX,
+                                                ay + a.offsetY + y - by - b.offsetY)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool referenceHitsSolid(const TileMap &map, const CollisionMask &mask, int x, int y) {
+    for (int py = 0; py < mask.h; py++) {
+        for (int px = 0; px < mask.w; px++) {
+            int wx = x + mask.offsetX + px, wy = y + mask.offsetY + py;
+            if (maskPixel(mask, px, py) && ((map.solidMask >> tileAt(map, collisionFloorDiv(wx, map.tileSize),
+                                                                   collisionFloorDiv(wy, map.tileSize))) & 1)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static uint32_t pairsSeen[COLLISION_MAX_ENTITIES];
+
+static void countPair(uint8_t a, uint8_t b) {
+    pairsSeen[a] += 1U << (2 * b);   // two bits per pair, so a second report shows
+}
+
+int main() {
+    srand(11);
+    static TestMask a, b;
+
+    // One pixel each: the 96 pixel wide mask's pixel sits at the word
+    // boundaries, the other mask is walked across it at every shift
+    {
+        const int columns[] = {0, 31, 32, 63, 64, 95};
+        uint32_t wrong = 0, hits = 0;
+        for (uint8_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+            makeMask(a, 96, 3, 0, 0);
+            setMaskPixel(a, columns[i], 1);
+            for (int w = 1; w <= 70; w += 23) {
+                makeMask(b, w, 1, 0, 0);
+                setMaskPixel(b, w - 1, 0);
+                for (int bx = -80; bx <= 100; bx++) {
+                    bool expected = bx + w - 1 == columns[i];
+                    bool got = masksOverlap(a.mask, 0, 0, b.mask, bx, 1);
+                    wrong += got != expected;
+                    hits += got;
+                }
+            }
+        }
+        expect("single pixels across word boundaries", wrong == 0);
+        expect("single pixels hit", hits == 6 * 4);
+    }
+
+    // Random masks up to four words wide, with negative offsets and
+    // positions, overlapping partly, fully or not at all
+    {
+        uint32_t wrong = 0, hits = 0, trials = 0;
+        for (int t = 0; t < 400; t++) {
+            randomMask(a, 1 + rand() % 100, 1 + rand() % 40, rand() % 21 - 10, rand() % 21 - 10, 2 + rand() % 20);
+            randomMask(b, 1 + rand() % 100, 1 + rand() % 40, rand() % 21 - 10, rand() % 21 - 10, 2 + rand() % 20);
+            int ax = rand() % 200 - 100, ay = rand() % 200 - 100;
+            for (int d = 0; d < 40; d++) {
+                int bx = ax + rand() % 140 - 70, by = ay + rand() % 60 - 30;
+                bool expected = referenceOverlap(a.mask, ax, ay, b.mask, bx, by);
+                wrong += masksOverlap(a.mask, ax, ay, b.mask, bx, by) != expected;
+                wrong += masksOverlap(b.mask, bx, by, a.mask, ax, ay) != expected;
+                hits += expected;
+                trials++;
+            }
+        }
+        printf("random masks: %lu of %lu overlapping\n", (unsigned long)hits, (unsigned long)trials);
+        expect("random masks match the reference", wrong == 0);
+        expect("random masks hit and miss", hits > trials / 10 && hits < trials * 9 / 10);
+    }
+
+    // Walls: solid tiles and the outside of the map, tiles of 7, 16 and 32 pixels
+    {
+        static TileMap map;
+        uint32_t wrong = 0, hits = 0, trials = 0;
+        const uint8_t tileSizes[] = {16, 32, 7};
+        for (uint8_t s = 0; s < sizeof(tileSizes) / sizeof(tileSizes[0]); s++) {
+            memset(&map, 0, sizeof(map));
+            map.width = 6;
+            map.height = 5;
+            map.tileSize = tileSizes[s];
+            map.solidMask = 1 << 2;
+            for (int i = 0; i < map.width * map.height; i++) {
+                map.tiles[i] = (rand() % 8 == 0) ? 2 : rand() % 2;
+            }
+            for (int t = 0; t < 3000; t++) {
+                if (t % 100 == 0) {
+                    randomMask(a, 1 + rand() % 60, 1 + rand() % 30, rand() % 11 - 5, rand() % 11 - 5, 2 + rand() % 20);
+                }
+                int x = rand() % (map.width * map.tileSize + 40) - 40;
+                int y = rand() % (map.height * map.tileSize + 40) - 40;
+                bool expected = referenceHitsSolid(map, a.mask, x, y);
+                wrong += maskHitsSolidTiles(map, a.mask, x, y) != expected;
+                hits += expected;
+                trials++;
+            }
+        }
+        printf("walls: %lu of %lu touching\n", (unsigned long)hits, (unsigned long)trials);
+        expect("walls match the reference", wrong == 0);
+
+        // An open map: clear inside, blocked one pixel past any edge
+        memset(map.tiles, 0, sizeof(map.tiles));
+        map.tileSize = 16;
+        makeMask(a, 10, 10, 3, 3);
+        for (int i = 0; i < 10; i++) {
+            setMaskPixel(a, i, i);
+        }
+        expect("inside is open", !maskHitsSolidTiles(map, a.mask, -3, -3) &&
+                                 !maskHitsSolidTiles(map, a.mask, map.width * 16 - 13, map.height * 16 - 13));
+        expect("outside blocks", maskHitsSolidTiles(map, a.mask, -4, -3) && maskHitsSolidTiles(map, a.mask, -3, -4) &&
+                                 maskHitsSolidTiles(map, a.mask, map.width * 16 - 12, map.height * 16 - 13));
+    }
+
+    // Broad phase: each overlapping pair once, whatever cells the two share
+    {
+        static CollisionGrid grid;
+        static TestMask masks[COLLISION_MAX_ENTITIES];
+        uint32_t wrong = 0, repeated = 0, pairs = 0;
+        for (int t = 0; t < 200; t++) {
+            clearCollisionGrid(grid);
+            int count = 2 + rand() % (COLLISION_MAX_ENTITIES - 1);
+            int x[COLLISION_MAX_ENTITIES], y[COLLISION_MAX_ENTITIES];
+            for (int e = 0; e < count; e++) {
+                randomMask(masks[e], 20 + rand() % 80, 20 + rand() % 80, rand() % 11 - 5, rand() % 11 - 5, 30);
+                // Clustered on the cell corners, some off the grid
+                x[e] = COLLISION_CELL_SIZE * (rand() % (COLLISION_GRID_COLS + 2) - 1) + rand() % 80 - 60;
+                y[e] = COLLISION_CELL_SIZE * (rand() % (COLLISION_GRID_ROWS + 2) - 1) + rand() % 80 - 60;
+                addCollisionEntity(grid, masks[e].mask, x[e], y[e]);
+            }
+            memset(pairsSeen, 0, sizeof(pairsSeen));
+            int found = findCollisionPairs(grid, countPair);
+            int expected = 0;
+            for (int i = 0; i < count; i++) {
+                for (int j = i + 1; j < count; j++) {
+                    uint32_t seen = (pairsSeen[i] >> (2 * j)) & 3;
+                    bool overlap = referenceOverlap(masks[i].mask, x[i], y[i], masks[j].mask, x[j], y[j]);
+                    expected += overlap;
+                    wrong += (seen != 0) != overlap;
+                    repeated += seen > 1;
+                }
+            }
+            wrong += found != expected;
+            pairs += expected;
+        }
+        printf("broad phase: %lu overlapping pairs\n", (unsigned long)pairs);
+        expect("broad phase finds every pair", wrong == 0 && pairs > 0);
+        expect("broad phase reports each pair once", repeated == 0);
+
+        clearCollisionGrid(grid);
+        for (int e = 0; e < COLLISION_MAX_ENTITIES; e++) {
+            addCollisionEntity(grid, masks[0].mask, 0, 0);
+        }
+        expect("full grid refuses", addCollisionEntity(grid, masks[0].mask, 0, 0) == -1);
+        expect("every pair of a pile", findCollisionPairs(grid, NULL) ==
+                                       COLLISION_MAX_ENTITIES * (COLLISION_MAX_ENTITIES - 1) / 2);
+    }
+
+    // The game's characters: the catch test agrees with the reference both ways round
+    {
+        const int PRINCESS_INDEX = 0, DRAGON_INDEX = 1;
+        const CollisionMask &princess = characterCatchMask(PRINCESS_INDEX);
+        const CollisionMask &dragon = characterCatchMask(DRAGON_INDEX);
+        uint32_t wrong = 0, catches = 0;
+        for (int dy = -110; dy <= 110; dy += 3) {
+            for (int dx = -110; dx <= 110; dx += 3) {
+                int px = 400 + dx, py = 300 + dy;
+                bool expected = referenceOverlap(princess, px - ATLAS_CELL_SIZE / 2, py - ATLAS_CELL_SIZE / 2,
+                                                 dragon, 400 - ATLAS_CELL_SIZE / 2, 300 - ATLAS_CELL_SIZE / 2);
+                wrong += charactersOverlap(PRINCESS_INDEX, px, py, DRAGON_INDEX, 400, 300) != expected;
+                wrong += charactersOverlap(DRAGON_INDEX, 400, 300, PRINCESS_INDEX, px, py) != expected;
+                catches += expected;
+            }
+        }
+        expect("catches match the reference", wrong == 0);
+        expect("same spot is a catch", charactersOverlap(PRINCESS_INDEX, 200, 200, DRAGON_INDEX, 200, 200));
+        expect("far apart is not", !charactersOverlap(PRINCESS_INDEX, 100, 100, DRAGON_INDEX, 300, 100));
+        expect("some catches", catches > 0);
+
+        uint32_t distanceWrong = 0;
+        for (int i = 0; i < 10000; i++) {
+            int ax = rand() % 4000 - 2000, ay = rand() % 4000 - 2000;
+            int bx = rand() % 4000 - 2000, by = rand() % 4000 - 2000;
+            uint32_t expected = (uint32_t)floor(sqrt((double)(ax - bx) * (ax - bx) + (double)(ay - by) * (ay - by)));
+            distanceWrong += characterDistance(ax, ay, bx, by) != expected;
+        }
+        expect("distance rounds down", distanceWrong == 0 && characterDistance(0, 0, 3, 4) == 5 &&
+                                       characterDistance(0, 0, 1, 1) == 1);
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
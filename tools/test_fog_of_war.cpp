@@ -0,0 +1,209 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the fog-of-war mask (include/fog_of_war.h).
+//
+// Sources move, grow, shrink, leave the screen and switch on and off at
+// random. After every change the incrementally kept mask has to match one
+// computed per pixel from scratch, and compositing has to bring a model of
+// the panel back in line with it while drawing only dirty tiles, in
+// maximal runs. Rectangles marked dirty have to cover exactly the tiles
+// they touch on screen. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_fog_of_war tools/test_fog_of_war.cpp
+//     /tmp/test_fog_of_war
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../include/fog_of_war.h"
+
+static FogMask mask;
+static uint32_t rngState = 4242;
+static uint32_t errors = 0;
+
+// What the panel shows: -1 = never drawn, else the visibility last drawn
+static int8_t panel[FOG_ROWS][FOG_COLS];
+static int drawnTiles = 0;
+static int drawnRuns = 0;
+static bool runsBad = false;
+static uint32_t drawnRows[FOG_ROWS];
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return rngState >> 8;
+}
+
+static void drawRun(int x, int y, int w, int h, bool visible) {
+    runsBad |= x % FOG_TILE_SIZE != 0 || y % FOG_TILE_SIZE != 0 || w <= 0 || w % FOG_TILE_SIZE != 0 ||
+               h != FOG_TILE_SIZE || x + w > FOG_COLS * FOG_TILE_SIZE;
+    int row = y / FOG_TILE_SIZE;
+    drawnRuns++;
+    for (int c = x / FOG_TILE_SIZE; c < (x + w) / FOG_TILE_SIZE; c++) {
+        runsBad |= (drawnRows[row] >> c) & 1;   // drawn twice in one pass
+        drawnRows[row] |= 1UL << c;
+        panel[row][c] = visible;
+        drawnTiles++;
+    }
+}
+
+// Per pixel: a tile is visible if any of its pixels is inside an active circle
+static bool referenceVisible(int col, int row) {
+    for (int s = 0; s < FOG_SOURCE_COUNT; s++) {
+        const FogCircle &circle = mask.sources[s];
+        if (!circle.active) {
+            continue;
+        }
+        int32_t r2 = (int32_t)circle.radius * circle.radius;
+        for (int py = row * FOG_TILE_SIZE; py < (row + 1) * FOG_TILE_SIZE; py++) {
+            for (int px = col * FOG_TILE_SIZE; px < (col + 1) * FOG_TILE_SIZE; px++) {
+                int32_t dx = px - circle.x, dy = py - circle.y;
+                if (dx * dx + dy * dy <= r2) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+static uint32_t maskMismatches() {
+    uint32_t wrong = 0;
+    for (int r = 0; r < FOG_ROWS; r++) {
+        wrong += (mask.visible[r] & ~FOG_ROW_BITS) != 0;
+        for (int c = 0; c < FOG_COLS; c++) {
+            wrong += isFogTileVisible(mask, c, r) != referenceVisible(c, r);
+        }
+    }
+    return wrong;
+}
+
+// Composites and checks that exactly the dirty tiles were drawn, in maximal runs
+static uint32_t compositeAndCheck() {
+    uint32_t dirty[FOG_ROWS];
+    int dirtyCount = 0, runCount = 0;
+    memcpy(dirty, mask.dirty, sizeof(dirty));
+    for (int r = 0; r < FOG_ROWS; r++) {
+        for (int c = 0; c < FOG_COLS; c++) {
+            bool d = (dirty[r] >> c) & 1;
+            dirtyCount += d;
+            bool continues = c > 0 && ((dirty[r] >> (c - 1)) & 1) &&
+                             isFogTileVisible(mask, c - 1, r) == isFogTileVisible(mask, c, r);
+            runCount += d && !continues;
+        }
+    }
+    memset(drawnRows, 0, sizeof(drawnRows));
+    drawnTiles = 0;
+    drawnRuns = 0;
+    int tiles = compositeFog(mask, drawRun);
+
+    uint32_t wrong = 0;
+    wrong += tiles != dirtyCount || drawnTiles != dirtyCount || drawnRuns != runCount;
+    for (int r = 0; r < FOG_ROWS; r++) {
+        wrong += mask.dirty[r] != 0 || drawnRows[r] != (dirty[r] & FOG_ROW_BITS);
+        for (int c = 0; c < FOG_COLS; c++) {
+            wrong += panel[r][c] != (int8_t)isFogTileVisible(mask, c, r);
+        }
+    }
+    return wrong;
+}
+
+int main() {
+    memset(panel, -1, sizeof(panel));
+    initFogMask(mask);
+    expect("starts fogged", maskMismatches() == 0);
+    expect("first composite draws everything", compositeAndCheck() == 0 && drawnTiles == FOG_COLS * FOG_ROWS);
+    expect("nothing left to draw", compositeFog(mask, drawRun) == 0);
+
+    // A player in the middle of the screen
+    setFogSource(mask, FOG_SOURCE_PLAYER, 160, 120, 40, true);
+    expect("player circle", maskMismatches() == 0 && isFogTileVisible(mask, 10, 7) && !isFogTileVisible(mask, 0, 0));
+    expect("player composite", compositeAndCheck() == 0 && drawnTiles > 0 && drawnTiles < 40);
+    setFogSource(mask, FOG_SOURCE_PLAYER, 160, 120, 40, true);
+    expect("same circle changes nothing", compositeFog(mask, drawRun) == 0);
+    setFogSource(mask, FOG_SOURCE_REVEAL, 0, 0, 30, false);
+    expect("inactive source changes nothing", compositeFog(mask, drawRun) == 0);
+
+    // A one-pixel move only redraws the tiles that flipped
+    setFogSource(mask, FOG_SOURCE_PLAYER, 161, 120, 40, true);
+    expect("sub-tile move", maskMismatches() == 0);
+    expect("sub-tile move draws only flips", compositeAndCheck() == 0);
+
+    // Random moves, resizes and switches, on and off the screen
+    {
+        uint32_t wrong = 0;
+        for (int round = 0; round < 3000; round++) {
+            uint8_t source = nextRandom() % FOG_SOURCE_COUNT;
+            int x = (int)(nextRandom() % 560) - 120;
+            int y = (int)(nextRandom() % 480) - 120;
+            int radius = nextRandom() % 8 == 0 ? 0 : (int)(nextRandom() % 180);
+            bool active = nextRandom() % 5 != 0;
+            setFogSource(mask, source, x, y, radius, active);
+            if (nextRandom() % 4 == 0) {
+                markFogRectDirty(mask, (int)(nextRandom() % 400) - 40, (int)(nextRandom() % 300) - 30,
+                                 nextRandom() % 64, nextRandom() % 64);
+            }
+            wrong += maskMismatches();
+            if (nextRandom() % 3 == 0) {
+                wrong += compositeAndCheck();
+            }
+        }
+        wrong += compositeAndCheck();
+        expect("random sources match the reference", wrong == 0);
+    }
+
+    // Switching everything off fogs the whole screen again
+    setFogSource(mask, FOG_SOURCE_PLAYER, 0, 0, 0, false);
+    setFogSource(mask, FOG_SOURCE_REVEAL, 0, 0, 0, false);
+    {
+        uint32_t lit = 0;
+        for (int r = 0; r < FOG_ROWS; r++) {
+            lit += mask.visible[r] != 0;
+        }
+        expect("all off", lit == 0 && compositeAndCheck() == 0);
+    }
+
+    // A circle bigger than the screen
+    setFogSource(mask, FOG_SOURCE_REVEAL, -50, -50, 1000, true);
+    expect("huge circle", maskMismatches() == 0 && isFogTileVisible(mask, FOG_COLS - 1, FOG_ROWS - 1));
+    expect("huge circle composite", compositeAndCheck() == 0);
+
+    // Dirty rectangles cover exactly the on-screen tiles they touch
+    {
+        uint32_t wrong = 0;
+        for (int round = 0; round < 4000; round++) {
+            int x = (int)(nextRandom() % 480) - 80;
+            int y = (int)(nextRandom() % 360) - 60;
+            int w = (int)(nextRandom() % 120) - 10;
+            int h = (int)(nextRandom() % 120) - 10;
+            memset(mask.dirty, 0, sizeof(mask.dirty));
+            markFogRectDirty(mask, x, y, w, h);
+            for (int r = 0; r < FOG_ROWS; r++) {
+                for (int c = 0; c < FOG_COLS; c++) {
+                    bool touches = w > 0 && h > 0 && x < (c + 1) * FOG_TILE_SIZE && x + w > c * FOG_TILE_SIZE &&
+                                   y < (r + 1) * FOG_TILE_SIZE && y + h > r * FOG_TILE_SIZE;
+                    wrong += (bool)((mask.dirty[r] >> c) & 1) != touches;
+                }
+                wrong += (mask.dirty[r] & ~FOG_ROW_BITS) != 0;
+            }
+        }
+        expect("dirty rectangles", wrong == 0);
+    }
+
+    // Invalidating redraws everything once
+    memset(mask.dirty, 0, sizeof(mask.dirty));
+    invalidateFogMask(mask);
+    expect("invalidate", compositeAndCheck() == 0 && drawnTiles == FOG_COLS * FOG_ROWS);
+    markFogTileDirty(mask, 3, 4);
+    expect("one tile", compositeAndCheck() == 0 && drawnTiles == 1);
+
+    expect("runs well formed", !runsBad);
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the game flow state machine (include/game_flow.h).
+//
+// Plays both a normal round and the awkward cases through the table with
+// recording actions: guarded starts, duplicate and late events from the
+// peer, events raised from inside actions, and disconnects from every
+// state. Checks the states reached and that every entry and exit action ran
+// exactly once per real change. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_game_flow tools/test_game_flow.cpp
+//     /tmp/test_game_flow
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/game_flow.h"
+
+static GameFlow flow;
+static uint32_t errors = 0;
+static int entered[S_STATE_COUNT];
+static int left[S_STATE_COUNT];
+static bool playersChosen = false;
+static bool raiseOnGameOver = false;
+
+static void countEnter(uint8_t state) {
+    entered[state]++;
+}
+
+static void enterWaiting(uint8_t, uint8_t) { countEnter(S_WAITING); }
+static void enterPlayerSelect(uint8_t, uint8_t) { countEnter(S_PLAYER_SELECT); }
+static void enterTutorial(uint8_t, uint8_t) { countEnter(S_TUTORIAL); }
+static void enterGame(uint8_t, uint8_t) { countEnter(S_GAME); }
+
+// Like endGame() answering a game over: raises more events from inside an action
+static void enterGameOver(uint8_t, uint8_t) {
+    countEnter(S_GAME_OVER);
+    if (raiseOnGameOver) {
+        dispatchGameEvent(flow, EV_REMOTE_CAUGHT);      // ignored, already over
+        dispatchGameEvent(flow, EV_PLAY_AGAIN);         // runs once this one is done
+        if (flow.state != S_GAME_OVER) {
+            printf("event from an action ran before the action finished\n");
+            errors++;
+        }
+    }
+}
+
+static void leaveState(uint8_t, uint8_t) {
+    // The machine still reports the state being left
+    left[flow.state]++;
+}
+
+static const GameStateActions actions[S_STATE_COUNT] = {
+    { enterWaiting,      leaveState },
+    { enterPlayerSelect, leaveState },
+    { enterTutorial,     leaveState },
+    { enterGame,         leaveState },
+    { enterGameOver,     leaveState },
+};
+
+static bool guard(uint8_t which) {
+    return which == GUARD_PLAYERS_CHOSEN ? playersChosen : true;
+}
+
+static void reset() {
+    initGameFlow(flow, S_WAITING, actions, guard);
+    for (int i = 0; i < S_STATE_COUNT; i++) {
+        entered[i] = left[i] = 0;
+    }
+    playersChosen = false;
+    raiseOnGameOver = false;
+}
+
+static void expectState(const char *what, uint8_t state) {
+    if (flow.state != state) {
+        printf("%s: state %d, expected %d\n", what, flow.state, state);
+        errors++;
+    }
+}
+
+static void expectCount(const char *what, const int *counts, uint8_t state, int count) {
+    if (counts[state] != count) {
+        printf("%s: state %d counted %d times, expected %d\n", what, state, counts[state], count);
+        errors++;
+    }
+}
+
+int main() {
+    // A normal round
+    reset();
+    postGameEvent(flow, EV_CONNECTED);
+    expectState("posted events wait for runGameEvents", S_WAITING);
+    runGameEvents(flow);
+    expectState("connect", S_PLAYER_SELECT);
+    raiseGameEvent(flow, EV_TUTORIAL_OPENED);
+    runGameEvents(flow);
+    expectState("tutorial", S_TUTORIAL);
+    dispatchGameEvent(flow, EV_TUTORIAL_CLOSED);
+    expectState("tutorial closed", S_PLAYER_SELECT);
+    expectCount("select entered once per visit", entered, S_PLAYER_SELECT, 2);
+
+    // Start needs both players
+    if (dispatchGameEvent(flow, EV_START)) {
+        printf("start without players reported a change\n");
+        errors++;
+    }
+    expectState("guarded start", S_PLAYER_SELECT);
+    expectCount("no exit on a refused start", left, S_PLAYER_SELECT, 1);
+    playersChosen = true;
+    dispatchGameEvent(flow, EV_START);
+    expectState("start", S_GAME);
+
+    // The peer's start arriving late changes nothing
+    postGameEvent(flow, EV_REMOTE_START);
+    runGameEvents(flow);
+    expectCount("late remote start", entered, S_GAME, 1);
+
+    // Caught, then the peer's own game over: one end of the game only
+    dispatchGameEvent(flow, EV_CAUGHT);
+    postGameEvent(flow, EV_REMOTE_CAUGHT);
+    postGameEvent(flow, EV_REMOTE_TIME_UP);
+    runGameEvents(flow);
+    dispatchGameEvent(flow, EV_TIME_UP);
+    expectState("caught", S_GAME_OVER);
+    expectCount("game over entered once", entered, S_GAME_OVER, 1);
+    expectCount("game left once", left, S_GAME, 1);
+    if (flow.cause != EV_CAUGHT) {
+        printf("cause %d, expected EV_CAUGHT\n", flow.cause);
+        errors++;
+    }
+
+    // The peer starts the next round before we tapped Play again
+    postGameEvent(flow, EV_REMOTE_START);
+    runGameEvents(flow);
+    expectState("remote start from game over", S_GAME);
+    expectCount("second round", entered, S_GAME, 2);
+
+    // The peer's timer ran out first: its reason comes along and ends ours the same way
+    postGameEvent(flow, remoteGameOverEvent(gameOverReason(EV_TIME_UP)));
+    runGameEvents(flow);
+    dispatchGameEvent(flow, EV_CAUGHT);
+    expectState("remote time up", S_GAME_OVER);
+    if (flow.cause != EV_REMOTE_TIME_UP || gameOverReason(flow.cause) != GAME_OVER_TIME_UP) {
+        printf("cause %d, expected EV_REMOTE_TIME_UP\n", flow.cause);
+        errors++;
+    }
+    if (remoteGameOverEvent(gameOverReason(EV_CAUGHT)) != EV_REMOTE_CAUGHT || remoteGameOverEvent(0) != EV_REMOTE_CAUGHT) {
+        printf("a catch, or a game over without a reason, must end as a catch\n");
+        errors++;
+    }
+    postGameEvent(flow, EV_REMOTE_START);
+    runGameEvents(flow);
+    expectCount("third round", entered, S_GAME, 3);
+
+    // Events raised from inside an action run after it, in order
+    raiseOnGameOver = true;
+    dispatchGameEvent(flow, EV_TIME_UP);
+    expectState("play again raised by the game over action", S_PLAYER_SELECT);
+    expectCount("game over entered once more", entered, S_GAME_OVER, 3);
+
+    // A disconnect leads back to waiting from every state, once
+    for (uint8_t s = S_PLAYER_SELECT; s < S_STATE_COUNT; s++) {
+        reset();
+        flow.state = s;
+        postGameEvent(flow, EV_DISCONNECTED);
+        postGameEvent(flow, EV_DISCONNECTED);
+        runGameEvents(flow);
+        expectState("disconnect", S_WAITING);
+        expectCount("disconnect leaves once", left, s, 1);
+        expectCount("waiting entered once", entered, S_WAITING, 1);
+    }
+
+    // Waiting ignores everything but a connection
+    reset();
+    for (uint8_t e = 0; e < EV_EVENT_COUNT; e++) {
+        if (e != EV_CONNECTED) {
+            dispatchGameEvent(flow, e);
+        }
+    }
+    expectState("waiting ignores events", S_WAITING);
+
+    // Every row leads somewhere real
+    for (size_t i = 0; i < sizeof(gameTransitions) / sizeof(gameTransitions[0]); i++) {
+        const GameTransition &t = gameTransitions[i];
+        if (t.to >= S_STATE_COUNT || t.event >= EV_EVENT_COUNT ||
+            (t.from != S_ANY && t.from >= S_STATE_COUNT)) {
+            printf("row %u is out of range\n", (unsigned)i);
+            errors++;
+        }
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the HUD layer (include/hud.h).
+//
+// Numbers must come out as printf would print them while they fit the
+// field, and clamp to the widest one that fits, sign and all, once they
+// don't; the timer never grows past m:ss in six characters. A field update
+// has to draw only the characters that changed and blank the ones a
+// shorter value leaves over. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_hud tools/test_hud.cpp
+//     /tmp/test_hud
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../include/hud.h"
+
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static void expectNumber(int32_t value, const char *shown) {
+    char text[HUD_FIELD_CHARS + 2];
+    text[HUD_FIELD_CHARS + 1] = 'X';
+    formatHudNumber(text, value);
+    if (strcmp(text, shown) != 0 || text[HUD_FIELD_CHARS + 1] != 'X') {
+        printf("%ld shows as \"%s\", expected \"%s\"\n", (long)value, text, shown);
+        errors++;
+    }
+}
+
+static void expectTime(uint32_t ms, const char *shown) {
+    char text[HUD_FIELD_CHARS + 2];
+    text[HUD_FIELD_CHARS + 1] = 'X';
+    formatHudTime(text, ms);
+    if (strcmp(text, shown) != 0 || text[HUD_FIELD_CHARS + 1] != 'X') {
+        printf("%lu ms shows as \"%s\", expected \"%s\"\n", (unsigned long)ms, text, shown);
+        errors++;
+    }
+}
+
+static int drawnX[64];
+static int drawnCount = 0;
+
+static void recordGlyph(int x, int, const uint16_t *, int, int) {
+    if (drawnCount < 64) {
+        drawnX[drawnCount] = x;
+    }
+    drawnCount++;
+}
+
+int main() {
+    // Numbers that fit come out as printf's
+    {
+        const int32_t values[] = {0, 7, -7, 42, 999999, -99999, 123456, -12345, 100000, -10000};
+        uint32_t wrong = 0;
+        for (uint8_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+            char text[HUD_FIELD_CHARS + 1], expected[16];
+            formatHudNumber(text, values[i]);
+            snprintf(expected, sizeof(expected), "%ld", (long)values[i]);
+            wrong += strcmp(text, expected) != 0;
+        }
+        expect("fitting numbers as printf", wrong == 0);
+    }
+
+    // Too wide: clamped, never the low digits, and negatives keep their sign
+    expectNumber(1000000, "999999");
+    expectNumber(1234567, "999999");
+    expectNumber(INT32_MAX, "999999");
+    expectNumber(-100000, "-99999");
+    expectNumber(-123456, "-99999");
+    expectNumber(INT32_MIN, "-99999");
+
+    // The timer
+    expectTime(0, "0:00");
+    expectTime(999, "0:00");
+    expectTime(61000, "1:01");
+    expectTime(600000, "10:00");
+    expectTime((999 * 60 + 59) * 1000UL, "999:59");
+    expectTime(1000UL * 60 * 1000, "999:59");
+    expectTime(UINT32_MAX, "999:59");
+
+    // Only the characters that changed are drawn, leftovers blanked once
+    {
+        static HudGlyphStyle styles[1];
+        buildHudGlyphStyle(styles[0], 0xFFFF, 0x0000);
+        HudField field;
+        initHudField(field, 10, 20, 0);
+        drawnCount = 0;
+        expect("first update draws all", updateHudField(field, "1:59", styles, recordGlyph) == 4 && drawnCount == 4);
+        drawnCount = 0;
+        expect("one digit changed", updateHudField(field, "1:58", styles, recordGlyph) == 1 && drawnCount == 1 &&
+                                    drawnX[0] == 10 + 3 * HUD_GLYPH_W);
+        expect("nothing changed", updateHudField(field, "1:58", styles, recordGlyph) == 0);
+        drawnCount = 0;
+        expect("shorter value blanks the rest", updateHudField(field, "9", styles, recordGlyph) == 4);
+        expect("blanked once", updateHudField(field, "9", styles, recordGlyph) == 0);
+        invalidateHudField(field);
+        expect("invalidated redraws", updateHudField(field, "9", styles, recordGlyph) == 1);
+        setHudFieldStyle(field, 0);
+        expect("same style keeps it", updateHudField(field, "9", styles, recordGlyph) == 0);
+    }
+
+    // Glyphs: the font's pixels in the style's colours, unknown characters as a space
+    {
+        static HudGlyphStyle style;
+        buildHudGlyphStyle(style, 0xF800, 0x001F);
+        const uint16_t *one = style.pixels[hudGlyphIndex('1')];
+        expect("glyph pixels", one[2] == 0xF800 && one[0] == 0x001F && one[HUD_GLYPH_W - 1] == 0x001F &&
+                               one[7 * HUD_GLYPH_W + 2] == 0x001F);
+        expect("unknown is a space", hudGlyphIndex('x') == hudGlyphIndex(' '));
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the joystick mapping (include/joystick_input.h).
+//
+// The centre and everything up to the deadzone edge must read as zero, the
+// first step past it as the smallest nonzero value, and full deflection on
+// either side of an off-centre stick as JOY_ONE. Along an axis the output
+// only ever grows, the curve never overtakes the linear response, and no
+// diagonal leaves the unit circle. Calibrations at the extremes (a side
+// with no reach, inverted or one-step ranges, readings far beyond the
+// calibrated range, maximum jitter) must neither divide by zero nor leave
+// -JOY_ONE..JOY_ONE. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_joystick_input tools/test_joystick_input.cpp
+//     /tmp/test_joystick_input
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/joystick_input.h"
+
+static uint32_t rngState = 99;
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return rngState >> 8;
+}
+
+static JoystickCalibration makeCalibration(int centreX, int centreY, int minX, int maxX, int minY, int maxY,
+                                           uint8_t noise) {
+    JoystickCalibration cal;
+    cal.version = JOY_CALIBRATION_VERSION;
+    cal.noise = noise;
+    cal.centreX = centreX;
+    cal.centreY = centreY;
+    cal.minX = minX;
+    cal.maxX = maxX;
+    cal.minY = minY;
+    cal.maxY = maxY;
+    return cal;
+}
+
+static bool inRange(const JoystickVector &v) {
+    return v.x >= -JOY_ONE && v.x <= JOY_ONE && v.y >= -JOY_ONE && v.y <= JOY_ONE &&
+           (int)joystickIsqrt((uint32_t)(v.x * v.x + v.y * v.y)) <= JOY_ONE;
+}
+
+int main() {
+    JoystickCalibration cal;
+    initJoystickCalibration(cal);
+    const JoystickResponse linear = { 16, 0 };
+    const JoystickResponse cubic = { 16, 255 };
+
+    // Centre and full deflection
+    {
+        JoystickVector v = mapJoystick(cal, defaultJoystickResponse, cal.centreX, cal.centreY);
+        expect("centre is zero", v.x == 0 && v.y == 0);
+        v = mapJoystick(cal, defaultJoystickResponse, JOY_RAW_MAX, cal.centreY);
+        expect("full right", v.x == JOY_ONE && v.y == 0);
+        v = mapJoystick(cal, defaultJoystickResponse, 0, cal.centreY);
+        expect("full left", v.x == -JOY_ONE && v.y == 0);
+        v = mapJoystick(cal, defaultJoystickResponse, cal.centreX, 0);
+        expect("full up", v.x == 0 && v.y == -JOY_ONE);
+        v = mapJoystick(cal, cubic, cal.centreX, JOY_RAW_MAX);
+        expect("full down, cubic", v.x == 0 && v.y == JOY_ONE);
+        v = mapJoystick(cal, defaultJoystickResponse, 30000, -30000);
+        expect("beyond the range clamps", inRange(v) && v.x > 80 && v.y < -80);
+    }
+
+    // The deadzone edge: zero up to it, the smallest step right after it
+    {
+        uint32_t wrong = 0;
+        int edge = 0;
+        for (int raw = cal.centreX; raw <= JOY_RAW_MAX; raw++) {
+            int x = normaliseJoystickAxis(raw, cal.centreX, cal.minX, cal.maxX);
+            JoystickVector v = mapJoystick(cal, linear, raw, cal.centreY);
+            if (x <= linear.deadzone) {
+                wrong += v.x != 0;
+            } else if (edge == 0) {
+                edge = raw;
+                wrong += v.x != 1;
+            }
+        }
+        expect("deadzone edge", wrong == 0 && edge > cal.centreX);
+    }
+
+    // Jitter measured at rest widens the deadzone
+    {
+        JoystickCalibration noisy = makeCalibration(511, 511, 0, 1023, 0, 1023, 100);
+        int raw = 511 + 22 * 512 / JOY_ONE;   // about 22 units out, past the default deadzone
+        expect("quiet stick moves", mapJoystick(cal, defaultJoystickResponse, raw, 511).x > 0);
+        expect("noisy stick stays", mapJoystick(noisy, defaultJoystickResponse, raw, 511).x == 0);
+        expect("noisy stick full", mapJoystick(noisy, defaultJoystickResponse, 1023, 511).x == JOY_ONE);
+    }
+
+    // Monotonic along both halves of both axes, the curve below linear
+    {
+        const JoystickCalibration offCentre = makeCalibration(600, 420, 100, 1000, 40, 990, 3);
+        uint32_t wrong = 0;
+        for (int curve = 0; curve <= 255; curve += 51) {
+            JoystickResponse response = { 16, (uint8_t)curve };
+            int lastRight = 0, lastLeft = 0, lastDown = 0, lastUp = 0;
+            for (int step = 0; step <= 600; step++) {
+                int right = mapJoystick(offCentre, response, 600 + step, 420).x;
+                int left = mapJoystick(offCentre, response, 600 - step, 420).x;
+                int down = mapJoystick(offCentre, response, 600, 420 + step).y;
+                int up = mapJoystick(offCentre, response, 600, 420 - step).y;
+                wrong += right < lastRight || left > lastLeft || down < lastDown || up > lastUp;
+                wrong += right > mapJoystick(offCentre, linear, 600 + step, 420).x;
+                lastRight = right;
+                lastLeft = left;
+                lastDown = down;
+                lastUp = up;
+            }
+            wrong += lastRight != JOY_ONE || lastLeft != -JOY_ONE || lastDown != JOY_ONE || lastUp != -JOY_ONE;
+        }
+        expect("monotonic, full on every side", wrong == 0);
+        int half = mapJoystick(cal, linear, 511 + 256, 511).x;
+        int halfCubic = mapJoystick(cal, cubic, 511 + 256, 511).x;
+        expect("cubic finer at half", halfCubic < half / 2);
+    }
+
+    // Diagonals stay inside the circle and point the right way
+    {
+        uint32_t wrong = 0;
+        for (int rawY = -100; rawY <= JOY_RAW_MAX + 100; rawY += 7) {
+            for (int rawX = -100; rawX <= JOY_RAW_MAX + 100; rawX += 7) {
+                JoystickVector v = mapJoystick(cal, defaultJoystickResponse, rawX, rawY);
+                wrong += !inRange(v);
+                wrong += (v.x > 0 && rawX < cal.centreX) || (v.x < 0 && rawX > cal.centreX);
+                wrong += (v.y > 0 && rawY < cal.centreY) || (v.y < 0 && rawY > cal.centreY);
+            }
+        }
+        expect("diagonals in the circle", wrong == 0);
+        JoystickVector v = mapJoystick(cal, defaultJoystickResponse, JOY_RAW_MAX, JOY_RAW_MAX);
+        expect("full diagonal", v.x == v.y && v.x >= 88 && v.x <= 90);
+    }
+
+    // Calibration extremes: no division by zero, nothing out of range
+    {
+        const JoystickCalibration extremes[] = {
+            makeCalibration(511, 511, 511, 511, 511, 511, 0),         // no reach at all
+            makeCalibration(511, 511, 511, 1023, 0, 511, 0),          // one side of each axis missing
+            makeCalibration(511, 511, 900, 100, 900, 100, 0),         // inverted
+            makeCalibration(511, 511, 510, 512, 510, 512, 0),         // one step each way
+            makeCalibration(511, 511, 510, 512, 510, 512, 255),       // and all jitter
+            makeCalibration(-32768, 32767, -32768, 32767, -32768, 32767, 255),
+            makeCalibration(0, 1023, 0, 1023, 0, 1023, 0),            // centre on the limits
+        };
+        uint32_t wrong = 0;
+        for (uint8_t c = 0; c < sizeof(extremes) / sizeof(extremes[0]); c++) {
+            for (int round = 0; round < 4000; round++) {
+                int rawX = (int)(nextRandom() % 65536) - 32768;
+                int rawY = (int)(nextRandom() % 65536) - 32768;
+                JoystickResponse response = { (uint8_t)(nextRandom() % 256), (uint8_t)(nextRandom() % 256) };
+                wrong += !inRange(mapJoystick(extremes[c], response, rawX, rawY));
+            }
+            wrong += !inRange(mapJoystick(extremes[c], defaultJoystickResponse, -32768, 32767));
+            wrong += isJoystickCalibrationValid(extremes[c]);
+        }
+        expect("extreme calibrations stay in range", wrong == 0);
+        JoystickVector v = mapJoystick(extremes[1], defaultJoystickResponse, 0, 511);
+        expect("side without reach reads centred", v.x == 0 && v.y == 0);
+        v = mapJoystick(extremes[1], defaultJoystickResponse, 1023, 511);
+        expect("other side still works", v.x == JOY_ONE);
+        const JoystickResponse wide = { 255, 0 };
+        v = mapJoystick(cal, wide, JOY_RAW_MAX, cal.centreY);
+        expect("deadzone wider than the stick", v.x == JOY_ONE && v.y == 0 &&
+                                                mapJoystick(cal, wide, JOY_RAW_MAX - 8, cal.centreY).x == 0);
+    }
+
+    // Calibrating: resting jitter and the reach of a circled stick
+    {
+        JoystickCalibrator calibrator;
+        JoystickCalibration measured;
+        resetJoystickCalibrator(calibrator);
+        for (int i = 0; i < 64; i++) {
+            addJoystickSample(calibrator, 530 + (int)(nextRandom() % 9) - 4, 490 + (int)(nextRandom() % 5) - 2);
+        }
+        finishJoystickCentre(calibrator, measured);
+        expect("centre", measured.centreX >= 528 && measured.centreX <= 532 && measured.centreY >= 488 &&
+                         measured.centreY <= 492 && measured.noise >= 2 && measured.noise <= 6);
+        resetJoystickCalibrator(calibrator);
+        addJoystickSample(calibrator, 40, 490);
+        addJoystickSample(calibrator, 1000, 490);
+        addJoystickSample(calibrator, 530, 20);
+        addJoystickSample(calibrator, 530, 980);
+        expect("circled stick", finishJoystickRange(calibrator, measured));
+        resetJoystickCalibrator(calibrator);
+        addJoystickSample(calibrator, 500, 490);
+        addJoystickSample(calibrator, 560, 490);
+        expect("barely moved stick refused", !finishJoystickRange(calibrator, measured));
+        JoystickCalibration empty;
+        resetJoystickCalibrator(calibrator);
+        finishJoystickCentre(calibrator, empty);
+        expect("no resting samples", empty.centreX == JOY_RAW_MAX / 2 && empty.centreY == JOY_RAW_MAX / 2);
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
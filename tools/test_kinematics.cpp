@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the fixed-point movement (include/kinematics.h).
+//
+// Drives a body through a fixed joystick script in a walled box and checks
+// that it reaches the speed level, slows down and stops when the stick is
+// let go, and never ends up inside a wall. Every tick of the run is hashed
+// and the hash is pinned, so a change to the arithmetic (which would make
+// older and newer devices disagree mid-game) shows up here. Build and run
+// from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_kinematics tools/test_kinematics.cpp
+//     /tmp/test_kinematics
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/kinematics.h"
+
+// Box from (0, 0) to (300, 200) with a pillar in the middle
+static bool blockedAt(int x, int y) {
+    if (x < 0 || y < 0 || x >= 300 || y >= 200) {
+        return true;
+    }
+    return x >= 140 && x < 160 && y >= 60 && y < 140;
+}
+
+struct ScriptStep {
+    int ticks;
+    int axisX;    // stick, -KIN_AXIS_MAX..KIN_AXIS_MAX
+    int axisY;
+};
+
+static const ScriptStep SCRIPT[] = {
+    { 60, 127, 0 },      // full right into the pillar
+    { 30, 0, 0 },        // let go
+    { 40, 60, -127 },    // half right, full up
+    { 80, -127, 127 },   // full left and down into the corner
+    { 25, 0, 0 },
+    { 50, 127, 127 },
+    { 100, -50, 38 },
+};
+
+static const uint32_t EXPECTED_HASH = 0x740a9777UL;
+
+static uint32_t hashMix(uint32_t hash, int32_t value) {
+    hash ^= (uint32_t)value;
+    return hash * 16777619UL;
+}
+
+int main() {
+    uint32_t errors = 0;
+    uint32_t hash = 2166136261UL;
+    int level = 5;
+
+    // Full stick from standing settles on the top speed
+    int32_t v = 0;
+    for (int i = 0; i < 100; i++) {
+        v = stepVelocity(v, KIN_AXIS_MAX, level);
+    }
+    if (v < kinTopSpeed(level) - KIN_ONE / 8 || v > kinTopSpeed(level)) {
+        printf("top speed %ld, expected about %ld\n", (long)v, (long)kinTopSpeed(level));
+        errors++;
+    }
+    // and letting go stops it
+    for (int i = 0; i < 100; i++) {
+        v = stepVelocity(v, 0, level);
+    }
+    if (v != 0) {
+        printf("still moving at %ld after letting go\n", (long)v);
+        errors++;
+    }
+
+    KinematicBody body;
+    placeBody(body, 40, 100);
+    for (unsigned s = 0; s < sizeof(SCRIPT) / sizeof(SCRIPT[0]); s++) {
+        for (int t = 0; t < SCRIPT[s].ticks; t++) {
+            stepBody(body, SCRIPT[s].axisX, SCRIPT[s].axisY, level, blockedAt);
+            if (blockedAt(kinToPixels(body.x), kinToPixels(body.y))) {
+                printf("step %u tick %d: inside a wall at %d,%d\n", s, t,
+                       kinToPixels(body.x), kinToPixels(body.y));
+                errors++;
+            }
+            hash = hashMix(hash, body.x);
+            hash = hashMix(hash, body.y);
+            hash = hashMix(hash, body.vx);
+            hash = hashMix(hash, body.vy);
+        }
+    }
+
+    printf("final %d,%d hash %08lx\n", kinToPixels(body.x), kinToPixels(body.y), (unsigned long)hash);
+    if (hash != EXPECTED_HASH) {
+        printf("hash differs from the pinned %08lx\n", (unsigned long)EXPECTED_HASH);
+        errors++;
+    }
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
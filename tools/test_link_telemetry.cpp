@@ -0,0 +1,133 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the link telemetry (include/link_telemetry.h).
+//
+// Two telemetries ping each other over a link with a fixed delay and check
+// the round trips come out right, that replies older than a link are thrown
+// away, that the percentiles pick the right ranks from a full window, and
+// that the record has the documented layout. Build and run from the
+// repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_link_telemetry tools/test_link_telemetry.cpp
+//     /tmp/test_link_telemetry
+//
+// tools/link_telemetry.py decodes the hex this prints last.
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/link_telemetry.h"
+
+const uint32_t DELAY_MS = 15;   // one way
+const int LINK_SLOTS = 16;
+
+struct InFlight {
+    uint32_t arriveAt;
+    PingPacket packet;
+};
+
+struct Link {
+    InFlight slots[LINK_SLOTS];
+    int count;
+};
+
+static LinkTelemetry a;
+static LinkTelemetry b;
+static Link aToB;
+static Link bToA;
+static uint32_t now = 1000;
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static void linkSend(Link &link, const uint8_t *bytes, size_t length) {
+    expect("a ping has the documented size", length == PING_PACKET_SIZE);
+    if (link.count == LINK_SLOTS) {
+        return;
+    }
+    InFlight &f = link.slots[link.count++];
+    f.arriveAt = now + DELAY_MS;
+    memcpy(f.packet.bytes, bytes, PING_PACKET_SIZE);
+}
+
+static void linkDeliver(Link &link, LinkTelemetry &to) {
+    int kept = 0;
+    for (int i = 0; i < link.count; i++) {
+        if ((int32_t)(now - link.slots[i].arriveAt) >= 0) {
+            receivePingPacket(to, link.slots[i].packet.bytes, PING_PACKET_SIZE);
+        } else {
+            link.slots[kept++] = link.slots[i];
+        }
+    }
+    link.count = kept;
+}
+
+static void sendFromA(const uint8_t *bytes, size_t length) { linkSend(aToB, bytes, length); }
+static void sendFromB(const uint8_t *bytes, size_t length) { linkSend(bToA, bytes, length); }
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int main() {
+    resetLinkTelemetry(a, now);
+    resetLinkTelemetry(b, now);
+
+    // Twenty seconds of pings both ways, 5 ms loops
+    for (int step = 0; step < 4000; step++) {
+        linkDeliver(aToB, b);
+        linkDeliver(bToA, a);
+        servicePings(a, now, sendFromA);
+        servicePings(b, now, sendFromB);
+        now += 5;
+    }
+    LinkReport report;
+    fillLinkReport(report, a, 0, 0);
+    expect("a ping every LINK_PING_MS", a.pingsSent == 20000 / LINK_PING_MS);
+    expect("every ping but the last answered", a.repliesReceived + 1 >= a.pingsSent);
+    expect("the window is full", report.samples == LINK_RTT_WINDOW);
+    expect("round trip is both delays", report.rttMedian >= 2 * DELAY_MS && report.rttMax <= 2 * DELAY_MS + 5);
+
+    // A reply from before a reconnect is not a round trip
+    uint32_t replies = a.repliesReceived;
+    uint8_t old[PING_PACKET_SIZE] = { PING_REPLY, 0, 0, 0, 0, 0 };
+    receivePingPacket(a, old, sizeof(old));
+    a.nextPingMs = now + LINK_PING_MS;
+    servicePings(a, now, sendFromA);
+    expect("stale reply ignored", a.repliesReceived == replies);
+    expect("wrong sizes refused", !receivePingPacket(a, old, sizeof(old) - 1));
+
+    // Percentiles: 1..32 in a scrambled order
+    resetLinkTelemetry(a, now);
+    for (uint32_t i = 0; i < LINK_RTT_WINDOW; i++) {
+        addRttSample(a, 1 + (i * 7) % LINK_RTT_WINDOW);
+    }
+    a.notifyOk = 1234;
+    a.notifyFailed = 5;
+    fillLinkReport(report, a, 900, 100);
+    expect("p50 is the 16th of 32", report.rttMedian == 16);
+    expect("p90 is the 29th of 32", report.rttP90 == 29);
+    expect("p99 and max are the last", report.rttTail == 32 && report.rttMax == 32);
+    addRttSample(a, 500);
+    fillLinkReport(report, a, 900, 100);
+    expect("the oldest sample makes room", report.samples == LINK_RTT_WINDOW && report.rttMax == 500);
+
+    // Layout the host tool decodes
+    uint8_t record[TELEMETRY_RECORD_SIZE];
+    encodeLinkReport(report, record);
+    expect("version first", record[0] == TELEMETRY_VERSION && record[1] == LINK_RTT_WINDOW);
+    expect("max at 8", (record[8] | (record[9] << 8)) == 500);
+    expect("notifications at 18", get32(record + 18) == 1234 && get32(record + 22) == 5);
+    expect("snapshots at 34", get32(record + 34) == 900 && get32(record + 38) == 100);
+
+    printf("telemetry: ");
+    for (uint8_t i = 0; i < TELEMETRY_RECORD_SIZE; i++) {
+        printf("%02x", record[i]);
+    }
+    printf("\n");
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the connection parameter tuning (include/link_tuning.h).
+//
+// Feeds the tuner made-up snapshot counters for clean, slow, lossy and
+// silent windows and checks which parameters it asks for, and that every
+// parameter set is one a controller accepts. Build and run from the
+// repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_link_tuning tools/test_link_tuning.cpp
+//     /tmp/test_link_tuning
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/link_tuning.h"
+
+static LinkTuner tuner;
+static uint32_t now = 0;
+static uint32_t received = 0, lost = 0, rttSamples = 0, rttTotalMs = 0;
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+// One window of snapshots: `count` arrived, `missing` didn't, acked after `rttMs`
+static bool window(uint32_t count, uint32_t missing, uint32_t rttMs) {
+    for (uint32_t ms = 0; ms < LINK_WINDOW_MS; ms += 20) {
+        now += 20;
+        received += count * (ms + 20) / LINK_WINDOW_MS - count * ms / LINK_WINDOW_MS;
+        lost += missing * (ms + 20) / LINK_WINDOW_MS - missing * ms / LINK_WINDOW_MS;
+        if (rttMs) {
+            rttSamples++;
+            rttTotalMs += rttMs;
+        }
+        if (updateLinkTuner(tuner, now, received, lost, rttSamples, rttTotalMs)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The Bluetooth rule: the supervision timeout outlasts two (skipped) intervals
+static bool acceptable(const LinkParams &p) {
+    return p.minInterval >= 6 && p.minInterval <= p.maxInterval && p.maxInterval <= 3200 &&
+           p.latency <= 499 && p.timeout >= 10 && p.timeout <= 3200 &&
+           (uint32_t)p.timeout * 10 * 4 > (1 + (uint32_t)p.latency) * p.maxInterval * 5 * 2;
+}
+
+int main() {
+    resetLinkTuner(tuner, now);
+    expect("a connection asks for the idle parameters", takeLinkRequest(tuner) && !tuner.inGame);
+    expect("only once", !takeLinkRequest(tuner));
+    expect("idle windows don't count", !window(100, 0, 40) && !takeLinkRequest(tuner));
+
+    setLinkInGame(tuner, true);
+    expect("a game asks for the shortest interval", takeLinkRequest(tuner) && tuner.step == 0);
+    setLinkInGame(tuner, true);
+    expect("staying in the game asks for nothing", !takeLinkRequest(tuner));
+
+    // Clean windows relax the interval one step at a time
+    for (int i = 0; i < LINK_CALM_WINDOWS - 1; i++) {
+        expect("a window closes", window(100, 0, 30));
+    }
+    expect("not before enough clean windows", !takeLinkRequest(tuner) && tuner.step == 0);
+    window(100, 0, 30);
+    expect("relaxed a step", takeLinkRequest(tuner) && tuner.step == 1);
+
+    // Middling windows hold the step and restart the count
+    window(100, 0, 70);
+    window(100, 0, 30);
+    window(100, 0, 30);
+    expect("middling window resets the count", !takeLinkRequest(tuner) && tuner.step == 1);
+
+    // A slow window and a lossy one go back towards the shortest
+    window(100, 0, 150);
+    expect("slow window tightens", takeLinkRequest(tuner) && tuner.step == 0 && tuner.rttMs == 150);
+    for (int i = 0; i < LINK_CALM_WINDOWS; i++) {
+        window(100, 0, 30);
+    }
+    takeLinkRequest(tuner);
+    window(80, 20, 30);
+    expect("lossy window tightens", takeLinkRequest(tuner) && tuner.step == 0 && tuner.lossPercent == 20);
+    window(80, 20, 30);
+    expect("nothing shorter than the shortest", !takeLinkRequest(tuner) && tuner.step == 0);
+
+    // Never further than the longest game step
+    for (int i = 0; i < LINK_CALM_WINDOWS * (LINK_GAME_STEPS + 2); i++) {
+        window(100, 0, 20);
+    }
+    expect("stops at the longest game step", tuner.step == LINK_GAME_STEPS - 1);
+    takeLinkRequest(tuner);
+
+    // A silent window changes nothing
+    expect("no samples, no verdict", !window(0, 0, 0) && !takeLinkRequest(tuner));
+
+    setLinkInGame(tuner, false);
+    expect("game over asks for the idle parameters", takeLinkRequest(tuner) &&
+                                                     linkParams(tuner).minInterval == linkIdleParams.minInterval);
+
+    expect("idle parameters are valid", acceptable(linkIdleParams));
+    for (uint8_t i = 0; i < LINK_GAME_STEPS; i++) {
+        expect("game parameters are valid", acceptable(linkGameSteps[i]));
+        expect("game steps get longer", i == 0 || linkGameSteps[i].minInterval > linkGameSteps[i - 1].maxInterval);
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,255 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the lockstep mode (include/lockstep.h).
+//
+// Runs a server and a client session against each other over simulated
+// links that delay and drop packets (seeded, so every run is the same),
+// with loops that run zero to a few ticks. Once the link settles both
+// devices have to hold the exact state a plain stepDuel() run on the
+// inputs they played gives, the state hashes have to have been compared
+// and agreed, and a link within the input delay must hardly ever make
+// anyone wait. A state changed behind the simulation's back has to show
+// up as a desync on both sides. Also checks the integer distance against
+// the floating point one it replaced. Build and run from the repository
+// root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_lockstep tools/test_lockstep.cpp
+//     /tmp/test_lockstep
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "../include/lockstep.h"
+#include "../include/game_tick.h"
+#include "../include/game_tile_map.h"
+
+const uint32_t LOOP_MS = 14;
+const int LINK_SLOTS = 64;
+const uint32_t MAX_TICKS = 20000;
+
+// A one-way link: packets arrive in order after a delay, some never
+struct InFlight {
+    uint32_t arriveAt;
+    uint8_t length;
+    uint8_t bytes[DUEL_PACKET_SIZE];
+};
+
+struct Link {
+    InFlight slots[LINK_SLOTS];
+    int count;
+    int dropPercent;
+    uint32_t delayMs;
+    uint32_t jitterMs;
+    uint32_t lastArrival;
+    uint32_t bytes;
+};
+
+static TileMap map;
+static LockstepSession sessions[2];
+static Link links[2];                       // links[i] carries what session i sends
+static DuelInput played[2][MAX_TICKS];      // the input each player scheduled for each tick
+static uint32_t rngState = 99;
+static uint32_t now = 0;
+static uint32_t errors = 0;
+static int sending = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return (rngState >> 16) & 0x7FFF;
+}
+
+static void sendPacket(const uint8_t *bytes, size_t length) {
+    Link &link = links[sending];
+    expect("packet fits", length <= DUEL_PACKET_SIZE);
+    link.bytes += length;
+    if ((int)(nextRandom() % 100) < link.dropPercent || link.count == LINK_SLOTS) {
+        return;
+    }
+    uint32_t arriveAt = now + link.delayMs + (link.jitterMs ? nextRandom() % link.jitterMs : 0);
+    if (arriveAt < link.lastArrival) {
+        arriveAt = link.lastArrival;   // a BLE link keeps the order
+    }
+    link.lastArrival = arriveAt;
+    InFlight &slot = link.slots[link.count++];
+    slot.arriveAt = arriveAt;
+    slot.length = (uint8_t)length;
+    memcpy(slot.bytes, bytes, length);
+}
+
+static void deliver(int from) {
+    Link &link = links[from];
+    int kept = 0;
+    for (int i = 0; i < link.count; i++) {
+        if (link.slots[i].arriveAt <= now) {
+            receiveLockstepPacket(sessions[1 - from], link.slots[i].bytes, link.slots[i].length);
+        } else {
+            link.slots[kept++] = link.slots[i];
+        }
+    }
+    link.count = kept;
+}
+
+// The server steers at the client, the client wanders
+static DuelInput chooseInput(int side, DuelInput current) {
+    const DuelState &state = sessions[side].state;
+    if (side == 0 && nextRandom() % 3 == 0) {
+        int dx = kinToPixels(state.body[1].x) - kinToPixels(state.body[0].x);
+        int dy = kinToPixels(state.body[1].y) - kinToPixels(state.body[0].y);
+        current.x = dx > 4 ? 127 : dx < -4 ? -127 : 0;
+        current.y = dy > 4 ? 127 : dy < -4 ? -127 : 0;
+    } else if (nextRandom() % 10 == 0) {
+        current.x = (int8_t)((int)(nextRandom() % 255) - 127);
+        current.y = (int8_t)((int)(nextRandom() % 255) - 127);
+    }
+    if (nextRandom() % 300 == 0) {
+        current.level = current.level == 5 ? 1 : current.level + 1;
+    }
+    return current;
+}
+
+/////////////////////////////////////////////////////////////////
+// Plays `loops` loops, then lets the link settle with nobody
+// running past the furthest tick either side reached. Returns
+// that tick.
+/////////////////////////////////////////////////////////////////
+static uint32_t play(uint32_t loops, int dropPercent, uint32_t delayMs, uint32_t jitterMs) {
+    memset(links, 0, sizeof(links));
+    for (int i = 0; i < 2; i++) {
+        links[i].dropPercent = dropPercent;
+        links[i].delayMs = delayMs;
+        links[i].jitterMs = jitterMs;
+        resetLockstep(sessions[i], i, map, 1, 0, 3);   // dragon chases princess
+        for (uint32_t t = 0; t < LOCKSTEP_DELAY; t++) {
+            played[i][t] = sessions[i].inputs[i][t];
+        }
+    }
+    DuelInput input[2] = {{0, 0, 3}, {0, 0, 3}};
+    uint32_t accumulated[2] = {0, 7};
+    uint32_t target = 0;
+
+    for (uint32_t loop = 0; loop < loops + 2000; loop++) {
+        bool settling = loop >= loops;
+        if (settling && !target) {
+            target = sessions[0].state.tick > sessions[1].state.tick ? sessions[0].state.tick
+                                                                      : sessions[1].state.tick;
+            links[0].dropPercent = links[1].dropPercent = 0;
+        }
+        now += LOOP_MS;
+        for (int side = 0; side < 2; side++) {
+            deliver(1 - side);
+            LockstepSession &session = sessions[side];
+            receiveLockstepInputs(session);
+
+            // Ticks due, like advanceTickClock(); now and then a slow loop catches up later
+            accumulated[side] += LOOP_MS;
+            uint32_t due = 0;
+            if (nextRandom() % 20 != 0) {
+                due = accumulated[side] / SIM_TICK_MS;
+                accumulated[side] -= due * SIM_TICK_MS;
+            }
+            if (settling) {
+                due = session.state.tick < target ? target - session.state.tick : 0;
+            } else {
+                input[side] = chooseInput(side, input[side]);
+            }
+
+            uint32_t first = session.scheduled;
+            uint32_t ran = advanceLockstep(session, input[side], due);
+            for (uint32_t t = first; t < first + ran && t < MAX_TICKS; t++) {
+                played[side][t] = input[side];
+            }
+            sending = side;
+            sendLockstepInputs(session, now, sendPacket);
+        }
+    }
+    return target;
+}
+
+static void checkRun(const char *name, uint32_t ticks) {
+    printf("%s: %lu ticks, waited %lu/%lu, %lu/%lu hashes compared, %.1f bytes per tick\n", name,
+           (unsigned long)ticks, (unsigned long)sessions[0].stats.waits, (unsigned long)sessions[1].stats.waits,
+           (unsigned long)sessions[0].stats.checks, (unsigned long)sessions[1].stats.checks,
+           (double)(links[0].bytes + links[1].bytes) / 2 / ticks);
+
+    // The same game from the played inputs, with no link in between
+    DuelState reference;
+    resetDuel(reference, map, 1, 0);
+    while (reference.tick < ticks) {
+        uint32_t t = reference.tick;
+        stepDuel(reference, played[0][t], played[1][t]);
+    }
+
+    for (int side = 0; side < 2; side++) {
+        const LockstepSession &session = sessions[side];
+        expect("settled on the last tick", session.state.tick == ticks);
+        expect("state matches the played inputs", memcmp(&session.state, &reference, sizeof(reference)) == 0);
+        expect("hashes compared", session.stats.checks > ticks / LOCKSTEP_HASH_TICKS / 2);
+        expect("no desync", session.stats.desyncs == 0);
+        expect("no malformed packets", session.stats.malformed == 0);
+    }
+}
+
+int main() {
+    expect("arena map loads", loadTileMap(arenaMapData, arenaMapSize, map));
+
+    // A link well within the input delay: nobody waits
+    uint32_t ticks = play(3000, 0, 15, 10);
+    checkRun("clean", ticks);
+    expect("clean link doesn't wait", sessions[0].stats.waits + sessions[1].stats.waits < 20);
+    expect("a few bytes per tick", (links[0].bytes + links[1].bytes) / 2 / ticks < 16);
+
+    // A typical link: some loss, the resends cover it
+    ticks = play(6000, 10, 40, 30);
+    checkRun("typical", ticks);
+    expect("catch happens on both", sessions[0].state.caught && sessions[1].state.caught &&
+                                    sessions[0].state.caughtTick == sessions[1].state.caughtTick);
+
+    // A bad link: past the delay, so both sides wait but stay together
+    ticks = play(4000, 30, 200, 100);
+    checkRun("bad", ticks);
+    expect("bad link waits", sessions[0].stats.waits > 0 && sessions[1].stats.waits > 0);
+
+    // One side's state nudged: both notice at the next hash
+    play(200, 0, 15, 0);
+    sessions[1].state.body[1].x += 1;
+    for (uint32_t loop = 0; loop < 200; loop++) {
+        now += SIM_TICK_MS;
+        for (int side = 0; side < 2; side++) {
+            deliver(1 - side);
+            receiveLockstepInputs(sessions[side]);
+            advanceLockstep(sessions[side], sessions[side].inputs[side][0], 1);
+            sending = side;
+            sendLockstepInputs(sessions[side], now, sendPacket);
+        }
+    }
+    expect("desync seen on both sides", sessions[0].stats.desyncs > 0 && sessions[1].stats.desyncs > 0);
+    expect("desync seen at the next hash", sessions[0].stats.firstDesyncTick == sessions[1].stats.firstDesyncTick &&
+                                           sessions[0].stats.firstDesyncTick % LOCKSTEP_HASH_TICKS == 0);
+
+    // Packets that don't add up are refused
+    resetLockstep(sessions[0], 0, map, 1, 0, 3);
+    uint8_t junk[DUEL_PACKET_SIZE] = {DUEL_PACKET_VERSION << 4 | 0x08 | 1, 0, 0, 0, 0};
+    receiveLockstepPacket(sessions[0], junk, DUEL_PACKET_HEADER + DUEL_INPUT_SIZE);   // no room for the hash
+    expect("too long refused", !receiveLockstepPacket(sessions[0], junk, DUEL_PACKET_SIZE + 1));
+    receiveLockstepInputs(sessions[0]);
+    expect("bad packets counted", sessions[0].stats.malformed == 1 && sessions[0].confirmed == LOCKSTEP_DELAY);
+
+    // The HUD distance, against the pow()/sqrt() it replaced
+    for (int i = 0; i < 100000; i++) {
+        int ax = nextRandom() % 1024, ay = nextRandom() % 1024, bx = nextRandom() % 1024, by = nextRandom() % 1024;
+        uint32_t expected = (uint32_t)sqrt(pow(ax - bx, 2) + pow(ay - by, 2));
+        if (characterDistance(ax, ay, bx, by) != expected) {
+            expect("integer distance", false);
+            break;
+        }
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
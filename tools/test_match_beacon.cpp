@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the advertising beacon (include/match_beacon.h).
+//
+// Every status a server can be in has to come back out of its bytes the
+// same, together with the service UUID fit one advertising packet, and
+// lead a player or a spectator to the right servers. Manufacturer data
+// from other devices, other versions or cut short has to be ignored. Build
+// and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_match_beacon tools/test_match_beacon.cpp
+//     /tmp/test_match_beacon
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../include/match_beacon.h"
+#include "../include/game_flow.h"
+#include "../include/duel_sim.h"
+#include "../include/spectator_feed.h"
+
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+int main() {
+    // Flags (3), complete 128 bit service list (2 + 16), manufacturer data (2 + payload)
+    expect("fits an advertising packet", 3 + 18 + 2 + MATCH_BEACON_SIZE <= MATCH_BEACON_ADVERTISING_SIZE);
+
+    // Every status round trips
+    uint32_t checked = 0;
+    for (uint8_t mode = NET_SNAPSHOTS; mode <= NET_LOCKSTEP; mode++) {
+        for (uint8_t state = 0; state < S_STATE_COUNT; state++) {
+            for (uint8_t character = 1; character <= 3; character++) {
+                for (uint8_t players = 0; players <= 1; players++) {
+                    for (uint8_t spectators = 0; spectators <= SPECTATOR_MAX; spectators++) {
+                        MatchBeacon beacon = {mode, state, character, players, spectators};
+                        MatchBeacon decoded;
+                        uint8_t bytes[MATCH_BEACON_SIZE];
+                        uint8_t length = encodeMatchBeacon(beacon, bytes);
+                        if (!decodeMatchBeacon(bytes, length, decoded) || !sameMatchBeacon(beacon, decoded)) {
+                            expect("beacon round trips", false);
+                        }
+                        checked++;
+                    }
+                }
+            }
+        }
+    }
+    printf("%lu beacons round tripped\n", (unsigned long)checked);
+
+    // Players go to free servers of their own mode, spectators to games on
+    MatchBeacon waiting = {NET_SNAPSHOTS, S_WAITING, 3, 1, SPECTATOR_MAX};
+    MatchBeacon playing = {NET_SNAPSHOTS, S_GAME, 2, 0, SPECTATOR_MAX};
+    MatchBeacon crowded = {NET_SNAPSHOTS, S_GAME, 1, 0, 0};
+    MatchBeacon lockstep = {NET_LOCKSTEP, S_WAITING, 3, 1, SPECTATOR_MAX};
+    expect("free server joinable", matchBeaconJoinable(waiting, NET_SNAPSHOTS));
+    expect("taken server not joinable", !matchBeaconJoinable(playing, NET_SNAPSHOTS));
+    expect("other mode not joinable", !matchBeaconJoinable(lockstep, NET_SNAPSHOTS) &&
+                                      matchBeaconJoinable(lockstep, NET_LOCKSTEP));
+    expect("game on watchable", matchBeaconWatchable(playing));
+    expect("nothing to watch yet", !matchBeaconWatchable(waiting));
+    expect("full server not watchable", !matchBeaconWatchable(crowded));
+
+    // Anything else is ignored
+    uint8_t bytes[MATCH_BEACON_SIZE + 1];
+    MatchBeacon decoded;
+    encodeMatchBeacon(waiting, bytes);
+    expect("cut short ignored", !decodeMatchBeacon(bytes, MATCH_BEACON_SIZE - 1, decoded));
+    expect("too long ignored", !decodeMatchBeacon(bytes, MATCH_BEACON_SIZE + 1, decoded));
+    uint8_t other[MATCH_BEACON_SIZE] = {0x4C, 0x00, 0x02, 0x15, 0x00, 0x00};   // an iBeacon
+    expect("other company ignored", !decodeMatchBeacon(other, sizeof(other), decoded));
+    bytes[2] ^= 0xFF;
+    expect("other magic ignored", !decodeMatchBeacon(bytes, MATCH_BEACON_SIZE, decoded));
+    bytes[2] ^= 0xFF;
+    bytes[3] = (MATCH_BEACON_VERSION + 1) << 4;
+    expect("other version ignored", !decodeMatchBeacon(bytes, MATCH_BEACON_SIZE, decoded));
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the match recording (include/match_record.h).
+//
+// Plays a match the way a role's loop() does: loops that run zero to a few
+// ticks, a stick that wanders, SELECT presses, an opponent that walks and
+// now and then jumps, and a powerup from the peer. Everything goes into a
+// recorder, and the replay of the recording has to hit every recorded hash.
+// A recording with one input changed has to fail the checks, and one that
+// ran out of room has to replay cleanly up to where it stopped. Build and
+// run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_match_record tools/test_match_record.cpp
+//     /tmp/test_match_record
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/match_record.h"
+#include "../include/game_tile_map.h"
+
+static TileMap map;
+static MatchRecorder recorder;
+static uint32_t rngState = 2024;
+static uint32_t errors = 0;
+
+// The device side
+static KinematicBody body;
+static Powerups powerups;
+static uint32_t tick;
+static int opponentX, opponentY;
+static int character = 1;   // dragon
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return (rngState >> 16) & 0x7FFF;
+}
+
+static bool blocked(int x, int y) {
+    return characterBlocked(map, character, x, y);
+}
+
+/////////////////////////////////////////////////////////////////
+// Plays `loops` loops and returns the number of checks recorded
+/////////////////////////////////////////////////////////////////
+static uint32_t play(uint32_t loops) {
+    memset(&body, 0, sizeof(body));
+    placeBody(body, map.spawnX[SPAWN_SERVER], map.spawnY[SPAWN_SERVER]);
+    resetPowerups(powerups);
+    tick = 0;
+    opponentX = map.spawnX[SPAWN_CLIENT];
+    opponentY = map.spawnY[SPAWN_CLIENT];
+    int moveX = 0, moveY = 0, level = 3;
+    startMatchRecord(recorder, MATCH_ROLE_SERVER, character, 0, level, kinToPixels(body.x), kinToPixels(body.y),
+                     opponentX, opponentY);
+
+    uint32_t checks = 0;
+    for (uint32_t loop = 0; loop < loops; loop++) {
+        // playGame(): the stick, START and SELECT
+        if (nextRandom() % 8 == 0) {
+            moveX = (int)(nextRandom() % 255) - 127;
+            moveY = (int)(nextRandom() % 255) - 127;
+        }
+        if (nextRandom() % 200 == 0) {
+            level = level == 5 ? 1 : level + 1;
+        }
+        bool pressed = nextRandom() % 150 == 0;
+        if (pressed) {
+            pressPowerup(powerups, tick);
+        }
+        recordMatchInput(recorder, tick, moveX, moveY, level, pressed);
+
+        // stepSimulation(): whatever ticks are due
+        uint32_t ticks = nextRandom() % 4 == 0 ? 0 : 1 + nextRandom() % 2;
+        if (nextRandom() % 500 == 0) {
+            ticks = 40;   // a long stall, recorded as a varint
+        }
+        for (uint32_t i = 0; i < ticks; i++) {
+            stepBody(body, moveX, moveY, level, blocked);
+        }
+        tick += ticks;
+        expirePowerups(powerups, tick);
+
+        // The event channel and the snapshots
+        if (nextRandom() % 400 == 0) {
+            ReliableMessage message;
+            message.type = MSG_POWERUP;
+            message.length = POWERUP_MESSAGE_SIZE;
+            encodePowerupMessage(message.payload, 0, tick - 1);
+            startOpponentPowerup(powerups, decodePowerupTick(message.payload, tick));
+            recordMatchMessage(recorder, tick, message);
+        }
+        if (nextRandom() % 2 == 0) {
+            opponentX += (int)(nextRandom() % 7) - 3;
+            opponentY += (int)(nextRandom() % 7) - 3;
+            if (nextRandom() % 100 == 0) {
+                opponentX += 300;   // too far for a step
+            }
+            recordMatchOpponent(recorder, tick, opponentX, opponentY);
+        }
+
+        uint32_t before = recorder.length;
+        recordMatchCheck(recorder, tick, matchStateHash(tick, body, opponentX, opponentY, powerups), 1000);
+        if (recorder.length != before) {
+            checks++;
+        }
+    }
+    recordMatchEnd(recorder, tick, EV_TIME_UP);
+    return checks;
+}
+
+static uint32_t replayedTicks = 0;
+static void countTick(const MatchSim &) {
+    replayedTicks++;
+}
+
+int main() {
+    expect("arena map loads", loadTileMap(arenaMapData, arenaMapSize, map));
+
+    // A two minute match at about 70 loops a second
+    uint32_t checks = play(8000);
+    MatchSim sim;
+    MatchReplayResult result = replayMatch(recorder.bytes, recorder.length, map, sim, countTick, NULL);
+    printf("%lu bytes for %lu ticks, %lu checks\n", (unsigned long)recorder.length, (unsigned long)tick,
+           (unsigned long)result.checks);
+    expect("recording fits", !recorder.truncated);
+    expect("every entry read", result.complete);
+    expect("every check replayed", result.checks == checks && checks > 100);
+    expect("replay matches the device", result.mismatches == 0);
+    expect("replay ends on the same tick", sim.tick == tick && replayedTicks == tick);
+    expect("same body", memcmp(&sim.body, &body, sizeof(body)) == 0);
+    expect("one end, the right one", result.ends == 1 && result.endEvent == EV_TIME_UP);
+
+    // A second end is kept, nothing else after the first
+    uint32_t length = recorder.length;
+    recordMatchOpponent(recorder, tick, opponentX + 1, opponentY);
+    recordMatchInput(recorder, tick, 5, 5, 1, true);
+    expect("nothing after the end", recorder.length == length);
+    recordMatchEnd(recorder, tick, EV_CAUGHT);
+    result = replayMatch(recorder.bytes, recorder.length, map, sim, NULL, NULL);
+    expect("second end recorded", result.ends == 2 && result.endEvent == EV_TIME_UP);
+
+    // A changed input throws the state off
+    uint32_t pos = 1, at = 0;
+    MatchEntry entry;
+    while (readMatchEntry(recorder.bytes, recorder.length, pos, at, entry)) {
+        if (entry.type == MATCH_INPUT && entry.payload[0] != 0) {
+            recorder.bytes[entry.payload - recorder.bytes] ^= 0x40;
+            break;
+        }
+    }
+    result = replayMatch(recorder.bytes, recorder.length, map, sim, NULL, NULL);
+    expect("changed input caught", result.mismatches > 0);
+
+    // Garbage stops the replay
+    result = replayMatch(recorder.bytes, 7, map, sim, NULL, NULL);
+    expect("cut entry is not complete", !result.complete);
+
+    // A match too long for the buffer replays up to where it stopped
+    play(60000);
+    result = replayMatch(recorder.bytes, recorder.length, map, sim, NULL, NULL);
+    expect("long match truncated", recorder.truncated && recorder.length <= MATCH_RECORD_SIZE);
+    expect("truncated match replays", result.complete && result.mismatches == 0 && result.checks > 0);
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
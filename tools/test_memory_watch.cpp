@@ -0,0 +1,168 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the memory watch (include/memory_watch.h).
+//
+// A heap that only wobbles must stay quiet, a slow leak must show up as
+// its rate and sound the alarm while there are still minutes left, and a
+// heap with plenty free in small pieces must count as tight for BLE. Each
+// alarm goes off once however long a value sits on its floor, and clears
+// only once it is well above it. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_memory_watch tools/test_memory_watch.cpp
+//     /tmp/test_memory_watch
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../include/memory_watch.h"
+
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+// A healthy device: 100 KB free, 60 KB of it in one piece, stacks well clear, no PSRAM
+static MemorySample healthy(uint32_t ms) {
+    MemorySample sample;
+    sample.ms = ms;
+    sample.heapFree = 100 * 1024;
+    sample.heapMinFree = 90 * 1024;
+    sample.largestBlock = 60 * 1024;
+    sample.psramSize = 0;
+    sample.psramFree = 0;
+    for (uint8_t t = 0; t < MEM_TASK_COUNT; t++) {
+        sample.stackFree[t] = 2048;
+    }
+    sample.stackFree[MEM_TASK_SPECTATORS] = MEMORY_NO_TASK;
+    return sample;
+}
+
+int main() {
+    srand(7);
+
+    // Wobbling by a couple of KB for an hour: no alarm, no trend
+    {
+        MemoryWatch watch;
+        resetMemoryWatch(watch);
+        uint8_t raised = 0;
+        for (uint32_t i = 0; i < 360; i++) {
+            MemorySample sample = healthy(i * MEMORY_SAMPLE_MS);
+            sample.heapFree += rand() % 4096 - 2048;
+            raised |= updateMemoryWatch(watch, sample).raised;
+        }
+        printf("steady heap: %ld B/min\n", (long)watch.trend);
+        expect("steady heap quiet", raised == 0 && watch.alarms == 0);
+        expect("steady heap no trend", abs(watch.trend) < MEMORY_LEAK_MIN_SLOPE * 2);
+        expect("steady heap not tight", !memoryTight(watch));
+    }
+
+    // Leaking 500 B/min: the rate comes out, the alarm goes off with
+    // under MEMORY_LEAK_HORIZON_MIN minutes left but well before the floor
+    {
+        MemoryWatch watch;
+        resetMemoryWatch(watch);
+        uint32_t raisedAt = 0, minutesLeft = 0, freeAt = 0;
+        for (uint32_t i = 0; i < 1200 && !raisedAt; i++) {
+            MemorySample sample = healthy(i * MEMORY_SAMPLE_MS);
+            sample.heapFree -= i * MEMORY_SAMPLE_MS * 500 / 60000;
+            sample.heapFree += rand() % 512 - 256;
+            MemoryAlarmChange change = updateMemoryWatch(watch, sample);
+            expect("no leak alarm before the window is full", watch.count == MEMORY_WINDOW || !change.raised);
+            if (change.raised & MEM_ALARM_SHRINKING) {
+                raisedAt = sample.ms;
+                minutesLeft = memoryMinutesLeft(watch);
+                freeAt = sample.heapFree;
+            }
+        }
+        printf("leak: %ld B/min, alarm at %lu min with %lu B free, floor in %lu min\n", (long)watch.trend,
+               (unsigned long)(raisedAt / 60000), (unsigned long)freeAt, (unsigned long)minutesLeft);
+        expect("leak rate", watch.trend < -450 && watch.trend > -550);
+        expect("leak alarm raised", raisedAt != 0);
+        expect("leak alarm in time", minutesLeft >= MEMORY_LEAK_HORIZON_MIN - 2 && minutesLeft < MEMORY_LEAK_HORIZON_MIN &&
+                                     freeAt > MEMORY_HEAP_FLOOR);
+        expect("leak alarm alone", watch.alarms == MEM_ALARM_SHRINKING);
+
+        // The leak stops: cleared once the window sees a flat heap
+        uint32_t clearedAfter = 0;
+        for (uint32_t i = 1; i <= MEMORY_WINDOW && !clearedAfter; i++) {
+            MemorySample sample = healthy(raisedAt + i * MEMORY_SAMPLE_MS);
+            sample.heapFree = freeAt;
+            if (updateMemoryWatch(watch, sample).cleared & MEM_ALARM_SHRINKING) {
+                clearedAfter = i;
+            }
+        }
+        expect("leak alarm cleared", clearedAfter != 0 && watch.alarms == 0);
+    }
+
+    // Free heap around its floor: one alarm, cleared a quarter above it
+    {
+        MemoryWatch watch;
+        resetMemoryWatch(watch);
+        const uint32_t levels[] = {30000, 24000, 24800, 24400, 26000, 29000, 31000, 30000};
+        const uint8_t alarmed[] = {0, 1, 1, 1, 1, 1, 0, 0};
+        uint32_t raisedCount = 0, clearedCount = 0;
+        for (uint8_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+            MemorySample sample = healthy(i * MEMORY_SAMPLE_MS);
+            sample.heapFree = sample.largestBlock = levels[i];
+            MemoryAlarmChange change = updateMemoryWatch(watch, sample);
+            raisedCount += (change.raised & MEM_ALARM_HEAP) != 0;
+            clearedCount += (change.cleared & MEM_ALARM_HEAP) != 0;
+            if (((watch.alarms & MEM_ALARM_HEAP) != 0) != alarmed[i]) {
+                expect("heap alarm follows its floor", false);
+            }
+        }
+        expect("heap alarm once", raisedCount == 1 && clearedCount == 1);
+    }
+
+    // Plenty free, all in small pieces: tight for BLE
+    {
+        MemoryWatch watch;
+        resetMemoryWatch(watch);
+        MemorySample sample = healthy(0);
+        sample.largestBlock = 8 * 1024;
+        MemoryAlarmChange change = updateMemoryWatch(watch, sample);
+        expect("fragmented raised", change.raised == MEM_ALARM_BLOCK);
+        expect("fragmentation", memoryFragmentation(sample) == 92);
+        expect("fragmented is tight", memoryTight(watch));
+        sample.largestBlock = 60 * 1024;
+        expect("fragmentation healthy", memoryFragmentation(sample) == 40);
+        change = updateMemoryWatch(watch, sample);
+        expect("fragmented cleared", change.cleared == MEM_ALARM_BLOCK && !memoryTight(watch));
+    }
+
+    // Stacks: each task that goes low is named once; one that isn't running never is
+    {
+        MemoryWatch watch;
+        resetMemoryWatch(watch);
+        MemorySample sample = healthy(0);
+        sample.stackFree[MEM_TASK_BLE] = 300;
+        MemoryAlarmChange change = updateMemoryWatch(watch, sample);
+        expect("stack raised", change.raised == MEM_ALARM_STACK && change.stacksRaised == 1 << MEM_TASK_BLE);
+        sample.stackFree[MEM_TASK_RENDER] = 200;
+        change = updateMemoryWatch(watch, sample);
+        expect("second stack named", change.raised == 0 && change.stacksRaised == 1 << MEM_TASK_RENDER);
+        change = updateMemoryWatch(watch, sample);
+        expect("stacks named once", change.raised == 0 && change.stacksRaised == 0);
+        expect("stack low is not tight", !memoryTight(watch));
+        sample.stackFree[MEM_TASK_BLE] = sample.stackFree[MEM_TASK_RENDER] = 2048;
+        change = updateMemoryWatch(watch, sample);
+        expect("stack cleared", change.cleared == MEM_ALARM_STACK && watch.stacksLow == 0);
+    }
+
+    // PSRAM: only watched where there is some
+    {
+        MemoryWatch watch;
+        resetMemoryWatch(watch);
+        MemorySample sample = healthy(0);
+        expect("no psram quiet", updateMemoryWatch(watch, sample).raised == 0);
+        sample.psramSize = 4 * 1024 * 1024;
+        sample.psramFree = 32 * 1024;
+        expect("psram low", updateMemoryWatch(watch, sample).raised == MEM_ALARM_PSRAM);
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the object pool (include/object_pool.h).
+//
+// Every object handed out must be built once and destroyed once, in a
+// properly aligned slot of the pool's own storage; a full pool must say
+// no instead of growing, and anything released must be reusable. The
+// client's rescan pattern (take the new server, give back the last one)
+// has to run forever on two slots. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_object_pool tools/test_object_pool.cpp
+//     /tmp/test_object_pool
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/object_pool.h"
+
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static int32_t alive = 0;
+
+// Stands in for a discovered server: no default constructor, wants alignment
+struct Record {
+    Record(uint32_t id, double rssi) : id(id), rssi(rssi) { alive++; }
+    ~Record() { alive--; }
+    uint32_t id;
+    double rssi;
+    uint64_t stamp;
+};
+
+int main() {
+    {
+        ObjectPool<Record, 3> pool;
+        Record *a = pool.acquire(1, -40.0);
+        Record *b = pool.acquire(2, -50.0);
+        Record *c = pool.acquire(3, -60.0);
+        expect("built with its arguments", a && b && c && a->id == 1 && b->id == 2 && c->rssi == -60.0);
+        expect("three alive", alive == 3 && pool.inUse() == 3);
+        expect("aligned", (uintptr_t)a % alignof(Record) == 0 && (uintptr_t)b % alignof(Record) == 0 &&
+                          (uintptr_t)c % alignof(Record) == 0);
+        expect("in the pool", (uint8_t *)a >= (uint8_t *)&pool && (uint8_t *)c < (uint8_t *)&pool + sizeof(pool));
+
+        expect("full pool says no", pool.acquire(4, 0.0) == NULL && pool.exhausted() == 1 && alive == 3);
+
+        pool.release(b);
+        expect("released destroyed", alive == 2 && pool.inUse() == 2);
+        Record *d = pool.acquire(5, -70.0);
+        expect("slot reused", d == b && d->id == 5 && alive == 3);
+
+        Record stranger(9, 0.0);
+        pool.release(&stranger);
+        pool.release(NULL);
+        expect("strangers ignored", alive == 4 && pool.inUse() == 3);
+        pool.release(a);
+        pool.release(a);
+        expect("released once", alive == 3 && pool.inUse() == 2);
+    }
+    expect("pool destroys what is left", alive == 0);
+
+    // Rescans: a new server each time, the last one given back after
+    {
+        ObjectPool<Record, 2> servers;
+        Record *current = NULL;
+        uint32_t cycles = 0;
+        for (uint32_t i = 0; i < 10000; i++) {
+            Record *found = servers.acquire(i, -55.0);
+            if (found == NULL) {
+                break;
+            }
+            servers.release(current);
+            current = found;
+            cycles++;
+        }
+        expect("rescans never run out", cycles == 10000 && servers.exhausted() == 0);
+        expect("only the current one alive", alive == 1 && servers.inUse() == 1 && current->id == 9999);
+    }
+    expect("rescan pool empty", alive == 0);
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
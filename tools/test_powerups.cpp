@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the powerup timers (include/powerups.h).
+//
+// Checks the press rules (count, cooldown, one at a time), that a powerup
+// ends on the same tick on both devices however late the peer hears about
+// it, and that start ticks survive the 16 bit trip through a message.
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_powerups tools/test_powerups.cpp
+//     /tmp/test_powerups
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/powerups.h"
+
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+int main() {
+    Powerups local;
+    Powerups remote;
+    resetPowerups(local);
+    resetPowerups(remote);
+
+    // First press starts one; presses during the cooldown and while it runs don't
+    expect("first press starts a powerup", pressPowerup(local, 100));
+    expect("press during the cooldown is ignored", !pressPowerup(local, 100 + POWERUP_COOLDOWN_TICKS - 1));
+    expect("press while running is ignored", !pressPowerup(local, 100 + POWERUP_COOLDOWN_TICKS));
+    expect("only one used", local.left == POWERUPS_PER_GAME - 1);
+
+    // The peer hears about it 7 ticks late; both end on the same tick
+    uint8_t payload[POWERUP_MESSAGE_SIZE];
+    encodePowerupMessage(payload, 2, local.own.startTick);
+    startOpponentPowerup(remote, decodePowerupTick(payload, 107));
+    uint32_t endTick = 100 + POWERUP_TICKS;
+    expect("running on the last tick", isPowerupActive(local.own, endTick - 1) &&
+                                       isPowerupActive(remote.opponent, endTick - 1));
+    expect("peer's copy not ended early", !expirePowerups(remote, endTick - 1) && remote.opponent.active);
+    expect("own powerup reports its end", expirePowerups(local, endTick));
+    expirePowerups(remote, endTick);
+    expect("peer's copy ends on the same tick", !remote.opponent.active);
+
+    // A message that arrives after the powerup is over never shows
+    startOpponentPowerup(remote, decodePowerupTick(payload, endTick + 20));
+    expirePowerups(remote, endTick + 20);
+    expect("stale powerup is dropped", !remote.opponent.active);
+
+    // A peer a tick ahead: the start is in our future but counts already
+    PowerupTimer ahead = { 1, 502 };
+    expect("start tick slightly ahead counts", isPowerupActive(ahead, 500));
+
+    // Start ticks near a 16 bit wrap decode to the closest full tick
+    uint32_t starts[] = { 0, 65535, 65536, 70000, 131071 };
+    for (unsigned i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+        encodePowerupMessage(payload, 1, starts[i]);
+        for (int late = -3; late <= 300; late += 101) {
+            uint32_t now = starts[i] + late;
+            if (decodePowerupTick(payload, now) != starts[i]) {
+                printf("start %lu decoded at %lu as %lu\n", (unsigned long)starts[i], (unsigned long)now,
+                       (unsigned long)decodePowerupTick(payload, now));
+                errors++;
+            }
+        }
+    }
+
+    // All of them used up
+    uint32_t tick = 1000;
+    int started = 0;
+    for (int i = 0; i < 10; i++) {
+        started += pressPowerup(local, tick) ? 1 : 0;
+        tick += POWERUP_TICKS;
+        expirePowerups(local, tick);
+    }
+    expect("no more than a game's worth", started == POWERUPS_PER_GAME - 1 && local.left == 0);
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
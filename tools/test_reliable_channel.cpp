@@ -0,0 +1,157 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the reliable message channel (include/reliable_channel.h).
+//
+// Connects two channels through simulated links that drop, delay and
+// duplicate packets (seeded, so every run is the same) and sends a burst
+// of numbered messages each way. Every message has to arrive exactly once
+// and in order, and both outboxes have to drain. Build and run from the
+// repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_reliable_channel tools/test_reliable_channel.cpp
+//     /tmp/test_reliable_channel
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/reliable_channel.h"
+
+const int MESSAGES = 200;
+const uint32_t LOOP_MS = 10;
+const int LINK_SLOTS = 64;
+
+// A one-way link: packets arrive in order after a delay, some never
+// (BLE itself doesn't reorder, it loses writes and notifications)
+struct InFlight {
+    uint32_t arriveAt;
+    ReliablePacket packet;
+};
+
+struct Link {
+    InFlight slots[LINK_SLOTS];
+    int count;
+    int dropPercent;
+    uint32_t lastArrival;
+};
+
+static uint32_t rngState = 12345;
+static uint32_t now = 0;
+static uint32_t errors = 0;
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return (rngState >> 16) & 0x7FFF;
+}
+
+static void linkSend(Link &link, const uint8_t *bytes, size_t length) {
+    int copies = (nextRandom() % 100 < 5) ? 2 : 1;   // duplicated now and then
+    for (int c = 0; c < copies; c++) {
+        if ((int)(nextRandom() % 100) < link.dropPercent || link.count == LINK_SLOTS) {
+            continue;
+        }
+        InFlight &f = link.slots[link.count++];
+        f.arriveAt = now + 10 + nextRandom() % 60;
+        if ((int32_t)(f.arriveAt - link.lastArrival) < 0) {
+            f.arriveAt = link.lastArrival;
+        }
+        link.lastArrival = f.arriveAt;
+        f.packet.length = (uint8_t)length;
+        memcpy(f.packet.bytes, bytes, length);
+    }
+}
+
+// Hands the packets that have arrived to the receiving channel
+static void linkDeliver(Link &link, ReliableChannel &to) {
+    int kept = 0;
+    for (int i = 0; i < link.count; i++) {
+        if ((int32_t)(now - link.slots[i].arriveAt) >= 0) {
+            receiveReliablePacket(to, link.slots[i].packet.bytes, link.slots[i].packet.length);
+        } else {
+            link.slots[kept++] = link.slots[i];
+        }
+    }
+    link.count = kept;
+}
+
+static ReliableChannel a;
+static ReliableChannel b;
+static Link aToB;
+static Link bToA;
+static int receivedByA = 0;
+static int receivedByB = 0;
+
+static void sendFromA(const uint8_t *bytes, size_t length) { linkSend(aToB, bytes, length); }
+static void sendFromB(const uint8_t *bytes, size_t length) { linkSend(bToA, bytes, length); }
+
+static void checkMessage(const char *who, int &received, const ReliableMessage &message) {
+    int value = message.payload[0] | (message.payload[1] << 8);
+    if (message.type != MSG_GAME_STATE || message.length != 2 || value != received) {
+        printf("%s: got type %d value %d, expected message %d\n", who, message.type, value, received);
+        errors++;
+    }
+    received++;
+}
+
+static void deliverToA(const ReliableMessage &message) { checkMessage("a", receivedByA, message); }
+static void deliverToB(const ReliableMessage &message) { checkMessage("b", receivedByB, message); }
+
+static void run(int dropPercent, uint32_t maxMs) {
+    resetReliableChannel(a);
+    resetReliableChannel(b);
+    memset(&a.stats, 0, sizeof(a.stats));
+    memset(&b.stats, 0, sizeof(b.stats));
+    aToB.count = bToA.count = 0;
+    aToB.dropPercent = bToA.dropPercent = dropPercent;
+    receivedByA = receivedByB = 0;
+
+    int queuedByA = 0, queuedByB = 0;
+    uint32_t end = now + maxMs;
+    while ((int32_t)(now - end) < 0 && (receivedByA < MESSAGES || receivedByB < MESSAGES ||
+                                        reliableUnacked(a) || reliableUnacked(b))) {
+        // Bursts of up to three messages, as many as the outboxes take
+        for (int i = nextRandom() % 4; i > 0 && queuedByA < MESSAGES; i--) {
+            uint8_t payload[2] = { (uint8_t)queuedByA, (uint8_t)(queuedByA >> 8) };
+            if (sendReliableMessage(a, MSG_GAME_STATE, payload, 2)) {
+                queuedByA++;
+            }
+        }
+        for (int i = nextRandom() % 4; i > 0 && queuedByB < MESSAGES; i--) {
+            uint8_t payload[2] = { (uint8_t)queuedByB, (uint8_t)(queuedByB >> 8) };
+            if (sendReliableMessage(b, MSG_GAME_STATE, payload, 2)) {
+                queuedByB++;
+            }
+        }
+        linkDeliver(aToB, b);
+        linkDeliver(bToA, a);
+        serviceReliableChannel(a, now, sendFromA, deliverToA);
+        serviceReliableChannel(b, now, sendFromB, deliverToB);
+        now += LOOP_MS;
+    }
+
+    printf("drop %2d%%: %d/%d delivered to b, %d/%d to a, a sent %lu (%lu resent), b sent %lu (%lu resent)\n",
+           dropPercent, receivedByB, MESSAGES, receivedByA, MESSAGES,
+           (unsigned long)a.stats.sent, (unsigned long)a.stats.resent,
+           (unsigned long)b.stats.sent, (unsigned long)b.stats.resent);
+    if (receivedByA != MESSAGES || receivedByB != MESSAGES || reliableUnacked(a) || reliableUnacked(b)) {
+        printf("  not everything arrived and was acked\n");
+        errors++;
+    }
+}
+
+int main() {
+    run(0, 60000);
+    run(10, 120000);
+    run(40, 600000);
+
+    // A packet with a payload longer than it says is refused
+    resetReliableChannel(b);
+    uint8_t broken[] = { 0, 0, MSG_GAME_STATE, 4, 1 };
+    receiveReliablePacket(b, broken, sizeof(broken));
+    uint32_t malformed = b.stats.malformed;
+    serviceReliableChannel(b, now, sendFromB, deliverToB);
+    if (b.stats.malformed != malformed + 1) {
+        printf("short packet was not refused\n");
+        errors++;
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
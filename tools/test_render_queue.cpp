@@ -0,0 +1,158 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host stress test for the render queue (include/render_queue.h).
+//
+// One pthread produces numbered items as fast as it can and another
+// consumes them, the same way loop() and the render task share the queue
+// on the two ESP32 cores. Every item must arrive exactly once and in order,
+// and pushes that fail because the queue is full must show up as drops.
+// The render task's coalescing (include/draw_command.h) must draw only the
+// newest frame, and a repaint a skipped frame asked for must not be lost.
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -pthread -o /tmp/test_render_queue tools/test_render_queue.cpp
+//     /tmp/test_render_queue
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../include/render_queue.h"
+#include "../include/draw_command.h"
+
+static const uint32_t ITEMS = 2000000;
+
+// Big enough that a torn copy would be noticed
+struct Item {
+    uint32_t sequence;
+    uint32_t check[7];
+};
+
+static RenderQueue<Item, 16> queue;
+static uint32_t failedPushes = 0;
+static uint32_t errors = 0;
+
+static void *producer(void *) {
+    for (uint32_t i = 0; i < ITEMS; i++) {
+        Item item;
+        item.sequence = i;
+        for (int c = 0; c < 7; c++) {
+            item.check[c] = i * 31 + c;
+        }
+        while (!queue.push(item)) {
+            failedPushes++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *) {
+    uint32_t expected = 0;
+    Item item;
+    while (expected < ITEMS) {
+        const Item *next = queue.peek();
+        if (next == NULL) {
+            sched_yield();
+            continue;
+        }
+        uint32_t peeked = next->sequence;
+        if (!queue.pop(item)) {
+            errors++;
+            break;
+        }
+        if (item.sequence != expected || peeked != expected) {
+            errors++;
+        }
+        for (int c = 0; c < 7; c++) {
+            if (item.check[c] != item.sequence * 31 + c) {
+                errors++;
+            }
+        }
+        expected = item.sequence + 1;
+    }
+    return NULL;
+}
+
+static void pushFrame(RenderQueue<DrawCommand, 16> &commands, int16_t x, uint8_t forceRedraw) {
+    DrawCommand command = DrawCommand();
+    command.type = DRAW_FRAME;
+    command.frame.x = x;
+    command.frame.forceRedraw = forceRedraw;
+    commands.push(command);
+}
+
+static void drawNothing() {}
+
+// Drains the queue; the frames drawn, the last one's x and full redraws
+static uint32_t drain(RenderQueue<DrawCommand, 16> &commands, FrameCoalescer &coalescer,
+                      int16_t &lastX, uint32_t &fullRedraws) {
+    DrawCommand command;
+    bool fullRedraw;
+    uint32_t drawn = 0;
+    fullRedraws = 0;
+    while (nextDrawCommand(commands, coalescer, command, fullRedraw)) {
+        if (command.type == DRAW_FRAME) {
+            drawn++;
+            lastX = command.frame.x;
+            fullRedraws += fullRedraw;
+        }
+    }
+    return drawn;
+}
+
+static void checkCoalescing() {
+    static RenderQueue<DrawCommand, 16> commands;
+    FrameCoalescer coalescer;
+    resetFrameCoalescer(coalescer);
+    int16_t lastX = 0;
+    uint32_t fullRedraws = 0;
+
+    // The first frame after setup()'s screen repaints everything
+    pushFrame(commands, 1, 0);
+    if (drain(commands, coalescer, lastX, fullRedraws) != 1 || fullRedraws != 1) {
+        errors++;
+    }
+
+    // Behind: only the newest is drawn, and the repaint the oldest asked for comes with it
+    pushFrame(commands, 2, 1);
+    pushFrame(commands, 3, 0);
+    pushFrame(commands, 4, 0);
+    if (drain(commands, coalescer, lastX, fullRedraws) != 1 || lastX != 4 || fullRedraws != 1 ||
+            coalescer.coalesced != 2) {
+        errors++;
+    }
+
+    // ...once: the frame after that only draws what changed
+    pushFrame(commands, 5, 0);
+    if (drain(commands, coalescer, lastX, fullRedraws) != 1 || fullRedraws != 0) {
+        errors++;
+    }
+
+    // A screen in between is drawn, and the frame after it repaints
+    pushFrame(commands, 6, 0);
+    DrawCommand screen = DrawCommand();
+    screen.type = DRAW_SCREEN;
+    screen.screen = drawNothing;
+    commands.push(screen);
+    pushFrame(commands, 7, 0);
+    if (drain(commands, coalescer, lastX, fullRedraws) != 2 || lastX != 7 || fullRedraws != 1) {
+        errors++;
+    }
+}
+
+int main() {
+    pthread_t producerThread, consumerThread;
+    pthread_create(&consumerThread, NULL, consumer, NULL);
+    pthread_create(&producerThread, NULL, producer, NULL);
+    pthread_join(producerThread, NULL);
+    pthread_join(consumerThread, NULL);
+    checkCoalescing();
+
+    if (failedPushes != queue.drops() || queue.depth() != 0 || queue.maxDepth() > queue.capacity()) {
+        errors++;
+    }
+    printf("items %u, full pushes %u (drops %u), max depth %u/%u\n",
+           ITEMS, failedPushes, queue.drops(), queue.maxDepth(), queue.capacity());
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
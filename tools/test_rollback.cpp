@@ -0,0 +1,254 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the rollback netcode (include/rollback.h).
+//
+// Runs a server and a client session against each other over simulated
+// links that delay, reorder-free, and drop packets (seeded, so every run is
+// the same). The server chases what it sees of the client and the client
+// wanders, both with loops that run zero to a few ticks. Once the link
+// settles, both devices have to hold the exact state a plain stepDuel() run
+// on the true inputs gives, both have to confirm the same catch, a catch
+// must never be confirmed that the true inputs don't produce, and no
+// correction may reach further back than the window. Build and run from
+// the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_rollback tools/test_rollback.cpp
+//     /tmp/test_rollback
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "../include/rollback.h"
+#include "../include/game_tick.h"
+#include "../include/game_tile_map.h"
+
+const uint32_t LOOP_MS = 14;
+const int LINK_SLOTS = 64;
+const uint32_t MAX_TICKS = 20000;
+
+// A one-way link: packets arrive in order after a delay, some never
+struct InFlight {
+    uint32_t arriveAt;
+    uint8_t length;
+    uint8_t bytes[DUEL_PACKET_SIZE];
+};
+
+struct Link {
+    InFlight slots[LINK_SLOTS];
+    int count;
+    int dropPercent;
+    uint32_t delayMs;
+    uint32_t jitterMs;
+    uint32_t lastArrival;
+};
+
+static TileMap map;
+static RollbackSession sessions[2];
+static Link links[2];                       // links[i] carries what session i sends
+static DuelInput truth[2][MAX_TICKS];       // what each player really did on each tick
+static uint32_t rngState = 77;
+static uint32_t now = 0;
+static uint32_t errors = 0;
+static int sending = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return (rngState >> 16) & 0x7FFF;
+}
+
+static void sendPacket(const uint8_t *bytes, size_t length) {
+    Link &link = links[sending];
+    expect("packet fits", length <= DUEL_PACKET_SIZE);
+    if ((int)(nextRandom() % 100) < link.dropPercent || link.count == LINK_SLOTS) {
+        return;
+    }
+    uint32_t arriveAt = now + link.delayMs + (link.jitterMs ? nextRandom() % link.jitterMs : 0);
+    if (arriveAt < link.lastArrival) {
+        arriveAt = link.lastArrival;   // a BLE link keeps the order
+    }
+    link.lastArrival = arriveAt;
+    InFlight &slot = link.slots[link.count++];
+    slot.arriveAt = arriveAt;
+    slot.length = (uint8_t)length;
+    memcpy(slot.bytes, bytes, length);
+}
+
+static void deliver(int from) {
+    Link &link = links[from];
+    int kept = 0;
+    for (int i = 0; i < link.count; i++) {
+        if (link.slots[i].arriveAt <= now) {
+            receiveRollbackPacket(sessions[1 - from], link.slots[i].bytes, link.slots[i].length);
+        } else {
+            link.slots[kept++] = link.slots[i];
+        }
+    }
+    link.count = kept;
+}
+
+// The server steers at where it sees the client, the client wanders
+static DuelInput chooseInput(int side, DuelInput current) {
+    const DuelState &state = sessions[side].state;
+    if (side == 0 && nextRandom() % 3 == 0) {
+        int dx = kinToPixels(state.body[1].x) - kinToPixels(state.body[0].x);
+        int dy = kinToPixels(state.body[1].y) - kinToPixels(state.body[0].y);
+        current.x = dx > 4 ? 127 : dx < -4 ? -127 : 0;
+        current.y = dy > 4 ? 127 : dy < -4 ? -127 : 0;
+    } else if (nextRandom() % 10 == 0) {
+        current.x = (int8_t)((int)(nextRandom() % 255) - 127);
+        current.y = (int8_t)((int)(nextRandom() % 255) - 127);
+    }
+    if (nextRandom() % 300 == 0) {
+        current.level = current.level == 5 ? 1 : current.level + 1;
+    }
+    return current;
+}
+
+struct RunResult {
+    uint32_t ticks;
+    uint32_t confirmedCatch[2];   // tick of the catch each side confirmed, 0 if none
+    double advanceUs;
+    double worstUs;
+    uint32_t advances;
+};
+
+/////////////////////////////////////////////////////////////////
+// Plays `loops` loops, then lets the link settle with nobody
+// adding ticks past the furthest one either side reached
+/////////////////////////////////////////////////////////////////
+static RunResult play(uint32_t loops, int dropPercent, uint32_t delayMs, uint32_t jitterMs) {
+    RunResult result;
+    memset(&result, 0, sizeof(result));
+    memset(links, 0, sizeof(links));
+    for (int i = 0; i < 2; i++) {
+        links[i].dropPercent = dropPercent;
+        links[i].delayMs = delayMs;
+        links[i].jitterMs = jitterMs;
+        resetRollback(sessions[i], i, map, 1, 0, 3);   // dragon chases princess
+    }
+    DuelInput input[2] = {{0, 0, 3}, {0, 0, 3}};
+    uint32_t accumulated[2] = {0, 7};
+    uint32_t target = 0;
+
+    for (uint32_t loop = 0; loop < loops + 2000; loop++) {
+        bool settling = loop >= loops;
+        if (settling && !target) {
+            target = sessions[0].state.tick > sessions[1].state.tick ? sessions[0].state.tick
+                                                                      : sessions[1].state.tick;
+            links[0].dropPercent = links[1].dropPercent = 0;
+        }
+        now += LOOP_MS;
+        for (int side = 0; side < 2; side++) {
+            deliver(1 - side);
+            RollbackSession &session = sessions[side];
+            receiveRollbackInputs(session);
+
+            // Ticks due, like advanceTickClock(); now and then a slow loop catches up later
+            accumulated[side] += LOOP_MS;
+            uint32_t due = 0;
+            if (nextRandom() % 20 != 0) {
+                due = accumulated[side] / SIM_TICK_MS;
+                accumulated[side] -= due * SIM_TICK_MS;
+            }
+            if (settling) {
+                due = session.state.tick < target ? target - session.state.tick : 0;
+                input[side] = truth[side][session.state.tick ? session.state.tick - 1 : 0];
+            } else {
+                input[side] = chooseInput(side, input[side]);
+            }
+
+            uint32_t first = session.state.tick;
+            clock_t start = clock();
+            uint32_t ran = advanceRollback(session, input[side], due);
+            double us = (double)(clock() - start) * 1e6 / CLOCKS_PER_SEC;
+            result.advanceUs += us;
+            result.advances++;
+            if (us > result.worstUs) {
+                result.worstUs = us;
+            }
+            for (uint32_t t = first; t < first + ran && t < MAX_TICKS; t++) {
+                truth[side][t] = input[side];
+            }
+            if (!result.confirmedCatch[side] && rollbackCaught(session)) {
+                result.confirmedCatch[side] = session.state.caughtTick;
+            }
+            sending = side;
+            sendRollbackInputs(session, now, sendPacket);
+        }
+    }
+    result.ticks = target;
+    return result;
+}
+
+static void checkRun(const char *name, const RunResult &result) {
+    printf("%s: %lu ticks, rollbacks %lu/%lu, %lu ticks resimulated, deepest %lu, stalls %lu/%lu, "
+           "%.2f us per advance (worst %.0f)\n",
+           name, (unsigned long)result.ticks, (unsigned long)sessions[0].stats.rollbacks,
+           (unsigned long)sessions[1].stats.rollbacks,
+           (unsigned long)(sessions[0].stats.resimulated + sessions[1].stats.resimulated),
+           (unsigned long)(sessions[0].stats.deepest > sessions[1].stats.deepest ? sessions[0].stats.deepest
+                                                                                  : sessions[1].stats.deepest),
+           (unsigned long)sessions[0].stats.stalls, (unsigned long)sessions[1].stats.stalls,
+           result.advanceUs / result.advances, result.worstUs);
+
+    // The same game from the true inputs, with no link in between
+    DuelState reference;
+    resetDuel(reference, map, 1, 0);
+    uint32_t trueCatch = 0;
+    while (reference.tick < result.ticks) {
+        uint32_t t = reference.tick;
+        stepDuel(reference, truth[0][t], truth[1][t]);
+        if (reference.caught && !trueCatch) {
+            trueCatch = reference.caughtTick;
+        }
+    }
+
+    for (int side = 0; side < 2; side++) {
+        const RollbackSession &session = sessions[side];
+        expect("settled on the last tick", session.state.tick == result.ticks && session.confirmed == result.ticks);
+        expect("state matches the true inputs", memcmp(&session.state, &reference, sizeof(reference)) == 0);
+        expect("never rewinds past the window", session.stats.deepest <= ROLLBACK_WINDOW);
+        expect("no malformed packets", session.stats.malformed == 0);
+        expect("confirmed catch is the real one", result.confirmedCatch[side] == trueCatch);
+    }
+    expect("both sides confirm the same catch", result.confirmedCatch[0] == result.confirmedCatch[1]);
+}
+
+int main() {
+    expect("arena map loads", loadTileMap(arenaMapData, arenaMapSize, map));
+
+    // A clean, fast link: corrections are rare and shallow
+    RunResult clean = play(3000, 0, 15, 0);
+    checkRun("clean", clean);
+    expect("clean link barely stalls", sessions[0].stats.stalls + sessions[1].stats.stalls < 20);
+
+    // A typical link: 60 ms with jitter and some loss
+    RunResult typical = play(6000, 10, 60, 40);
+    checkRun("typical", typical);
+    expect("typical link rolls back", sessions[0].stats.rollbacks > 0 && sessions[1].stats.rollbacks > 0);
+    expect("a catch happens", typical.confirmedCatch[0] != 0);
+
+    // A bad link: past the window, so the sessions have to wait
+    RunResult bad = play(4000, 30, 200, 100);
+    checkRun("bad", bad);
+    expect("bad link stalls", sessions[0].stats.stalls > 0);
+
+    // Packets that don't add up are refused
+    resetRollback(sessions[0], 0, map, 1, 0, 3);
+    uint8_t junk[DUEL_PACKET_SIZE] = {DUEL_PACKET_VERSION << 4 | 3, 0, 0, 0, 0};
+    receiveRollbackPacket(sessions[0], junk, DUEL_PACKET_HEADER + 2 * DUEL_INPUT_SIZE);
+    junk[0] = 0x21;
+    receiveRollbackPacket(sessions[0], junk, DUEL_PACKET_HEADER + DUEL_INPUT_SIZE);
+    expect("too long refused", !receiveRollbackPacket(sessions[0], junk, DUEL_PACKET_SIZE + 1));
+    receiveRollbackInputs(sessions[0]);
+    expect("bad packets counted", sessions[0].stats.malformed == 2 && sessions[0].confirmed == 0);
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the spectator feed (include/spectator_feed.h).
+//
+// Plays a made-up match into a feed and fans every frame it builds out to
+// a few spectators over links that lose frames at different rates
+// (seeded, so every run is the same), one of them joining late. Every
+// frame has to fit one notification, the feed must keep to its rate and
+// stay quiet while nothing changes, and a spectator that holds a frame
+// must hold exactly what the server had in it. A spectator that missed a
+// frame has to be back with the next keyframe it gets. Build and run from
+// the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_spectator_feed tools/test_spectator_feed.cpp
+//     /tmp/test_spectator_feed
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/spectator_feed.h"
+
+const uint32_t LOOP_MS = 14;
+const int SPECTATORS = 3;
+
+static uint32_t rngState = 45;
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return (rngState >> 16) & 0x7FFF;
+}
+
+// The match as the server has it on each loop
+struct Match {
+    int x[2], y[2];
+    uint32_t timer;
+    uint8_t left[2];
+    uint8_t active;
+};
+
+static void takeFrame(const Match &match, SpectatorFrame &frame) {
+    setSpectatorField(frame, SPF_STATE, spectatorStateField(3, 2, 1));
+    setSpectatorField(frame, SPF_SERVER_X, match.x[0]);
+    setSpectatorField(frame, SPF_SERVER_Y, match.y[0]);
+    setSpectatorField(frame, SPF_CLIENT_X, match.x[1]);
+    setSpectatorField(frame, SPF_CLIENT_Y, match.y[1]);
+    setSpectatorField(frame, SPF_TIMER, match.timer);
+    setSpectatorField(frame, SPF_POWERUPS_LEFT, match.left[0] << 4 | match.left[1]);
+    setSpectatorField(frame, SPF_POWERUPS_ACTIVE, match.active);
+}
+
+static void moveMatch(Match &match, uint32_t now) {
+    for (int i = 0; i < 2; i++) {
+        match.x[i] += (int)(nextRandom() % 7) - 3;
+        match.y[i] += (int)(nextRandom() % 7) - 3;
+        if (nextRandom() % 200 == 0) {
+            match.x[i] += 300;   // a teleport: too far for one byte
+        }
+    }
+    match.timer = (120000 - now) / 100;
+    if (nextRandom() % 400 == 0 && match.left[0]) {
+        match.left[0]--;
+        match.active ^= 1;
+    }
+}
+
+int main() {
+    SpectatorFeed feed;
+    SpectatorView views[SPECTATORS];
+    int dropPercent[SPECTATORS] = {0, 10, 40};
+    uint32_t joinAt[SPECTATORS] = {0, 0, 20000};
+    uint32_t waiting[SPECTATORS] = {0, 0, 0};       // frames in a row that couldn't be decoded
+    uint32_t longestWait[SPECTATORS] = {0, 0, 0};
+    uint32_t recovered[SPECTATORS] = {0, 0, 0};
+    uint32_t lastGood[SPECTATORS] = {0, 0, 0};
+    resetSpectatorFeed(feed);
+    memset(views, 0, sizeof(views));
+
+    Match match = {{100, 400}, {100, 300}, 1200, {3, 3}, 0};
+    uint32_t lastFrameMs = 0;
+    uint32_t now = 0;
+    uint32_t endAt = 110000;
+    for (; now < endAt; now += LOOP_MS) {
+        moveMatch(match, now);
+        SpectatorFrame frame;
+        takeFrame(match, frame);
+        if (!buildSpectatorFrame(feed, frame, now)) {
+            continue;
+        }
+        expect("frame fits a notification", feed.packet.length <= SPECTATOR_FRAME_SIZE);
+        expect("frames keep to the rate", feed.stats.frames == 1 || now - lastFrameMs >= SPECTATOR_FRAME_MS);
+        lastFrameMs = now;
+
+        // One frame, every spectator
+        for (int i = 0; i < SPECTATORS; i++) {
+            if (now < joinAt[i] || (int)(nextRandom() % 100) < dropPercent[i]) {
+                continue;
+            }
+            bool keyframe = (feed.packet.bytes[0] & SPECTATOR_KEYFRAME) != 0;
+            if (readSpectatorFrame(views[i], feed.packet.bytes, feed.packet.length)) {
+                expect("spectator holds the server's frame", memcmp(&views[i].frame, &frame, sizeof(frame)) == 0);
+                recovered[i] += waiting[i] ? 1 : 0;
+                waiting[i] = 0;
+                lastGood[i] = now;
+            } else {
+                expect("a keyframe always decodes", !keyframe);
+                if (++waiting[i] > longestWait[i]) {
+                    longestWait[i] = waiting[i];
+                }
+            }
+        }
+    }
+
+    printf("%lu frames (%lu keyframes), %.1f bytes per frame\n", (unsigned long)feed.stats.frames,
+           (unsigned long)feed.stats.keyframes, (double)feed.stats.bytes / feed.stats.frames);
+    for (int i = 0; i < SPECTATORS; i++) {
+        printf("spectator %d: %lu received, %lu missed, %lu skipped (at most %lu in a row), %lu recoveries\n", i,
+               (unsigned long)views[i].stats.received, (unsigned long)views[i].stats.missed,
+               (unsigned long)views[i].stats.skipped, (unsigned long)longestWait[i], (unsigned long)recovered[i]);
+        expect("no malformed frames", views[i].stats.malformed == 0);
+    }
+    expect("lossless spectator misses nothing", views[0].stats.missed == 0 && views[0].stats.skipped == 0);
+    expect("lossy spectators miss and recover", recovered[1] > 0 && recovered[2] > 0);
+    expect("deltas are small", feed.stats.bytes / feed.stats.frames < 12);
+    expect("late spectator caught up", views[2].stats.received > 0 && lastGood[2] >= joinAt[2]);
+
+    // Nothing changes: only the keyframes go
+    uint32_t frames = feed.stats.frames;
+    SpectatorFrame still;
+    takeFrame(match, still);
+    for (uint32_t t = 0; t < 5000; t += LOOP_MS) {
+        buildSpectatorFrame(feed, still, now + t);
+    }
+    expect("quiet match only keyframes", feed.stats.frames - frames <= 5 + 1);
+
+    // A joining spectator gets a keyframe with the next frame
+    now += 5000;
+    requestSpectatorKeyframe(feed);
+    SpectatorView late;
+    memset(&late, 0, sizeof(late));
+    expect("keyframe on request", buildSpectatorFrame(feed, still, now) &&
+                                  (feed.packet.bytes[0] & SPECTATOR_KEYFRAME) &&
+                                  readSpectatorFrame(late, feed.packet.bytes, feed.packet.length) &&
+                                  memcmp(&late.frame, &still, sizeof(still)) == 0);
+
+    // Frames that don't add up are refused
+    uint8_t junk[SPECTATOR_FRAME_SIZE] = {0x21, 0};
+    expect("wrong version refused", !readSpectatorFrame(late, junk, 2));
+    junk[0] = SPECTATOR_VERSION << 4 | SPECTATOR_KEYFRAME;
+    junk[2] = 0xFF;
+    expect("short keyframe refused", !readSpectatorFrame(late, junk, 4));
+    expect("bad frames counted", late.stats.malformed == 2 && !late.valid);
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the state snapshots (include/state_snapshot.h).
+//
+// Runs two links against each other over simulated links that drop and
+// delay packets (seeded, so every run is the same), with one side walking
+// a character around and changing state now and then. Whatever got through
+// last has to match what was sent exactly, every packet has to fit one
+// notification, and with nothing lost the deltas have to be much smaller
+// than keyframes. Also checks that the field codec survives 16 bit
+// wraps and refuses packets that don't add up. Build and run from the
+// repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_state_snapshot tools/test_state_snapshot.cpp
+//     /tmp/test_state_snapshot
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/state_snapshot.h"
+
+const uint32_t LOOP_MS = 10;
+const int LINK_SLOTS = 64;
+
+// A one-way link: packets arrive in order after a delay, some never
+struct InFlight {
+    uint32_t arriveAt;
+    SnapshotPacket packet;
+};
+
+struct Link {
+    InFlight slots[LINK_SLOTS];
+    int count;
+    int dropPercent;
+    uint32_t lastArrival;
+};
+
+static uint32_t rngState = 4321;
+static uint32_t now = 0;
+static uint32_t errors = 0;
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return (rngState >> 16) & 0x7FFF;
+}
+
+static void linkSend(Link &link, const uint8_t *bytes, size_t length) {
+    if (length > SNAPSHOT_PACKET_SIZE) {
+        printf("packet of %u bytes does not fit a notification\n", (unsigned)length);
+        errors++;
+        return;
+    }
+    if ((int)(nextRandom() % 100) < link.dropPercent || link.count == LINK_SLOTS) {
+        return;
+    }
+    InFlight &f = link.slots[link.count++];
+    f.arriveAt = now + 10 + nextRandom() % 40;
+    if ((int32_t)(f.arriveAt - link.lastArrival) < 0) {
+        f.arriveAt = link.lastArrival;
+    }
+    link.lastArrival = f.arriveAt;
+    f.packet.length = (uint8_t)length;
+    memcpy(f.packet.bytes, bytes, length);
+}
+
+static void linkDeliver(Link &link, SnapshotLink &to) {
+    int kept = 0;
+    for (int i = 0; i < link.count; i++) {
+        if ((int32_t)(now - link.slots[i].arriveAt) >= 0) {
+            receiveSnapshotPacket(to, link.slots[i].packet.bytes, link.slots[i].packet.length);
+        } else {
+            link.slots[kept++] = link.slots[i];
+        }
+    }
+    link.count = kept;
+}
+
+static SnapshotLink a;
+static SnapshotLink b;
+static Link aToB;
+static Link bToA;
+
+static void sendFromA(const uint8_t *bytes, size_t length) { linkSend(aToB, bytes, length); }
+static void sendFromB(const uint8_t *bytes, size_t length) { linkSend(bToA, bytes, length); }
+
+static bool sameSnapshot(const GameSnapshot &x, const GameSnapshot &y) {
+    return memcmp(x.field, y.field, sizeof(x.field)) == 0;
+}
+
+// A character walking about at a couple of pixels a loop, the game running
+static void moveAround(GameSnapshot &s, int step) {
+    setSnapshotField(s, SF_STATE, (step / 500) % 2 ? 3 : 1);
+    setSnapshotField(s, SF_CHARACTER, 1 + (step / 700) % 3);
+    setSnapshotField(s, SF_X, s.field[SF_X] + (int)(nextRandom() % 5) - 2);
+    setSnapshotField(s, SF_Y, s.field[SF_Y] + (int)(nextRandom() % 5) - 2);
+    setSnapshotField(s, SF_TIMER, 1200 - step / 10);
+    setSnapshotField(s, SF_POWERUPS_LEFT, 3 - (step / 1000) % 4);
+    setSnapshotField(s, SF_POWERUP_ACTIVE, (step / 150) % 2);
+    setSnapshotField(s, SF_TICK, step / 2);
+}
+
+static void run(int dropPercent, int steps) {
+    resetSnapshotLink(a);
+    resetSnapshotLink(b);
+    memset(&a.stats, 0, sizeof(a.stats));
+    memset(&b.stats, 0, sizeof(b.stats));
+    aToB.count = bToA.count = 0;
+    aToB.dropPercent = bToA.dropPercent = dropPercent;
+
+    GameSnapshot ownA, ownB, seenByA, seenByB;
+    memset(&ownA, 0, sizeof(ownA));
+    memset(&ownB, 0, sizeof(ownB));
+    memset(&seenByA, 0xFF, sizeof(seenByA));
+    memset(&seenByB, 0xFF, sizeof(seenByB));
+    setSnapshotField(ownA, SF_X, 120);
+    setSnapshotField(ownA, SF_Y, 2000);
+    setSnapshotField(ownB, SF_X, -30);
+
+    for (int step = 0; step < steps; step++) {
+        moveAround(ownA, step);
+        linkDeliver(aToB, b);
+        linkDeliver(bToA, a);
+        serviceSnapshotLink(a, ownA, now, sendFromA, seenByA);
+        serviceSnapshotLink(b, ownB, now, sendFromB, seenByB);
+        now += LOOP_MS;
+    }
+    // Let it settle: a standing character, heartbeats only
+    for (int i = 0; i < 100; i++) {
+        linkDeliver(aToB, b);
+        linkDeliver(bToA, a);
+        serviceSnapshotLink(a, ownA, now, sendFromA, seenByA);
+        serviceSnapshotLink(b, ownB, now, sendFromB, seenByB);
+        now += LOOP_MS;
+    }
+
+    // A keyframe of the same loops, for comparison
+    uint8_t fields[SNAPSHOT_PACKET_SIZE];
+    uint32_t keyframeBytes = SNAPSHOT_HEADER_SIZE - 2 + encodeSnapshotFields(NULL, ownA, fields);
+    printf("drop %2d%%: a sent %lu (%lu keyframes), %lu bytes, %.1f per packet (keyframe %lu), "
+           "b got %lu (%lu lost), %lu undecodable, rtt %lu ms\n",
+           dropPercent, (unsigned long)a.stats.sent, (unsigned long)a.stats.keyframes,
+           (unsigned long)a.stats.bytes, (double)a.stats.bytes / a.stats.sent, (unsigned long)keyframeBytes,
+           (unsigned long)b.stats.received, (unsigned long)b.stats.lost, (unsigned long)b.stats.undecodable,
+           (unsigned long)(a.stats.rttTotalMs / (a.stats.rttSamples ? a.stats.rttSamples : 1)));
+    if (!sameSnapshot(seenByB, ownA) || !sameSnapshot(seenByA, ownB)) {
+        printf("  the last snapshot did not get across\n");
+        errors++;
+    }
+    // Every snapshot b didn't get shows up as lost, but for the last few (in flight,
+    // or lost with nothing after them yet)
+    uint32_t accounted = b.stats.received + b.stats.lost;
+    if (accounted > a.stats.sent || a.stats.sent - accounted > 5 || (dropPercent == 0 && b.stats.lost != 0)) {
+        printf("  losses were not counted\n");
+        errors++;
+    }
+    if (a.stats.malformed || b.stats.malformed) {
+        printf("  good packets were refused\n");
+        errors++;
+    }
+    // Keyframes only until the first ack, and deltas well under a keyframe
+    if (dropPercent == 0 && (a.stats.keyframes > SNAPSHOT_HISTORY ||
+                             a.stats.bytes * 5 > a.stats.sent * keyframeBytes * 3)) {
+        printf("  deltas are not paying off\n");
+        errors++;
+    }
+}
+
+int main() {
+    run(0, 3000);
+    run(10, 3000);
+    run(50, 3000);
+
+    // Wide fields across a 16 bit wrap and big jumps
+    GameSnapshot base, next, out;
+    memset(&base, 0, sizeof(base));
+    setSnapshotField(base, SF_TICK, 65530);
+    setSnapshotField(base, SF_X, -5);
+    next = base;
+    setSnapshotField(next, SF_TICK, 65530 + 11);
+    setSnapshotField(next, SF_X, 3000);
+    uint8_t bytes[SNAPSHOT_PACKET_SIZE];
+    uint8_t length = encodeSnapshotFields(&base, next, bytes);
+    if (!decodeSnapshotFields(&base, bytes, length, out) || !sameSnapshot(out, next)) {
+        printf("wrapping tick or big jump decoded wrong\n");
+        errors++;
+    }
+    if (length != 2 + 1 + 2) {
+        printf("wrapping tick took %u bytes\n", (unsigned)length);
+        errors++;
+    }
+
+    // Short or padded field data is refused, so is a keyframe missing a field
+    if (decodeSnapshotFields(&base, bytes, length - 1, out) || decodeSnapshotFields(&base, bytes, length + 1, out)) {
+        printf("truncated or padded fields were accepted\n");
+        errors++;
+    }
+    if (decodeSnapshotFields(NULL, bytes, length, out)) {
+        printf("a partial keyframe was accepted\n");
+        errors++;
+    }
+
+    // Another version's packet is refused
+    resetSnapshotLink(b);
+    uint8_t foreign[SNAPSHOT_HEADER_SIZE] = { (SNAPSHOT_VERSION + 1) << 4, 0, 0, 0, 0, 0 };
+    receiveSnapshotPacket(b, foreign, sizeof(foreign));
+    uint32_t malformed = b.stats.malformed;
+    GameSnapshot ignored;
+    serviceSnapshotLink(b, base, now, sendFromB, ignored);
+    if (b.stats.malformed != malformed + 1) {
+        printf("packet of another version was not refused\n");
+        errors++;
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}
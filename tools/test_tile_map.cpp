@@ -0,0 +1,242 @@
+/////////////////////////////////////////////////////////////////////////////
+// Host test for the tile map (include/tile_map.h).
+//
+// The loader has to decode the arena and hand-made maps, and refuse every
+// blob it cannot trust: any truncation, another magic or version, a header
+// that doesn't fit the map struct, and runs that end past the data or
+// cover too many or too few tiles. Random corruption must never make it
+// read past the blob or accept a map with holes in it. Off the map counts
+// as the first solid tile, and the camera stays on whole tiles inside the
+// map. Build and run from the repository root:
+//
+//     g++ -O2 -std=c++11 -o /tmp/test_tile_map tools/test_tile_map.cpp
+//     /tmp/test_tile_map
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/tile_map.h"
+#include "../include/game_tile_map.h"
+
+static TileMap map;
+static uint32_t rngState = 77;
+static uint32_t errors = 0;
+
+static void expect(const char *what, bool ok) {
+    if (!ok) {
+        printf("%s\n", what);
+        errors++;
+    }
+}
+
+static uint32_t nextRandom() {
+    rngState = rngState * 1103515245UL + 12345UL;
+    return rngState >> 8;
+}
+
+// A map file as tools/build_tile_map.py writes it
+struct Blob {
+    uint8_t data[512];
+    uint32_t size;
+};
+
+static void putU16(Blob &blob, uint16_t v) {
+    blob.data[blob.size++] = v & 0xFF;
+    blob.data[blob.size++] = v >> 8;
+}
+
+static void startBlob(Blob &blob, uint8_t tileSize, uint16_t width, uint16_t height, uint16_t solidMask,
+                      uint8_t spawnCount) {
+    memcpy(blob.data, "TMAP", 4);
+    blob.data[4] = TILE_MAP_VERSION;
+    blob.data[5] = tileSize;
+    blob.size = 6;
+    putU16(blob, width);
+    putU16(blob, height);
+    putU16(blob, solidMask);
+    blob.data[blob.size++] = spawnCount;
+    for (uint8_t i = 0; i < spawnCount; i++) {
+        putU16(blob, 16 * i + 8);
+        putU16(blob, 24);
+    }
+}
+
+static void putRuns(Blob &blob, const uint8_t *runs, uint16_t count) {
+    putU16(blob, count);
+    memcpy(blob.data + blob.size, runs, count);
+    blob.size += count;
+}
+
+// 4x3 tiles: a wall border around a floor and a grass tile
+//   1 1 1 1
+//   1 0 3 1
+//   1 1 1 1
+static const uint8_t smallRuns[] = {0x41, 0x00, 0x03, 0x41};
+
+static void smallMap(Blob &blob) {
+    startBlob(blob, 16, 4, 3, 1 << TILE_WALL, 2);
+    putRuns(blob, smallRuns, sizeof(smallRuns));
+}
+
+// Loads from a buffer of exactly `size` bytes, so a sanitizer build
+// catches any read past the end
+static bool loadExact(const uint8_t *data, uint32_t size) {
+    uint8_t *copy = (uint8_t *)malloc(size ? size : 1);
+    memcpy(copy, data, size);
+    bool ok = loadTileMap(copy, size, map);
+    free(copy);
+    return ok;
+}
+
+static void expectRefused(const char *what, const Blob &blob) {
+    expect(what, !loadExact(blob.data, blob.size));
+}
+
+int main() {
+    // The arena and a hand-made map decode
+    expect("arena loads", loadExact(arenaMapData, arenaMapSize));
+    expect("arena header", map.width == 40 && map.height == 30 && map.tileSize == TILESET_TILE_SIZE &&
+                           map.spawnCount >= SPAWN_COUNT);
+    expect("arena border is wall", tileAt(map, 0, 0) == TILE_WALL && tileAt(map, 39, 29) == TILE_WALL);
+
+    Blob blob;
+    smallMap(blob);
+    expect("small map loads", loadExact(blob.data, blob.size));
+    {
+        const uint8_t expected[] = {1, 1, 1, 1, 1, 0, 3, 1, 1, 1, 1, 1};
+        expect("small map tiles", memcmp(map.tiles, expected, sizeof(expected)) == 0);
+        expect("small map spawns", map.spawnCount == 2 && map.spawnX[1] == 24 && map.spawnY[1] == 24);
+    }
+
+    // Every truncation is refused
+    {
+        uint32_t accepted = 0;
+        for (uint32_t size = 0; size < arenaMapSize; size++) {
+            accepted += loadExact(arenaMapData, size);
+        }
+        for (uint32_t size = 0; size < blob.size; size++) {
+            accepted += loadExact(blob.data, size);
+        }
+        expect("truncations refused", accepted == 0);
+    }
+
+    // Headers that don't fit
+    smallMap(blob);
+    blob.data[0] = 'X';
+    expectRefused("bad magic", blob);
+    smallMap(blob);
+    blob.data[4] = TILE_MAP_VERSION + 1;
+    expectRefused("other version", blob);
+    smallMap(blob);
+    blob.data[5] = 0;
+    expectRefused("tile size 0", blob);
+    startBlob(blob, 16, 0, 3, 0, 0);
+    putRuns(blob, smallRuns, 0);
+    expectRefused("width 0", blob);
+    startBlob(blob, 16, 64, 65, 0, 0);
+    putRuns(blob, smallRuns, 0);
+    expectRefused("too many tiles", blob);
+    startBlob(blob, 16, 65535, 65535, 0, 0);
+    putRuns(blob, smallRuns, 0);
+    expectRefused("65535x65535 tiles", blob);
+    startBlob(blob, 16, 4, 3, 0, TILE_MAP_MAX_SPAWNS + 1);
+    putRuns(blob, smallRuns, sizeof(smallRuns));
+    expectRefused("too many spawns", blob);
+
+    // The largest map there is room for
+    {
+        static Blob big;
+        startBlob(big, 8, 64, 64, 0, 0);
+        static uint8_t runs[256];
+        for (int i = 0; i < 256; i++) {
+            runs[i] = 0xF2;
+        }
+        putRuns(big, runs, 256);
+        expect("64x64 loads", loadExact(big.data, big.size) && map.tiles[TILE_MAP_MAX_TILES - 1] == 2);
+    }
+
+    // Runs
+    smallMap(blob);
+    blob.data[blob.size - sizeof(smallRuns) - 2] = sizeof(smallRuns) + 1;
+    expectRefused("run bytes past the end", blob);
+    {
+        const uint8_t over[] = {0x41, 0x00, 0x03, 0x51};
+        startBlob(blob, 16, 4, 3, 0, 0);
+        putRuns(blob, over, sizeof(over));
+        expectRefused("runs past the tile count", blob);
+        const uint8_t shortRuns[] = {0x41, 0x00, 0x03, 0x31};
+        startBlob(blob, 16, 4, 3, 0, 0);
+        putRuns(blob, shortRuns, sizeof(shortRuns));
+        expectRefused("runs short of the tile count", blob);
+        startBlob(blob, 16, 4, 3, 0, 0);
+        putRuns(blob, shortRuns, 0);
+        expectRefused("no runs", blob);
+    }
+
+    // Random corruption of the arena: never past the blob, never a short map
+    {
+        static uint8_t copy[512];
+        uint32_t bad = 0;
+        for (int round = 0; round < 20000; round++) {
+            memcpy(copy, arenaMapData, arenaMapSize);
+            int flips = 1 + nextRandom() % 4;
+            for (int i = 0; i < flips; i++) {
+                copy[nextRandom() % arenaMapSize] ^= 1 << (nextRandom() % 8);
+            }
+            if (loadExact(copy, arenaMapSize)) {
+                uint32_t pos = 13 + map.spawnCount * 4;
+                uint32_t runBytes = copy[pos] | (copy[pos + 1] << 8);
+                uint32_t filled = 0;
+                for (uint32_t r = 0; r < runBytes; r++) {
+                    filled += (copy[pos + 2 + r] >> 4) + 1;
+                }
+                bad += map.tileSize == 0 || map.spawnCount > TILE_MAP_MAX_SPAWNS ||
+                       filled != (uint32_t)map.width * map.height || pos + 2 + runBytes > arenaMapSize;
+            }
+        }
+        expect("corrupt arenas that load are whole", bad == 0);
+    }
+
+    // Off the map is the first solid tile
+    smallMap(blob);
+    loadExact(blob.data, blob.size);
+    expect("inside", tileAt(map, 2, 1) == 3 && !tileMapSolidAt(map, 16, 16) && tileMapSolidAt(map, 15, 16));
+    expect("outside", tileAt(map, -1, 0) == TILE_WALL && tileAt(map, 4, 0) == TILE_WALL &&
+                      tileAt(map, 0, 3) == TILE_WALL && tileAt(map, 0, -1) == TILE_WALL);
+    expect("outside pixels", tileMapSolidAt(map, -1, 20) && tileMapSolidAt(map, 20, -1) &&
+                             tileMapSolidAt(map, 64, 20) && tileMapSolidAt(map, 20, 48));
+    map.solidMask = 0;
+    expect("no solid type", tileAt(map, -1, 0) == 0);
+
+    // The camera: whole tiles, never past the map, pinned on maps smaller than the screen
+    loadExact(arenaMapData, arenaMapSize);
+    {
+        TileCamera camera;
+        uint32_t wrong = 0;
+        for (int round = 0; round < 5000; round++) {
+            int x = (int)(nextRandom() % 900) - 200;
+            int y = (int)(nextRandom() % 700) - 100;
+            followTileCamera(camera, map, x, y, 320, 240);
+            wrong += camera.x < 0 || camera.y < 0 || camera.x % 16 != 0 || camera.y % 16 != 0 ||
+                     camera.x + 320 > 640 || camera.y + 240 > 480;
+        }
+        expect("camera inside the map", wrong == 0);
+        followTileCamera(camera, map, 320, 240, 320, 240);
+        expect("camera centred", camera.x == 160 && camera.y == 128);
+        followTileCamera(camera, map, 10000, 10000, 320, 240);
+        expect("camera at the far corner", camera.x == 320 && camera.y == 240);
+        followTileCamera(camera, map, -10000, -10000, 320, 240);
+        expect("camera at the origin", camera.x == 0 && camera.y == 0);
+    }
+    smallMap(blob);
+    loadExact(blob.data, blob.size);
+    {
+        TileCamera camera;
+        followTileCamera(camera, map, 500, 500, 320, 240);
+        expect("small map pins the camera", camera.x == 0 && camera.y == 0);
+    }
+
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", (unsigned long)errors);
+    return errors ? 1 : 0;
+}